@@ -0,0 +1,299 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "src/common.h"
+
+// defaults: operations per run, timed runs per primitive, untimed warm-up runs
+#define BENCH_DEFAULT_BATCH 65536
+#define BENCH_DEFAULT_RUNS 7
+#define BENCH_WARMUP_RUNS 2
+
+// a primitive under test: run it once per segment in the batch
+struct benchmark
+{
+    const char *name;
+    void (*run)(mytcp_t *, size_t);
+};
+
+// results are folded into this so the compiler cannot drop the work
+static volatile uint64_t sink;
+
+static char text[MAX_TCP_CHAR_SIZE];
+static FILE *devnull;
+
+// the wire codec converts into these, a batch at a time
+static mytcp_wire_t wire[BENCH_DEFAULT_BATCH];
+static mytcp_t decoded[BENCH_DEFAULT_BATCH];
+
+static void bench_create_segment(mytcp_t *segs, size_t n)
+{
+    for (size_t i = 0; i < n; i++) segs[i] = mytcp_create_segment(CLIENT_PORT, SERVER_PORT);
+}
+
+static void bench_generate_sequence(mytcp_t *segs, size_t n)
+{
+    (void) segs;
+    uint64_t acc = 0;
+    for (size_t i = 0; i < n; i++) acc += mytcp_generate_sequence();
+    sink += acc;
+}
+
+static void bench_set_flag(mytcp_t *segs, size_t n)
+{
+    for (size_t i = 0; i < n; i++) mytcp_set_flag(&segs[i], (uint8_t) (i % NUM_FLAGS));
+}
+
+static void bench_clear_flag(mytcp_t *segs, size_t n)
+{
+    for (size_t i = 0; i < n; i++) mytcp_clear_flag(&segs[i], (uint8_t) (i % NUM_FLAGS));
+}
+
+static void bench_set_sequence(mytcp_t *segs, size_t n)
+{
+    for (size_t i = 0; i < n; i++) mytcp_set_sequence(&segs[i], segs[i].sequence + 1);
+}
+
+static void bench_calculate_checksum(mytcp_t *segs, size_t n)
+{
+    uint64_t acc = 0;
+    for (size_t i = 0; i < n; i++) acc += mytcp_calculate_checksum(&segs[i]);
+    sink += acc;
+}
+
+static void bench_verify_checksum(mytcp_t *segs, size_t n)
+{
+    uint64_t acc = 0;
+    for (size_t i = 0; i < n; i++) acc += mytcp_verify_checksum(&segs[i]);
+    sink += acc;
+}
+
+static void bench_validate(mytcp_t *segs, size_t n)
+{
+    mytcp_expect_t expect;
+    mytcp_expect_init(&expect, 0, (uint16_t) (1 << FLAG_SYN | 1 << FLAG_FIN));
+    mytcp_expect_ack(&expect, 0);
+
+    uint64_t acc = 0;
+    for (size_t i = 0; i < n; i++) acc += mytcp_validate(&segs[i], &expect);
+    sink += acc;
+}
+
+static void bench_calculate_checksum_batch(mytcp_t *segs, size_t n)
+{
+    static uint16_t sums[BENCH_DEFAULT_BATCH];
+    for (size_t i = 0; i < n; i += BENCH_DEFAULT_BATCH)
+    {
+        size_t k = n - i < BENCH_DEFAULT_BATCH ? n - i : BENCH_DEFAULT_BATCH;
+        mytcp_calculate_checksum_batch(&segs[i], k, sums);
+        sink += sums[k - 1];
+    }
+}
+
+static void bench_verify_checksum_batch(mytcp_t *segs, size_t n)
+{
+    static bool valid[BENCH_DEFAULT_BATCH];
+    for (size_t i = 0; i < n; i += BENCH_DEFAULT_BATCH)
+    {
+        size_t k = n - i < BENCH_DEFAULT_BATCH ? n - i : BENCH_DEFAULT_BATCH;
+        sink += mytcp_verify_checksum_batch(&segs[i], k, valid);
+    }
+}
+
+static void bench_wire_encode(mytcp_t *segs, size_t n)
+{
+    uint64_t acc = 0;
+    for (size_t i = 0; i < n; i++) acc += mytcp_wire_encode(&segs[i], &wire[i % BENCH_DEFAULT_BATCH]);
+    sink += acc;
+}
+
+static void bench_wire_decode(mytcp_t *segs, size_t n)
+{
+    (void) segs;
+    uint64_t acc = 0;
+    for (size_t i = 0; i < n; i++)
+        acc += mytcp_wire_decode(&wire[i % BENCH_DEFAULT_BATCH], &decoded[i % BENCH_DEFAULT_BATCH]);
+    sink += acc;
+}
+
+static void bench_wire_view(mytcp_t *segs, size_t n)
+{
+    (void) segs;
+    uint64_t acc = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        const mytcp_wire_t *w = &wire[i % BENCH_DEFAULT_BATCH];
+        acc += mytcp_wire_sequence(w) + mytcp_wire_check_flag(w, FLAG_ACK);
+    }
+    sink += acc;
+}
+
+static void bench_wire_encode_batch(mytcp_t *segs, size_t n)
+{
+    for (size_t i = 0; i < n; i += BENCH_DEFAULT_BATCH)
+    {
+        size_t k = n - i < BENCH_DEFAULT_BATCH ? n - i : BENCH_DEFAULT_BATCH;
+        mytcp_wire_encode_batch(&segs[i], k, wire);
+        sink += wire[k - 1].sequence;
+    }
+}
+
+static void bench_wire_decode_batch(mytcp_t *segs, size_t n)
+{
+    (void) segs;
+    for (size_t i = 0; i < n; i += BENCH_DEFAULT_BATCH)
+    {
+        size_t k = n - i < BENCH_DEFAULT_BATCH ? n - i : BENCH_DEFAULT_BATCH;
+        mytcp_wire_decode_batch(wire, k, decoded);
+        sink += decoded[k - 1].sequence;
+    }
+}
+
+static void bench_format_segment(mytcp_t *segs, size_t n)
+{
+    uint64_t acc = 0;
+    for (size_t i = 0; i < n; i++) acc += mytcp_format_segment(text, sizeof(text), &segs[i], "benchmark");
+    sink += acc;
+}
+
+static void bench_print_segment(mytcp_t *segs, size_t n)
+{
+    for (size_t i = 0; i < n; i++) mytcp_print_segment(devnull, &segs[i], "benchmark");
+}
+
+static const struct benchmark BENCHMARKS[] = {
+        { "create_segment",          bench_create_segment },
+        { "generate_sequence",       bench_generate_sequence },
+        { "set_flag",                bench_set_flag },
+        { "clear_flag",              bench_clear_flag },
+        { "set_sequence",            bench_set_sequence },
+        { "calculate_checksum",      bench_calculate_checksum },
+        { "verify_checksum",         bench_verify_checksum },
+        { "validate",                bench_validate },
+        { "calculate_checksum_batch", bench_calculate_checksum_batch },
+        { "verify_checksum_batch",   bench_verify_checksum_batch },
+        { "wire_encode",             bench_wire_encode },
+        { "wire_decode",             bench_wire_decode },
+        { "wire_view",               bench_wire_view },
+        { "wire_encode_batch",       bench_wire_encode_batch },
+        { "wire_decode_batch",       bench_wire_decode_batch },
+        { "format_segment",          bench_format_segment },
+        { "print_segment",           bench_print_segment },
+};
+
+#define NUM_BENCHMARKS (sizeof(BENCHMARKS) / sizeof(BENCHMARKS[0]))
+
+int bench_one(const struct benchmark *, mytcp_t *, size_t, int);
+
+int main(int argc, char **argv)
+{
+    long batch = BENCH_DEFAULT_BATCH, runs = BENCH_DEFAULT_RUNS;
+    const char *filter = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:r:f:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n':
+                batch = strtol(optarg, NULL, 10);
+                break;
+            case 'r':
+                runs = strtol(optarg, NULL, 10);
+                break;
+            case 'f':
+                filter = optarg;
+                break;
+            default:
+                fprintf(stderr, "Usage:\n    %s [-n BATCH] [-r RUNS] [-f NAME] - Time the segment primitives\n\n"
+                                "    -n Operations per run (default %d)\n    -r Timed runs per primitive (default %d)\n"
+                                "    -f Only run primitives whose name contains NAME\n",
+                        argv[0], BENCH_DEFAULT_BATCH, BENCH_DEFAULT_RUNS);
+                return 1;
+        }
+    }
+
+    if (batch < 1 || runs < 1) return abort_with_message("Error: batch and runs must be positive");
+
+    errno = 0;
+
+    // mytcp_print_segment() also echoes to stdout, so that is pointed at /dev/null while it runs
+    devnull = fopen("/dev/null", "w");
+    if (devnull == NULL || errno != 0)
+        return abort_with_errno(errno, "fopen");
+
+    mytcp_t *segs = calloc((size_t) batch, sizeof(mytcp_t));
+    if (segs == NULL) return abort_with_errno(errno, "calloc");
+    for (long i = 0; i < batch; i++) segs[i] = mytcp_create_segment(CLIENT_PORT, SERVER_PORT);
+
+    // the decode and view benchmarks read wire[], so it holds the encoded batch even if no encode benchmark runs first
+    mytcp_wire_encode_batch(segs, (size_t) (batch < BENCH_DEFAULT_BATCH ? batch : BENCH_DEFAULT_BATCH), wire);
+
+    printf("batch of %ld operations, %d warm-up + %ld timed runs, checksum kernel: %s, byte swap kernel: %s\n\n",
+           batch, BENCH_WARMUP_RUNS, runs, mytcp_checksum_impl(), mytcp_wire_impl());
+    printf("%-26s %10s %10s %10s %14s\n", "primitive", "min ns/op", "med ns/op", "max ns/op", "ops/sec (med)");
+
+    for (size_t b = 0; b < NUM_BENCHMARKS; b++)
+        if (filter == NULL || strstr(BENCHMARKS[b].name, filter) != NULL)
+            bench_one(&BENCHMARKS[b], segs, (size_t) batch, (int) runs);
+
+    free(segs);
+    fclose(devnull);
+    return 0;
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Time one primitive: untimed warm-up runs, then repeated timed runs over the whole batch. Prints the fastest,
+ * median and slowest run in nanoseconds per operation, and the median throughput.
+ *
+ * @param b The primitive
+ * @param segs The batch of segments to run it on
+ * @param n The number of segments
+ * @param runs The number of timed runs
+ * @return 0
+ */
+int bench_one(const struct benchmark *b, mytcp_t *segs, size_t n, int runs)
+{
+    double ns_per_op[runs];
+    int saved_stdout = -1;
+
+    if (b->run == bench_print_segment)
+    {
+        fflush(stdout);
+        saved_stdout = dup(STDOUT_FILENO);
+        dup2(fileno(devnull), STDOUT_FILENO);
+    }
+
+    for (int i = 0; i < BENCH_WARMUP_RUNS; i++) b->run(segs, n);
+
+    for (int i = 0; i < runs; i++)
+    {
+        struct timespec start, stop;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        b->run(segs, n);
+        clock_gettime(CLOCK_MONOTONIC, &stop);
+        double elapsed = (double) (stop.tv_sec - start.tv_sec) * 1e9 + (double) (stop.tv_nsec - start.tv_nsec);
+        ns_per_op[i] = elapsed / (double) n;
+    }
+
+    if (saved_stdout != -1)
+    {
+        fflush(stdout);
+        dup2(saved_stdout, STDOUT_FILENO);
+        close(saved_stdout);
+    }
+
+    qsort(ns_per_op, (size_t) runs, sizeof(double), compare_doubles);
+    double median = ns_per_op[runs / 2];
+    printf("%-26s %10.2f %10.2f %10.2f %14.0f\n", b->name, ns_per_op[0], median, ns_per_op[runs - 1],
+           median > 0 ? 1e9 / median : 0.0);
+    return 0;
+}
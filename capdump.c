@@ -0,0 +1,88 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "src/common.h"
+
+// segments read (and checksummed) at a time
+#define DUMP_BATCH 256
+
+int dump_batch(const mytcp_capture_entry_t *, size_t, size_t *);
+
+int main(int argc, char **argv)
+{
+    if (argc != 2)
+    {
+        fprintf(stderr, "Usage:\n    %s CAPTURE - Print the segments of a pcap capture (e.g. server.pcap)\n", argv[0]);
+        return 1;
+    }
+
+    errno = 0;
+
+    // open capture
+    FILE *f = fopen(argv[1], "rb");
+    if (f == NULL || errno != 0)
+        return abort_with_errno(errno, "fopen");
+
+    if (mytcp_capture_open(f) != 0)
+        return abort_with_message("Error: not a segment capture");
+
+    static mytcp_capture_entry_t entries[DUMP_BATCH];
+    size_t n = 0, total = 0, bad_checksums = 0;
+    int status;
+
+    // read in batches so checksums can be verified a batch at a time
+    while ((status = mytcp_capture_next(f, &entries[n])) == 1)
+    {
+        if (++n < DUMP_BATCH) continue;
+        total += n;
+        dump_batch(entries, n, &bad_checksums);
+        n = 0;
+    }
+
+    total += n;
+    dump_batch(entries, n, &bad_checksums);
+    fclose(f);
+
+    if (status == -1) fprintf(stderr, "warning: capture is truncated or malformed\n");
+    printf("%zu segments, %zu with invalid checksums\n", total, bad_checksums);
+
+    return status == -1 ? 1 : 0;
+}
+
+/**
+ * Print a batch of captured segments in the same layout as the text logs, each preceded by its timestamp and
+ * addresses.
+ *
+ * @param entries The captured segments
+ * @param n The number of segments
+ * @param bad_checksums Incremented by the number of segments whose checksum is invalid
+ * @return 0
+ */
+int dump_batch(const mytcp_capture_entry_t *entries, size_t n, size_t *bad_checksums)
+{
+    mytcp_t segs[DUMP_BATCH] = { 0 };   // zeroed so -O2 cannot warn that the batch may be read uninitialized
+    bool valid[DUMP_BATCH];
+    char title[TITLE_LEN], str[MAX_TCP_CHAR_SIZE];
+    char src[INET_ADDRSTRLEN], dst[INET_ADDRSTRLEN];
+
+    for (size_t i = 0; i < n; i++) segs[i] = entries[i].seg;
+    *bad_checksums += n - mytcp_verify_checksum_batch(segs, n, valid);
+
+    for (size_t i = 0; i < n; i++)
+    {
+        const mytcp_capture_entry_t *e = &entries[i];
+        inet_ntop(AF_INET, &e->src_addr, src, sizeof(src));
+        inet_ntop(AF_INET, &e->dst_addr, dst, sizeof(dst));
+
+        snprintf(title, TITLE_LEN, "%s %s", e->incoming ? "incoming" : "outgoing", SEGMENT_KIND_NAMES[e->kind]);
+        mytcp_format_segment(str, sizeof(str), &segs[i], title);
+
+        printf("[%ld.%09ld] %s -> %s%s\n%s\n", (long) e->ts.tv_sec, (long) e->ts.tv_nsec, src, dst,
+               valid[i] ? "" : " (invalid checksum)", str);
+    }
+
+    return 0;
+}
@@ -1,5 +1,4 @@
 #include <arpa/inet.h>
-#include <time.h>
 #include <netdb.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -15,31 +14,153 @@ int mock_close(int, FILE *);
 
 int main(int argc, char **argv)
 {
-    srand((uint32_t) time(NULL));
-
-    if (argc < 2 || (strcasecmp(argv[1], "open") != 0 && strcasecmp(argv[1], "close") != 0))
+    if (argc < 2 || (strcasecmp(argv[1], "open") != 0 && strcasecmp(argv[1], "close") != 0
+                     && strcasecmp(argv[1], "transfer") != 0 && strcasecmp(argv[1], "load") != 0
+                     && strcasecmp(argv[1], "loop") != 0))
     {
-        fprintf(stderr, "Usage:\n    %s open  %s\n    %s close %s\n", argv[0], HELP_OPEN, argv[0], HELP_CLOSE);
+        fprintf(stderr, "Usage:\n    %s open  [-u] [-H HOST] [-P PORT] %s\n    %s close [-u] [-H HOST] [-P PORT] %s\n"
+                        "    %s transfer [-u] [-H HOST] [-P PORT] [-b BYTES] [-w WINDOW] [-s MSS] [-a ALGO] [-T FILE]\n"
+                        "                %s\n"
+                        "    %s load  [-u] [-H HOST] [-P PORT] [-t THREADS] [-c CONNECTIONS] [-r RATE] [-m OPEN%%]\n"
+                        "                [-d SECONDS] [-n COUNT] [-f RATE] [-M PORT] [-k SOCKETS] %s\n"
+                        "    %s loop  [-t 1|2] [-c CONNECTIONS] [-m OPEN%%] [-n COUNT] %s\n\n"
+                        "    -u %s\n    -H Server to connect to (default %s)\n    -P Server port (default %d)\n"
+                        "    -t Load worker threads (default %d; loop: default %d, and 2 runs client and server on\n"
+                        "       separate threads)\n"
+                        "    -c Concurrent handshakes (default %d; loop: %d)\n"
+                        "    -r Handshakes started per second (default 0: as fast as possible)\n"
+                        "    -m Percentage of open handshakes, the rest are close handshakes (default 100)\n"
+                        "    -d Seconds to keep starting handshakes (default %.0f)\n"
+                        "    -n Stop after this many handshakes, if sooner (default 0: no limit; loop: 1000000)\n"
+                        "    -f Also send this many never-completed connection requests per second (SYN flood, -u)\n"
+                        "    -M %s\n"
+                        "    -k Keep this many sockets per thread open and multiplex the handshakes over them, each\n"
+                        "       from its own port (TCP only; the server needs -m)\n"
+                        "    -b Payload bytes to transfer (default %d)\n"
+                        "    -w Most unacknowledged payload bytes in flight (default %d, or less if the server says;\n"
+                        "       up to %u, with window scaling)\n"
+                        "    -s Largest payload per segment (default %d)\n"
+                        "    -a Congestion control: reno, cubic or none for a fixed window (default %s)\n"
+                        "    -T Trace the windows over time to this CSV file\n",
+                argv[0], HELP_OPEN, argv[0], HELP_CLOSE, argv[0], HELP_XFER, argv[0], HELP_LOAD, argv[0], HELP_LOOP,
+                HELP_UDP, SERVER_HOSTNAME, SERVER_PORT, LOAD_DEFAULT_THREADS, LOOPBACK_DEFAULT_THREADS,
+                LOAD_DEFAULT_CONNECTIONS, LOOPBACK_DEFAULT_CONNECTIONS, LOAD_DEFAULT_DURATION, HELP_METRICS,
+                TRANSFER_DEFAULT_BYTES, TRANSFER_DEFAULT_WINDOW, TRANSFER_MAX_WINDOW, TRANSFER_DEFAULT_MSS,
+                TRANSFER_DEFAULT_CC);
         if (argc == 1) return 1;
         fprintf(stderr, "\nInvalid argument: %s\n", argv[1]);
         return 1;
     }
 
-    errno = 0;
-
-    // open output file
-    FILE *outfile = fopen(OUTFILE_NAME, "w");
-    if (outfile == NULL || errno != 0)
-        return abort_with_errno(errno, "fopen");
+    // parse options following the action
+    bool udp = false, load = strcasecmp(argv[1], "load") == 0, loop = strcasecmp(argv[1], "loop") == 0;
+    bool transfer = strcasecmp(argv[1], "transfer") == 0;
+    bool load_options = false, network_options = false, transfer_options = false;
+    const char *hostname = SERVER_HOSTNAME;
+    double port = SERVER_PORT, threads = 0, connections = 0;     // 0 until given: load and loop default differently
+    double rate = 0, open_percent = 100, duration = LOAD_DEFAULT_DURATION, count = 0, flood = 0, metrics_port = 0;
+    double persistent = 0;
+    double bytes = TRANSFER_DEFAULT_BYTES, window = TRANSFER_DEFAULT_WINDOW, mss = TRANSFER_DEFAULT_MSS;
+    const mytcp_cc_ops_t *cc = mytcp_cc_find(TRANSFER_DEFAULT_CC);
+    const char *trace = NULL;
+    int opt, bad = 0;
+    while ((opt = getopt(argc - 1, argv + 1, "uH:P:t:c:r:m:d:n:f:M:k:b:w:s:a:T:")) != -1)
+    {
+        load_options |= strchr("rdfMk", opt) != NULL;
+        transfer_options |= strchr("bwsaT", opt) != NULL;
+        network_options |= strchr("uHP", opt) != NULL;
+        switch (opt)
+        {
+            case 'u':
+                udp = true;
+                break;
+            case 'H':
+                hostname = optarg;
+                break;
+            case 'P':
+                bad |= parse_option(optarg, 1, 65535, &port);
+                break;
+            case 't':
+                bad |= parse_option(optarg, 1, 1024, &threads);
+                break;
+            case 'c':
+                bad |= parse_option(optarg, 1, 1000000, &connections);
+                break;
+            case 'r':
+                bad |= parse_option(optarg, 0, 1e9, &rate);
+                break;
+            case 'm':
+                bad |= parse_option(optarg, 0, 100, &open_percent);
+                break;
+            case 'd':
+                bad |= parse_option(optarg, 0.001, 1e6, &duration);
+                break;
+            case 'n':
+                bad |= parse_option(optarg, 0, 1e15, &count);
+                break;
+            case 'f':
+                bad |= parse_option(optarg, 0, 1e9, &flood);
+                break;
+            case 'M':
+                bad |= parse_option(optarg, 1, 65535, &metrics_port);
+                break;
+            case 'k':
+                bad |= parse_option(optarg, 1, 1024, &persistent);
+                break;
+            case 'b':
+                bad |= parse_option(optarg, 0, 1e15, &bytes);
+                break;
+            case 'w':
+                bad |= parse_option(optarg, 1, TRANSFER_MAX_WINDOW, &window);
+                break;
+            case 's':
+                bad |= parse_option(optarg, 1, MYTCP_MAX_PAYLOAD, &mss);
+                break;
+            case 'a':
+                cc = mytcp_cc_find(optarg);
+                if (cc == NULL && strcasecmp(optarg, "none") != 0)
+                    return abort_with_message("Error: unknown congestion control");
+                break;
+            case 'T':
+                trace = optarg;
+                break;
+            default:
+                return abort_with_message("Error: unknown option");
+        }
+    }
 
-    printf("writing output to %s as well as console\n", OUTFILE_NAME);
+    if (bad) return abort_with_message("Error: option value out of range");
+    if (load_options && !load) return abort_with_message("Error: -r, -d, -f, -M and -k require load");
+    if (transfer_options && !transfer) return abort_with_message("Error: -b, -w, -s, -a and -T require transfer");
+    if (!load && !loop && (threads != 0 || connections != 0 || open_percent != 100 || count != 0))
+        return abort_with_message("Error: -t, -c, -m and -n require load or loop");
+    if (threads == 0) threads = loop ? LOOPBACK_DEFAULT_THREADS : LOAD_DEFAULT_THREADS;
+    if (connections == 0) connections = loop ? LOOPBACK_DEFAULT_CONNECTIONS : LOAD_DEFAULT_CONNECTIONS;
+    if (loop && network_options) return abort_with_message("Error: loop does not use the network");
+    if (flood > 0 && !udp) return abort_with_message("Error: -f requires -u");
+    if (persistent > 0 && udp) return abort_with_message("Error: -k only applies to TCP");
+    if (persistent > 0 && connections > threads * LOAD_MAX_MUX_SLOTS)
+        return abort_with_message("Error: too many connections per thread to multiplex");
+
+    // loop mode runs client and server in this process, linked by in-memory rings
+    if (loop)
+    {
+        if (threads > 2) return abort_with_message("Error: loop runs on 1 or 2 threads");
+        if (connections > LOOPBACK_MAX_CONNECTIONS) return abort_with_message("Error: too many connections");
+
+        mytcp_loopback_config_t config = {
+                .threads = (int) threads,
+                .connections = (int) connections,
+                .open_percent = (int) open_percent,
+                .count = count != 0 ? (uint64_t) count : LOOPBACK_DEFAULT_COUNT
+        };
+        return mytcp_loopback_run(&config);
+    }
 
-    // create socket
-    int sockfd = socket(AF_INET, SOCK_STREAM, 0);
-    if (sockfd == -1 || errno != 0) return abort_with_errno(errno, "socket");
+    errno = 0;
 
     // resolve hostname
-    struct hostent *server_hostname = gethostbyname(SERVER_HOSTNAME);
+    struct hostent *server_hostname = gethostbyname(hostname);
     if (server_hostname == NULL) return abort_with_message("Error: invalid hostname");
 
     // build server address
@@ -47,9 +168,40 @@ int main(int argc, char **argv)
     bzero(&server_addr, sizeof(server_addr));
     server_addr.sin_family = AF_INET;
     server_addr.sin_addr = *((struct in_addr *) server_hostname->h_addr_list[0]);
-    server_addr.sin_port = htons(SERVER_PORT);
+    server_addr.sin_port = htons((uint16_t) port);
+
+    // load mode manages its own sockets and prints a report instead of segments
+    if (load)
+    {
+        mytcp_load_config_t config = {
+                .target = server_addr,
+                .udp = udp,
+                .threads = (int) threads,
+                .connections = (int) connections,
+                .rate = rate,
+                .open_percent = (int) open_percent,
+                .duration = duration,
+                .count = (uint64_t) count,
+                .timeout_ms = LOAD_DEFAULT_TIMEOUT_MS,
+                .flood = flood,
+                .metrics_port = (uint16_t) metrics_port,
+                .persistent = (int) persistent
+        };
+        return mytcp_load_run(&config);
+    }
+
+    // open output file
+    FILE *outfile = fopen(OUTFILE_NAME, "w");
+    if (outfile == NULL || errno != 0)
+        return abort_with_errno(errno, "fopen");
+
+    printf("writing output to %s as well as console\n", OUTFILE_NAME);
+
+    // create socket
+    int sockfd = socket(AF_INET, udp ? SOCK_DGRAM : SOCK_STREAM, 0);
+    if (sockfd == -1 || errno != 0) return abort_with_errno(errno, "socket");
 
-    // attempt to connect
+    // attempt to connect; for UDP this only fixes the peer, so read() and write() carry one datagram each
     printf("connecting to %s:%d ... ", inet_ntoa(server_addr.sin_addr), ntohs(server_addr.sin_port));
     if (connect(sockfd, (struct sockaddr *) &server_addr, sizeof(server_addr)) != 0 || errno != 0)
         return abort_with_errno(errno, "connect");
@@ -68,6 +220,19 @@ int main(int argc, char **argv)
     else if (strcasecmp(argv[1], "close") == 0)
         result = mock_close(sockfd, outfile);
 
+        // if we are transferring, open, send the payload and close
+    else if (transfer)
+    {
+        mytcp_transfer_config_t config = {
+                .bytes = (uint64_t) bytes,
+                .window = (uint32_t) window,
+                .mss = (uint16_t) mss,
+                .cc = cc,
+                .trace = trace
+        };
+        result = mytcp_transfer_send(sockfd, outfile, udp, &config);
+    }
+
     shutdown(sockfd, SHUT_RDWR);
     close(sockfd);
     return result;
@@ -77,148 +242,20 @@ int mock_open(int sockfd, FILE *outfile)
 {
     printf("simulating opening a TCP connection\n\n");
 
-    errno = 0;
-
-    /* SEND CONNECTION REQUEST SEGMENT */
-
-    printf("sending connection request ... ");
-
-    // create a tcp segment with initial values
-    mytcp_t segment = mytcp_create_segment(CLIENT_PORT, SERVER_PORT);
-    uint32_t initial_seq = segment.sequence;
-    mytcp_set_flag(&segment, FLAG_SYN);
-    mytcp_set_checksum(&segment);
-
-    // attempt to send
-    ssize_t rw_result;
-    if ((rw_result = write(sockfd, &segment, sizeof(segment))) != sizeof(segment) || errno != 0)
-        return handle_bad_rw_result(rw_result, "send conn req");
-
-    printf("OK\n");
-
-    mytcp_print_segment(outfile, segment, "outgoing connection request");
-
-    /* RECEIVE CONNECTION GRANTED SEGMENT */
-
-    printf("awaiting connection granted ... ");
-
-    // receive connection granted segment
-    if ((rw_result = read(sockfd, &segment, sizeof(segment))) != sizeof(segment) || errno != 0)
-        return handle_bad_rw_result(rw_result, "receive conn granted");
-
-    // check connection granted segment
-    if (segment.acknowledgment != initial_seq + 1) return abort_with_message("conn granted: ack != initial_seq + 1");
-    if (!mytcp_check_flag(segment, FLAG_SYN)) return abort_with_message("conn granted: SYN not set");
-    if (!mytcp_check_flag(segment, FLAG_ACK)) return abort_with_message("conn granted: ACK not set");
-    if (!mytcp_verify_checksum(segment)) return abort_with_message("conn granted: invalid checksum");
-
-    printf("OK\n");
-
-    mytcp_print_segment(outfile, segment, "incoming connection granted");
-
-    /* SEND CONNECTION ACKNOWLEDGEMENT SEGMENT */
-
-    // set sequence to initial sequence + 1, acknowledgement to server sequence + 1
-    uint32_t server_seq = segment.sequence;
-    segment.sequence = initial_seq + 1;
-    segment.acknowledgment = server_seq + 1;
-
-    // set ACK flag and checksum
-    mytcp_set_flag(&segment, FLAG_ACK);
-    mytcp_set_checksum(&segment);
-
-    // send connection acknowledgement segment
-    printf("sending connection acknowledgement ... ");
-    if ((rw_result = write(sockfd, &segment, sizeof(segment))) != sizeof(segment) || errno != 0)
-        return handle_bad_rw_result(rw_result, "send conn ack");
-
-    printf("OK\n");
-
-    mytcp_print_segment(outfile, segment, "outgoing connection acknowledgment");
-
-    return 0;
+    mytcp_t segment;
+    mytcp_conn_t conn;
+    mytcp_conn_init(&conn, CLIENT_PORT, SERVER_PORT, STATE_CLOSED);
+    mytcp_conn_open(&conn, &segment);
+    return run_handshake(sockfd, outfile, &conn, &segment);
 }
 
 int mock_close(int sockfd, FILE *outfile)
 {
-    printf("simulating opening a TCP connection\n\n");
-
-    errno = 0;
-
-    /* SEND CLOSE REQUEST */
-
-    printf("sending close request ... ");
-
-    // create a new TCP segment with initial values
-    mytcp_t segment = mytcp_create_segment(CLIENT_PORT, SERVER_PORT);
-    uint32_t initial_seq = segment.sequence;
-    mytcp_set_flag(&segment, FLAG_FIN);
-    mytcp_set_checksum(&segment);
-
-    // attempt to send
-    ssize_t rw_result;
-    if ((rw_result = write(sockfd, &segment, sizeof(segment))) != sizeof(segment) || errno != 0)
-        return handle_bad_rw_result(rw_result, "request close");
-
-    printf("OK\n");
-
-    mytcp_print_segment(outfile, segment, "outgoing close request");
-
-    /* RECEIVE ACKNOWLEDGMENT SEGMENT */
-
-    printf("awaiting close acknowledgment ... ");
-
-    if ((rw_result = read(sockfd, &segment, sizeof(segment))) != sizeof(segment) || errno != 0)
-        return handle_bad_rw_result(rw_result, "receive close ack 1");
-
-    // verify checksum
-    if (!mytcp_verify_checksum(segment)) return abort_with_message("ack 1: invalid checksum");
-
-    // verify values
-    uint32_t server_seq = segment.sequence;
-    if (segment.acknowledgment != initial_seq + 1) return abort_with_message("ack 1: bad ack number");
-    if (!mytcp_check_flag(segment, FLAG_ACK)) return abort_with_message("ack 1: ACK not set");
-
-    printf("OK\n");
-
-    mytcp_print_segment(outfile, segment, "incoming close acknowledgment");
-
-    /* RECEIVE ANOTHER CLOSE ACKNOWLEDGMENT SEGMENT */
-
-    printf("awaiting close request ... ");
-
-    if ((rw_result = read(sockfd, &segment, sizeof(segment))) != sizeof(segment) || errno != 0)
-        return handle_bad_rw_result(rw_result, "receive close ack 2");
-
-    // verify checksum
-    if (!mytcp_verify_checksum(segment)) return abort_with_message("ack 2: invalid checksum");
-
-    // verify values
-    if (segment.acknowledgment != initial_seq + 1) return abort_with_message("ack 2: bad ack number");
-    if (!mytcp_check_flag(segment, FLAG_FIN)) return abort_with_message("ack 2: FIN not set");
-
-    printf("OK\n");
-
-    mytcp_print_segment(outfile, segment, "incoming close request");
-
-    /* SEND CLOSE ACKNOWLEDGMENT SEGMENT */
-
-    printf("sending close acknowledgment ... ");
-
-    // set values
-    segment = mytcp_create_segment(CLIENT_PORT, SERVER_PORT);
-    segment.sequence = initial_seq + 1;
-    segment.acknowledgment = server_seq + 1;
-    mytcp_set_flag(&segment, FLAG_ACK);
-    mytcp_set_checksum(&segment);
-
-    // send ack
-    if ((rw_result = write(sockfd, &segment, sizeof(segment))) != sizeof(segment) || errno != 0)
-        return handle_bad_rw_result(rw_result, "send final close ack");
-
-    printf("OK\n");
-
-    mytcp_print_segment(outfile, segment, "outgoing close acknowledgment");
+    printf("simulating closing a TCP connection\n\n");
 
-    return 0;
+    mytcp_t segment;
+    mytcp_conn_t conn;
+    mytcp_conn_init(&conn, CLIENT_PORT, SERVER_PORT, STATE_ESTABLISHED);
+    mytcp_conn_close(&conn, &segment);
+    return run_handshake(sockfd, outfile, &conn, &segment);
 }
@@ -0,0 +1,120 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "src/common.h"
+
+// where the proxy relays to by default; it is meant to run next to the server
+#define PROXY_DEFAULT_HOST "localhost"
+
+int main(int argc, char **argv)
+{
+    mytcp_impair_config_t config = { .reorder_ms = IMPAIR_DEFAULT_REORDER_MS };
+    const char *hostname = PROXY_DEFAULT_HOST, *log_name = NULL;
+    double listen_port = IMPAIR_DEFAULT_PORT, port = SERVER_PORT, seed = 0;
+    int opt, bad = 0;
+
+    while ((opt = getopt(argc, argv, "uL:H:P:d:j:l:D:r:g:x:S:o:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'u':
+                config.udp = true;
+                break;
+            case 'L':
+                bad |= parse_option(optarg, 1, 65535, &listen_port);
+                break;
+            case 'H':
+                hostname = optarg;
+                break;
+            case 'P':
+                bad |= parse_option(optarg, 1, 65535, &port);
+                break;
+            case 'd':
+                bad |= parse_option(optarg, 0, 60000, &config.delay_ms);
+                break;
+            case 'j':
+                bad |= parse_option(optarg, 0, 60000, &config.jitter_ms);
+                break;
+            case 'l':
+                bad |= parse_option(optarg, 0, 100, &config.loss);
+                break;
+            case 'D':
+                bad |= parse_option(optarg, 0, 100, &config.duplicate);
+                break;
+            case 'r':
+                bad |= parse_option(optarg, 0, 100, &config.reorder);
+                break;
+            case 'g':
+                bad |= parse_option(optarg, 0, 60000, &config.reorder_ms);
+                break;
+            case 'x':
+                bad |= parse_option(optarg, 0, 100, &config.corrupt);
+                break;
+            case 'S':
+                bad |= parse_option(optarg, 0, UINT32_MAX, &seed);
+                config.seeded = true;
+                break;
+            case 'o':
+                log_name = optarg;
+                break;
+            default:
+                fprintf(stderr, "Usage:\n    %s [-u] [-L PORT] [-H HOST] [-P PORT] [-d DELAY] [-j JITTER] [-l LOSS%%] "
+                                "[-D DUPLICATE%%] [-r REORDER%%]\n"
+                                "            [-g GAP] [-x CORRUPT%%] [-S SEED] [-o FILE] - Relay segments between "
+                                "clients and a server, impaired\n\n"
+                                "    -u %s\n    -L Port clients connect to (default %d)\n"
+                                "    -H Server to relay to (default %s)\n    -P Server port (default %d)\n"
+                                "    -d Delay added to every segment, in ms (default 0)\n"
+                                "    -j The delay varies uniformly by up to this many ms either way (default 0)\n"
+                                "    -l Percentage of segments dropped\n"
+                                "    -D Percentage of segments relayed twice\n"
+                                "    -r Percentage of segments held back so later ones overtake them\n"
+                                "    -g How long a reordered segment is held back, in ms (default %.0f)\n"
+                                "    -x Percentage of segments with one header bit flipped (the checksum fails)\n"
+                                "    -S Seed of the random choices, to repeat a run (default: a new one each run)\n"
+                                "    -o Log every segment, its timing and what became of it to this CSV file\n",
+                        argv[0], HELP_UDP, IMPAIR_DEFAULT_PORT, PROXY_DEFAULT_HOST, SERVER_PORT,
+                        IMPAIR_DEFAULT_REORDER_MS);
+                return 1;
+        }
+    }
+
+    if (bad) return abort_with_message("Error: option value out of range");
+    if (optind != argc) return abort_with_message("Error: unexpected argument");
+
+    errno = 0;
+
+    // resolve the server
+    struct hostent *server_hostname = gethostbyname(hostname);
+    if (server_hostname == NULL) return abort_with_message("Error: invalid hostname");
+
+    bzero(&config.target, sizeof(config.target));
+    config.target.sin_family = AF_INET;
+    config.target.sin_addr = *((struct in_addr *) server_hostname->h_addr_list[0]);
+    config.target.sin_port = htons((uint16_t) port);
+
+    // only local clients: the proxy stands in for a network, not a path into one
+    bzero(&config.listen, sizeof(config.listen));
+    config.listen.sin_family = AF_INET;
+    config.listen.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    config.listen.sin_port = htons((uint16_t) listen_port);
+
+    if (config.listen.sin_port == config.target.sin_port && config.target.sin_addr.s_addr == htonl(INADDR_LOOPBACK))
+        return abort_with_message("Error: the proxy cannot relay to itself");
+
+    config.seed = (uint32_t) seed;
+    if (log_name != NULL)
+    {
+        config.log = fopen(log_name, "w");
+        if (config.log == NULL) return abort_with_errno(errno, "fopen");
+    }
+
+    int result = mytcp_impair_run(&config);
+    if (config.log != NULL) fclose(config.log);
+    return result;
+}
@@ -1,48 +1,166 @@
+#define _GNU_SOURCE     // recvmmsg, sendmmsg
+
 #include <arpa/inet.h>
 #include <time.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
 #include <unistd.h>
 
 #define OUTFILE_NAME "server.out"
+#define CAPTURE_NAME "server.pcap"
 
 #include "src/common.h"
 
+// maximum number of epoll events handled per wakeup in serve mode
+#define SERVE_MAX_EVENTS 256
+
+// maximum number of datagrams received (and twice that sent) per system call in UDP serve mode
+#define DGRAM_BATCH 64
+
+// receive buffer requested for the UDP serve socket (the kernel caps it at net.core.rmem_max)
+#define DGRAM_RCVBUF (4 * 1024 * 1024)
+
+// most segments read at once from a client socket that multiplexes connections
+#define MUX_BATCH 64
+
+// most responses queued on a client socket that multiplexes connections before it is no longer read from
+#define MUX_MAX_BACKLOG (64 * MUX_BATCH)
+
+// number of UDP peers the connection table is initially sized for in serve mode (it grows as needed)
+#define PEER_TABLE_SIZE 4096
+
+// handshake each client runs in serve mode; SERVE_ANY lets each client's first segment pick it
+enum serve_mode
+{
+    SERVE_OPEN,
+    SERVE_CLOSE,
+    SERVE_ANY
+};
+
+static const char *SERVE_MODE_NAMES[] = { "open", "close", "open and close" };
+
+struct serve_worker;
+
+int open_listener(const struct sockaddr_in *, bool, int, bool);
 int mock_open(int, FILE *);
 int mock_close(int, FILE *);
+int serve_run(const struct sockaddr_in *, int, bool, bool, bool, bool, enum serve_mode, int, bool, uint16_t);
+int serve_forever(struct serve_worker *);
+int serve_uring(struct serve_worker *);
+int serve_datagrams(struct serve_worker *);
 
 int main(int argc, char **argv)
 {
-    srand((uint32_t) time(NULL));
-
-    if (argc < 2 || (strcasecmp(argv[1], "open") != 0 && strcasecmp(argv[1], "close") != 0))
+    if (argc < 2 || (strcasecmp(argv[1], "open") != 0 && strcasecmp(argv[1], "close") != 0
+                     && strcasecmp(argv[1], "any") != 0 && strcasecmp(argv[1], "transfer") != 0))
     {
-        fprintf(stderr, "Usage:\n    %s open  %s\n    %s close %s\n", argv[0], HELP_OPEN, argv[0], HELP_CLOSE);
+        fprintf(stderr, "Usage:\n    %s open  [-s [-b] [-w WORKERS [-p]] [-i] [-c] [-m] [-M PORT]] [-u] %s\n"
+                        "    %s close [-s [-b] [-w WORKERS [-p]] [-i] [-m] [-M PORT]] [-u] %s\n"
+                        "    %s any   -s [-b] [-w WORKERS [-p]] [-i] [-c] [-m] [-M PORT] [-u]  %s\n"
+                        "    %s transfer [-W WINDOW] [-u] %s\n\n"
+                        "    -s %s\n    -b %s\n    -w %s\n    -p %s\n    -i %s\n    -c %s\n    -m %s\n    -M %s\n"
+                        "    -u %s\n"
+                        "    -W Receive window to advertise, in bytes (default %d; up to %u, with window scaling)\n",
+                argv[0], HELP_OPEN, argv[0], HELP_CLOSE, argv[0], HELP_ANY, argv[0], HELP_XFER,
+                HELP_SERVE, HELP_CAPTURE, HELP_WORKERS, HELP_PIN, HELP_URING, HELP_COOKIES, HELP_MUX, HELP_METRICS,
+                HELP_UDP,
+                TRANSFER_DEFAULT_WINDOW, TRANSFER_MAX_WINDOW);
         if (argc == 1) return 1;
         fprintf(stderr, "\nInvalid argument: %s\n", argv[1]);
         return 1;
     }
 
+    // parse options following the action
+    bool serve = false, udp = false, capture = false, pin = false, uring = false, cookies = false, mux = false;
+    int opt, workers = 1, window = TRANSFER_DEFAULT_WINDOW, metrics_port = 0;
+    while ((opt = getopt(argc - 1, argv + 1, "sbw:picmM:uW:")) != -1)
+    {
+        switch (opt)
+        {
+            case 's':
+                serve = true;
+                break;
+            case 'b':
+                capture = true;
+                break;
+            case 'w':
+                workers = atoi(optarg);
+                if (workers < 0) return abort_with_message("Error: invalid number of workers");
+                break;
+            case 'p':
+                pin = true;
+                break;
+            case 'i':
+                uring = true;
+                break;
+            case 'c':
+                cookies = true;
+                break;
+            case 'm':
+                mux = true;
+                break;
+            case 'M':
+                metrics_port = atoi(optarg);
+                if (metrics_port < 1 || metrics_port > 65535) return abort_with_message("Error: invalid port");
+                break;
+            case 'u':
+                udp = true;
+                break;
+            case 'W':
+                window = atoi(optarg);
+                if (window < 1 || (uint32_t) window > TRANSFER_MAX_WINDOW)
+                    return abort_with_message("Error: invalid window");
+                break;
+            default:
+                return abort_with_message("Error: unknown option");
+        }
+    }
+
+    // the one-shot path prints segments synchronously as text
+    if (capture && !serve) return abort_with_message("Error: -b requires -s");
+    if ((workers != 1 || pin || uring || cookies || mux || metrics_port != 0) && !serve)
+        return abort_with_message("Error: -w, -p, -i, -c, -m and -M require -s");
+    if (uring && udp) return abort_with_message("Error: -i only applies to TCP");
+    if (mux && udp) return abort_with_message("Error: -m only applies to TCP");
+    if (mux && uring) return abort_with_message("Error: -m does not run on io_uring");
+    if (cookies && !udp) return abort_with_message("Error: -c only applies to UDP");
+    if (cookies && strcasecmp(argv[1], "close") == 0) return abort_with_message("Error: -c requires open or any");
+    if (strcasecmp(argv[1], "any") == 0 && !serve) return abort_with_message("Error: any requires -s");
+    if (strcasecmp(argv[1], "transfer") == 0 && serve) return abort_with_message("Error: transfer serves one client");
+    if (window != TRANSFER_DEFAULT_WINDOW && strcasecmp(argv[1], "transfer") != 0)
+        return abort_with_message("Error: -W requires transfer");
+
     errno = 0;
 
     // open output file
-    FILE *outfile = fopen(OUTFILE_NAME, "w");
+    const char *outfile_name = capture ? CAPTURE_NAME : OUTFILE_NAME;
+    FILE *outfile = fopen(outfile_name, capture ? "wb" : "w");
     if (outfile == NULL || errno != 0)
         return abort_with_errno(errno, "fopen");
 
-    printf("writing output to %s as well as console\n", OUTFILE_NAME);
-
-    // create socket
-    int sockfd = socket(AF_INET, SOCK_STREAM, 0);
-    if (sockfd == -1 || errno != 0)
-        return abort_with_errno(errno, "socket");
+    if (serve)
+        printf("writing segments to %s\n", outfile_name);
+    else
+        printf("writing output to %s as well as console\n", outfile_name);
 
-    // allow address reuse if process is killed
-    int32_t yes = 1;
-    if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes)) == -1 || errno != 0)
-        return abort_with_errno(errno, "setsockopt");
+    // one worker per CPU we are allowed to run on
+    if (workers == 0)
+    {
+        cpu_set_t cpus;
+        workers = sched_getaffinity(0, sizeof(cpus), &cpus) == 0 ? CPU_COUNT(&cpus) : 1;
+    }
 
     // assign port
     struct sockaddr_in server_addr;
@@ -51,24 +169,52 @@ int main(int argc, char **argv)
     server_addr.sin_addr.s_addr = htonl(INADDR_ANY);
     server_addr.sin_port = htons(SERVER_PORT);
 
-    // attempt to bind
-    if (bind(sockfd, (struct sockaddr *) &server_addr, sizeof(server_addr)) != 0 || errno != 0)
-        return abort_with_errno(errno, "bind");
-
-    // attempt to listen
-    if (listen(sockfd, 5) != 0 || errno != 0)
-        return abort_with_errno(errno, "listen");
+    // serve mode needs a backlog deep enough to absorb bursts of clients, and one listener per worker
+    int sockfd = open_listener(&server_addr, udp, serve ? SOMAXCONN : 5, workers > 1);
+    if (sockfd == -1) return 1;
 
     // nice
-    printf("listening on port %d\n", ntohs(server_addr.sin_port));
+    printf("listening on %s port %d\n", udp ? "UDP" : "TCP", ntohs(server_addr.sin_port));
+
+    // serve mode never returns to the one-shot path below; segments are logged to the outfile in the background
+    if (serve)
+    {
+        int err = mytcp_log_start(outfile, capture ? LOG_FORMAT_PCAP : LOG_FORMAT_TEXT, false, LOG_DEFAULT_CAPACITY);
+        if (err != 0) return abort_with_errno(err, "segment log");
+
+        enum serve_mode mode = strcasecmp(argv[1], "open") == 0 ? SERVE_OPEN
+                               : strcasecmp(argv[1], "close") == 0 ? SERVE_CLOSE : SERVE_ANY;
+        int result = serve_run(&server_addr, sockfd, udp, uring, cookies, mux, mode, workers, pin,
+                               (uint16_t) metrics_port);
+
+        mytcp_log_stop();
+        fclose(outfile);
+        return result;
+    }
 
-    // attempt to accept
     struct sockaddr_in client_addr;
     socklen_t client_len = sizeof(client_addr);
     bzero(&client_addr, sizeof(client_addr));
-    int clientfd = accept(sockfd, (struct sockaddr *) &client_addr, &client_len);
-    if (clientfd == -1 || errno != 0)
-        return abort_with_errno(errno, "accept");
+    int clientfd;
+
+    if (udp)
+    {
+        // wait for the first datagram without consuming it, then only talk to its sender
+        mytcp_t first;
+        if (recvfrom(sockfd, &first, sizeof(first), MSG_PEEK, (struct sockaddr *) &client_addr, &client_len) == -1
+            || errno != 0)
+            return abort_with_errno(errno, "recvfrom");
+        if (connect(sockfd, (struct sockaddr *) &client_addr, client_len) != 0 || errno != 0)
+            return abort_with_errno(errno, "connect");
+        clientfd = dup(sockfd);
+    }
+    else
+    {
+        // attempt to accept
+        clientfd = accept(sockfd, (struct sockaddr *) &client_addr, &client_len);
+        if (clientfd == -1 || errno != 0)
+            return abort_with_errno(errno, "accept");
+    }
 
     // nice
     printf("client connected from %s\n", inet_ntoa(client_addr.sin_addr));
@@ -83,6 +229,9 @@ int main(int argc, char **argv)
     else if (strcasecmp(argv[1], "close") == 0)
         result = mock_close(clientfd, outfile);
 
+    else if (strcasecmp(argv[1], "transfer") == 0)
+        result = mytcp_transfer_receive(clientfd, outfile, udp, (uint32_t) window);
+
     shutdown(clientfd, SHUT_RDWR);
     shutdown(sockfd, SHUT_RDWR);
 
@@ -92,169 +241,2176 @@ int main(int argc, char **argv)
     return result;
 }
 
+/**
+ * Create a socket bound to the server address, listening if it is a TCP socket.
+ *
+ * @param addr The address to bind to
+ * @param udp True for a UDP socket, false for a TCP socket
+ * @param backlog The TCP listen backlog
+ * @param reuseport True to let other sockets bind the same port (SO_REUSEPORT), which spreads clients across them
+ * @return The socket, or -1 after printing an error
+ */
+int open_listener(const struct sockaddr_in *addr, bool udp, int backlog, bool reuseport)
+{
+    errno = 0;
+
+    // create socket
+    int sockfd = socket(AF_INET, udp ? SOCK_DGRAM : SOCK_STREAM, 0);
+    if (sockfd == -1)
+    {
+        write_errno(errno, "socket");
+        return -1;
+    }
+
+    // allow address reuse if process is killed, then bind and (for TCP) listen
+    int32_t yes = 1;
+    const char *failed = NULL;
+    if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes)) == -1)
+        failed = "setsockopt";
+    else if (reuseport && setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes)) == -1)
+        failed = "SO_REUSEPORT";
+    else if (bind(sockfd, (const struct sockaddr *) addr, sizeof(*addr)) != 0)
+        failed = "bind";
+    else if (!udp && listen(sockfd, backlog) != 0)
+        failed = "listen";
+
+    if (failed != NULL)
+    {
+        write_errno(errno, failed);
+        close(sockfd);
+        return -1;
+    }
+
+    return sockfd;
+}
+
 int mock_open(int client_fd, FILE *outfile)
 {
     printf("simulating opening a TCP connection\n\n");
-    errno = 0;
 
-    mytcp_t segment;
-    ssize_t rw_result;
+    mytcp_conn_t conn;
+    mytcp_conn_init(&conn, SERVER_PORT, CLIENT_PORT, STATE_LISTEN);
+    return run_handshake(client_fd, outfile, &conn, NULL);
+}
+
+int mock_close(int client_fd, FILE *outfile)
+{
+    printf("simulating closing a TCP connection\n\n");
+
+    mytcp_conn_t conn;
+    mytcp_conn_init(&conn, SERVER_PORT, CLIENT_PORT, STATE_ESTABLISHED);
+    return run_handshake(client_fd, outfile, &conn, NULL);
+}
+
+/* SERVE MODE */
+
+// per-client state for serve mode; lives from accept() until the handshake completes or fails
+struct serve_conn
+{
+    int fd;
+    uint32_t local_addr;    // the address the client connected to; the listener's own is the wildcard address
+    uint32_t peer_addr;
+    mytcp_conn_t conn;
+    bool pending;           // serving any: the first segment has not picked the handshake yet
+
+    // partially received incoming segment
+    mytcp_t in;
+    size_t in_len;
+
+    // responses not yet accepted by the kernel (the close handshake answers with two segments)
+    mytcp_t out[2];
+    size_t out_len;
+    size_t out_sent;
+
+    uint64_t stamp;         // when the handshake's latest event happened, for the step metrics
+
+    // fires when the client has been silent for a retransmission timeout; a client that stays silent through
+    // CONN_MAX_RETRIES of them is dropped (a stream loses nothing, so there is nothing to retransmit)
+    mytcp_timer_t timer;
+
+    // the worker's other live clients, so the ones still in flight can be released when serve mode stops
+    struct serve_conn *prev;
+    struct serve_conn *next;
+};
+
+// handshake counters, reported when serve mode stops and exported while it runs (see METRIC_INC())
+struct serve_stats
+{
+    uint64_t accepted;
+    uint64_t completed;
+    uint64_t failed;
+    uint64_t half_open;         // handshakes still in progress when serve mode stopped
+    uint64_t cookies_sent;
+    uint64_t cookies_rejected;
+    uint64_t retransmitted;     // UDP segments sent again after a timeout or a duplicate
+    uint64_t timed_out;         // handshakes failed because the client stopped answering (also counted as failed)
+};
+
+// one serve mode worker: its own listening socket, event loop and counters; nothing is shared between workers,
+// and each sits on its own cache lines so their counters never contend
+struct serve_worker
+{
+    int sockfd;
+    int stopfd;             // eventfd shared by all workers, readable once serve mode is stopping
+    int cpu;                // CPU the worker is pinned to, or -1
+    bool udp;
+    bool uring;             // use the io_uring engine instead of epoll
+    bool cookies;           // answer UDP connection requests with SYN cookies
+    bool mux;               // each TCP client multiplexes many connections over its socket, told apart by port pair
+    enum serve_mode mode;
+    pthread_t thread;
+    struct serve_stats stats;
+    mytcp_metrics_t metrics;
+    mytcp_wheel_t wheel;    // the timers of the worker's clients
+    struct serve_conn *live;        // TCP clients accepted and not yet released
+    struct mux_stream *streams;     // with mux set, the client sockets not yet closed
+} __attribute__((aligned(64)));
+
+// what the metrics exporter and SIGUSR1 report on
+struct serve_export
+{
+    const struct serve_worker *workers;
+    int nworkers;
+};
+
+/**
+ * Put a file descriptor into non-blocking mode.
+ *
+ * @param fd The file descriptor to modify
+ * @return 0 on success, -1 on failure (errno is set)
+ */
+static int set_nonblocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags == -1) return -1;
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+/**
+ * Queue an accepted segment and the responses it produced for the background segment log.
+ *
+ * @param conn The connection the segments belong to
+ * @param local_addr Our IPv4 address the client talks to (network byte order)
+ * @param peer_addr The client's IPv4 address (network byte order)
+ * @param in The accepted incoming segment
+ * @param out The responses
+ * @param nout The number of responses
+ */
+static void serve_log(const mytcp_conn_t *conn, uint32_t local_addr, uint32_t peer_addr, const mytcp_t *in,
+                      const mytcp_t *out, size_t nout)
+{
+    mytcp_log_segment(in, mytcp_conn_kind(conn, in), true, local_addr, peer_addr);
+    for (size_t i = 0; i < nout; i++)
+        mytcp_log_segment(&out[i], mytcp_conn_kind(conn, &out[i]), false, local_addr, peer_addr);
+}
+
+/**
+ * The local address of a connected socket, for the segment log.
+ *
+ * @param fd The socket
+ * @return Its IPv4 address (network byte order), or INADDR_ANY if it cannot be read
+ */
+static uint32_t local_address(int fd)
+{
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    if (getsockname(fd, (struct sockaddr *) &addr, &len) == -1 || addr.sin_family != AF_INET)
+        return htonl(INADDR_ANY);
+    return addr.sin_addr.s_addr;
+}
+
+/**
+ * Feed one complete incoming segment to a served connection and queue the response(s), if any.
+ *
+ * @param metrics The worker's metrics
+ * @param conn The connection that received the segment
+ * @return NULL if the segment was accepted, else a message describing the protocol violation
+ */
+static const char *serve_handle_segment(mytcp_metrics_t *metrics, struct serve_conn *conn)
+{
+    if (conn->pending)
+    {
+        mytcp_conn_accept(&conn->conn, SERVER_PORT, CLIENT_PORT, &conn->in);
+        conn->pending = false;
+    }
+
+    int nout;
+    size_t first = conn->out_len;
+    mytcp_conn_error_t err = mytcp_conn_input(&conn->conn, &conn->in, &conn->out[conn->out_len], &nout);
+    if (err != CONN_OK)
+    {
+        mytcp_metrics_rejected(metrics, err);
+        return CONN_ERROR_NAMES[err];
+    }
+    conn->out_len += nout;
+    mytcp_metrics_received(metrics, &conn->stamp, mytcp_conn_kind(&conn->conn, &conn->in), mytcp_metrics_now());
+
+    // nothing left to send before our own close request
+    if (conn->conn.state == STATE_CLOSE_WAIT)
+        mytcp_conn_close(&conn->conn, &conn->out[conn->out_len++]);
+
+    serve_log(&conn->conn, conn->local_addr, conn->peer_addr, &conn->in, &conn->out[first], conn->out_len - first);
+    return NULL;
+}
+
+/**
+ * Report the responses the kernel has just taken in full to the step metrics.
+ *
+ * @param metrics The worker's metrics
+ * @param conn The connection whose output was written
+ * @param before How much of the output had been written before
+ */
+static void serve_sent(mytcp_metrics_t *metrics, struct serve_conn *conn, size_t before)
+{
+    size_t first = before / sizeof(mytcp_t), last = conn->out_sent / sizeof(mytcp_t);
+    if (first == last) return;
+
+    uint64_t now = mytcp_metrics_now();
+    for (size_t i = first; i < last; i++)
+        mytcp_metrics_sent(metrics, &conn->stamp, mytcp_conn_kind(&conn->conn, &conn->out[i]), now);
+}
+
+/**
+ * Write as much queued output as the socket accepts without blocking.
+ *
+ * @param metrics The worker's metrics
+ * @param conn The connection whose output we are flushing
+ * @return 0 if all output was written or the socket is full, -1 on a write error
+ */
+static int serve_flush(mytcp_metrics_t *metrics, struct serve_conn *conn)
+{
+    size_t total = conn->out_len * sizeof(mytcp_t), before = conn->out_sent;
+    int result = 0;
+
+    while (conn->out_sent < total)
+    {
+        ssize_t written = write(conn->fd, (char *) conn->out + conn->out_sent, total - conn->out_sent);
+        if (written == -1)
+        {
+            result = (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+            break;
+        }
+        conn->out_sent += (size_t) written;
+    }
+
+    serve_sent(metrics, conn, before);
+    if (conn->out_sent < total) return result;
+
+    conn->out_len = 0;
+    conn->out_sent = 0;
+    return 0;
+}
+
+/**
+ * Read and process every complete segment currently available on a served connection.
+ *
+ * @param metrics The worker's metrics
+ * @param conn The readable connection
+ * @return 1 if the connection is still in progress, 0 if the handshake completed, -1 on failure
+ */
+static int serve_readable(mytcp_metrics_t *metrics, struct serve_conn *conn)
+{
+    for (;;)
+    {
+        ssize_t got = read(conn->fd, (char *) &conn->in + conn->in_len, sizeof(mytcp_t) - conn->in_len);
 
-    /* RECEIVE CONNECTION REQUEST SEGMENT */
+        if (got == 0) return -1;
+        if (got == -1)
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 1 : -1;
 
-    printf("awaiting connection request ... ");
+        conn->in_len += (size_t) got;
+        if (conn->in_len < sizeof(mytcp_t)) continue;
+        conn->in_len = 0;
 
-    // attempt to receive an example tcp segment
-    bzero(&segment, sizeof(segment));
-    if ((rw_result = read(client_fd, &segment, sizeof(segment))) != sizeof(segment) || errno != 0)
-        return handle_bad_rw_result(rw_result, "receive conn req");
+        const char *violation = serve_handle_segment(metrics, conn);
+        if (violation != NULL)
+        {
+            fprintf(stderr, "client fd %d: %s\n", conn->fd, violation);
+            return -1;
+        }
 
-    // verify checksum
-    if (!mytcp_verify_checksum(segment)) return abort_with_message("incoming conn req: invalid checksum");
+        if (serve_flush(metrics, conn) != 0) return -1;
+        if (mytcp_conn_done(&conn->conn)) return 0;
+    }
+}
 
-    // check that everything is set properly
-    if (!mytcp_check_flag(segment, FLAG_SYN)) return abort_with_message("incoming conn req: SYN not set");
+/**
+ * Add a newly accepted client to its worker's live clients.
+ *
+ * @param w The worker
+ * @param conn The client
+ */
+static void serve_track(struct serve_worker *w, struct serve_conn *conn)
+{
+    conn->prev = NULL;
+    conn->next = w->live;
+    if (w->live != NULL) w->live->prev = conn;
+    w->live = conn;
+}
 
-    printf("OK\n");
+/**
+ * Remove a client from its worker's live clients.
+ *
+ * @param w The worker
+ * @param conn The client
+ */
+static void serve_untrack(struct serve_worker *w, struct serve_conn *conn)
+{
+    if (conn->prev != NULL)
+        conn->prev->next = conn->next;
+    else
+        w->live = conn->next;
+    if (conn->next != NULL) conn->next->prev = conn->prev;
+}
 
-    mytcp_print_segment(outfile, segment, "incoming connection request");
+/**
+ * Release a served connection and remove it from the epoll set, the timer wheel and the worker's live clients.
+ *
+ * @param epfd The epoll instance watching the connection
+ * @param w The worker
+ * @param conn The connection to release
+ */
+static void serve_release(int epfd, struct serve_worker *w, struct serve_conn *conn)
+{
+    mytcp_wheel_cancel(&w->wheel, &conn->timer);
+    serve_untrack(w, conn);
+    epoll_ctl(epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    free(conn);
+}
 
-    /* SEND CONNECTION GRANTED SEGMENT */
+/**
+ * Initialize a newly accepted client. When serving any handshake, the connection itself is initialized later, from
+ * the client's first segment.
+ *
+ * @param conn The zeroed client state
+ * @param fd The client socket
+ * @param peer_addr The client's IPv4 address (network byte order)
+ * @param mode The handshake to run with the client
+ */
+static void serve_conn_init(struct serve_conn *conn, int fd, uint32_t peer_addr, enum serve_mode mode)
+{
+    conn->fd = fd;
+    conn->local_addr = local_address(fd);
+    conn->peer_addr = peer_addr;
+    conn->pending = mode == SERVE_ANY;
+    if (!conn->pending)
+        mytcp_conn_init(&conn->conn, SERVER_PORT, CLIENT_PORT, mode == SERVE_OPEN ? STATE_LISTEN : STATE_ESTABLISHED);
+}
 
-    // save client sequence
-    uint32_t client_seq = segment.sequence;
+// what serve_expired() and mux_expired() need besides the timer
+struct serve_timeout
+{
+    struct serve_worker *w;
+    int epfd;
+    uint64_t now;
+};
 
-    // re-initialize segment (assigns sequence number automatically)
-    segment = mytcp_create_segment(SERVER_PORT, CLIENT_PORT);
-    uint32_t server_seq = segment.sequence;
+// a connection multiplexed over a client's socket, stored in the socket's table under its port pair
+struct mux_conn
+{
+    mytcp_tuple_t tuple;
+    struct mux_stream *stream;
+    mytcp_conn_t conn;
+    uint64_t stamp;         // when the handshake's latest event happened, for the step metrics
+    mytcp_timer_t timer;    // fires when the client has been silent for a retransmission timeout, as for serve_conn
+};
+
+// a client socket multiplexing any number of connections, told apart by their port pairs; it lives until the client
+// closes it, however many handshakes it carried
+struct mux_stream
+{
+    int fd;
+    uint32_t local_addr;
+    uint32_t peer_addr;
+    mytcp_table_t conns;
+
+    // received bytes not yet handled: whole segments, then the start of a partial one
+    char in[MUX_BATCH * sizeof(mytcp_t)];
+    size_t in_len;
+
+    // responses of all its connections not yet accepted by the kernel, in the order they were produced
+    mytcp_t *out;
+    size_t out_len;
+    size_t out_cap;
+    size_t out_sent;        // in bytes
+    bool paused;            // not read from (EPOLLIN dropped) until the client takes all its queued responses
+
+    // the worker's other open client sockets, so they can be closed when serve mode stops
+    struct mux_stream *prev;
+    struct mux_stream *next;
+};
+
+/**
+ * The 4-tuple a multiplexed connection is stored under: its ports tell it apart from the others on the socket.
+ *
+ * @param stream The socket carrying the connection
+ * @param seg A segment from the client
+ * @return The tuple
+ */
+static mytcp_tuple_t mux_tuple(const struct mux_stream *stream, const mytcp_t *seg)
+{
+    mytcp_tuple_t tuple = {
+            .src_addr = stream->peer_addr,
+            .dest_addr = htonl(INADDR_ANY),
+            .srcport = htons(seg->srcport),
+            .destport = htons(seg->destport)
+    };
+    return tuple;
+}
 
-    // set acknowledgement number to client sequence number + 1
-    segment.acknowledgment = client_seq + 1;
+/**
+ * Append responses to a client socket's output.
+ *
+ * @param stream The socket
+ * @param out The responses
+ * @param n The number of responses
+ * @return 0 on success, -1 if out of memory
+ */
+static int mux_queue(struct mux_stream *stream, const mytcp_t *out, size_t n)
+{
+    if (stream->out_len + n > stream->out_cap)
+    {
+        size_t cap = stream->out_cap == 0 ? MUX_BATCH : 2 * stream->out_cap;
+        mytcp_t *grown = realloc(stream->out, cap * sizeof(*grown));
+        if (grown == NULL) return -1;
+        stream->out = grown;
+        stream->out_cap = cap;
+    }
 
-    // set SYNACK and checksum
-    mytcp_set_flag(&segment, FLAG_SYN);
-    mytcp_set_flag(&segment, FLAG_ACK);
-    mytcp_set_checksum(&segment);
+    memcpy(&stream->out[stream->out_len], out, n * sizeof(*out));
+    stream->out_len += n;
+    return 0;
+}
 
-    // send connection granted response
-    printf("sending connection granted ... ");
-    if ((rw_result = write(client_fd, &segment, sizeof(segment))) != sizeof(segment) || errno != 0)
-        return handle_bad_rw_result(rw_result, "connection granted");
+/**
+ * Write as much of a client socket's output as it accepts without blocking.
+ *
+ * @param stream The socket
+ * @return 0 if all output was written or the socket is full, -1 on a write error
+ */
+static int mux_flush(struct mux_stream *stream)
+{
+    size_t total = stream->out_len * sizeof(mytcp_t);
 
-    printf("OK\n");
+    while (stream->out_sent < total)
+    {
+        ssize_t written = write(stream->fd, (char *) stream->out + stream->out_sent, total - stream->out_sent);
+        if (written == -1)
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+        stream->out_sent += (size_t) written;
+    }
 
-    mytcp_print_segment(outfile, segment, "outgoing connection granted");
+    stream->out_len = 0;
+    stream->out_sent = 0;
+    return 0;
+}
 
-    /* RECEIVE CONNECTION ACKNOWLEDGMENT SEGMENT */
+/**
+ * Remove a multiplexed connection from its socket's table and the timer wheel, and free it.
+ *
+ * @param wheel The timer wheel
+ * @param stream The socket carrying the connection
+ * @param conn The connection
+ */
+static void mux_release(mytcp_wheel_t *wheel, struct mux_stream *stream, struct mux_conn *conn)
+{
+    mytcp_wheel_cancel(wheel, &conn->timer);
+    mytcp_table_remove(&stream->conns, &conn->tuple);
+    free(conn);
+}
 
-    printf("awaiting connection acknowledgment ... ");
+/**
+ * Create the connection a port pair's first segment starts, and store it in its socket's table.
+ *
+ * @param w The worker
+ * @param stream The socket the segment arrived on
+ * @param tuple The segment's tuple
+ * @param seg The segment
+ * @return The connection, or NULL if out of memory
+ */
+static struct mux_conn *mux_open(struct serve_worker *w, struct mux_stream *stream, const mytcp_tuple_t *tuple,
+                                 const mytcp_t *seg)
+{
+    struct mux_conn *conn = malloc(sizeof(*conn));
+    if (conn == NULL) return NULL;
+
+    // answer from the ports the client sent from and to
+    conn->tuple = *tuple;
+    conn->stream = stream;
+    conn->stamp = 0;
+    mytcp_timer_init(&conn->timer);
+    if (w->mode == SERVE_ANY)
+        mytcp_conn_accept(&conn->conn, seg->destport, seg->srcport, seg);
+    else
+        mytcp_conn_init(&conn->conn, seg->destport, seg->srcport,
+                        w->mode == SERVE_OPEN ? STATE_LISTEN : STATE_ESTABLISHED);
+    if (mytcp_table_insert(&stream->conns, tuple, conn) != 0)
+    {
+        free(conn);
+        return NULL;
+    }
+    METRIC_INC(w->stats.accepted);
+    return conn;
+}
 
-    // attempt to receive connection ack
-    bzero(&segment, sizeof(segment));
-    if ((rw_result = read(client_fd, &segment, sizeof(segment))) != sizeof(segment) || errno != 0)
-        return handle_bad_rw_result(rw_result, "receive ack");
+/**
+ * Feed one segment to the connection its port pair belongs to, creating the connection if this is its first segment,
+ * and queue the response(s). A connection is dropped once its handshake is done or fails, so the client may reuse
+ * its ports for the next one; the socket stays open either way. A fresh connection request the connection rejects
+ * means the client gave up on it and reused its ports, so it is counted as failed and replaced by a new one.
+ *
+ * @param w The worker
+ * @param stream The socket the segment arrived on
+ * @param seg The segment
+ * @param tick The current timer wheel tick
+ * @return 0 on success, -1 if out of memory
+ */
+static int mux_segment(struct serve_worker *w, struct mux_stream *stream, const mytcp_t *seg, uint64_t tick)
+{
+    mytcp_tuple_t tuple = mux_tuple(stream, seg);
+    struct mux_conn *conn = mytcp_table_find(&stream->conns, &tuple);
+    if (conn == NULL && (conn = mux_open(w, stream, &tuple, seg)) == NULL) return -1;
+
+    mytcp_t out[2];
+    int nout;
+    mytcp_conn_error_t err = mytcp_conn_input(&conn->conn, seg, out, &nout);
+    if (err != CONN_OK && err != CONN_ERR_DUPLICATE && w->mode != SERVE_CLOSE && conn->conn.state != STATE_LISTEN
+        && mytcp_check_flag(seg, FLAG_SYN) && !mytcp_check_flag(seg, FLAG_ACK))
+    {
+        fprintf(stderr, "client fd %d port %d: new connection request replaces one in %s\n", stream->fd,
+                seg->srcport, STATE_NAMES[conn->conn.state]);
+        METRIC_INC(w->stats.failed);
+        mux_release(&w->wheel, stream, conn);
+        if ((conn = mux_open(w, stream, &tuple, seg)) == NULL) return -1;
+        err = mytcp_conn_input(&conn->conn, seg, out, &nout);
+    }
+    if (err != CONN_OK)
+    {
+        fprintf(stderr, "client fd %d port %d: %s\n", stream->fd, seg->srcport, CONN_ERROR_NAMES[err]);
+        mytcp_metrics_rejected(&w->metrics, err);
+        METRIC_INC(w->stats.failed);
+        mux_release(&w->wheel, stream, conn);
+        return 0;
+    }
 
-    // verify checksum
-    if (!mytcp_verify_checksum(segment)) return abort_with_message("incoming ack: invalid checksum");
+    uint64_t now = mytcp_metrics_now();
+    mytcp_metrics_received(&w->metrics, &conn->stamp, mytcp_conn_kind(&conn->conn, seg), now);
+    if (conn->conn.state == STATE_CLOSE_WAIT) mytcp_conn_close(&conn->conn, &out[nout++]);
+    serve_log(&conn->conn, stream->local_addr, stream->peer_addr, seg, out, (size_t) nout);
 
-    // check values
-    if (segment.sequence != client_seq + 1) return abort_with_message("incoming ack: sequence != initial_seq + 1");
-    if (segment.acknowledgment != server_seq + 1) return abort_with_message("incoming ack: ack != server_seq + 1");
-    if (!mytcp_check_flag(segment, FLAG_ACK)) return abort_with_message("incoming ack: ACK flag not set");
+    // responses are timed as sent once queued: the connection may be gone by the time the socket takes them
+    for (int i = 0; i < nout; i++)
+        mytcp_metrics_sent(&w->metrics, &conn->stamp, mytcp_conn_kind(&conn->conn, &out[i]), now);
+    if (mux_queue(stream, out, (size_t) nout) != 0) return -1;
 
-    printf("OK\n\nall good: we are now connected.\n");
+    if (mytcp_conn_done(&conn->conn))
+    {
+        METRIC_INC(w->stats.completed);
+        mux_release(&w->wheel, stream, conn);
+    }
+    else
+        mytcp_wheel_arm(&w->wheel, &conn->timer, tick + mytcp_conn_rto(&conn->conn));
+    return 0;
+}
 
-    mytcp_print_segment(outfile, segment, "incoming connection acknowledgment");
+/**
+ * Stop or resume reading a client socket. Resuming re-arms it, so segments left unread are reported again.
+ *
+ * @param epfd The epoll instance watching the socket
+ * @param stream The socket
+ * @param paused True to stop reading it
+ * @return 0 on success, -1 on failure (errno is set)
+ */
+static int mux_pause(int epfd, struct mux_stream *stream, bool paused)
+{
+    struct epoll_event ev = { .events = EPOLLOUT | EPOLLET | EPOLLRDHUP, .data.ptr = stream };
+    if (!paused) ev.events |= EPOLLIN;
+    if (epoll_ctl(epfd, EPOLL_CTL_MOD, stream->fd, &ev) == -1) return -1;
 
+    stream->paused = paused;
     return 0;
 }
 
-int mock_close(int client_fd, FILE *outfile)
+/**
+ * Read every complete segment available on a client socket and hand each to its connection. Reading stops once
+ * MUX_MAX_BACKLOG responses wait for the client to take them, so a client that never reads its responses
+ * cannot make the server queue them without bound.
+ *
+ * @param epfd The epoll instance watching the socket
+ * @param w The worker
+ * @param stream The readable socket
+ * @return 1 if the socket is still open, 0 if the client closed it, -1 on failure
+ */
+static int mux_readable(int epfd, struct serve_worker *w, struct mux_stream *stream)
+{
+    uint64_t tick = mytcp_wheel_clock();
+
+    for (;;)
+    {
+        if (stream->out_len >= MUX_MAX_BACKLOG) return mux_pause(epfd, stream, true) == 0 ? 1 : -1;
+
+        ssize_t got = read(stream->fd, stream->in + stream->in_len, sizeof(stream->in) - stream->in_len);
+
+        // a client that ran one handshake per socket resets it rather than closing it
+        if (got == 0 || (got == -1 && errno == ECONNRESET)) return 0;
+        if (got == -1)
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 1 : -1;
+
+        stream->in_len += (size_t) got;
+        size_t whole = stream->in_len / sizeof(mytcp_t) * sizeof(mytcp_t);
+        for (size_t off = 0; off < whole; off += sizeof(mytcp_t))
+            if (mux_segment(w, stream, (const mytcp_t *) (stream->in + off), tick) != 0) return -1;
+
+        stream->in_len -= whole;
+        memmove(stream->in, stream->in + whole, stream->in_len);
+    }
+}
+
+// mytcp_table_foreach() callback dropping the connections left on a client socket when it closes
+static void mux_drop(void *conn, void *arg)
+{
+    struct serve_worker *w = arg;
+    struct mux_conn *c = conn;
+
+    mytcp_wheel_cancel(&w->wheel, &c->timer);
+    free(c);
+}
+
+/**
+ * Close a client socket and remove it from the worker's open sockets. The handshakes still in progress on it are
+ * counted as failed, or as left half-open if serve mode is stopping.
+ *
+ * @param epfd The epoll instance watching the socket
+ * @param w The worker
+ * @param stream The socket
+ * @param stopping True if serve mode is stopping
+ */
+static void mux_close(int epfd, struct serve_worker *w, struct mux_stream *stream, bool stopping)
+{
+    if (stopping)
+        METRIC_ADD(w->stats.half_open, mytcp_table_size(&stream->conns));
+    else
+        METRIC_ADD(w->stats.failed, mytcp_table_size(&stream->conns));
+    mytcp_table_foreach(&stream->conns, mux_drop, w);
+    mytcp_table_free(&stream->conns);
+
+    if (stream->prev != NULL)
+        stream->prev->next = stream->next;
+    else
+        w->streams = stream->next;
+    if (stream->next != NULL) stream->next->prev = stream->prev;
+    epoll_ctl(epfd, EPOLL_CTL_DEL, stream->fd, NULL);
+    close(stream->fd);
+    free(stream->out);
+    free(stream);
+}
+
+/**
+ * Register a newly accepted client that multiplexes its connections over its socket. Nothing is counted as accepted
+ * until its connections' first segments arrive.
+ *
+ * @param epfd The epoll instance
+ * @param w The worker
+ * @param fd The client socket
+ * @param peer_addr The client's IPv4 address (network byte order)
+ * @return 0 on success, -1 on failure (errno is set)
+ */
+static int mux_accept(int epfd, struct serve_worker *w, int fd, uint32_t peer_addr)
+{
+    struct mux_stream *stream = calloc(1, sizeof(*stream));
+    if (stream == NULL) return -1;
+
+    int err = mytcp_table_init(&stream->conns, TABLE_MIN_SLOTS);
+    if (err != 0)
+    {
+        free(stream);
+        errno = err;
+        return -1;
+    }
+
+    // the client's many handshakes answer each other's responses, so never hold one back for a fuller segment
+    int one = 1;
+    stream->fd = fd;
+    stream->local_addr = local_address(fd);
+    stream->peer_addr = peer_addr;
+    struct epoll_event ev = { .events = EPOLLIN | EPOLLOUT | EPOLLET | EPOLLRDHUP, .data.ptr = stream };
+    if (set_nonblocking(fd) == -1 || setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) == -1
+        || epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == -1)
+    {
+        mytcp_table_free(&stream->conns);
+        free(stream);
+        return -1;
+    }
+
+    stream->next = w->streams;
+    if (w->streams != NULL) w->streams->prev = stream;
+    w->streams = stream;
+    return 0;
+}
+
+/**
+ * Handle one epoll event on a client socket multiplexing connections: handle what it received, then write all the
+ * responses produced at once. A socket that stopped being read resumes once all its responses are written. The
+ * socket is closed when the client closes it or on an error.
+ *
+ * @param epfd The epoll instance
+ * @param w The worker
+ * @param stream The socket
+ * @param events The epoll events reported
+ */
+static void mux_event(int epfd, struct serve_worker *w, struct mux_stream *stream, uint32_t events)
+{
+    int status = 1;
+    if (!stream->paused && (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)))
+        status = mux_readable(epfd, w, stream);
+    if (status == 1 && stream->out_len != 0 && mux_flush(stream) != 0) status = -1;
+    if (status == 1 && stream->paused && stream->out_len == 0 && mux_pause(epfd, stream, false) != 0) status = -1;
+
+    if (status == -1) fprintf(stderr, "client fd %d: %s\n", stream->fd, strerror(errno));
+    if (status != 1) mux_close(epfd, w, stream, false);
+}
+
+/**
+ * Timer callback for a connection multiplexed over a client socket: like serve_expired(), the client has been
+ * silent, so back off, or drop the connection (but not the socket) once the retries are used up.
+ *
+ * @param timer The connection's timer
+ * @param arg The worker, its epoll instance and the current tick (struct serve_timeout)
+ */
+static void mux_expired(mytcp_timer_t *timer, void *arg)
+{
+    struct serve_timeout *ctx = arg;
+    struct mux_conn *conn = TIMER_OWNER(timer, struct mux_conn, timer);
+
+    mytcp_t unused[2];
+    if (mytcp_conn_timeout(&conn->conn, unused) != -1)
+    {
+        mytcp_wheel_arm(&ctx->w->wheel, timer, ctx->now + mytcp_conn_rto(&conn->conn));
+        return;
+    }
+
+    fprintf(stderr, "client port %d: timed out\n", conn->conn.header.destport);
+    METRIC_INC(ctx->w->stats.failed);
+    METRIC_INC(ctx->w->stats.timed_out);
+    mux_release(&ctx->w->wheel, conn->stream, conn);
+}
+
+/**
+ * Accept every pending client on the listening socket and register it with epoll.
+ *
+ * @param epfd The epoll instance
+ * @param w The worker, owning the non-blocking listening socket
+ */
+static void serve_accept(int epfd, struct serve_worker *w)
+{
+    for (;;)
+    {
+        struct sockaddr_in client_addr;
+        socklen_t client_len = sizeof(client_addr);
+        int clientfd = accept(w->sockfd, (struct sockaddr *) &client_addr, &client_len);
+        if (clientfd == -1)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ECONNABORTED && errno != EINTR)
+                write_errno(errno, "accept");
+            return;
+        }
+
+        if (w->mux)
+        {
+            if (mux_accept(epfd, w, clientfd, client_addr.sin_addr.s_addr) == -1)
+            {
+                write_errno(errno, "accept setup");
+                close(clientfd);
+            }
+            continue;
+        }
+
+        struct serve_conn *conn = calloc(1, sizeof(*conn));
+        if (conn == NULL || set_nonblocking(clientfd) == -1)
+        {
+            write_errno(errno, "accept setup");
+            free(conn);
+            close(clientfd);
+            continue;
+        }
+
+        serve_conn_init(conn, clientfd, client_addr.sin_addr.s_addr, w->mode);
+
+        struct epoll_event ev = { .events = EPOLLIN | EPOLLOUT | EPOLLET | EPOLLRDHUP, .data.ptr = conn };
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, clientfd, &ev) == -1)
+        {
+            write_errno(errno, "epoll_ctl");
+            free(conn);
+            close(clientfd);
+            continue;
+        }
+
+        serve_track(w, conn);
+        mytcp_wheel_arm(&w->wheel, &conn->timer, mytcp_wheel_clock() + mytcp_conn_rto(&conn->conn));
+        METRIC_INC(w->stats.accepted);
+    }
+}
+
+/**
+ * Timer callback for a client served over a stream: it has been silent for a retransmission timeout, so back off,
+ * or drop it once the retries are used up.
+ *
+ * @param timer The client's timer
+ * @param arg The worker, its epoll instance and the current tick (struct serve_timeout)
+ */
+static void serve_expired(mytcp_timer_t *timer, void *arg)
+{
+    struct serve_timeout *ctx = arg;
+    struct serve_conn *conn = TIMER_OWNER(timer, struct serve_conn, timer);
+
+    mytcp_t unused[2];
+    if (mytcp_conn_timeout(&conn->conn, unused) != -1)
+    {
+        mytcp_wheel_arm(&ctx->w->wheel, timer, ctx->now + mytcp_conn_rto(&conn->conn));
+        return;
+    }
+
+    fprintf(stderr, "client fd %d: timed out\n", conn->fd);
+    METRIC_INC(ctx->w->stats.failed);
+    METRIC_INC(ctx->w->stats.timed_out);
+    serve_release(ctx->epfd, ctx->w, conn);
+}
+
+/**
+ * Route SIGINT/SIGTERM, and SIGUSR1 which dumps the metrics, to sigwait() in the main thread by blocking them
+ * (workers inherit the mask), and keep a client resetting its socket from killing the server.
+ *
+ * @param signals Set to the signals the main thread waits for
+ */
+static void serve_install_signals(sigset_t *signals)
+{
+    sigemptyset(signals);
+    sigaddset(signals, SIGINT);
+    sigaddset(signals, SIGTERM);
+    sigaddset(signals, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, signals, NULL);
+
+    signal(SIGPIPE, SIG_IGN);
+}
+
+/**
+ * Add up the workers' counters. The workers may still be counting.
+ *
+ * @param workers The workers
+ * @param nworkers The number of workers
+ * @param total Set to the totals
+ */
+static void serve_totals(const struct serve_worker *workers, int nworkers, struct serve_stats *total)
+{
+    bzero(total, sizeof(*total));
+    for (int i = 0; i < nworkers; i++)
+    {
+        const struct serve_stats *stats = &workers[i].stats;
+        total->accepted += METRIC_READ(stats->accepted);
+        total->completed += METRIC_READ(stats->completed);
+        total->failed += METRIC_READ(stats->failed);
+        total->half_open += METRIC_READ(stats->half_open);
+        total->cookies_sent += METRIC_READ(stats->cookies_sent);
+        total->cookies_rejected += METRIC_READ(stats->cookies_rejected);
+        total->retransmitted += METRIC_READ(stats->retransmitted);
+        total->timed_out += METRIC_READ(stats->timed_out);
+    }
+}
+
+/**
+ * Write one counter or gauge without labels, header included.
+ *
+ * @param f The file to write to
+ * @param name The metric's name
+ * @param type counter or gauge
+ * @param help What the metric counts
+ * @param value Its value
+ */
+static void serve_metric(FILE *f, const char *name, const char *type, const char *help, uint64_t value)
+{
+    mytcp_metrics_family(f, name, type, help);
+    mytcp_metrics_value(f, name, NULL, NULL, value);
+}
+
+/**
+ * Write the serve mode metrics, summed over the running workers, in Prometheus text format.
+ *
+ * @param f The file to write to
+ * @param arg The workers (struct serve_export)
+ */
+static void serve_metrics(FILE *f, void *arg)
+{
+    const struct serve_export *export = arg;
+
+    struct serve_stats total;
+    serve_totals(export->workers, export->nworkers, &total);
+    mytcp_metrics_t *merged = malloc(sizeof(*merged));
+    if (merged == NULL) return;
+    mytcp_metrics_init(merged);
+    for (int i = 0; i < export->nworkers; i++) mytcp_metrics_merge(merged, &export->workers[i].metrics);
+
+    uint64_t done = total.completed + total.failed;
+    serve_metric(f, "mytcp_server_clients_accepted_total", "counter", "Clients accepted", total.accepted);
+    serve_metric(f, "mytcp_server_handshakes_completed_total", "counter", "Handshakes completed", total.completed);
+    serve_metric(f, "mytcp_server_handshakes_failed_total", "counter", "Handshakes failed, including timeouts",
+                 total.failed);
+    serve_metric(f, "mytcp_server_handshakes_timed_out_total", "counter", "Handshakes failed because the client "
+                 "stopped answering", total.timed_out);
+    serve_metric(f, "mytcp_server_handshakes_in_progress", "gauge", "Handshakes started but not yet done",
+                 total.accepted > done ? total.accepted - done : 0);
+    serve_metric(f, "mytcp_server_segments_retransmitted_total", "counter", "Segments sent again (UDP)",
+                 total.retransmitted);
+    if (export->workers[0].cookies)
+    {
+        mytcp_metrics_family(f, "mytcp_server_syn_cookies_total", "counter", "SYN cookies sent, and acknowledgments "
+                             "rejected for a bad cookie");
+        mytcp_metrics_value(f, "mytcp_server_syn_cookies_total", "result", "sent", total.cookies_sent);
+        mytcp_metrics_value(f, "mytcp_server_syn_cookies_total", "result", "rejected", total.cookies_rejected);
+    }
+    mytcp_metrics_write(f, "mytcp_server", merged);
+    free(merged);
+}
+
+/**
+ * Print the serve mode summary: handshake counts and the overall handshake rate, then the same per worker if there
+ * are several.
+ *
+ * @param workers The stopped workers
+ * @param nworkers The number of workers
+ * @param started When serving started (CLOCK_MONOTONIC)
+ */
+static void serve_report(const struct serve_worker *workers, int nworkers, const struct timespec *started)
+{
+    struct timespec stopped;
+    clock_gettime(CLOCK_MONOTONIC, &stopped);
+    double elapsed = (double) (stopped.tv_sec - started->tv_sec) + (stopped.tv_nsec - started->tv_nsec) / 1e9;
+
+    struct serve_stats total;
+    serve_totals(workers, nworkers, &total);
+
+    printf("\nserved %llu clients: %llu handshakes completed, %llu failed in %.3f s (%.1f handshakes/s)\n",
+           (unsigned long long) total.accepted, (unsigned long long) total.completed,
+           (unsigned long long) total.failed, elapsed, elapsed > 0 ? total.completed / elapsed : 0.0);
+    if (total.half_open != 0) printf("%llu handshakes left half-open\n", (unsigned long long) total.half_open);
+    if (total.retransmitted != 0 || total.timed_out != 0)
+        printf("%llu segments retransmitted, %llu handshakes timed out\n", (unsigned long long) total.retransmitted,
+               (unsigned long long) total.timed_out);
+    if (workers[0].cookies)
+        printf("SYN cookies: %llu sent, %llu rejected\n", (unsigned long long) total.cookies_sent,
+               (unsigned long long) total.cookies_rejected);
+
+    if (nworkers == 1) return;
+    for (int i = 0; i < nworkers; i++)
+    {
+        const struct serve_stats *stats = &workers[i].stats;
+        printf("    worker %d", i);
+        if (workers[i].cpu != -1) printf(" (cpu %d)", workers[i].cpu);
+        printf(": %llu clients, %llu completed, %llu failed (%.1f handshakes/s)\n",
+               (unsigned long long) stats->accepted, (unsigned long long) stats->completed,
+               (unsigned long long) stats->failed, elapsed > 0 ? stats->completed / elapsed : 0.0);
+    }
+}
+
+/**
+ * Worker thread entry point: serve on the worker's own socket until serve mode stops.
+ *
+ * @param arg The worker
+ * @return NULL
+ */
+static void *serve_worker_main(void *arg)
+{
+    struct serve_worker *w = arg;
+    if (w->udp)
+        serve_datagrams(w);
+    else if (!w->uring || serve_uring(w) == -1)
+        serve_forever(w);
+    return NULL;
+}
+
+/**
+ * Run serve mode with one or more workers until SIGINT/SIGTERM. Each worker gets its own listening socket; with more
+ * than one, the sockets share the port through SO_REUSEPORT and the kernel spreads clients across them, so workers
+ * never share connections, locks or counters. Workers can be pinned to distinct CPUs.
+ *
+ * @param addr The address the first socket is bound to
+ * @param sockfd The first, already bound (and listening) socket
+ * @param udp True if the sockets are UDP sockets
+ * @param uring True to serve TCP with the io_uring engine (falling back to epoll if it is unavailable)
+ * @param cookies True to answer UDP connection requests with SYN cookies
+ * @param mux True to demultiplex many connections per TCP client by their port pairs
+ * @param mode The handshake to run with each client
+ * @param nworkers The number of workers
+ * @param pin True to pin each worker to its own CPU
+ * @param metrics_port Local port to serve metrics on while serving, 0 for none
+ * @return 0 on clean shutdown, else a non-zero error code
+ */
+int serve_run(const struct sockaddr_in *addr, int sockfd, bool udp, bool uring, bool cookies, bool mux,
+              enum serve_mode mode, int nworkers, bool pin, uint16_t metrics_port)
+{
+    sigset_t signals;
+    serve_install_signals(&signals);
+
+    int stopfd = eventfd(0, EFD_NONBLOCK);
+    if (stopfd == -1) return abort_with_errno(errno, "eventfd");
+
+    struct serve_worker *workers = aligned_alloc(64, sizeof(*workers) * (size_t) nworkers);
+    if (workers == NULL) return abort_with_errno(errno, "aligned_alloc");
+    bzero(workers, sizeof(*workers) * (size_t) nworkers);
+
+    // pin workers round-robin over the CPUs we are allowed to run on
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (pin && sched_getaffinity(0, sizeof(allowed), &allowed) != 0) pin = false;
+
+    int cpu = -1;
+    for (int i = 0; i < nworkers; i++)
+    {
+        struct serve_worker *w = &workers[i];
+        w->sockfd = i == 0 ? sockfd : open_listener(addr, udp, SOMAXCONN, true);
+        if (w->sockfd == -1) return 1;
+        w->stopfd = stopfd;
+        w->udp = udp;
+        w->uring = uring;
+        w->cookies = cookies;
+        w->mux = mux;
+        w->mode = mode;
+        w->cpu = -1;
+        mytcp_metrics_init(&w->metrics);
+
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        if (pin)
+        {
+            do
+                cpu = (cpu + 1) % CPU_SETSIZE;
+            while (!CPU_ISSET(cpu, &allowed));
+            cpu_set_t one;
+            CPU_ZERO(&one);
+            CPU_SET(cpu, &one);
+            if (pthread_attr_setaffinity_np(&attr, sizeof(one), &one) == 0) w->cpu = cpu;
+        }
+
+        int err = pthread_create(&w->thread, &attr, serve_worker_main, w);
+        pthread_attr_destroy(&attr);
+        if (err != 0) return abort_with_errno(err, "pthread_create");
+    }
+
+    struct timespec started;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    printf("serving %s handshakes over %s with %d %sworker%s; press ^C to stop\n", SERVE_MODE_NAMES[mode],
+           udp ? "UDP" : mux ? "multiplexed TCP" : "TCP", nworkers, uring ? "io_uring " : "", nworkers == 1 ? "" : "s");
+
+    struct serve_export export = { .workers = workers, .nworkers = nworkers };
+    mytcp_exporter_t exporter;
+    if (metrics_port != 0)
+    {
+        int err = mytcp_exporter_start(&exporter, metrics_port, serve_metrics, &export);
+        if (err != 0)
+        {
+            write_errno(err, "metrics exporter");
+            metrics_port = 0;
+        }
+        else
+            printf("serving metrics on http://127.0.0.1:%d/metrics\n", metrics_port);
+    }
+
+    // dump the metrics on SIGUSR1 until a stop signal, then wake every worker at once
+    int sig;
+    while (sigwait(&signals, &sig) == 0 && sig == SIGUSR1)
+    {
+        serve_metrics(stdout, &export);
+        fflush(stdout);
+    }
+    uint64_t one = 1;
+    if (write(stopfd, &one, sizeof(one)) != sizeof(one)) write_errno(errno, "eventfd");
+
+    for (int i = 0; i < nworkers; i++)
+    {
+        pthread_join(workers[i].thread, NULL);
+        close(workers[i].sockfd);
+    }
+
+    if (metrics_port != 0) mytcp_exporter_stop(&exporter);
+    serve_report(workers, nworkers, &started);
+    free(workers);
+    close(stopfd);
+    return 0;
+}
+
+/**
+ * Serve handshakes for any number of clients until serve mode stops (the worker's stop eventfd becomes readable).
+ * The listening socket and all client sockets are non-blocking and multiplexed on a single epoll instance, which
+ * also sleeps until the next client timer; clients that stay silent are dropped (see serve_expired()). With mux set,
+ * a client socket carries any number of connections instead, told apart by their port pairs (see mux_segment()).
+ * Segments are not printed in this mode.
+ *
+ * @param w The worker, owning a bound, listening TCP socket
+ * @return 0 on clean shutdown, else a non-zero error code
+ */
+int serve_forever(struct serve_worker *w)
 {
-    printf("simulating closing a TCP connection\n\n");
     errno = 0;
 
-    mytcp_t segment;
-    bzero(&segment, sizeof(segment));
+    if (set_nonblocking(w->sockfd) == -1) return abort_with_errno(errno, "fcntl");
+
+    int epfd = epoll_create1(0);
+    if (epfd == -1) return abort_with_errno(errno, "epoll_create1");
+
+    // the listening socket is identified by a NULL data pointer, the stop eventfd by the worker itself
+    struct epoll_event listen_ev = { .events = EPOLLIN, .data.ptr = NULL };
+    struct epoll_event stop_ev = { .events = EPOLLIN, .data.ptr = w };
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, w->sockfd, &listen_ev) == -1
+        || epoll_ctl(epfd, EPOLL_CTL_ADD, w->stopfd, &stop_ev) == -1)
+        return abort_with_errno(errno, "epoll_ctl");
+
+    mytcp_wheel_init(&w->wheel, mytcp_wheel_clock());
+    struct serve_timeout timeout = { .w = w, .epfd = epfd };
+
+    struct epoll_event events[SERVE_MAX_EVENTS];
+    for (bool serving = true; serving;)
+    {
+        // sleep until the next client may time out
+        int sleep_ms = mytcp_wheel_timeout(&w->wheel, mytcp_wheel_clock(), -1);
+        int n = epoll_wait(epfd, events, SERVE_MAX_EVENTS, sleep_ms);
+        if (n == -1)
+        {
+            if (errno == EINTR) continue;
+            close(epfd);
+            return abort_with_errno(errno, "epoll_wait");
+        }
+
+        for (int i = 0; i < n; i++)
+        {
+            struct serve_conn *conn = events[i].data.ptr;
+            if (conn == NULL)
+            {
+                serve_accept(epfd, w);
+                continue;
+            }
+            if (events[i].data.ptr == w)
+            {
+                serving = false;
+                continue;
+            }
+            if (w->mux)
+            {
+                mux_event(epfd, w, events[i].data.ptr, events[i].events);
+                continue;
+            }
+
+            int status = 1;
+            if (events[i].events & EPOLLOUT)
+                status = serve_flush(&w->metrics, conn) == 0 ? 1 : -1;
+            if (status == 1 && events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+                status = serve_readable(&w->metrics, conn);
+
+            // keep the connection around until its final responses are written
+            if (status == -1)
+            {
+                METRIC_INC(w->stats.failed);
+                serve_release(epfd, w, conn);
+            }
+            else if (mytcp_conn_done(&conn->conn) && conn->out_len == 0)
+            {
+                METRIC_INC(w->stats.completed);
+                serve_release(epfd, w, conn);
+            }
+            else if (events[i].events & EPOLLIN)
+                mytcp_wheel_arm(&w->wheel, &conn->timer, mytcp_wheel_clock() + mytcp_conn_rto(&conn->conn));
+        }
+
+        // only once the events are handled, so none of them refers to a connection released here
+        timeout.now = mytcp_wheel_clock();
+        mytcp_wheel_advance(&w->wheel, timeout.now, w->mux ? mux_expired : serve_expired, &timeout);
+    }
+
+    // release the clients still in flight
+    while (w->live != NULL)
+    {
+        METRIC_INC(w->stats.half_open);
+        serve_release(epfd, w, w->live);
+    }
+    while (w->streams != NULL)
+        mux_close(epfd, w, w->streams, true);
+
+    close(epfd);
+    return 0;
+}
+
+
+/* IO_URING SERVE MODE */
+
+#ifdef MYTCP_HAVE_URING
+
+// per-worker io_uring sizes: queue entries, and provided receive buffers (count must be a power of two)
+#define URING_ENTRIES 4096
+#define URING_BUFS 4096
+#define URING_BUF_SIZE 256
+#define URING_BUF_GROUP 0
+
+// what a completion belongs to, kept in the low bits of its user_data; the other bits point to the connection
+enum uring_op
+{
+    URING_ACCEPT = 1,
+    URING_STOP,
+    URING_RECV,
+    URING_SEND,
+    URING_TICK,             // the timeout that wakes the loop for the next client timer
+    URING_RETICK            // moves that timeout earlier; its own completion tells nothing
+};
+
+#define URING_OP_MASK 7u
+
+// a client served through io_uring; freed once it is finished and no request refers to it any more
+struct uring_conn
+{
+    struct serve_conn base;
+    int inflight;           // requests in flight that refer to this connection
+    bool recv_armed;
+    bool sending;
+    bool finished;
+};
+
+/**
+ * Queue a multishot accept on the listening socket: one request keeps producing a completion per new client.
+ *
+ * @param ring The worker's ring
+ * @param sockfd The listening socket
+ * @return True if the request was queued
+ */
+static bool uring_arm_accept(mytcp_uring_t *ring, int sockfd)
+{
+    struct io_uring_sqe *sqe = mytcp_uring_get_sqe(ring);
+    if (sqe == NULL) return false;
+
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = sockfd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = URING_ACCEPT;
+    return true;
+}
+
+/**
+ * Queue a multishot receive on a client: each completion carries one provided buffer filled with whatever arrived.
+ *
+ * @param ring The worker's ring
+ * @param c The client
+ * @return True if the request was queued
+ */
+static bool uring_arm_recv(mytcp_uring_t *ring, struct uring_conn *c)
+{
+    struct io_uring_sqe *sqe = mytcp_uring_get_sqe(ring);
+    if (sqe == NULL) return false;
+
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = c->base.fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUF_GROUP;
+    sqe->user_data = (uint64_t) (uintptr_t) c | URING_RECV;
+    c->inflight++;
+    c->recv_armed = true;
+    return true;
+}
+
+/**
+ * Queue a send of a client's unsent responses. It is submitted together with everything else queued in this
+ * iteration of the event loop.
+ *
+ * @param ring The worker's ring
+ * @param c The client
+ * @return True if the request was queued
+ */
+static bool uring_send(mytcp_uring_t *ring, struct uring_conn *c)
+{
+    struct io_uring_sqe *sqe = mytcp_uring_get_sqe(ring);
+    if (sqe == NULL) return false;
+
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = c->base.fd;
+    sqe->addr = (uint64_t) (uintptr_t) ((char *) c->base.out + c->base.out_sent);
+    sqe->len = (uint32_t) (c->base.out_len * sizeof(mytcp_t) - c->base.out_sent);
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = (uint64_t) (uintptr_t) c | URING_SEND;
+    c->inflight++;
+    c->sending = true;
+    return true;
+}
+
+/**
+ * Count a client's handshake as completed or failed and shut its socket down, which ends its multishot receive.
+ * The client is freed by uring_release() once that receive has completed.
+ *
+ * @param w The worker
+ * @param c The client
+ * @param completed True if the handshake completed, false if it failed
+ */
+static void uring_finish(struct serve_worker *w, struct uring_conn *c, bool completed)
+{
+    if (c->finished) return;
+    c->finished = true;
+    mytcp_wheel_cancel(&w->wheel, &c->base.timer);
+
+    if (completed)
+        METRIC_INC(w->stats.completed);
+    else
+        METRIC_INC(w->stats.failed);
+    shutdown(c->base.fd, SHUT_RDWR);
+}
+
+/**
+ * Close and free a finished client once no request refers to it.
+ *
+ * @param w The worker
+ * @param c The client
+ */
+static void uring_release(struct serve_worker *w, struct uring_conn *c)
+{
+    if (!c->finished || c->inflight > 0) return;
+    serve_untrack(w, &c->base);
+    close(c->base.fd);
+    free(c);
+}
+
+/**
+ * Start serving a client accepted by the multishot accept.
+ *
+ * @param ring The worker's ring
+ * @param w The worker
+ * @param fd The client socket
+ */
+static void uring_accepted(mytcp_uring_t *ring, struct serve_worker *w, int fd)
+{
+    struct uring_conn *c = calloc(1, sizeof(*c));
+    if (c == NULL)
+    {
+        write_errno(errno, "accept setup");
+        close(fd);
+        return;
+    }
+
+    // the client's address is only needed for the segment log
+    struct sockaddr_in client_addr;
+    socklen_t client_len = sizeof(client_addr);
+    bzero(&client_addr, sizeof(client_addr));
+    getpeername(fd, (struct sockaddr *) &client_addr, &client_len);
+
+    serve_conn_init(&c->base, fd, client_addr.sin_addr.s_addr, w->mode);
+    serve_track(w, &c->base);
+    METRIC_INC(w->stats.accepted);
+    mytcp_wheel_arm(&w->wheel, &c->base.timer, mytcp_wheel_clock() + mytcp_conn_rto(&c->base.conn));
+
+    if (!uring_arm_recv(ring, c))
+    {
+        uring_finish(w, c, false);
+        uring_release(w, c);
+    }
+}
+
+/**
+ * Feed received bytes to a client, handling every segment they complete.
+ *
+ * @param metrics The worker's metrics
+ * @param conn The client
+ * @param data The received bytes
+ * @param len The number of bytes
+ * @return NULL if every complete segment was accepted, else a message describing the protocol violation
+ */
+static const char *uring_feed(mytcp_metrics_t *metrics, struct serve_conn *conn, const char *data, size_t len)
+{
+    while (len > 0)
+    {
+        size_t take = sizeof(mytcp_t) - conn->in_len;
+        if (take > len) take = len;
+        memcpy((char *) &conn->in + conn->in_len, data, take);
+        conn->in_len += take;
+        data += take;
+        len -= take;
+
+        if (conn->in_len < sizeof(mytcp_t)) break;
+        conn->in_len = 0;
+
+        const char *violation = serve_handle_segment(metrics, conn);
+        if (violation != NULL) return violation;
+    }
+
+    return NULL;
+}
+
+/**
+ * Handle a receive completion: feed the data, hand the buffer back, and send any responses.
+ *
+ * @param ring The worker's ring
+ * @param bufs The worker's provided buffers
+ * @param w The worker
+ * @param c The client
+ * @param res The completion result: bytes received, 0 at end of stream, or a negated errno value
+ * @param flags The completion flags (buffer ID, more completions to come)
+ */
+static void uring_received(mytcp_uring_t *ring, mytcp_uring_bufs_t *bufs, struct serve_worker *w,
+                           struct uring_conn *c, int res, uint32_t flags)
+{
+    if (!(flags & IORING_CQE_F_MORE))
+    {
+        c->recv_armed = false;
+        c->inflight--;
+    }
+
+    if (res > 0)
+    {
+        uint16_t bid = (uint16_t) (flags >> IORING_CQE_BUFFER_SHIFT);
+        const char *data = mytcp_uring_buf(bufs, bid);
+        const char *violation = c->finished ? NULL : uring_feed(&w->metrics, &c->base, data, (size_t) res);
+        mytcp_uring_bufs_recycle(bufs, bid);
+
+        if (!c->finished)
+            mytcp_wheel_arm(&w->wheel, &c->base.timer, mytcp_wheel_clock() + mytcp_conn_rto(&c->base.conn));
+
+        if (violation != NULL)
+        {
+            fprintf(stderr, "client fd %d: %s\n", c->base.fd, violation);
+            uring_finish(w, c, false);
+        }
+        else if (!c->finished && !c->sending && c->base.out_len > 0)
+        {
+            if (!uring_send(ring, c)) uring_finish(w, c, false);
+        }
+        else if (!c->finished && !c->sending && mytcp_conn_done(&c->base.conn))
+            uring_finish(w, c, true);
+    }
+    else if (res != -ENOBUFS && !c->finished)
+        uring_finish(w, c, false);
+
+    // the receive stops early when the buffers run out; they are handed back before this is submitted
+    if (!c->finished && !c->recv_armed && !uring_arm_recv(ring, c))
+        uring_finish(w, c, false);
+
+    uring_release(w, c);
+}
+
+/**
+ * Handle a send completion: send whatever is left, or finish the client if its handshake is done.
+ *
+ * @param ring The worker's ring
+ * @param w The worker
+ * @param c The client
+ * @param res The completion result: bytes sent, or a negated errno value
+ */
+static void uring_sent(mytcp_uring_t *ring, struct serve_worker *w, struct uring_conn *c, int res)
+{
+    c->inflight--;
+    c->sending = false;
+
+    if (res < 0)
+        uring_finish(w, c, false);
+    else if (!c->finished)
+    {
+        size_t before = c->base.out_sent;
+        c->base.out_sent += (size_t) res;
+        serve_sent(&w->metrics, &c->base, before);
+        if (c->base.out_sent < c->base.out_len * sizeof(mytcp_t))
+        {
+            if (!uring_send(ring, c)) uring_finish(w, c, false);
+        }
+        else
+        {
+            c->base.out_len = 0;
+            c->base.out_sent = 0;
+            if (mytcp_conn_done(&c->base.conn)) uring_finish(w, c, true);
+        }
+    }
 
-    /* RECEIVE CLOSE REQUEST */
+    uring_release(w, c);
+}
 
-    printf("awaiting close request ... ");
+/**
+ * Timer callback for a client served through io_uring: as serve_expired(), back off or drop it. Dropping it shuts its
+ * socket down, which ends its receive; it is freed once that completes.
+ *
+ * @param timer The client's timer
+ * @param arg The worker
+ */
+static void uring_expired(mytcp_timer_t *timer, void *arg)
+{
+    struct serve_worker *w = arg;
+    struct uring_conn *c = TIMER_OWNER(timer, struct uring_conn, base.timer);
 
-    ssize_t rw_result;
-    if ((rw_result = read(client_fd, &segment, sizeof(segment))) != sizeof(segment) || errno != 0)
-        return handle_bad_rw_result(rw_result, "receive close request");
+    mytcp_t unused[2];
+    if (mytcp_conn_timeout(&c->base.conn, unused) != -1)
+    {
+        mytcp_wheel_arm(&w->wheel, timer, mytcp_wheel_clock() + mytcp_conn_rto(&c->base.conn));
+        return;
+    }
 
-    // verify checksum
-    if (!mytcp_verify_checksum(segment)) return abort_with_message("incoming close req: invalid checksum");
+    fprintf(stderr, "client fd %d: timed out\n", c->base.fd);
+    METRIC_INC(w->stats.timed_out);
+    uring_finish(w, c, false);
+    uring_release(w, c);
+}
 
-    // verify values
-    uint32_t client_seq = segment.sequence;
-    if (segment.acknowledgment != 0) return abort_with_message("incoming close req: non-zero ack number");
-    if (!mytcp_check_flag(segment, FLAG_FIN)) return abort_with_message("incoming close req: FIN not set");
+/**
+ * Queue a timeout that completes when the next client timer is due, so the loop wakes up for it. While one is
+ * already pending, it is moved earlier instead if a client timer has since been armed to fire before it.
+ *
+ * @param ring The worker's ring
+ * @param w The worker
+ * @param ts Where the timeout's duration is kept until the request is submitted
+ * @param due The tick the pending timeout completes at; set when it is queued or moved
+ * @param pending True if a timeout is already pending
+ * @return True if a timeout is pending once the request is submitted
+ */
+static bool uring_arm_tick(mytcp_uring_t *ring, struct serve_worker *w, struct __kernel_timespec *ts, uint64_t *due,
+                           bool pending)
+{
+    uint64_t now = mytcp_wheel_clock();
+    int sleep_ms = mytcp_wheel_timeout(&w->wheel, now, -1);
+    if (pending && now + (uint64_t) sleep_ms >= *due) return true;
+
+    struct io_uring_sqe *sqe = mytcp_uring_get_sqe(ring);
+    if (sqe == NULL) return pending;
+
+    // the kernel copies the duration when the request is submitted, so ts may be reused for the next one
+    ts->tv_sec = sleep_ms / 1000;
+    ts->tv_nsec = (long long) (sleep_ms % 1000) * 1000000;
+    sqe->fd = -1;
+    if (pending)
+    {
+        sqe->opcode = IORING_OP_TIMEOUT_REMOVE;
+        sqe->addr = URING_TICK;
+        sqe->addr2 = (uint64_t) (uintptr_t) ts;
+        sqe->timeout_flags = IORING_TIMEOUT_UPDATE;
+        sqe->user_data = URING_RETICK;
+    }
+    else
+    {
+        sqe->opcode = IORING_OP_TIMEOUT;
+        sqe->addr = (uint64_t) (uintptr_t) ts;
+        sqe->len = 1;
+        sqe->user_data = URING_TICK;
+    }
+    *due = now + (uint64_t) sleep_ms;
+    return true;
+}
+
+/**
+ * Serve handshakes through io_uring until serve mode stops. One multishot accept produces every client; each client
+ * gets one multishot receive that picks buffers from a shared provided buffer ring; responses are queued as send
+ * requests. Everything queued while handling a batch of completions is submitted with the same io_uring_enter()
+ * call that waits for the next batch, so a burst of handshakes costs a handful of system calls instead of several
+ * per segment. While any client timer is armed, a timeout request wakes the loop for the next one (and is moved
+ * earlier when a timer is armed to fire before it); the wheel is advanced after every batch of completions.
+ *
+ * @param w The worker, owning a bound, listening TCP socket
+ * @return 0 on clean shutdown, -1 if io_uring is unavailable (nothing was served), else a non-zero error code
+ */
+int serve_uring(struct serve_worker *w)
+{
+    mytcp_uring_t ring;
+    mytcp_uring_bufs_t bufs;
+
+    int err = mytcp_uring_init(&ring, URING_ENTRIES);
+    if (err != 0)
+    {
+        write_errno(err, "io_uring unavailable, falling back to epoll");
+        return -1;
+    }
+
+    err = mytcp_uring_bufs_init(&ring, &bufs, URING_BUF_GROUP, URING_BUFS, URING_BUF_SIZE);
+    if (err != 0)
+    {
+        write_errno(err, "io_uring provided buffers unavailable, falling back to epoll");
+        mytcp_uring_free(&ring);
+        return -1;
+    }
+
+    // the stop eventfd is watched with a one-shot poll
+    struct io_uring_sqe *stop = mytcp_uring_get_sqe(&ring);
+    stop->opcode = IORING_OP_POLL_ADD;
+    stop->fd = w->stopfd;
+    stop->poll32_events = POLLIN;
+    stop->user_data = URING_STOP;
+    bool accepting = uring_arm_accept(&ring, w->sockfd);
+
+    mytcp_wheel_init(&w->wheel, mytcp_wheel_clock());
+    struct __kernel_timespec tick_ts;
+    uint64_t tick_due = 0;
+    bool ticking = false;
+
+    int result = 0;
+    for (bool serving = true; serving;)
+    {
+        if (w->wheel.armed > 0) ticking = uring_arm_tick(&ring, w, &tick_ts, &tick_due, ticking);
+        if (mytcp_uring_submit_and_wait(&ring, 1) == -1 && errno != EINTR && errno != EBUSY)
+        {
+            result = abort_with_errno(errno, "io_uring_enter");
+            break;
+        }
+
+        unsigned seen = 0;
+        struct io_uring_cqe *cqe;
+        while ((cqe = mytcp_uring_peek(&ring, seen)) != NULL)
+        {
+            seen++;
+            struct uring_conn *c = (struct uring_conn *) (uintptr_t) (cqe->user_data & ~(uint64_t) URING_OP_MASK);
+
+            switch (cqe->user_data & URING_OP_MASK)
+            {
+                case URING_STOP:
+                    serving = false;
+                    break;
+
+                case URING_ACCEPT:
+                    if (!(cqe->flags & IORING_CQE_F_MORE)) accepting = false;
+
+                    // multishot accept not supported by this kernel: nothing can be served, so let epoll take over
+                    if (cqe->res == -EINVAL)
+                    {
+                        write_errno(-cqe->res, "io_uring multishot accept unavailable, falling back to epoll");
+                        result = -1;
+                        serving = false;
+                    }
+                    else if (cqe->res >= 0)
+                        uring_accepted(&ring, w, cqe->res);
+                    else if (cqe->res != -EAGAIN && cqe->res != -ECONNABORTED && cqe->res != -EINTR)
+                        write_errno(-cqe->res, "io_uring accept");
+                    break;
+
+                case URING_RECV:
+                    uring_received(&ring, &bufs, w, c, cqe->res, cqe->flags);
+                    break;
+
+                case URING_SEND:
+                    uring_sent(&ring, w, c, cqe->res);
+                    break;
+
+                case URING_TICK:
+                    ticking = false;
+                    break;
+
+                case URING_RETICK:
+                    break;
+            }
+        }
+
+        mytcp_uring_advance(&ring, seen);
+        mytcp_wheel_advance(&w->wheel, mytcp_wheel_clock(), uring_expired, w);
+        mytcp_uring_bufs_publish(&bufs);
+        if (serving && !accepting) accepting = uring_arm_accept(&ring, w->sockfd);
+    }
 
-    printf("OK\n");
+    // closing the ring cancels every request, so the clients still in flight can be released regardless
+    mytcp_uring_bufs_free(&ring, &bufs);
+    mytcp_uring_free(&ring);
+    while (w->live != NULL)
+    {
+        struct uring_conn *c = (struct uring_conn *) w->live;     // base is its first member
+        if (!c->finished) METRIC_INC(w->stats.half_open);
+        mytcp_wheel_cancel(&w->wheel, &c->base.timer);
+        serve_untrack(w, &c->base);
+        close(c->base.fd);
+        free(c);
+    }
+    return result;
+}
 
-    mytcp_print_segment(outfile, segment, "incoming close request");
+#else
 
-    /* SEND CLOSE ACK */
+int serve_uring(struct serve_worker *w)
+{
+    (void) w;
+    fprintf(stderr, "io_uring support was not compiled in, falling back to epoll\n");
+    return -1;
+}
 
-    printf("sending close ack ... ");
+#endif //MYTCP_HAVE_URING
 
-    // create a new segment (assigns sequence number automatically)
-    segment = mytcp_create_segment(SERVER_PORT, CLIENT_PORT);
-    uint32_t server_seq = segment.sequence;
 
-    // set acknowledgment number to client_seq + 1
-    segment.acknowledgment = client_seq + 1;
-    mytcp_set_flag(&segment, FLAG_ACK);
+/* UDP SERVE MODE */
 
-    // send close ack
-    mytcp_set_checksum(&segment);
-    if ((rw_result = write(client_fd, &segment, sizeof(segment))) != sizeof(segment) || errno != 0)
-        return handle_bad_rw_result(rw_result, "send close ack");
+// a UDP client whose handshake is in progress, stored in the connection table under its 4-tuple
+struct peer_conn
+{
+    mytcp_tuple_t tuple;
+    mytcp_conn_t conn;
+    uint64_t stamp;         // when the handshake's latest event happened, for the step metrics
+    mytcp_timer_t timer;    // armed while we wait for the client to answer our latest segments
+};
+
+// a UDP worker's batch buffers for recvmmsg()/sendmmsg()
+struct dgram_buffers
+{
+    mytcp_t in[DGRAM_BATCH];
+    struct sockaddr_in in_addr[DGRAM_BATCH];
+    struct iovec in_iov[DGRAM_BATCH];
+    struct mmsghdr in_msgs[DGRAM_BATCH];
+    char in_control[DGRAM_BATCH][CMSG_SPACE(sizeof(struct in_pktinfo))];  // IP_PKTINFO: the address each came to
+
+    mytcp_t out[2 * DGRAM_BATCH];
+    struct sockaddr_in out_addr[2 * DGRAM_BATCH];
+    struct iovec out_iov[2 * DGRAM_BATCH];
+    struct mmsghdr out_msgs[2 * DGRAM_BATCH];
+
+    // what each response's step is timed from once it is sent: its connection's stamp, its own for a stateless
+    // answer, or NULL for a retransmission, which is not timed
+    uint64_t *out_stamp[2 * DGRAM_BATCH];
+    uint64_t out_since[2 * DGRAM_BATCH];
+    uint8_t out_kind[2 * DGRAM_BATCH];
+
+    // peers released while handling a batch; freed once the batch's responses, whose stamps they hold, are sent
+    struct peer_conn *released[DGRAM_BATCH];
+    int nreleased;
+};
+
+/**
+ * The 4-tuple a peer's datagrams are tracked under. Every peer talks to the same wildcard address and port, so only
+ * its own address and port tell it apart.
+ *
+ * @param addr The peer's address
+ * @return The tuple
+ */
+static mytcp_tuple_t peer_tuple(const struct sockaddr_in *addr)
+{
+    mytcp_tuple_t tuple = {
+            .src_addr = addr->sin_addr.s_addr,
+            .dest_addr = htonl(INADDR_ANY),
+            .srcport = addr->sin_port,
+            .destport = htons(SERVER_PORT)
+    };
+    return tuple;
+}
 
-    printf("OK\n");
+/**
+ * Find the connection for a peer, creating it if this is the first datagram we see from it.
+ *
+ * @param peers The connection table
+ * @param tuple The peer's 4-tuple
+ * @param first The datagram's segment, which picks the handshake of a new connection when serving any
+ * @param mode The handshake to run with each client
+ * @param stats Counters to update when a connection is created
+ * @param created Set to true if the connection was created for this datagram
+ * @return The peer's entry, or NULL if out of memory
+ */
+static struct peer_conn *peer_lookup(mytcp_table_t *peers, const mytcp_tuple_t *tuple, const mytcp_t *first,
+                                     enum serve_mode mode, struct serve_stats *stats, bool *created)
+{
+    struct peer_conn *p = mytcp_table_find(peers, tuple);
+    *created = p == NULL;
+    if (p != NULL) return p;
+
+    p = malloc(sizeof(*p));
+    if (p == NULL) return NULL;
+
+    p->tuple = *tuple;
+    p->stamp = 0;
+    mytcp_timer_init(&p->timer);
+    if (mode == SERVE_ANY)
+        mytcp_conn_accept(&p->conn, SERVER_PORT, CLIENT_PORT, first);
+    else
+        mytcp_conn_init(&p->conn, SERVER_PORT, CLIENT_PORT, mode == SERVE_OPEN ? STATE_LISTEN : STATE_ESTABLISHED);
+    if (mytcp_table_insert(peers, tuple, p) != 0)
+    {
+        free(p);
+        return NULL;
+    }
 
-    mytcp_print_segment(outfile, segment, "outgoing close acknowledgment");
+    METRIC_INC(stats->accepted);
+    return p;
+}
 
-    /* SEND CLOSE REQUEST */
+/**
+ * Remove a peer from the connection table and the timer wheel.
+ *
+ * @param peers The connection table
+ * @param wheel The timer wheel
+ * @param peer The entry to remove
+ */
+static void peer_unlink(mytcp_table_t *peers, mytcp_wheel_t *wheel, struct peer_conn *peer)
+{
+    mytcp_wheel_cancel(wheel, &peer->timer);
+    mytcp_table_remove(peers, &peer->tuple);
+}
 
-    printf("sending close request ... ");
+/**
+ * Remove a peer from the connection table and the timer wheel, and free it.
+ *
+ * @param peers The connection table
+ * @param wheel The timer wheel
+ * @param peer The entry to remove
+ */
+static void peer_release(mytcp_table_t *peers, mytcp_wheel_t *wheel, struct peer_conn *peer)
+{
+    peer_unlink(peers, wheel, peer);
+    free(peer);
+}
 
-    // clear ACK and set FIN
-    mytcp_clear_flag(&segment, FLAG_ACK);
-    mytcp_set_flag(&segment, FLAG_FIN);
+/**
+ * Remove a peer while handling a batch; it is freed once the batch's responses are sent (see serve_datagrams()).
+ *
+ * @param peers The connection table
+ * @param wheel The timer wheel
+ * @param buf The batch buffers
+ * @param peer The entry to remove
+ */
+static void peer_retire(mytcp_table_t *peers, mytcp_wheel_t *wheel, struct dgram_buffers *buf, struct peer_conn *peer)
+{
+    peer_unlink(peers, wheel, peer);
+    buf->released[buf->nreleased++] = peer;
+}
 
-    // send close request
-    mytcp_set_checksum(&segment);
-    if ((rw_result = write(client_fd, &segment, sizeof(segment))) != sizeof(segment) || errno != 0)
-        return handle_bad_rw_result(rw_result, "send close request");
+// what peer_expired() needs besides the timer
+struct peer_timeout
+{
+    struct serve_worker *w;
+    mytcp_table_t *peers;
+    uint64_t now;
+};
+
+/**
+ * Timer callback for a UDP client that has not answered our latest segments within the retransmission timeout: send
+ * them again and back off, or give the handshake up once the retries are used up. Timeouts are rare, so the
+ * retransmissions are sent right away rather than batched.
+ *
+ * @param timer The client's timer
+ * @param arg The worker, the connection table and the current tick (struct peer_timeout)
+ */
+static void peer_expired(mytcp_timer_t *timer, void *arg)
+{
+    struct peer_timeout *ctx = arg;
+    struct peer_conn *peer = TIMER_OWNER(timer, struct peer_conn, timer);
+
+    // the tuple holds the client's own address and port
+    struct sockaddr_in addr = {
+            .sin_family = AF_INET,
+            .sin_addr.s_addr = peer->tuple.src_addr,
+            .sin_port = peer->tuple.srcport
+    };
+
+    mytcp_t out[2];
+    int n = mytcp_conn_timeout(&peer->conn, out);
+    if (n == -1)
+    {
+        fprintf(stderr, "client %s:%d: timed out\n", inet_ntoa(addr.sin_addr), ntohs(addr.sin_port));
+        METRIC_INC(ctx->w->stats.failed);
+        METRIC_INC(ctx->w->stats.timed_out);
+        peer_release(ctx->peers, &ctx->w->wheel, peer);
+        return;
+    }
 
-    printf("OK\n");
+    for (int i = 0; i < n; i++)
+        if (sendto(ctx->w->sockfd, &out[i], sizeof(out[i]), 0, (struct sockaddr *) &addr, sizeof(addr)) != -1)
+            METRIC_INC(ctx->w->stats.retransmitted);
+    mytcp_wheel_arm(&ctx->w->wheel, timer, ctx->now + mytcp_conn_rto(&peer->conn));
+}
 
-    mytcp_print_segment(outfile, segment, "outgoing close request");
+/**
+ * The address a datagram was sent to, from its IP_PKTINFO control message; the socket itself is bound to the
+ * wildcard address, so only the datagram tells which of ours the client talks to.
+ *
+ * @param msg The received message
+ * @return Our IPv4 address (network byte order), or INADDR_ANY if the message carries none
+ */
+static uint32_t dgram_local_addr(struct msghdr *msg)
+{
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL; cmsg = CMSG_NXTHDR(msg, cmsg))
+        if (cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_PKTINFO)
+        {
+            struct in_pktinfo info;
+            memcpy(&info, CMSG_DATA(cmsg), sizeof(info));
+            return info.ipi_addr.s_addr;
+        }
+    return htonl(INADDR_ANY);
+}
 
-    /* RECEIVE CLOSE ACK */
+/**
+ * Handle a datagram from a peer we keep no connection for, using SYN cookies: a connection request is answered with
+ * a cookie as our initial sequence number and then forgotten, and a connection acknowledgment carrying a valid cookie
+ * completes the open handshake on the spot. Half-open handshakes therefore cost no memory, however many there are.
+ *
+ * @param w The worker
+ * @param tuple The peer's 4-tuple
+ * @param addr The peer's address
+ * @param local_addr Our address the datagram was sent to (network byte order), for the segment log
+ * @param in The datagram's segment
+ * @param out Where to write the response, if any
+ * @return The number of responses written (0 or 1), or -1 if the segment is for a stateful connection (anything but
+ *         a connection request or acknowledgment)
+ */
+static int serve_cookie(struct serve_worker *w, const mytcp_tuple_t *tuple, const struct sockaddr_in *addr,
+                        uint32_t local_addr, const mytcp_t *in, mytcp_t *out)
+{
+    bool syn = mytcp_check_flag(in, FLAG_SYN), ack = mytcp_check_flag(in, FLAG_ACK);
+    if (mytcp_check_flag(in, FLAG_FIN) || (!syn && !ack)) return -1;
 
-    printf("awaiting close ack ... ");
+    mytcp_conn_error_t err;
+    if (syn && !ack)
+    {
+        uint32_t cookie = mytcp_cookie_make(tuple, in->sequence);
+        err = mytcp_conn_grant_stateless(SERVER_PORT, CLIENT_PORT, cookie, in, out);
+        if (err == CONN_OK)
+        {
+            METRIC_INC(w->stats.cookies_sent);
+            mytcp_log_segment(in, SEGMENT_CONN_REQUEST, true, local_addr, addr->sin_addr.s_addr);
+            mytcp_log_segment(out, SEGMENT_CONN_GRANTED, false, local_addr, addr->sin_addr.s_addr);
+            return 1;
+        }
+    }
+    else if (!syn && mytcp_cookie_check(tuple, in->sequence - 1, in->acknowledgment - 1))
+    {
+        mytcp_conn_t conn;
+        err = mytcp_conn_accept_stateless(&conn, SERVER_PORT, CLIENT_PORT, in->acknowledgment - 1, in);
+        if (err == CONN_OK)
+        {
+            METRIC_INC(w->stats.accepted);
+            METRIC_INC(w->stats.completed);
+            serve_log(&conn, local_addr, addr->sin_addr.s_addr, in, NULL, 0);
+            return 0;
+        }
+    }
+    else
+    {
+        METRIC_INC(w->stats.cookies_rejected);
+        err = CONN_ERR_ACK;
+    }
 
-    // receive close ack
-    bzero(&segment, sizeof(segment));
-    if ((rw_result = read(client_fd, &segment, sizeof(segment))) != sizeof(segment) || errno != 0)
-        return handle_bad_rw_result(rw_result, "receive close ack");
+    fprintf(stderr, "client %s:%d: %s\n", inet_ntoa(addr->sin_addr), ntohs(addr->sin_port), CONN_ERROR_NAMES[err]);
+    mytcp_metrics_rejected(&w->metrics, err);
+    METRIC_INC(w->stats.accepted);
+    METRIC_INC(w->stats.failed);
+    return 0;
+}
 
-    // verify checksum
-    if (!mytcp_verify_checksum(segment)) return abort_with_message("receive close ack: invalid checksum");
+// mytcp_table_foreach() callback freeing the peers left when serve mode stops
+static void peer_free(void *peer, void *unused)
+{
+    (void) unused;
+    free(peer);
+}
 
-    // verify values
-    if (segment.sequence != client_seq + 1) return abort_with_message("close ack: sequence != client_seq + 1");
-    if (segment.acknowledgment != server_seq + 1) return abort_with_message("close ack: ack != server_seq + 1");
-    if (!mytcp_check_flag(segment, FLAG_ACK)) return abort_with_message("close ack: ACK not set");
+/**
+ * Serve handshakes carried as UDP datagrams (one segment per datagram) until serve mode stops (the worker's stop
+ * eventfd becomes readable). Clients are told apart by their address and port. Datagrams are received in batches of
+ * up to DGRAM_BATCH with one recvmmsg() call, and every response produced by a batch is flushed with one sendmmsg()
+ * call; the worker only sleeps (in epoll) once the socket is drained, and no longer than until the next client
+ * timer. Lost segments are recovered: a client's duplicate gets our answer again, and our own segments are
+ * retransmitted when the client does not answer them in time (see peer_expired()).
+ *
+ * @param w The worker, owning a bound UDP socket
+ * @return 0 on clean shutdown, else a non-zero error code
+ */
+int serve_datagrams(struct serve_worker *w)
+{
+    errno = 0;
 
-    printf("OK\n\nall good. we have disconnected.\n");
+    int sockfd = w->sockfd;
+    if (set_nonblocking(sockfd) == -1) return abort_with_errno(errno, "fcntl");
+
+    // bursts of datagrams are dropped once the receive buffer fills up, so ask for a deep one
+    int rcvbuf = DGRAM_RCVBUF;
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+    // have each datagram say which of our addresses it was sent to, for the segment log
+    int one = 1;
+    setsockopt(sockfd, IPPROTO_IP, IP_PKTINFO, &one, sizeof(one));
+
+    // sleep on the socket and the stop eventfd, the latter identified by the worker itself
+    int epfd = epoll_create1(0);
+    if (epfd == -1) return abort_with_errno(errno, "epoll_create1");
+    struct epoll_event sock_ev = { .events = EPOLLIN, .data.ptr = NULL };
+    struct epoll_event stop_ev = { .events = EPOLLIN, .data.ptr = w };
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, sockfd, &sock_ev) == -1
+        || epoll_ctl(epfd, EPOLL_CTL_ADD, w->stopfd, &stop_ev) == -1)
+        return abort_with_errno(errno, "epoll_ctl");
+
+    mytcp_table_t peers;
+    int table_err = mytcp_table_init(&peers, PEER_TABLE_SIZE);
+    if (table_err != 0) return abort_with_errno(table_err, "mytcp_table_init");
+
+    mytcp_wheel_init(&w->wheel, mytcp_wheel_clock());
+    struct peer_timeout timeout = { .w = w, .peers = &peers };
+
+    struct dgram_buffers *buf = calloc(1, sizeof(*buf));
+    if (buf == NULL) return abort_with_errno(errno, "calloc");
+
+    // receive side: one segment buffer and source address per datagram
+    mytcp_t *in = buf->in;
+    struct sockaddr_in *in_addr = buf->in_addr;
+    struct iovec *in_iov = buf->in_iov;
+    struct mmsghdr *in_msgs = buf->in_msgs;
+
+    // send side: each incoming segment can produce up to two responses (ACK and FIN)
+    mytcp_t *out = buf->out;
+    struct sockaddr_in *out_addr = buf->out_addr;
+    struct iovec *out_iov = buf->out_iov;
+    struct mmsghdr *out_msgs = buf->out_msgs;
+    uint64_t **out_stamp = buf->out_stamp;
+
+    for (int i = 0; i < DGRAM_BATCH; i++)
+    {
+        in_iov[i].iov_base = &in[i];
+        in_iov[i].iov_len = sizeof(mytcp_t);
+        in_msgs[i].msg_hdr.msg_iov = &in_iov[i];
+        in_msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    for (int i = 0; i < 2 * DGRAM_BATCH; i++)
+    {
+        out_iov[i].iov_base = &out[i];
+        out_iov[i].iov_len = sizeof(mytcp_t);
+        out_msgs[i].msg_hdr.msg_iov = &out_iov[i];
+        out_msgs[i].msg_hdr.msg_iovlen = 1;
+        out_msgs[i].msg_hdr.msg_name = &out_addr[i];
+        out_msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+    }
 
-    mytcp_print_segment(outfile, segment, "incoming close acknowledgment");
+    for (bool serving = true; serving;)
+    {
+        // retransmit to the clients whose timers are due, between batches so a busy socket cannot hold them off
+        timeout.now = mytcp_wheel_clock();
+        mytcp_wheel_advance(&w->wheel, timeout.now, peer_expired, &timeout);
+
+        for (int i = 0; i < DGRAM_BATCH; i++)
+        {
+            in_msgs[i].msg_hdr.msg_name = &in_addr[i];
+            in_msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+            in_msgs[i].msg_hdr.msg_control = buf->in_control[i];
+            in_msgs[i].msg_hdr.msg_controllen = sizeof(buf->in_control[i]);
+        }
+
+        // take whatever is already queued; once drained, sleep until a datagram arrives or serve mode stops
+        int n = recvmmsg(sockfd, in_msgs, DGRAM_BATCH, 0, NULL);
+        if (n == -1)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                struct epoll_event ev;
+                int sleep_ms = mytcp_wheel_timeout(&w->wheel, timeout.now, -1);
+                if (epoll_wait(epfd, &ev, 1, sleep_ms) == 1 && ev.data.ptr == w) serving = false;
+                continue;
+            }
+            if (errno == EINTR) continue;
+            int saved = errno;
+            mytcp_table_foreach(&peers, peer_free, NULL);
+            mytcp_table_free(&peers);
+            free(buf);
+            close(epfd);
+            return abort_with_errno(saved, "recvmmsg");
+        }
+
+        // the whole batch was waiting by now, so its segments are timed from here
+        uint64_t received = mytcp_metrics_now();
+
+        int nout = 0;
+        for (int i = 0; i < n; i++)
+        {
+            // a datagram carries exactly one segment
+            if (in_msgs[i].msg_len != sizeof(mytcp_t)) continue;
+
+            mytcp_tuple_t tuple = peer_tuple(&in_addr[i]);
+            uint32_t local_addr = dgram_local_addr(&in_msgs[i].msg_hdr);
+            if (w->cookies && mytcp_table_find(&peers, &tuple) == NULL)
+            {
+                int produced = serve_cookie(w, &tuple, &in_addr[i], local_addr, &in[i], &out[nout]);
+                if (produced >= 0)
+                {
+                    if (produced > 0)
+                    {
+                        buf->out_since[nout] = received;
+                        out_stamp[nout] = &buf->out_since[nout];
+                        buf->out_kind[nout] = SEGMENT_CONN_GRANTED;
+                        out_addr[nout++] = in_addr[i];
+                    }
+                    continue;
+                }
+            }
+
+            bool created;
+            struct peer_conn *peer = peer_lookup(&peers, &tuple, &in[i], w->mode, &w->stats, &created);
+            if (peer == NULL) continue;
+
+            int produced;
+            mytcp_conn_error_t err = mytcp_conn_input(&peer->conn, &in[i], &out[nout], &produced);
+            if (err != CONN_OK) mytcp_metrics_rejected(&w->metrics, err);
+            if (err == CONN_ERR_DUPLICATE)
+            {
+                // our answer was lost: send it again
+                for (int k = mytcp_conn_retransmit(&peer->conn, &out[nout]); k > 0; k--)
+                {
+                    out_stamp[nout] = NULL;
+                    out_addr[nout++] = in_addr[i];
+                    METRIC_INC(w->stats.retransmitted);
+                }
+                continue;
+            }
+            // a datagram damaged or delayed on the way is dropped, and the retransmission timeout recovers the
+            // handshake; only a client whose very first segment is rejected has no handshake to recover
+            if (err != CONN_OK && !created) continue;
+            if (err != CONN_OK)
+            {
+                fprintf(stderr, "client %s:%d: %s\n", inet_ntoa(in_addr[i].sin_addr), ntohs(in_addr[i].sin_port),
+                        CONN_ERROR_NAMES[err]);
+                METRIC_INC(w->stats.failed);
+                peer_retire(&peers, &w->wheel, buf, peer);
+                continue;
+            }
+            mytcp_metrics_received(&w->metrics, &peer->stamp, mytcp_conn_kind(&peer->conn, &in[i]), received);
+
+            int first = nout;
+            nout += produced;
+
+            // nothing left to send before our own close request
+            if (peer->conn.state == STATE_CLOSE_WAIT) mytcp_conn_close(&peer->conn, &out[nout++]);
+
+            for (int k = first; k < nout; k++)
+            {
+                out_stamp[k] = &peer->stamp;
+                buf->out_kind[k] = (uint8_t) mytcp_conn_kind(&peer->conn, &out[k]);
+                out_addr[k] = in_addr[i];
+            }
+
+            serve_log(&peer->conn, local_addr, in_addr[i].sin_addr.s_addr, &in[i], &out[first],
+                      (size_t) (nout - first));
+
+            if (mytcp_conn_done(&peer->conn))
+            {
+                METRIC_INC(w->stats.completed);
+                peer_retire(&peers, &w->wheel, buf, peer);
+            }
+            else if (peer->conn.nsent > 0)
+                mytcp_wheel_arm(&w->wheel, &peer->timer, timeout.now + mytcp_conn_rto(&peer->conn));
+            else
+                mytcp_wheel_cancel(&w->wheel, &peer->timer);
+        }
+
+        // flush every response from this batch at once; UDP gives no delivery guarantee anyway
+        int sent = 0;
+        while (sent < nout)
+        {
+            int r = sendmmsg(sockfd, out_msgs + sent, (unsigned int) (nout - sent), 0);
+            if (r == -1)
+            {
+                if (errno == EINTR) continue;
+                write_errno(errno, "sendmmsg");
+                break;
+            }
+            sent += r;
+        }
+
+        if (sent > 0)
+        {
+            uint64_t flushed = mytcp_metrics_now();
+            for (int k = 0; k < sent; k++)
+                if (out_stamp[k] != NULL)
+                    mytcp_metrics_sent(&w->metrics, out_stamp[k], (mytcp_segment_kind_t) buf->out_kind[k], flushed);
+        }
+        for (int k = 0; k < buf->nreleased; k++) free(buf->released[k]);
+        buf->nreleased = 0;
+    }
 
+    METRIC_ADD(w->stats.half_open, mytcp_table_size(&peers));
+    mytcp_table_foreach(&peers, peer_free, NULL);
+    mytcp_table_free(&peers);
+    free(buf);
+    close(epfd);
     return 0;
 }
@@ -0,0 +1,162 @@
+#include "capture.h"
+
+#include <arpa/inet.h>
+#include <string.h>
+#include "wire.h"
+
+
+// pcap constants: nanosecond-resolution magic, version 2.4, raw IPv4 link type
+#define PCAP_MAGIC_NS 0xA1B23C4Du
+#define PCAP_VERSION_MAJOR 2
+#define PCAP_VERSION_MINOR 4
+#define PCAP_SNAPLEN 65535u
+#define PCAP_LINKTYPE_RAW 101u
+
+// synthesized IPv4 header values
+#define SYNTH_IP_VERSION_IHL 0x45
+#define SYNTH_IP_DONT_FRAGMENT 0x4000
+#define SYNTH_IP_TTL 64
+#define SYNTH_IP_PROTO_TCP 6
+
+// the IP identification field carries the segment's title: direction in the high byte, kind in the low byte
+#define SYNTH_IP_ID_INCOMING 0x0100
+
+/**
+ * Compute the IPv4 header checksum.
+ *
+ * @param header The 20-byte header, with its checksum field zeroed
+ * @return The checksum, in network byte order
+ */
+static uint16_t ip_checksum(const unsigned char *header)
+{
+    uint32_t sum = 0;
+    for (int i = 0; i < CAPTURE_IP_HEADER_LEN; i += 2) sum += (uint32_t) (header[i] << 8 | header[i + 1]);
+    while (sum >> 16) sum = (sum & 0xFFFF) + (sum >> 16);
+    return htons((uint16_t) ~sum);
+}
+
+/**
+ * Write the pcap file header.
+ *
+ * @param buf At least CAPTURE_FILE_HEADER_LEN bytes
+ * @return The number of bytes written
+ */
+size_t mytcp_capture_file_header(char *buf)
+{
+    uint32_t magic = PCAP_MAGIC_NS, zero = 0, snaplen = PCAP_SNAPLEN, linktype = PCAP_LINKTYPE_RAW;
+    uint16_t major = PCAP_VERSION_MAJOR, minor = PCAP_VERSION_MINOR;
+
+    memcpy(buf, &magic, 4);
+    memcpy(buf + 4, &major, 2);
+    memcpy(buf + 6, &minor, 2);
+    memcpy(buf + 8, &zero, 4);          // thiszone
+    memcpy(buf + 12, &zero, 4);         // sigfigs
+    memcpy(buf + 16, &snaplen, 4);
+    memcpy(buf + 20, &linktype, 4);
+    return CAPTURE_FILE_HEADER_LEN;
+}
+
+/**
+ * Write one pcap record: the record header, a synthesized IPv4 header, and the segment encoded in network byte order
+ * (see wire.h) so standard tools decode it as a TCP header (our flag bits and data offset already sit where TCP's do).
+ *
+ * @param buf At least CAPTURE_RECORD_LEN bytes
+ * @param seg The segment, in host byte order
+ * @param kind The segment's kind
+ * @param incoming True if the segment was received, false if it was sent
+ * @param local_addr Our IPv4 address, network byte order
+ * @param peer_addr The peer's IPv4 address, network byte order
+ * @param ts When the segment was logged
+ * @return The number of bytes written
+ */
+size_t mytcp_capture_record(char *buf, const mytcp_t *seg, mytcp_segment_kind_t kind, bool incoming,
+                            uint32_t local_addr, uint32_t peer_addr, const struct timespec *ts)
+{
+    uint32_t record[4] = {
+            (uint32_t) ts->tv_sec, (uint32_t) ts->tv_nsec,
+            CAPTURE_IP_HEADER_LEN + sizeof(mytcp_t), CAPTURE_IP_HEADER_LEN + sizeof(mytcp_t)
+    };
+    memcpy(buf, record, sizeof(record));
+
+    unsigned char *ip = (unsigned char *) buf + CAPTURE_RECORD_HEADER_LEN;
+    uint16_t total_len = htons(CAPTURE_IP_HEADER_LEN + sizeof(mytcp_t));
+    uint16_t id = htons((uint16_t) ((incoming ? SYNTH_IP_ID_INCOMING : 0) | kind));
+    uint16_t frag = htons(SYNTH_IP_DONT_FRAGMENT);
+    uint32_t src = incoming ? peer_addr : local_addr, dst = incoming ? local_addr : peer_addr;
+
+    bzero(ip, CAPTURE_IP_HEADER_LEN);
+    ip[0] = SYNTH_IP_VERSION_IHL;
+    memcpy(ip + 2, &total_len, 2);
+    memcpy(ip + 4, &id, 2);
+    memcpy(ip + 6, &frag, 2);
+    ip[8] = SYNTH_IP_TTL;
+    ip[9] = SYNTH_IP_PROTO_TCP;
+    memcpy(ip + 12, &src, 4);
+    memcpy(ip + 16, &dst, 4);
+    uint16_t checksum = ip_checksum(ip);
+    memcpy(ip + 10, &checksum, 2);
+
+    // records hold the fixed header only, whatever the offset says
+    mytcp_wire_encode_batch(seg, 1, (mytcp_wire_t *) (ip + CAPTURE_IP_HEADER_LEN));
+
+    return CAPTURE_RECORD_LEN;
+}
+
+/**
+ * Read and check the pcap file header of a capture written by mytcp_capture_file_header().
+ *
+ * @param f The capture, positioned at its start
+ * @return 0 if the header is valid, -1 otherwise
+ */
+int mytcp_capture_open(FILE *f)
+{
+    char header[CAPTURE_FILE_HEADER_LEN];
+    uint32_t magic, linktype;
+
+    if (fread(header, 1, sizeof(header), f) != sizeof(header)) return -1;
+    memcpy(&magic, header, 4);
+    memcpy(&linktype, header + 20, 4);
+
+    return (magic == PCAP_MAGIC_NS && linktype == PCAP_LINKTYPE_RAW) ? 0 : -1;
+}
+
+/**
+ * Read the next segment from a capture. Records that do not hold an IPv4/TCP packet of the expected size are
+ * skipped.
+ *
+ * @param f The capture, past its file header
+ * @param entry Receives the segment and its metadata
+ * @return 1 if a segment was read, 0 at end of file, -1 on a truncated or malformed record
+ */
+int mytcp_capture_next(FILE *f, mytcp_capture_entry_t *entry)
+{
+    for (;;)
+    {
+        uint32_t record[4];
+        size_t got = fread(record, 1, sizeof(record), f);
+        if (got == 0) return 0;
+        if (got != sizeof(record) || record[2] > PCAP_SNAPLEN) return -1;
+
+        unsigned char packet[CAPTURE_IP_HEADER_LEN + sizeof(mytcp_t)];
+        if (record[2] != sizeof(packet))
+        {
+            if (fseek(f, record[2], SEEK_CUR) != 0) return -1;
+            continue;
+        }
+        if (fread(packet, 1, sizeof(packet), f) != sizeof(packet)) return -1;
+        if (packet[0] != SYNTH_IP_VERSION_IHL || packet[9] != SYNTH_IP_PROTO_TCP) continue;
+
+        uint16_t id;
+        memcpy(&id, packet + 4, 2);
+        id = ntohs(id);
+        memcpy(&entry->src_addr, packet + 12, 4);
+        memcpy(&entry->dst_addr, packet + 16, 4);
+        entry->kind = (id & 0xFF) < NUM_SEGMENT_KINDS ? (mytcp_segment_kind_t) (id & 0xFF) : SEGMENT_NONE;
+        entry->incoming = (id & SYNTH_IP_ID_INCOMING) != 0;
+        entry->ts.tv_sec = record[0];
+        entry->ts.tv_nsec = record[1];
+
+        mytcp_wire_decode_batch((const mytcp_wire_t *) (packet + CAPTURE_IP_HEADER_LEN), 1, &entry->seg);
+        return 1;
+    }
+}
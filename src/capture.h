@@ -0,0 +1,37 @@
+#ifndef CSCE3530_LAB3_CAPTURE_H
+#define CSCE3530_LAB3_CAPTURE_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <time.h>
+#include "connection.h"
+#include "mytcp.h"
+
+// pcap layout: file header, then per segment a record header and a synthesized IPv4 packet carrying the segment
+#define CAPTURE_FILE_HEADER_LEN 24
+#define CAPTURE_RECORD_HEADER_LEN 16
+#define CAPTURE_IP_HEADER_LEN 20
+#define CAPTURE_RECORD_LEN (CAPTURE_RECORD_HEADER_LEN + CAPTURE_IP_HEADER_LEN + sizeof(mytcp_t))
+
+// one segment read back from a capture
+typedef struct mytcp_capture_entry
+{
+    mytcp_t seg;                    // in host byte order, exactly as it was logged
+    mytcp_segment_kind_t kind;
+    bool incoming;
+    uint32_t src_addr;              // IPv4, network byte order
+    uint32_t dst_addr;
+    struct timespec ts;
+} mytcp_capture_entry_t;
+
+// writing: fill caller buffers, no I/O
+size_t mytcp_capture_file_header(char *);
+size_t mytcp_capture_record(char *, const mytcp_t *, mytcp_segment_kind_t, bool, uint32_t, uint32_t,
+                            const struct timespec *);
+
+// reading
+int mytcp_capture_open(FILE *);
+int mytcp_capture_next(FILE *, mytcp_capture_entry_t *);
+
+#endif //CSCE3530_LAB3_CAPTURE_H
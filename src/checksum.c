@@ -0,0 +1,219 @@
+#include "mytcp.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MYTCP_HAVE_X86 1
+#endif
+
+
+// each segment is three 64-bit words; the kernels compute the sum of the four 16-bit words in each of them
+#define QWORDS_PER_SEGMENT (sizeof(mytcp_t) / sizeof(uint64_t))
+
+// number of segments each kernel consumes per iteration
+#define SSE2_BATCH 4
+#define AVX2_BATCH 8
+
+typedef void (*qword_sums_fn)(const mytcp_t *, size_t, uint64_t *);
+
+/**
+ * Fold a wide one's complement sum down to 16 bits and complement it.
+ * Yields the same result as the fold in mytcp_calculate_checksum().
+ *
+ * @param sum The sum of a segment's 16-bit words
+ * @return The checksum
+ */
+static uint16_t fold_checksum(uint64_t sum)
+{
+    while (sum >> 16) sum = (sum & 0xFFFF) + (sum >> 16);
+    return (uint16_t) (0xFFFF ^ sum);
+}
+
+/**
+ * Scalar fallback: the plain sum of each segment's 16-bit words, via the same loop as mytcp_calculate_checksum().
+ *
+ * @param segs The segments
+ * @param n The number of segments
+ * @param sums Receives one sum per segment
+ */
+static void segment_sums_scalar(const mytcp_t *segs, size_t n, uint64_t *sums)
+{
+    for (size_t k = 0; k < n; k++)
+    {
+        uint16_t words[12];
+        uint64_t sum = 0;
+        memcpy(words, &segs[k], sizeof(words));
+        for (int i = 0; i < 12; i++) sum += words[i];
+        sums[k] = sum;
+    }
+}
+
+#ifdef MYTCP_HAVE_X86
+
+/**
+ * SSE2 kernel: writes the 16-bit word sum of every 64-bit word of n segments (n a multiple of SSE2_BATCH).
+ * A word sum is the sum of the low bytes plus 256 times the sum of the high bytes, and PSADBW sums the eight bytes
+ * of each 64-bit lane in one instruction.
+ */
+__attribute__((target("sse2")))
+static void qword_sums_sse2(const mytcp_t *segs, size_t n, uint64_t *out)
+{
+    const __m128i low_bytes = _mm_set1_epi16(0x00FF);
+    const __m128i zero = _mm_setzero_si128();
+    const char *p = (const char *) segs;
+    size_t vectors = n * sizeof(mytcp_t) / sizeof(__m128i);
+
+    for (size_t i = 0; i < vectors; i++)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *) (p + i * sizeof(__m128i)));
+        __m128i lo = _mm_sad_epu8(_mm_and_si128(v, low_bytes), zero);
+        __m128i hi = _mm_sad_epu8(_mm_srli_epi16(v, 8), zero);
+        _mm_storeu_si128((__m128i *) (out + 2 * i), _mm_add_epi64(lo, _mm_slli_epi64(hi, 8)));
+    }
+}
+
+/**
+ * AVX2 kernel: same as qword_sums_sse2(), four 64-bit words at a time (n a multiple of AVX2_BATCH).
+ */
+__attribute__((target("avx2")))
+static void qword_sums_avx2(const mytcp_t *segs, size_t n, uint64_t *out)
+{
+    const __m256i low_bytes = _mm256_set1_epi16(0x00FF);
+    const __m256i zero = _mm256_setzero_si256();
+    const char *p = (const char *) segs;
+    size_t vectors = n * sizeof(mytcp_t) / sizeof(__m256i);
+
+    for (size_t i = 0; i < vectors; i++)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (p + i * sizeof(__m256i)));
+        __m256i lo = _mm256_sad_epu8(_mm256_and_si256(v, low_bytes), zero);
+        __m256i hi = _mm256_sad_epu8(_mm256_srli_epi16(v, 8), zero);
+        _mm256_storeu_si256((__m256i *) (out + 4 * i), _mm256_add_epi64(lo, _mm256_slli_epi64(hi, 8)));
+    }
+}
+
+#endif
+
+// selected kernel and how many segments it consumes at once; resolved at load time
+static qword_sums_fn qword_sums = NULL;
+static size_t qword_batch = 1;
+static const char *impl_name = "scalar";
+
+/**
+ * Pick the widest checksum kernel the running CPU supports. Runs before main(), so no locking is needed.
+ */
+__attribute__((constructor))
+static void resolve_checksum_impl(void)
+{
+#ifdef MYTCP_HAVE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        qword_batch = AVX2_BATCH;
+        impl_name = "avx2";
+        qword_sums = qword_sums_avx2;
+        return;
+    }
+    if (__builtin_cpu_supports("sse2"))
+    {
+        qword_batch = SSE2_BATCH;
+        impl_name = "sse2";
+        qword_sums = qword_sums_sse2;
+        return;
+    }
+#endif
+}
+
+/**
+ * Compute the plain sum of every segment's 16-bit words, using the SIMD kernel for whole batches and the scalar
+ * loop for the remainder.
+ *
+ * @param segs The segments
+ * @param n The number of segments
+ * @param sums Receives one sum per segment
+ */
+static void segment_sums(const mytcp_t *segs, size_t n, uint64_t *sums)
+{
+    size_t done = 0;
+    if (qword_sums != NULL)
+    {
+        uint64_t qwords[AVX2_BATCH * QWORDS_PER_SEGMENT];
+
+        for (; done + qword_batch <= n; done += qword_batch)
+        {
+            qword_sums(segs + done, qword_batch, qwords);
+            for (size_t k = 0; k < qword_batch; k++)
+                sums[done + k] = qwords[3 * k] + qwords[3 * k + 1] + qwords[3 * k + 2];
+        }
+    }
+
+    segment_sums_scalar(segs + done, n - done, sums + done);
+}
+
+// segments summed per call to segment_sums(), bounding stack usage
+#define SUM_CHUNK 256
+
+/**
+ * Calculate the checksums of n contiguous segments as if their checksum fields were zero.
+ * Equivalent to calling mytcp_calculate_checksum() on each segment, but sums the segments
+ * with the widest SIMD kernel the CPU supports.
+ *
+ * @param segs The segments whose checksums we are calculating
+ * @param n The number of segments
+ * @param checksums Receives one checksum per segment
+ */
+void mytcp_calculate_checksum_batch(const mytcp_t *segs, size_t n, uint16_t *checksums)
+{
+    uint64_t sums[SUM_CHUNK];
+
+    for (size_t base = 0; base < n; base += SUM_CHUNK)
+    {
+        size_t count = n - base < SUM_CHUNK ? n - base : SUM_CHUNK;
+        segment_sums(segs + base, count, sums);
+
+        // the kernels sum the checksum field too; take it back out
+        for (size_t k = 0; k < count; k++)
+            checksums[base + k] = fold_checksum(sums[k] - segs[base + k].checksum);
+    }
+}
+
+/**
+ * Verify the checksums of n contiguous segments. Equivalent to calling mytcp_verify_checksum() on each.
+ *
+ * @param segs The segments whose checksums we are verifying
+ * @param n The number of segments
+ * @param valid Receives, for each segment, whether its checksum is correct; may be NULL
+ * @return The number of segments whose checksum is correct
+ */
+size_t mytcp_verify_checksum_batch(const mytcp_t *segs, size_t n, bool *valid)
+{
+    uint64_t sums[SUM_CHUNK];
+    size_t good = 0;
+
+    for (size_t base = 0; base < n; base += SUM_CHUNK)
+    {
+        size_t count = n - base < SUM_CHUNK ? n - base : SUM_CHUNK;
+        segment_sums(segs + base, count, sums);
+
+        for (size_t k = 0; k < count; k++)
+        {
+            uint16_t given = segs[base + k].checksum;
+            bool ok = fold_checksum(sums[k] - given) == given;
+            if (valid != NULL) valid[base + k] = ok;
+            good += ok;
+        }
+    }
+
+    return good;
+}
+
+/**
+ * Name of the checksum kernel selected for this CPU ("avx2", "sse2" or "scalar").
+ *
+ * @return The kernel's name
+ */
+const char *mytcp_checksum_impl(void)
+{
+    return impl_name;
+}
@@ -1,5 +1,9 @@
 #include <stdio.h>      // printf, fprintf, snprintf
+#include <stdlib.h>     // strtod
 #include <string.h>     // strerror
+#include <unistd.h>     // read, write
+#include <poll.h>       // poll
+#include <sys/socket.h> // getsockopt
 #include "common.h"
 
 /**
@@ -57,3 +61,238 @@ int handle_bad_rw_result(ssize_t rw_result, const char *src)
     // print to stderr and return a non-zero exit code
     return abort_with_message(errmsg);
 }
+
+/**
+ * Parse a numeric option value and check its range.
+ *
+ * @param arg The option's argument
+ * @param min The smallest accepted value
+ * @param max The largest accepted value
+ * @param value Set to the parsed value
+ * @return 0 if the argument is a number in range, 1 otherwise
+ */
+int parse_option(const char *arg, double min, double max, double *value)
+{
+    char *end;
+    double parsed = strtod(arg, &end);
+    if (end == arg || *end != '\0' || parsed < min || parsed > max) return 1;
+
+    *value = parsed;
+    return 0;
+}
+
+
+/**
+ * Write one segment produced by a connection to a blocking socket, then print it.
+ *
+ * @param fd The socket to write to
+ * @param outfile The file to print the segment to (as well as stdout)
+ * @param conn The connection that produced the segment
+ * @param seg The segment to send
+ * @return 0 on success, else a non-zero error code
+ */
+static int send_segment(int fd, FILE *outfile, const mytcp_conn_t *conn, const mytcp_t *seg)
+{
+    const char *kind = SEGMENT_KIND_NAMES[mytcp_conn_kind(conn, seg)];
+    char title[TITLE_LEN];
+
+    printf("sending %s ... ", kind);
+
+    ssize_t rw_result;
+    snprintf(title, TITLE_LEN, "send %s", kind);
+    if ((rw_result = write(fd, seg, sizeof(*seg))) != sizeof(*seg) || errno != 0)
+        return handle_bad_rw_result(rw_result, title);
+
+    printf("OK\n");
+
+    snprintf(title, TITLE_LEN, "outgoing %s", kind);
+    mytcp_print_segment(outfile, seg, title);
+    return 0;
+}
+
+/**
+ * Send again the segments a connection last sent, after a timeout or a duplicate from the peer.
+ *
+ * @param fd The socket to write to
+ * @param outfile The file to print the segments to (as well as stdout)
+ * @param conn The connection that produced the segments
+ * @param segs The segments
+ * @param n The number of segments
+ * @return 0 on success, else a non-zero error code
+ */
+static int resend_segments(int fd, FILE *outfile, const mytcp_conn_t *conn, const mytcp_t *segs, int n)
+{
+    int result = 0;
+    for (int i = 0; i < n && result == 0; i++)
+    {
+        printf("re");
+        result = send_segment(fd, outfile, conn, &segs[i]);
+    }
+    return result;
+}
+
+/**
+ * Wait for the socket to become readable.
+ *
+ * @param fd The socket
+ * @param timeout_ms The longest to wait in milliseconds, or -1 to wait indefinitely
+ * @return 1 if it is readable, 0 on a timeout, else -1 with errno set
+ */
+static int wait_readable(int fd, int timeout_ms)
+{
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    return poll(&pfd, 1, timeout_ms);
+}
+
+/**
+ * Answer the peer for CONN_TIME_WAIT_MS after the exchange is done, in case the last segment we sent was lost: every
+ * retransmission of the peer's final segment gets our answer again, anything else is ignored. Only datagrams can be
+ * lost, so streams skip this.
+ *
+ * @param fd The socket
+ * @param outfile The file to print segments to (as well as stdout)
+ * @param conn The connection, done
+ * @param reader The reader the handshake used
+ * @return 0 on success, else a non-zero error code
+ */
+static int linger(int fd, FILE *outfile, mytcp_conn_t *conn, mytcp_reader_t *reader)
+{
+    mytcp_t response[2];
+    int result = 0, nout;
+    uint64_t until = mytcp_wheel_clock() + CONN_TIME_WAIT_MS, now;
+
+    while (result == 0 && (now = mytcp_wheel_clock()) < until)
+    {
+        const mytcp_t *segment = mytcp_reader_next(reader);
+        if (segment == NULL)
+        {
+            int ready = wait_readable(fd, (int) (until - now));
+            if (ready == -1) return abort_with_errno(errno, "poll");
+            if (ready == 0) break;
+
+            ssize_t rw_result = mytcp_reader_fill(reader);
+            if (rw_result <= 0 || errno != 0) result = handle_bad_rw_result(rw_result, "receive segment");
+            continue;
+        }
+
+        // feed a copy, so nothing but a duplicate can move the connection on
+        mytcp_conn_t probe = *conn;
+        if (mytcp_conn_input(&probe, segment, response, &nout) == CONN_ERR_DUPLICATE)
+        {
+            printf("duplicate %s\n", SEGMENT_KIND_NAMES[mytcp_conn_kind(conn, segment)]);
+            result = resend_segments(fd, outfile, conn, response, mytcp_conn_retransmit(conn, response));
+        }
+    }
+
+    return result;
+}
+
+/**
+ * Drive a connection over a blocking socket until its simulated exchange is done: send the first segment (if any),
+ * then repeatedly receive a segment, feed it to the connection, and send whatever it responds with.
+ * Segments are received through a mytcp_reader_t, so short reads are tolerated and segments that arrive together
+ * (e.g. the server's close acknowledgment and close request) are taken from a single read().
+ * A connection left in CLOSE_WAIT is closed right away, as the simulation has nothing else to send.
+ * While the peer owes us an answer, we wait for it at most a retransmission timeout, then resend our segments (over
+ * datagrams, which may be lost) and back off; after CONN_MAX_RETRIES the handshake has timed out. A retransmission
+ * from the peer means our answer was lost, so it is sent again, also after the exchange is done (see linger()).
+ *
+ * @param fd The connected socket
+ * @param outfile The file to print segments to (as well as stdout)
+ * @param conn The connection to drive
+ * @param first The segment produced by opening or closing the connection, or NULL if the peer speaks first
+ * @return 0 on success, else a non-zero error code
+ */
+int run_handshake(int fd, FILE *outfile, mytcp_conn_t *conn, const mytcp_t *first)
+{
+    errno = 0;
+
+    mytcp_t response[2];
+    mytcp_reader_t reader;
+    char title[TITLE_LEN];
+    int result = 0, nout, type;
+    socklen_t type_len = sizeof(type);
+
+    if (getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &type_len) != 0) return abort_with_errno(errno, "SO_TYPE");
+    if (mytcp_reader_init(&reader, fd, READER_DEFAULT_CAPACITY) != 0) return abort_with_errno(errno, "reader");
+
+    if (first != NULL) result = send_segment(fd, outfile, conn, first);
+
+    while (result == 0 && !mytcp_conn_done(conn))
+    {
+        const char *expecting = SEGMENT_KIND_NAMES[mytcp_conn_expecting(conn)];
+        printf("awaiting %s ... ", expecting);
+
+        // attempt to receive the next segment, reading more only when none is buffered; if we sent nothing the peer
+        // speaks first (or retransmits), so only then is there no timeout
+        const mytcp_t *segment;
+        snprintf(title, TITLE_LEN, "receive %s", expecting);
+        while ((segment = mytcp_reader_next(&reader)) == NULL)
+        {
+            int ready = wait_readable(fd, conn->nsent > 0 ? (int) mytcp_conn_rto(conn) : -1);
+            if (ready == 0)
+            {
+                int n = mytcp_conn_timeout(conn, response);
+                if (n == -1)
+                {
+                    result = abort_with_message("timed out");
+                    break;
+                }
+
+                printf("timed out (retry %d)\n", conn->retries);
+                if (type == SOCK_DGRAM && (result = resend_segments(fd, outfile, conn, response, n)) != 0) break;
+                printf("awaiting %s ... ", expecting);
+                continue;
+            }
+
+            ssize_t rw_result = ready == -1 ? -1 : mytcp_reader_fill(&reader);
+            if (rw_result <= 0 || errno != 0)
+            {
+                result = handle_bad_rw_result(rw_result < 0 ? rw_result : (ssize_t) mytcp_reader_buffered(&reader),
+                                              title);
+                break;
+            }
+        }
+        if (segment == NULL) break;
+
+        // validate it and advance the connection; a duplicate gets our last answer again
+        mytcp_conn_error_t err = mytcp_conn_input(conn, segment, response, &nout);
+        if (err == CONN_ERR_DUPLICATE)
+        {
+            printf("duplicate %s\n", SEGMENT_KIND_NAMES[mytcp_conn_kind(conn, segment)]);
+            result = resend_segments(fd, outfile, conn, response, mytcp_conn_retransmit(conn, response));
+            continue;
+        }
+        if (err != CONN_OK)
+        {
+            snprintf(title, TITLE_LEN, "incoming %s: %s", expecting, CONN_ERROR_NAMES[err]);
+            result = abort_with_message(title);
+            break;
+        }
+
+        printf("OK\n");
+
+        snprintf(title, TITLE_LEN, "incoming %s", SEGMENT_KIND_NAMES[mytcp_conn_kind(conn, segment)]);
+        mytcp_print_segment(outfile, segment, title);
+
+        if (nout > 0 && (result = send_segment(fd, outfile, conn, &response[0])) != 0) break;
+
+        // nothing left to send before our own close request
+        if (conn->state == STATE_CLOSE_WAIT)
+        {
+            mytcp_conn_close(conn, &response[0]);
+            result = send_segment(fd, outfile, conn, &response[0]);
+        }
+    }
+
+    if (result == 0 && type == SOCK_DGRAM && mytcp_conn_lingers(conn)) result = linger(fd, outfile, conn, &reader);
+    mytcp_reader_free(&reader);
+    if (result != 0) return result;
+
+    if (conn->state == STATE_ESTABLISHED)
+        printf("\nall good: we are now connected.\n");
+    else
+        printf("\nall good. we have disconnected.\n");
+
+    return 0;
+}
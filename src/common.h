@@ -3,16 +3,49 @@
 
 #include <errno.h>
 #include <stdio.h>
+#include "capture.h"
+#include "congestion.h"
+#include "connection.h"
+#include "conntable.h"
+#include "histogram.h"
+#include "impair.h"
+#include "loadgen.h"
+#include "loopback.h"
+#include "metrics.h"
 #include "mytcp.h"
+#include "options.h"
+#include "reader.h"
+#include "seglog.h"
+#include "syncookie.h"
+#include "timerwheel.h"
+#include "transfer.h"
+#include "uring.h"
+#include "wire.h"
 
 // help text macros
-#define HELP_OPEN  "- Simulate opening a TCP connection"
-#define HELP_CLOSE "- Simulate closing a TCP connection"
+#define HELP_OPEN    "- Simulate opening a TCP connection"
+#define HELP_CLOSE   "- Simulate closing a TCP connection"
+#define HELP_ANY     "- Serve open and close handshakes, whichever each client starts"
+#define HELP_LOAD    "- Generate load: run many concurrent handshakes and report throughput and latency"
+#define HELP_XFER    "- Open a connection, move bulk data over it through a sliding window, close it and report goodput"
+#define HELP_LOOP    "- Run handshakes between an in-process client and server linked by lock-free rings (no network)"
+#define HELP_SERVE   "- Keep serving handshakes for any number of concurrent clients until interrupted"
+#define HELP_CAPTURE "- Record segments as a binary pcap capture (server.pcap) instead of text"
+#define HELP_WORKERS "- Serve with this many workers, each with its own SO_REUSEPORT listener (0: one per CPU)"
+#define HELP_PIN     "- Pin each worker to its own CPU"
+#define HELP_URING   "- Use io_uring for accept/receive/send instead of epoll (TCP only)"
+#define HELP_COOKIES "- Answer connection requests with SYN cookies instead of keeping half-open handshakes (UDP only)"
+#define HELP_MUX     "- Demultiplex many connections per client socket by port pair (TCP only; for client load -k)"
+#define HELP_METRICS "- Serve metrics in Prometheus text format on this local port (SIGUSR1 also prints them)"
+#define HELP_UDP     "- Carry segments as UDP datagrams instead of over a TCP stream"
 
 // error-handling related macros
 #define RW_ERR_LEN 2048
 #define write_errno(e, c) fprintf(stderr, "Error: %s (%s)\n", strerror((e)), (c))
 
+// segment title related macros
+#define TITLE_LEN 64
+
 // connectivity related macros
 #define SERVER_HOSTNAME "cse01.cse.unt.edu"
 #define SERVER_PORT 27015
@@ -23,4 +56,10 @@ int abort_with_errno(int, const char *);
 int abort_with_message(const char *);
 int handle_bad_rw_result(ssize_t, const char *);
 
+// parse a numeric command-line option and check its range
+int parse_option(const char *, double, double, double *);
+
+// drive a connection's handshake over a blocking socket until it is done
+int run_handshake(int, FILE *, mytcp_conn_t *, const mytcp_t *);
+
 #endif //CSCE3530_LAB3_COMMON_H
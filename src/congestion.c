@@ -0,0 +1,265 @@
+#include "congestion.h"
+
+#include <string.h>
+#include <strings.h>
+
+
+// upper bound on cwnd, far above any window the 16-bit receive field can advertise
+#define CC_MAX_WINDOW (1u << 30)
+
+static const mytcp_cc_ops_t *ALGORITHMS[] = { &MYTCP_CC_RENO, &MYTCP_CC_CUBIC };
+
+/**
+ * Set a window, clamped to what the sender can always use: at least one segment, at most CC_MAX_WINDOW.
+ *
+ * @param cc The congestion state
+ * @param window The window in bytes
+ */
+static void cc_set_cwnd(mytcp_cc_t *cc, double window)
+{
+    if (window < cc->mss) window = cc->mss;
+    if (window > CC_MAX_WINDOW) window = CC_MAX_WINDOW;
+    cc->cwnd = (uint32_t) window;
+}
+
+/**
+ * Cube root by Newton's method, so the simulator does not need libm.
+ *
+ * @param x A non-negative number
+ * @return Its cube root
+ */
+static double cc_cbrt(double x)
+{
+    if (x <= 0) return 0;
+
+    // start from the power of two just above the root, where Newton's method converges quickly from above
+    double r = 1;
+    while (r * r * r < x) r *= 2;
+    for (int i = 0; i < 8; i++) r -= (r * r * r - x) / (3 * r * r);
+    return r;
+}
+
+/* RENO */
+
+/**
+ * Reno's answer to a loss: halve the window.
+ *
+ * @param cc The congestion state
+ * @param now The current time
+ */
+static void reno_loss(mytcp_cc_t *cc, uint64_t now)
+{
+    (void) now;
+    cc->ssthresh = cc->cwnd / 2 > 2 * cc->mss ? cc->cwnd / 2 : 2 * cc->mss;
+    cc->cwnd = cc->ssthresh;
+    cc->bytes_acked = 0;
+}
+
+/**
+ * Reno's congestion avoidance: one segment more per window acknowledged (appropriate byte counting, RFC 3465), so
+ * the window grows linearly with the round trips whatever the number of acknowledgments.
+ *
+ * @param cc The congestion state
+ * @param acked The bytes newly acknowledged
+ * @param now The current time
+ */
+static void reno_grow(mytcp_cc_t *cc, uint32_t acked, uint64_t now)
+{
+    (void) now;
+    cc->bytes_acked += acked;
+    while (cc->bytes_acked >= cc->cwnd)
+    {
+        cc->bytes_acked -= cc->cwnd;
+        cc_set_cwnd(cc, (double) cc->cwnd + cc->mss);
+    }
+}
+
+const mytcp_cc_ops_t MYTCP_CC_RENO = { "reno", reno_loss, reno_grow };
+
+/* CUBIC */
+
+/**
+ * CUBIC's answer to a loss: remember the window as the plateau of the next curve (lower, if the window did not even
+ * get back to the previous plateau, to yield to newer flows), and reduce it by CC_CUBIC_BETA.
+ *
+ * @param cc The congestion state
+ * @param now The current time
+ */
+static void cubic_loss(mytcp_cc_t *cc, uint64_t now)
+{
+    (void) now;
+    double w = (double) cc->cwnd / cc->mss;
+    cc->w_max = w < cc->w_max ? w * (1 + CC_CUBIC_BETA) / 2 : w;
+    cc->epoch = 0;
+
+    uint32_t reduced = (uint32_t) (cc->cwnd * CC_CUBIC_BETA);
+    cc->ssthresh = reduced > 2 * cc->mss ? reduced : 2 * cc->mss;
+    cc->cwnd = cc->ssthresh;
+}
+
+/**
+ * CUBIC's congestion avoidance: the window follows W(t) = C (t - K)^3 + W_max from the start of the epoch, concave up
+ * to the last plateau and convex beyond it, independently of the RTT. The window moves towards where the curve will
+ * be one RTT from now; where Reno would be faster (short RTTs, small windows), it follows Reno's estimate instead.
+ *
+ * @param cc The congestion state
+ * @param acked The bytes newly acknowledged
+ * @param now The current time
+ */
+static void cubic_grow(mytcp_cc_t *cc, uint32_t acked, uint64_t now)
+{
+    double w = (double) cc->cwnd / cc->mss, segments = (double) acked / cc->mss;
+
+    if (cc->epoch == 0)
+    {
+        cc->epoch = now;
+        cc->k = w < cc->w_max ? cc_cbrt((cc->w_max - w) / CC_CUBIC_C) : 0;
+        if (w >= cc->w_max) cc->w_max = w;
+        cc->w_est = w;
+    }
+
+    double t = (double) (now - cc->epoch) / 1e9 + (double) cc->srtt / 1e9 - cc->k;
+    double target = cc->w_max + CC_CUBIC_C * t * t * t;
+    if (target < w) target = w;
+    if (target > 1.5 * w) target = 1.5 * w;
+
+    // Reno's growth with CUBIC's reduction factor, up to the plateau; plain Reno's beyond it
+    double alpha = cc->w_est < cc->w_max ? 3 * (1 - CC_CUBIC_BETA) / (1 + CC_CUBIC_BETA) : 1;
+    cc->w_est += alpha * segments / w;
+
+    double next = w + (target - w) / w * segments;
+    if (cc->w_est > next) next = cc->w_est;
+    cc_set_cwnd(cc, next * cc->mss);
+}
+
+const mytcp_cc_ops_t MYTCP_CC_CUBIC = { "cubic", cubic_loss, cubic_grow };
+
+/* COMMON */
+
+/**
+ * Look a congestion control algorithm up by name.
+ *
+ * @param name The name, case insensitive
+ * @return The algorithm, or NULL if there is none by that name
+ */
+const mytcp_cc_ops_t *mytcp_cc_find(const char *name)
+{
+    for (size_t i = 0; i < sizeof(ALGORITHMS) / sizeof(ALGORITHMS[0]); i++)
+        if (strcasecmp(ALGORITHMS[i]->name, name) == 0) return ALGORITHMS[i];
+    return NULL;
+}
+
+/**
+ * Set up the congestion state of a connection about to send: CC_INITIAL_SEGMENTS segments, in slow start until the
+ * first loss.
+ *
+ * @param cc The congestion state to initialize
+ * @param ops The algorithm
+ * @param mss The sender's largest payload per segment
+ */
+void mytcp_cc_init(mytcp_cc_t *cc, const mytcp_cc_ops_t *ops, uint16_t mss)
+{
+    bzero(cc, sizeof(*cc));
+    cc->ops = ops;
+    cc->mss = mss;
+    cc->cwnd = CC_INITIAL_SEGMENTS * (uint32_t) mss;
+    cc->ssthresh = CC_MAX_WINDOW;
+}
+
+/**
+ * Take an acknowledgment of new data. During fast recovery, an acknowledgment that does not cover everything sent
+ * before the loss deflates the window by what it acknowledged; one that does ends the recovery at ssthresh.
+ * Otherwise the window grows: by the bytes acknowledged in slow start, by the algorithm beyond ssthresh; but only
+ * while it is what limits the sender, so a window the peer or the application keeps from being used does not grow
+ * without bound (RFC 7661).
+ *
+ * @param cc The congestion state
+ * @param acked The bytes newly acknowledged
+ * @param total The bytes acknowledged so far, including these
+ * @param limited True if the window was full when the acknowledgment arrived
+ * @param now The current time
+ */
+void mytcp_cc_ack(mytcp_cc_t *cc, uint32_t acked, uint64_t total, bool limited, uint64_t now)
+{
+    cc->dupacks = 0;
+
+    if (cc->recovering)
+    {
+        if (total < cc->recover)
+        {
+            cc_set_cwnd(cc, cc->cwnd > acked ? (double) (cc->cwnd - acked) + cc->mss : cc->mss);
+            return;
+        }
+        cc->recovering = false;
+        cc->cwnd = cc->ssthresh;
+        return;
+    }
+    if (!limited) return;
+
+    if (cc->cwnd < cc->ssthresh)
+    {
+        uint32_t room = cc->ssthresh - cc->cwnd, grown = acked < room ? acked : room;
+        cc_set_cwnd(cc, (double) cc->cwnd + grown);
+        acked -= grown;
+    }
+    if (acked > 0) cc->ops->grow(cc, acked, now);
+}
+
+/**
+ * Take an acknowledgment of nothing new while data is in flight. The CC_DUPACK_THRESHOLD-th in a row means a segment
+ * was lost: the algorithm reduces the window and fast recovery starts, inflating the window by the segments the
+ * duplicates show have left the network; further duplicates inflate it by one segment each.
+ *
+ * @param cc The congestion state
+ * @param sent The bytes sent so far; recovery lasts until they are all acknowledged
+ * @param now The current time
+ * @return True iff the sender should retransmit now (fast retransmit)
+ */
+bool mytcp_cc_duplicate(mytcp_cc_t *cc, uint64_t sent, uint64_t now)
+{
+    if (cc->recovering)
+    {
+        cc_set_cwnd(cc, (double) cc->cwnd + cc->mss);
+        return false;
+    }
+
+    if (++cc->dupacks < CC_DUPACK_THRESHOLD) return false;
+
+    cc->ops->loss(cc, now);
+    cc_set_cwnd(cc, (double) cc->cwnd + CC_DUPACK_THRESHOLD * cc->mss);
+    cc->recovering = true;
+    cc->recover = sent;
+    cc->dupacks = 0;
+    cc->losses++;
+    return true;
+}
+
+/**
+ * Take a round-trip time sample (never one of a retransmitted segment, which is ambiguous) into the smoothed RTT.
+ *
+ * @param cc The congestion state
+ * @param sample The round-trip time in nanoseconds
+ */
+void mytcp_cc_rtt(mytcp_cc_t *cc, uint64_t sample)
+{
+    cc->srtt = cc->srtt == 0 ? sample : (7 * cc->srtt + sample) / 8;
+}
+
+/**
+ * The retransmission timer expired: the algorithm answers the loss, then the window collapses to one segment and
+ * slow start begins again.
+ *
+ * @param cc The congestion state
+ * @param now The current time
+ */
+void mytcp_cc_timeout(mytcp_cc_t *cc, uint64_t now)
+{
+    // a window inflated by fast recovery is not what was in flight
+    if (cc->recovering) cc->cwnd = cc->ssthresh;
+    cc->ops->loss(cc, now);
+    cc->cwnd = cc->mss;
+    cc->recovering = false;
+    cc->dupacks = 0;
+    cc->bytes_acked = 0;
+    cc->timeouts++;
+}
@@ -0,0 +1,65 @@
+#ifndef CSCE3530_LAB3_CONGESTION_H
+#define CSCE3530_LAB3_CONGESTION_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+// initial window in segments (RFC 6928), and the duplicate acknowledgments that signal a loss (RFC 5681)
+#define CC_INITIAL_SEGMENTS 10
+#define CC_DUPACK_THRESHOLD 3
+
+// CUBIC constants (RFC 9438): window reduction factor and scaling constant
+#define CC_CUBIC_BETA 0.7
+#define CC_CUBIC_C 0.4
+
+struct mytcp_cc;
+
+// a congestion control algorithm: how it answers a loss and how it grows the window in congestion avoidance; slow
+// start, fast recovery and RTT estimation are common to all of them (see mytcp_cc_ack())
+typedef struct mytcp_cc_ops
+{
+    const char *name;
+    void (*loss)(struct mytcp_cc *, uint64_t);              // set ssthresh (and cwnd) after a loss, at a time in ns
+    void (*grow)(struct mytcp_cc *, uint32_t, uint64_t);    // bytes newly acknowledged in congestion avoidance
+} mytcp_cc_ops_t;
+
+// congestion state of one connection; windows are in bytes, times in nanoseconds
+typedef struct mytcp_cc
+{
+    const mytcp_cc_ops_t *ops;
+    uint32_t mss;
+    uint32_t cwnd;
+    uint32_t ssthresh;
+    uint32_t dupacks;           // duplicate acknowledgments in a row
+    bool recovering;            // in fast recovery until everything sent before the loss is acknowledged
+    uint64_t recover;           // bytes sent when the loss was detected
+    uint64_t srtt;              // smoothed round-trip time, 0 until the first sample
+    uint64_t losses;            // fast retransmits
+    uint64_t timeouts;
+
+    // Reno: bytes acknowledged towards the next one-segment increase
+    uint32_t bytes_acked;
+
+    // CUBIC, in segments: the window the curve plateaus at (the window before the last reduction), when the current
+    // epoch started (0: not yet), the time in seconds to reach the plateau, and the Reno-friendly estimate
+    double w_max;
+    uint64_t epoch;
+    double k;
+    double w_est;
+} mytcp_cc_t;
+
+// the algorithms
+extern const mytcp_cc_ops_t MYTCP_CC_RENO;
+extern const mytcp_cc_ops_t MYTCP_CC_CUBIC;
+
+// look an algorithm up by name, NULL if there is none
+const mytcp_cc_ops_t *mytcp_cc_find(const char *);
+
+// set up, and feed the events a sender sees: new acknowledgment, duplicate acknowledgment, RTT sample, timeout
+void mytcp_cc_init(mytcp_cc_t *, const mytcp_cc_ops_t *, uint16_t);
+void mytcp_cc_ack(mytcp_cc_t *, uint32_t, uint64_t, bool, uint64_t);
+bool mytcp_cc_duplicate(mytcp_cc_t *, uint64_t, uint64_t);
+void mytcp_cc_rtt(mytcp_cc_t *, uint64_t);
+void mytcp_cc_timeout(mytcp_cc_t *, uint64_t);
+
+#endif //CSCE3530_LAB3_CONGESTION_H
@@ -0,0 +1,428 @@
+#include "connection.h"
+
+#include <string.h>
+
+
+// names as arrays to make printing easier later
+const char *STATE_NAMES[NUM_STATES] = {
+        "CLOSED", "LISTEN", "SYN_SENT", "SYN_RCVD", "ESTABLISHED",
+        "FIN_WAIT_1", "FIN_WAIT_2", "CLOSE_WAIT", "LAST_ACK", "TIME_WAIT"
+};
+
+const char *SEGMENT_KIND_NAMES[NUM_SEGMENT_KINDS] = {
+        "nothing", "connection request", "connection granted", "connection acknowledgment",
+        "close request", "close acknowledgment"
+};
+
+const char *CONN_ERROR_NAMES[NUM_CONN_ERRORS] = {
+        "OK", "invalid checksum", "unexpected flags", "bad sequence number", "bad acknowledgment number",
+        "segment not expected in this state", "duplicate segment"
+};
+
+// how an incoming segment's sequence or acknowledgment number is checked
+enum number_rule
+{
+    NUMBER_ANY,                 // not checked
+    NUMBER_EXPECT,              // must match what we expect
+    NUMBER_EXPECT_IF_SYNCED     // must match if synchronized; otherwise sequence is learned and ack must be zero
+};
+
+// what a state does with an incoming segment
+struct transition
+{
+    mytcp_segment_kind_t expecting;
+    uint16_t required;          // flags that must be set
+    uint16_t forbidden;         // flags that must be clear; a retransmitted SYN or FIN is caught as a duplicate first
+    enum number_rule seq;       // compared against rcv_nxt
+    enum number_rule ack;       // compared against snd_nxt
+    uint16_t respond;           // flags of the response segment, or 0 for no response
+    mytcp_state_t next;
+};
+
+#define BIT(flag) ((uint16_t) (1 << (flag)))
+
+// incoming segment handling, indexed by state; states with no required flags accept no segments. No segment may
+// carry RST, and FIN_WAIT_1 allows FIN, as the peer's close request may stand in for its lost close acknowledgment
+static const struct transition TRANSITIONS[NUM_STATES] = {
+        [STATE_LISTEN]      = { SEGMENT_CONN_REQUEST,  BIT(FLAG_SYN), BIT(FLAG_ACK) | BIT(FLAG_FIN) | BIT(FLAG_RST),
+                                NUMBER_ANY,              NUMBER_ANY, BIT(FLAG_SYN) | BIT(FLAG_ACK), STATE_SYN_RCVD },
+        [STATE_SYN_SENT]    = { SEGMENT_CONN_GRANTED,  BIT(FLAG_SYN) | BIT(FLAG_ACK), BIT(FLAG_FIN) | BIT(FLAG_RST),
+                                NUMBER_ANY,              NUMBER_EXPECT, BIT(FLAG_ACK), STATE_ESTABLISHED },
+        [STATE_SYN_RCVD]    = { SEGMENT_CONN_ACK,      BIT(FLAG_ACK), BIT(FLAG_SYN) | BIT(FLAG_FIN) | BIT(FLAG_RST),
+                                NUMBER_EXPECT,           NUMBER_EXPECT, 0, STATE_ESTABLISHED },
+        [STATE_ESTABLISHED] = { SEGMENT_CLOSE_REQUEST, BIT(FLAG_FIN), BIT(FLAG_SYN) | BIT(FLAG_RST),
+                                NUMBER_EXPECT_IF_SYNCED, NUMBER_EXPECT_IF_SYNCED, BIT(FLAG_ACK), STATE_CLOSE_WAIT },
+        [STATE_FIN_WAIT_1]  = { SEGMENT_CLOSE_ACK,     BIT(FLAG_ACK), BIT(FLAG_SYN) | BIT(FLAG_RST),
+                                NUMBER_EXPECT_IF_SYNCED, NUMBER_EXPECT, 0, STATE_FIN_WAIT_2 },
+        [STATE_FIN_WAIT_2]  = { SEGMENT_CLOSE_REQUEST, BIT(FLAG_FIN), BIT(FLAG_SYN) | BIT(FLAG_RST),
+                                NUMBER_EXPECT,           NUMBER_EXPECT, BIT(FLAG_ACK), STATE_TIME_WAIT },
+        [STATE_LAST_ACK]    = { SEGMENT_CLOSE_ACK,     BIT(FLAG_ACK), BIT(FLAG_SYN) | BIT(FLAG_FIN) | BIT(FLAG_RST),
+                                NUMBER_EXPECT,           NUMBER_EXPECT, 0, STATE_CLOSED },
+};
+
+/**
+ * Build an outgoing segment from the connection's current numbers and advance snd_nxt if it consumes a sequence
+ * number (SYN and FIN do). The segment is also kept for retransmission, after any others sent for the same event.
+ *
+ * @param conn The connection sending the segment
+ * @param out Where to write the segment
+ * @param flags The flags to set
+ * @param ack The acknowledgment number to send
+ */
+static void conn_emit(mytcp_conn_t *conn, mytcp_t *out, uint16_t flags, uint32_t ack)
+{
+    // start from the connection's header, whose checksum is already valid, and patch it incrementally
+    *out = conn->header;
+    mytcp_set_sequence(out, conn->snd_nxt);
+    mytcp_set_acknowledgment(out, ack);
+    for (uint8_t i = FLAG_FIN; i < NUM_FLAGS; i++)
+        if (flags & BIT(i)) mytcp_set_flag(out, i);
+
+    if (flags & (BIT(FLAG_SYN) | BIT(FLAG_FIN))) conn->snd_nxt++;
+    if (flags & BIT(FLAG_FIN)) conn->closing = true;
+    if (conn->nsent < 2) conn->sent[conn->nsent++] = *out;
+}
+
+/**
+ * Initialize a connection. Use STATE_CLOSED for a client about to open, STATE_LISTEN for a server awaiting an open,
+ * and STATE_ESTABLISHED for either side of a simulated close on a connection that was never actually opened.
+ * Our initial sequence number is chosen here, along with the header every outgoing segment starts from.
+ *
+ * @param conn The connection to initialize
+ * @param local_port Our port, used as srcport on outgoing segments
+ * @param remote_port The peer's port, used as destport on outgoing segments
+ * @param initial The state to start in
+ */
+void mytcp_conn_init(mytcp_conn_t *conn, uint16_t local_port, uint16_t remote_port, mytcp_state_t initial)
+{
+    bzero(conn, sizeof(*conn));
+    conn->state = initial;
+    conn->header = mytcp_create_segment(local_port, remote_port);
+    conn->snd_nxt = conn->header.sequence;
+}
+
+/**
+ * Initialize a passive connection for whichever handshake the peer's first segment starts: LISTEN for a connection
+ * request, (unsynchronized) ESTABLISHED for anything else, so a close request is accepted and any other segment is
+ * rejected as usual once it is fed to mytcp_conn_input().
+ *
+ * @param conn The connection to initialize
+ * @param local_port Our port, used as srcport on outgoing segments
+ * @param remote_port The peer's port, used as destport on outgoing segments
+ * @param first The first segment received from the peer
+ */
+void mytcp_conn_accept(mytcp_conn_t *conn, uint16_t local_port, uint16_t remote_port, const mytcp_t *first)
+{
+    mytcp_conn_init(conn, local_port, remote_port,
+                    mytcp_check_flag(first, FLAG_SYN) ? STATE_LISTEN : STATE_ESTABLISHED);
+}
+
+/**
+ * Set the receive window the connection advertises. Every segment it sends from now on carries it, since they all
+ * start from the connection's header.
+ *
+ * @param conn The connection
+ * @param window The number of payload bytes we are willing to receive
+ */
+void mytcp_conn_set_window(mytcp_conn_t *conn, uint16_t window)
+{
+    mytcp_set_window(&conn->header, window);
+}
+
+/**
+ * Answer a connection request without keeping a connection: validate it as LISTEN would and write the connection
+ * granted segment that a connection in SYN_RCVD with initial sequence number iss would send. Used for SYN cookies.
+ *
+ * @param local_port Our port, used as srcport on the response
+ * @param remote_port The peer's port, used as destport on the response
+ * @param iss Our initial sequence number (the cookie)
+ * @param in The connection request
+ * @param out Where to write the connection granted segment
+ * @return CONN_OK if the request was answered, else the reason it was rejected
+ */
+mytcp_conn_error_t mytcp_conn_grant_stateless(uint16_t local_port, uint16_t remote_port, uint32_t iss,
+                                              const mytcp_t *in, mytcp_t *out)
+{
+    mytcp_conn_t listener;
+    mytcp_conn_init(&listener, local_port, remote_port, STATE_LISTEN);
+    listener.snd_nxt = iss;
+
+    int nout;
+    return mytcp_conn_input(&listener, in, out, &nout);
+}
+
+/**
+ * Complete a connection from the peer's connection acknowledgment alone: rebuild the SYN_RCVD connection that
+ * mytcp_conn_grant_stateless() answered for, then feed it the acknowledgment (SYN_RCVD -> ESTABLISHED). The caller
+ * must have checked iss, since it is taken from the acknowledgment itself.
+ *
+ * @param conn The connection to initialize
+ * @param local_port Our port, used as srcport on outgoing segments
+ * @param remote_port The peer's port, used as destport on outgoing segments
+ * @param iss Our initial sequence number (the cookie the peer acknowledged)
+ * @param in The connection acknowledgment
+ * @return CONN_OK if the connection is now established, else the reason the acknowledgment was rejected
+ */
+mytcp_conn_error_t mytcp_conn_accept_stateless(mytcp_conn_t *conn, uint16_t local_port, uint16_t remote_port,
+                                               uint32_t iss, const mytcp_t *in)
+{
+    mytcp_conn_init(conn, local_port, remote_port, STATE_SYN_RCVD);
+    conn->snd_nxt = iss + 1;
+    conn->rcv_nxt = in->sequence;
+
+    int nout;
+    return mytcp_conn_input(conn, in, NULL, &nout);
+}
+
+/**
+ * Actively open a connection (CLOSED -> SYN_SENT).
+ *
+ * @param conn The connection to open
+ * @param out Where to write the connection request segment
+ * @return CONN_OK, or CONN_ERR_STATE if the connection is not closed
+ */
+mytcp_conn_error_t mytcp_conn_open(mytcp_conn_t *conn, mytcp_t *out)
+{
+    if (conn->state != STATE_CLOSED) return CONN_ERR_STATE;
+
+    conn->nsent = 0;
+    conn_emit(conn, out, BIT(FLAG_SYN), 0);
+    conn->state = STATE_SYN_SENT;
+    return CONN_OK;
+}
+
+/**
+ * Close a connection from our side (ESTABLISHED -> FIN_WAIT_1, or CLOSE_WAIT -> LAST_ACK).
+ *
+ * @param conn The connection to close
+ * @param out Where to write the close request segment
+ * @return CONN_OK, or CONN_ERR_STATE if the connection cannot be closed from its current state
+ */
+mytcp_conn_error_t mytcp_conn_close(mytcp_conn_t *conn, mytcp_t *out)
+{
+    switch (conn->state)
+    {
+        case STATE_ESTABLISHED:
+            conn->nsent = 0;
+            conn_emit(conn, out, BIT(FLAG_FIN), conn->synchronized ? conn->rcv_nxt : 0);
+            conn->state = STATE_FIN_WAIT_1;
+            return CONN_OK;
+
+        case STATE_CLOSE_WAIT:
+            // sent right after our close acknowledgment, so both are retransmitted together
+            conn_emit(conn, out, BIT(FLAG_FIN), conn->rcv_nxt);
+            conn->state = STATE_LAST_ACK;
+            return CONN_OK;
+
+        default:
+            return CONN_ERR_STATE;
+    }
+}
+
+/**
+ * Whether an incoming segment is a retransmission of one the connection already accepted: the peer's last SYN or FIN
+ * (which consumed the sequence number just before rcv_nxt), or a bare acknowledgment identical to the one that
+ * moved us to a state waiting for the peer's SYN or FIN.
+ *
+ * @param conn The connection
+ * @param t The transition of the connection's state
+ * @param in The incoming segment
+ * @return True iff the segment is a duplicate
+ */
+static bool conn_duplicate(const mytcp_conn_t *conn, const struct transition *t, const mytcp_t *in)
+{
+    if (conn->state == STATE_LISTEN || conn->state == STATE_SYN_SENT) return false;
+
+    if (in->flags & (BIT(FLAG_SYN) | BIT(FLAG_FIN))) return conn->nsent > 0 && in->sequence + 1 == conn->rcv_nxt;
+    return (in->flags & BIT(FLAG_ACK)) && (t->required & (BIT(FLAG_SYN) | BIT(FLAG_FIN)))
+           && (conn->synchronized || conn->closing) && in->sequence == conn->rcv_nxt
+           && in->acknowledgment == conn->snd_nxt;
+}
+
+/**
+ * Compile what a state's transition expects of an incoming segment, from the connection's current numbers.
+ *
+ * @param conn The connection
+ * @param t The transition of the connection's state
+ * @param expect Where to write the expectation
+ */
+static void conn_expect(const mytcp_conn_t *conn, const struct transition *t, mytcp_expect_t *expect)
+{
+    mytcp_expect_init(expect, t->required, t->forbidden);
+    if (conn->options) mytcp_expect_options(expect);
+
+    // sequence number must be the next one we expect from the peer
+    if (t->seq == NUMBER_EXPECT || (t->seq == NUMBER_EXPECT_IF_SYNCED && conn->synchronized))
+        mytcp_expect_sequence(expect, conn->rcv_nxt);
+
+    // acknowledgment must cover everything we sent; an unsynchronized close request carries none
+    if (t->ack == NUMBER_EXPECT) mytcp_expect_ack(expect, conn->snd_nxt);
+    if (t->ack == NUMBER_EXPECT_IF_SYNCED) mytcp_expect_ack(expect, conn->synchronized ? conn->snd_nxt : 0);
+}
+
+/**
+ * Feed one incoming segment to a connection. The segment is validated against the current state's transition;
+ * if it is accepted the connection advances and a response may be produced.
+ * The connection is left untouched if the segment is rejected. A retransmission of a segment already accepted,
+ * which means our answer to it was lost, is rejected as CONN_ERR_DUPLICATE; mytcp_conn_retransmit() produces the
+ * answer again (if it needed one).
+ *
+ * @param conn The connection receiving the segment
+ * @param in The incoming segment
+ * @param out Where to write the response segment, if any
+ * @param nout Set to the number of response segments written (0 or 1)
+ * @return CONN_OK if the segment was accepted, else the reason it was rejected
+ */
+mytcp_conn_error_t mytcp_conn_input(mytcp_conn_t *conn, const mytcp_t *in, mytcp_t *out, int *nout)
+{
+    const struct transition *t = &TRANSITIONS[conn->state];
+    *nout = 0;
+
+    mytcp_expect_t expect;
+    conn_expect(conn, t, &expect);
+    uint32_t invalid = mytcp_validate(in, &expect);
+
+    if (invalid & INVALID_CHECKSUM) return CONN_ERR_CHECKSUM;
+    if (conn_duplicate(conn, t, in)) return CONN_ERR_DUPLICATE;
+
+    // the peer's close request also acknowledges ours, so if its close acknowledgment was lost, take both at once
+    const struct transition *fin_wait_2 = &TRANSITIONS[STATE_FIN_WAIT_2];
+    if (conn->state == STATE_FIN_WAIT_1 && (in->flags & BIT(FLAG_FIN)) && !(in->flags & fin_wait_2->forbidden)
+        && in->acknowledgment == conn->snd_nxt && (!conn->synchronized || in->sequence == conn->rcv_nxt))
+    {
+        // that is everything FIN_WAIT_2 checks, except the header length, which every state checks alike; rcv_nxt
+        // is taken from the FIN below, once the segment is accepted
+        t = fin_wait_2;
+        invalid &= INVALID_OFFSET;
+    }
+
+    // of several failures, the first of these is the reason
+    if (t->required == 0) return CONN_ERR_STATE;
+    if (invalid & (INVALID_FLAGS | INVALID_OFFSET)) return CONN_ERR_FLAGS;
+    if (invalid & INVALID_SEQUENCE) return CONN_ERR_SEQUENCE;
+    if (invalid & INVALID_ACK) return CONN_ERR_ACK;
+
+    // accepted: SYN and FIN each consume a sequence number
+    conn->rcv_nxt = in->sequence + ((in->flags & (BIT(FLAG_SYN) | BIT(FLAG_FIN))) ? 1 : 0);
+    conn->snd_wnd = in->receive;
+    conn->nsent = 0;
+    conn->retries = 0;
+    if (in->flags & BIT(FLAG_FIN)) conn->closing = true;
+    if (t->next == STATE_ESTABLISHED) conn->synchronized = true;
+    conn->state = t->next;
+
+    if (t->respond != 0)
+    {
+        conn_emit(conn, out, t->respond, conn->rcv_nxt);
+        *nout = 1;
+    }
+
+    return CONN_OK;
+}
+
+/**
+ * Produce again the segments the connection sent in answer to the latest event: our request if the peer has not
+ * answered it, or our answer to the peer's last segment if the peer sent it again.
+ *
+ * @param conn The connection
+ * @param out Where to write the segments; room for two
+ * @return The number of segments written (0 if the latest event needed no answer)
+ */
+int mytcp_conn_retransmit(const mytcp_conn_t *conn, mytcp_t *out)
+{
+    for (int i = 0; i < conn->nsent; i++) out[i] = conn->sent[i];
+    return conn->nsent;
+}
+
+/**
+ * The peer has not answered within the retransmission timeout: retransmit, and back off so the next timeout is twice
+ * as long. Over a stream, which cannot lose segments, callers only count the timeout and discard the segments.
+ *
+ * @param conn The connection
+ * @param out Where to write the segments to retransmit; room for two
+ * @return The number of segments written, or -1 if the retries are used up and the handshake has timed out
+ */
+int mytcp_conn_timeout(mytcp_conn_t *conn, mytcp_t *out)
+{
+    if (conn->retries == CONN_MAX_RETRIES) return -1;
+    conn->retries++;
+    return mytcp_conn_retransmit(conn, out);
+}
+
+/**
+ * How long to wait for the peer before the next timeout.
+ *
+ * @param conn The connection
+ * @return The retransmission timeout in milliseconds: CONN_RTO_MS doubled once per retry so far, capped
+ */
+uint32_t mytcp_conn_rto(const mytcp_conn_t *conn)
+{
+    uint32_t rto = (uint32_t) CONN_RTO_MS << conn->retries;
+    return rto < CONN_RTO_MAX_MS ? rto : CONN_RTO_MAX_MS;
+}
+
+/**
+ * Whether a connection that is done should stay around for CONN_TIME_WAIT_MS: it sent the last segment of the
+ * exchange (the final acknowledgment of an open or a close), so if that segment is lost, the peer retransmits and
+ * only we can answer.
+ *
+ * @param conn The connection
+ * @return True iff the connection should linger
+ */
+bool mytcp_conn_lingers(const mytcp_conn_t *conn)
+{
+    return mytcp_conn_done(conn) && conn->nsent > 0;
+}
+
+/**
+ * Which kind of segment the connection is waiting for.
+ *
+ * @param conn The connection
+ * @return The expected segment kind, or SEGMENT_NONE if the connection is not waiting for the peer
+ */
+mytcp_segment_kind_t mytcp_conn_expecting(const mytcp_conn_t *conn)
+{
+    if (mytcp_conn_done(conn)) return SEGMENT_NONE;
+    return TRANSITIONS[conn->state].expecting;
+}
+
+/**
+ * Classify a segment sent or received on a connection. Must be called right after the segment was produced or
+ * accepted, since a bare ACK is told apart by whether the connection is closing.
+ *
+ * @param conn The connection the segment belongs to
+ * @param seg The segment to classify
+ * @return The segment's kind
+ */
+mytcp_segment_kind_t mytcp_conn_kind(const mytcp_conn_t *conn, const mytcp_t *seg)
+{
+    bool syn = mytcp_check_flag(seg, FLAG_SYN);
+    bool ack = mytcp_check_flag(seg, FLAG_ACK);
+
+    if (syn) return ack ? SEGMENT_CONN_GRANTED : SEGMENT_CONN_REQUEST;
+    if (mytcp_check_flag(seg, FLAG_FIN)) return SEGMENT_CLOSE_REQUEST;
+    if (ack) return conn->closing ? SEGMENT_CLOSE_ACK : SEGMENT_CONN_ACK;
+    return SEGMENT_NONE;
+}
+
+/**
+ * Whether the simulated exchange on a connection has finished: it is open after an open handshake, or
+ * fully closed after a close handshake.
+ *
+ * @param conn The connection
+ * @return True iff nothing more is expected from either side
+ */
+bool mytcp_conn_done(const mytcp_conn_t *conn)
+{
+    switch (conn->state)
+    {
+        case STATE_ESTABLISHED:
+            return conn->synchronized;
+        case STATE_TIME_WAIT:
+            return true;
+        case STATE_CLOSED:
+            return conn->closing;
+        default:
+            return false;
+    }
+}
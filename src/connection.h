@@ -0,0 +1,109 @@
+#ifndef CSCE3530_LAB3_CONNECTION_H
+#define CSCE3530_LAB3_CONNECTION_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include "mytcp.h"
+
+// retransmission timeout: doubled after every retransmission, up to the maximum; a handshake whose peer has not
+// answered after CONN_MAX_RETRIES retransmissions has timed out
+#define CONN_RTO_MS 200
+#define CONN_RTO_MAX_MS 3200
+#define CONN_MAX_RETRIES 5
+
+// how long a connection that sent the exchange's last segment stays around to answer the peer in case that segment
+// was lost (TIME_WAIT; 2 MSL, shortened for the simulation)
+#define CONN_TIME_WAIT_MS 2000
+
+// connection states (RFC 793 names)
+typedef enum mytcp_state
+{
+    STATE_CLOSED,
+    STATE_LISTEN,
+    STATE_SYN_SENT,
+    STATE_SYN_RCVD,
+    STATE_ESTABLISHED,
+    STATE_FIN_WAIT_1,
+    STATE_FIN_WAIT_2,
+    STATE_CLOSE_WAIT,
+    STATE_LAST_ACK,
+    STATE_TIME_WAIT,
+    NUM_STATES
+} mytcp_state_t;
+
+// kinds of segments exchanged during the simulated handshakes, used for titles and messages
+typedef enum mytcp_segment_kind
+{
+    SEGMENT_NONE,
+    SEGMENT_CONN_REQUEST,
+    SEGMENT_CONN_GRANTED,
+    SEGMENT_CONN_ACK,
+    SEGMENT_CLOSE_REQUEST,
+    SEGMENT_CLOSE_ACK,
+    NUM_SEGMENT_KINDS
+} mytcp_segment_kind_t;
+
+// reasons an incoming segment can be rejected
+typedef enum mytcp_conn_error
+{
+    CONN_OK,
+    CONN_ERR_CHECKSUM,
+    CONN_ERR_FLAGS,
+    CONN_ERR_SEQUENCE,
+    CONN_ERR_ACK,
+    CONN_ERR_STATE,
+    CONN_ERR_DUPLICATE,     // a retransmission of a segment already accepted; resend our answer
+    NUM_CONN_ERRORS
+} mytcp_conn_error_t;
+
+// state of one simulated connection; no I/O is performed on it, so any number can be multiplexed
+typedef struct mytcp_conn
+{
+    mytcp_state_t state;
+    mytcp_t header;         // ports and offset of outgoing segments, with a valid checksum
+    uint32_t snd_nxt;       // sequence number of the next segment we send
+    uint32_t rcv_nxt;       // sequence number we expect next from the peer
+    uint16_t snd_wnd;       // window the peer advertised in its latest accepted segment
+    bool synchronized;      // false when simulating a close on a connection that was never opened
+    bool closing;           // true once a FIN has been sent or received
+    bool options;           // incoming segments may carry options past the fixed header (whole headers are read)
+    uint8_t nsent;          // segments we sent in answer to the latest event, kept in sent[] for retransmission
+    uint8_t retries;        // retransmissions since the peer last answered
+    mytcp_t sent[2];
+} mytcp_conn_t;
+
+// names as arrays to make printing easier later
+extern const char *STATE_NAMES[NUM_STATES];
+extern const char *SEGMENT_KIND_NAMES[NUM_SEGMENT_KINDS];
+extern const char *CONN_ERROR_NAMES[NUM_CONN_ERRORS];
+
+// initialize a connection in CLOSED, LISTEN or (unsynchronized) ESTABLISHED
+void mytcp_conn_init(mytcp_conn_t *, uint16_t, uint16_t, mytcp_state_t);
+
+// initialize a server-side connection in LISTEN or ESTABLISHED, depending on the peer's first segment
+void mytcp_conn_accept(mytcp_conn_t *, uint16_t, uint16_t, const mytcp_t *);
+
+// advertise a receive window in every segment the connection sends from now on
+void mytcp_conn_set_window(mytcp_conn_t *, uint16_t);
+
+// SYN cookies: answer a connection request without state, and establish a connection from its acknowledgment alone
+mytcp_conn_error_t mytcp_conn_grant_stateless(uint16_t, uint16_t, uint32_t, const mytcp_t *, mytcp_t *);
+mytcp_conn_error_t mytcp_conn_accept_stateless(mytcp_conn_t *, uint16_t, uint16_t, uint32_t, const mytcp_t *);
+
+// events: active open, application close, incoming segment
+mytcp_conn_error_t mytcp_conn_open(mytcp_conn_t *, mytcp_t *);
+mytcp_conn_error_t mytcp_conn_close(mytcp_conn_t *, mytcp_t *);
+mytcp_conn_error_t mytcp_conn_input(mytcp_conn_t *, const mytcp_t *, mytcp_t *, int *);
+
+// retransmission: resend our latest segments (after a duplicate, or a timeout that backs off exponentially)
+int mytcp_conn_retransmit(const mytcp_conn_t *, mytcp_t *);
+int mytcp_conn_timeout(mytcp_conn_t *, mytcp_t *);
+uint32_t mytcp_conn_rto(const mytcp_conn_t *);
+bool mytcp_conn_lingers(const mytcp_conn_t *);
+
+// introspection
+mytcp_segment_kind_t mytcp_conn_expecting(const mytcp_conn_t *);
+mytcp_segment_kind_t mytcp_conn_kind(const mytcp_conn_t *, const mytcp_t *);
+bool mytcp_conn_done(const mytcp_conn_t *);
+
+#endif //CSCE3530_LAB3_CONNECTION_H
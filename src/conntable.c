@@ -0,0 +1,332 @@
+#include "conntable.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mytcp.h"
+
+// control word layout: the low 16 bits hold the probe distance + 1 (0: empty slot), the high 16 bits a hash tag
+#define CTRL_DIST(c) ((c) & 0xFFFFu)
+#define CTRL_MOVED 0xFFFFu
+
+// old slots moved per insert/remove while resizing; enough to drain the old array before the new one fills up
+#define TABLE_MIGRATE_STEP 16
+
+
+/**
+ * Hash a tuple. The table's random seed keeps clients from choosing addresses that all collide.
+ *
+ * @param t The table
+ * @param key The tuple
+ * @return 64 well-mixed bits: the low bits pick the home slot, the top 16 bits are the tag
+ */
+static uint64_t table_hash(const mytcp_table_t *t, const mytcp_tuple_t *key)
+{
+    uint64_t h = ((uint64_t) key->src_addr << 32 | key->dest_addr) ^ t->seed;
+    h ^= ((uint64_t) key->srcport << 16 | key->destport) * 0x9E3779B97F4A7C15ull;
+
+    // murmur3 finalizer
+    h = (h ^ (h >> 33)) * 0xFF51AFD7ED558CCDull;
+    h = (h ^ (h >> 33)) * 0xC4CEB9FE1A85EC53ull;
+    return h ^ (h >> 33);
+}
+
+static bool tuple_equal(const mytcp_tuple_t *a, const mytcp_tuple_t *b)
+{
+    return a->src_addr == b->src_addr && a->dest_addr == b->dest_addr && a->srcport == b->srcport
+           && a->destport == b->destport;
+}
+
+/**
+ * Allocate an empty slot array.
+ *
+ * @param s The slots to initialize
+ * @param nslots The number of slots; a power of two
+ * @return 0 on success, else an errno value
+ */
+static int slots_alloc(mytcp_table_slots_t *s, size_t nslots)
+{
+    s->ctrl = calloc(nslots, sizeof(*s->ctrl));
+    s->entries = malloc(nslots * sizeof(*s->entries));
+    if (s->ctrl == NULL || s->entries == NULL)
+    {
+        free(s->ctrl);
+        free(s->entries);
+        s->ctrl = NULL;
+        s->entries = NULL;
+        return ENOMEM;
+    }
+
+    s->mask = nslots - 1;
+    s->count = 0;
+    return 0;
+}
+
+static void slots_free(mytcp_table_slots_t *s)
+{
+    free(s->ctrl);
+    free(s->entries);
+    bzero(s, sizeof(*s));
+}
+
+/**
+ * Find a tuple's slot. Only the 4-byte control words are scanned until a tag matches; the probe stops at an empty
+ * slot, or at an entry closer to its home slot than the tuple would be (Robin Hood order guarantees it is absent).
+ *
+ * @param s The slots
+ * @param key The tuple
+ * @param h The tuple's hash
+ * @return The slot index, or -1 if the tuple is not stored here
+ */
+static ptrdiff_t slots_find(const mytcp_table_slots_t *s, const mytcp_tuple_t *key, uint64_t h)
+{
+    if (s->ctrl == NULL) return -1;
+
+    uint32_t tag = (uint32_t) (h >> 48);
+    size_t i = (size_t) h & s->mask;
+    for (uint32_t dist = 1;; dist++, i = (i + 1) & s->mask)
+    {
+        uint32_t c = s->ctrl[i];
+        if (CTRL_DIST(c) == 0) return -1;
+
+        // slots vacated by a resize keep probes going, since entries behind them were not shifted back
+        if (CTRL_DIST(c) == CTRL_MOVED) continue;
+        if (CTRL_DIST(c) < dist) return -1;
+        if (c >> 16 == tag && tuple_equal(&s->entries[i].key, key)) return (ptrdiff_t) i;
+    }
+}
+
+/**
+ * Store an entry, Robin Hood style: walking from its home slot, it takes the place of any entry that is closer to its
+ * own home slot, and that entry continues the walk instead. This keeps probe lengths short and even.
+ *
+ * @param s The slots, with at least one empty slot
+ * @param entry The entry
+ * @param h The hash of the entry's tuple
+ */
+static void slots_insert(mytcp_table_slots_t *s, mytcp_table_entry_t entry, uint64_t h)
+{
+    uint32_t ctrl = (uint32_t) (h >> 48) << 16 | 1;
+    for (size_t i = (size_t) h & s->mask;; i = (i + 1) & s->mask, ctrl++)
+    {
+        uint32_t c = s->ctrl[i];
+        if (CTRL_DIST(c) == 0)
+        {
+            s->ctrl[i] = ctrl;
+            s->entries[i] = entry;
+            s->count++;
+            return;
+        }
+
+        if (CTRL_DIST(c) < CTRL_DIST(ctrl))
+        {
+            mytcp_table_entry_t displaced = s->entries[i];
+            s->ctrl[i] = ctrl;
+            s->entries[i] = entry;
+            ctrl = c;
+            entry = displaced;
+        }
+    }
+}
+
+/**
+ * Empty a slot, shifting the entries after it back by one until one is in its home slot. No tombstones are left, so
+ * probe lengths do not degrade as connections come and go.
+ *
+ * @param s The slots
+ * @param i The slot index
+ */
+static void slots_erase(mytcp_table_slots_t *s, size_t i)
+{
+    for (;;)
+    {
+        size_t next = (i + 1) & s->mask;
+        uint32_t c = s->ctrl[next];
+        if (CTRL_DIST(c) <= 1)
+        {
+            s->ctrl[i] = 0;
+            break;
+        }
+
+        s->ctrl[i] = c - 1;
+        s->entries[i] = s->entries[next];
+        i = next;
+    }
+
+    s->count--;
+}
+
+/**
+ * Move up to a number of old slots' entries into the current array, and free the old array once it is drained.
+ * Moved slots are marked rather than emptied, so lookups still find the entries behind them.
+ *
+ * @param t The table, which is resizing
+ * @param nslots The number of old slots to visit
+ */
+static void table_migrate(mytcp_table_t *t, size_t nslots)
+{
+    mytcp_table_slots_t *old = &t->old;
+    for (; nslots > 0 && t->migrated <= old->mask; nslots--, t->migrated++)
+    {
+        uint32_t c = old->ctrl[t->migrated];
+        if (CTRL_DIST(c) == 0 || CTRL_DIST(c) == CTRL_MOVED) continue;
+
+        mytcp_table_entry_t *entry = &old->entries[t->migrated];
+        slots_insert(&t->cur, *entry, table_hash(t, &entry->key));
+        old->ctrl[t->migrated] = CTRL_MOVED;
+        old->count--;
+    }
+
+    if (t->migrated > old->mask) slots_free(old);
+}
+
+/**
+ * Start doubling the table: the current array becomes the old one, which is then drained a few slots at a time, so
+ * no single insert pays for rehashing every connection.
+ *
+ * @param t The table
+ * @return 0 on success, else an errno value
+ */
+static int table_grow(mytcp_table_t *t)
+{
+    // a resize still in progress is finished first
+    if (t->old.ctrl != NULL) table_migrate(t, t->old.mask + 1);
+
+    mytcp_table_slots_t bigger;
+    int err = slots_alloc(&bigger, (t->cur.mask + 1) * 2);
+    if (err != 0) return err;
+
+    t->old = t->cur;
+    t->cur = bigger;
+    t->migrated = 0;
+    return 0;
+}
+
+/**
+ * Create an empty table.
+ *
+ * @param t The table to initialize
+ * @param expected The number of connections expected; the table grows past it as needed
+ * @return 0 on success, else an errno value
+ */
+int mytcp_table_init(mytcp_table_t *t, size_t expected)
+{
+    bzero(t, sizeof(*t));
+    t->seed = (uint64_t) mytcp_generate_sequence() << 32 | mytcp_generate_sequence();
+
+    // room for the expected connections below the 7/8 load limit
+    size_t nslots = TABLE_MIN_SLOTS;
+    while (nslots / 8 * 7 < expected) nslots *= 2;
+    return slots_alloc(&t->cur, nslots);
+}
+
+/**
+ * Free a table. The values stored in it are left alone.
+ *
+ * @param t The table
+ */
+void mytcp_table_free(mytcp_table_t *t)
+{
+    slots_free(&t->cur);
+    slots_free(&t->old);
+}
+
+/**
+ * Look up a connection by its tuple.
+ *
+ * @param t The table
+ * @param key The tuple
+ * @return The connection's value, or NULL if it is not in the table
+ */
+void *mytcp_table_find(const mytcp_table_t *t, const mytcp_tuple_t *key)
+{
+    uint64_t h = table_hash(t, key);
+
+    ptrdiff_t i = slots_find(&t->cur, key, h);
+    if (i >= 0) return t->cur.entries[i].value;
+
+    i = slots_find(&t->old, key, h);
+    return i >= 0 ? t->old.entries[i].value : NULL;
+}
+
+/**
+ * Add a connection. Its tuple must not be in the table already.
+ *
+ * @param t The table
+ * @param key The tuple
+ * @param value The connection's value
+ * @return 0 on success, else an errno value (ENOMEM if the table had to grow and could not)
+ */
+int mytcp_table_insert(mytcp_table_t *t, const mytcp_tuple_t *key, void *value)
+{
+    if (t->old.ctrl != NULL) table_migrate(t, TABLE_MIGRATE_STEP);
+
+    if ((t->cur.count + 1) * 8 > (t->cur.mask + 1) * 7)
+    {
+        int err = table_grow(t);
+        if (err != 0) return err;
+    }
+
+    mytcp_table_entry_t entry = { .key = *key, .value = value };
+    slots_insert(&t->cur, entry, table_hash(t, key));
+    return 0;
+}
+
+/**
+ * Remove a connection.
+ *
+ * @param t The table
+ * @param key The tuple
+ * @return The connection's value, or NULL if it was not in the table
+ */
+void *mytcp_table_remove(mytcp_table_t *t, const mytcp_tuple_t *key)
+{
+    if (t->old.ctrl != NULL) table_migrate(t, TABLE_MIGRATE_STEP);
+
+    uint64_t h = table_hash(t, key);
+    ptrdiff_t i = slots_find(&t->cur, key, h);
+    if (i >= 0)
+    {
+        void *value = t->cur.entries[i].value;
+        slots_erase(&t->cur, (size_t) i);
+        return value;
+    }
+
+    // the old array is being drained in slot order, so it is only marked, never shifted
+    i = slots_find(&t->old, key, h);
+    if (i < 0) return NULL;
+    t->old.ctrl[i] = CTRL_MOVED;
+    t->old.count--;
+    return t->old.entries[i].value;
+}
+
+/**
+ * The number of connections in the table.
+ *
+ * @param t The table
+ * @return The number of connections
+ */
+size_t mytcp_table_size(const mytcp_table_t *t)
+{
+    return t->cur.count + t->old.count;
+}
+
+/**
+ * Call a function on every connection's value, in no particular order. The table must not be modified meanwhile.
+ *
+ * @param t The table
+ * @param fn The function, given a value and arg
+ * @param arg Passed to fn unchanged
+ */
+void mytcp_table_foreach(const mytcp_table_t *t, void (*fn)(void *, void *), void *arg)
+{
+    const mytcp_table_slots_t *parts[] = { &t->cur, &t->old };
+    for (size_t p = 0; p < 2; p++)
+    {
+        const mytcp_table_slots_t *s = parts[p];
+        if (s->ctrl == NULL) continue;
+
+        for (size_t i = 0; i <= s->mask; i++)
+            if (CTRL_DIST(s->ctrl[i]) != 0 && CTRL_DIST(s->ctrl[i]) != CTRL_MOVED) fn(s->entries[i].value, arg);
+    }
+}
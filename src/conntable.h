@@ -0,0 +1,58 @@
+#ifndef CSCE3530_LAB3_CONNTABLE_H
+#define CSCE3530_LAB3_CONNTABLE_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// smallest number of slots a table is created with; always a power of two
+#define TABLE_MIN_SLOTS 16
+
+// a connection's 4-tuple; all fields in network byte order, as found in struct sockaddr_in
+typedef struct mytcp_tuple
+{
+    uint32_t src_addr;
+    uint32_t dest_addr;
+    uint16_t srcport;
+    uint16_t destport;
+} mytcp_tuple_t;
+
+// a stored connection: its tuple and the caller's pointer for it
+typedef struct mytcp_table_entry
+{
+    mytcp_tuple_t key;
+    void *value;
+} mytcp_table_entry_t;
+
+// one Robin Hood hash array: a compact control word per slot (0 = empty), entries in a parallel array
+typedef struct mytcp_table_slots
+{
+    uint32_t *ctrl;             // 16-bit hash tag << 16 | probe distance + 1
+    mytcp_table_entry_t *entries;
+    size_t mask;                // number of slots - 1
+    size_t count;
+} mytcp_table_slots_t;
+
+// connection table keyed by 4-tuple; while growing, entries move from old to cur a few slots per insert/remove
+typedef struct mytcp_table
+{
+    mytcp_table_slots_t cur;
+    mytcp_table_slots_t old;    // old.ctrl is NULL unless a resize is in progress
+    size_t migrated;            // old slots below this index have been moved to cur
+    uint64_t seed;
+} mytcp_table_t;
+
+// setup and teardown; init returns 0 or an errno value
+int mytcp_table_init(mytcp_table_t *, size_t);
+void mytcp_table_free(mytcp_table_t *);
+
+// lookup, insert (the tuple must not be present yet; returns 0 or an errno value) and remove (returns the value)
+void *mytcp_table_find(const mytcp_table_t *, const mytcp_tuple_t *);
+int mytcp_table_insert(mytcp_table_t *, const mytcp_tuple_t *, void *);
+void *mytcp_table_remove(mytcp_table_t *, const mytcp_tuple_t *);
+
+// number of stored connections, and a visit of each (the table must not be modified meanwhile)
+size_t mytcp_table_size(const mytcp_table_t *);
+void mytcp_table_foreach(const mytcp_table_t *, void (*)(void *, void *), void *);
+
+#endif //CSCE3530_LAB3_CONNTABLE_H
@@ -0,0 +1,157 @@
+#include "histogram.h"
+
+#include <string.h>
+
+
+// the owning thread records while others may merge (e.g. to export live metrics): relaxed atomic accesses keep that
+// well defined and cost no more than plain ones; a merge may just miss the latest few values
+#define HIST_LOAD(field) __atomic_load_n(&(field), __ATOMIC_RELAXED)
+#define HIST_STORE(field, value) __atomic_store_n(&(field), (value), __ATOMIC_RELAXED)
+
+/**
+ * Map a value to its bucket. Values below HIST_SUB_COUNT get a bucket each; above that, every power of two is split
+ * into HIST_HALF_COUNT equal buckets.
+ *
+ * @param value The value
+ * @return The bucket index
+ */
+static size_t hist_index(uint64_t value)
+{
+    if (value < HIST_SUB_COUNT) return (size_t) value;
+
+    int msb = 63 - __builtin_clzll(value);
+    int shift = msb - (HIST_SUB_BITS - 1);
+    return (size_t) ((shift + 1) * HIST_HALF_COUNT + (int) (value >> shift) - HIST_HALF_COUNT);
+}
+
+/**
+ * The highest value that maps to a bucket.
+ *
+ * @param index The bucket index
+ * @return The bucket's upper bound
+ */
+static uint64_t hist_upper(size_t index)
+{
+    if (index < HIST_SUB_COUNT) return index;
+
+    int shift = (int) (index / HIST_HALF_COUNT) - 1;
+    uint64_t mantissa = index % HIST_HALF_COUNT + HIST_HALF_COUNT;
+    return ((mantissa + 1) << shift) - 1;
+}
+
+/**
+ * Initialize an empty histogram.
+ *
+ * @param h The histogram
+ */
+void mytcp_hist_init(mytcp_histogram_t *h)
+{
+    bzero(h, sizeof(*h));
+    h->min = UINT64_MAX;
+}
+
+/**
+ * Record one value (e.g. a latency in nanoseconds).
+ *
+ * @param h The histogram
+ * @param value The value to record
+ */
+void mytcp_hist_record(mytcp_histogram_t *h, uint64_t value)
+{
+    size_t index = hist_index(value);
+    HIST_STORE(h->counts[index], h->counts[index] + 1);
+    HIST_STORE(h->total, h->total + 1);
+    HIST_STORE(h->sum, h->sum + value);
+    if (value < h->min) HIST_STORE(h->min, value);
+    if (value > h->max) HIST_STORE(h->max, value);
+}
+
+/**
+ * Add every value recorded in one histogram to another. The source may be recording on another thread meanwhile.
+ *
+ * @param dst The histogram to add to
+ * @param src The histogram to add
+ */
+void mytcp_hist_merge(mytcp_histogram_t *dst, const mytcp_histogram_t *src)
+{
+    // the total is the sum of the buckets actually read, so it stays consistent with them
+    uint64_t total = 0;
+    for (size_t i = 0; i < HIST_BUCKETS; i++)
+    {
+        uint64_t count = HIST_LOAD(src->counts[i]);
+        dst->counts[i] += count;
+        total += count;
+    }
+    dst->total += total;
+    dst->sum += HIST_LOAD(src->sum);
+
+    uint64_t min = HIST_LOAD(src->min), max = HIST_LOAD(src->max);
+    if (min < dst->min) dst->min = min;
+    if (max > dst->max) dst->max = max;
+}
+
+/**
+ * Find the value below which a given percentage of recorded values fall.
+ *
+ * @param h The histogram
+ * @param percentile The percentile, e.g. 99.9
+ * @return The upper bound of the bucket holding the percentile (never above the maximum), or 0 if empty
+ */
+uint64_t mytcp_hist_percentile(const mytcp_histogram_t *h, double percentile)
+{
+    if (h->total == 0) return 0;
+
+    uint64_t rank = (uint64_t) (percentile / 100.0 * (double) h->total + 0.5);
+    if (rank < 1) rank = 1;
+    if (rank > h->total) rank = h->total;
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < HIST_BUCKETS; i++)
+    {
+        seen += h->counts[i];
+        if (seen >= rank)
+        {
+            uint64_t upper = hist_upper(i);
+            return upper < h->max ? upper : h->max;
+        }
+    }
+
+    return h->max;
+}
+
+/**
+ * Count the recorded values at most a given value, for cumulative buckets with bounds of one's choosing. Values are
+ * counted by whole buckets, and the bucket the bound falls inside is left out, so values up to ~3% below the bound
+ * may be missed; like mytcp_hist_percentile(), this errs towards reporting latencies as higher than they were.
+ *
+ * @param h The histogram
+ * @param value The bound
+ * @return The number of recorded values in buckets whose upper bound is at most the bound
+ */
+uint64_t mytcp_hist_count_upto(const mytcp_histogram_t *h, uint64_t value)
+{
+    uint64_t count = 0;
+    for (size_t i = 0; i < HIST_BUCKETS && hist_upper(i) <= value; i++) count += h->counts[i];
+    return count;
+}
+
+/**
+ * Print a one-line summary of a latency histogram recorded in nanoseconds, in microseconds.
+ *
+ * @param f The file to print to
+ * @param name What the histogram measures
+ * @param h The histogram
+ */
+void mytcp_hist_print(FILE *f, const char *name, const mytcp_histogram_t *h)
+{
+    if (h->total == 0)
+    {
+        fprintf(f, "%-22s (no samples)\n", name);
+        return;
+    }
+
+    fprintf(f, "%-22s n=%-10llu mean=%9.1f p50=%9.1f p99=%9.1f p99.9=%9.1f max=%9.1f us\n", name,
+            (unsigned long long) h->total, (double) h->sum / (double) h->total / 1e3,
+            mytcp_hist_percentile(h, 50.0) / 1e3, mytcp_hist_percentile(h, 99.0) / 1e3,
+            mytcp_hist_percentile(h, 99.9) / 1e3, h->max / 1e3);
+}
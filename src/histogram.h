@@ -0,0 +1,31 @@
+#ifndef CSCE3530_LAB3_HISTOGRAM_H
+#define CSCE3530_LAB3_HISTOGRAM_H
+
+#include <inttypes.h>
+#include <stdio.h>
+
+// log-linear buckets (HDR style): HIST_HALF_COUNT linear buckets per power of two, ~3% worst-case error
+#define HIST_SUB_BITS 6
+#define HIST_SUB_COUNT (1 << HIST_SUB_BITS)
+#define HIST_HALF_COUNT (HIST_SUB_COUNT / 2)
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) * HIST_HALF_COUNT + HIST_HALF_COUNT)
+
+// latency histogram; single writer, so keep one per thread and merge them to report (merging while the owner records
+// is safe)
+typedef struct mytcp_histogram
+{
+    uint64_t counts[HIST_BUCKETS];
+    uint64_t total;
+    uint64_t min;
+    uint64_t max;
+    uint64_t sum;
+} mytcp_histogram_t;
+
+void mytcp_hist_init(mytcp_histogram_t *);
+void mytcp_hist_record(mytcp_histogram_t *, uint64_t);
+void mytcp_hist_merge(mytcp_histogram_t *, const mytcp_histogram_t *);
+uint64_t mytcp_hist_percentile(const mytcp_histogram_t *, double);
+uint64_t mytcp_hist_count_upto(const mytcp_histogram_t *, uint64_t);
+void mytcp_hist_print(FILE *, const char *, const mytcp_histogram_t *);
+
+#endif //CSCE3530_LAB3_HISTOGRAM_H
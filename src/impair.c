@@ -0,0 +1,846 @@
+#include "impair.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "common.h"
+
+
+// maximum number of epoll events handled per wakeup
+#define IMPAIR_MAX_EVENTS 64
+
+// number of UDP clients the flow table is initially sized for (it grows as needed)
+#define IMPAIR_FLOW_TABLE_SIZE 1024
+
+#define NS_PER_MS 1000000ull
+
+// header bytes a corruption may hit: all but the payload length, so a TCP stream keeps its framing (the offset,
+// which frames it as well, is spared below)
+#define CORRUPTIBLE_BYTES (sizeof(mytcp_t) - sizeof(uint16_t))
+
+// impairments a relayed segment went through
+#define IMPAIRED_DUPLICATE 1
+#define IMPAIRED_REORDERED 2
+#define IMPAIRED_CORRUPTED 4
+
+// the two ways segments travel through the proxy
+enum impair_direction
+{
+    TO_SERVER,
+    TO_CLIENT,
+    NUM_DIRECTIONS
+};
+
+static const char *DIRECTION_NAMES[] = { "to server", "to client" };
+
+struct impair_flow;
+
+// one end of a flow, registered with epoll: the segments read from its socket travel in its direction
+struct impair_end
+{
+    struct impair_flow *flow;
+    enum impair_direction dir;
+};
+
+// a client, and the connection (TCP) or socket (UDP) the proxy opened to the server for it
+struct impair_flow
+{
+    uint32_t id;
+    int fds[NUM_DIRECTIONS];                    // socket each direction is read from (-1: the listening socket)
+    struct impair_end ends[NUM_DIRECTIONS];
+    mytcp_reader_t readers[NUM_DIRECTIONS];     // TCP: split each stream into segments
+    struct sockaddr_in client;
+    mytcp_tuple_t tuple;                        // UDP: key in the flow table
+    mytcp_timer_t idle;                         // UDP: forgets the client after IMPAIR_IDLE_MS of silence
+    int held[NUM_DIRECTIONS];                   // segments waiting out their delay
+    bool eof[NUM_DIRECTIONS];                   // TCP: the stream the direction is read from has ended
+    bool released;                              // sockets closed; freed once nothing is held
+    struct impair_flow *prev;                   // in the active list, or the released list
+    struct impair_flow *next;
+};
+
+// a segment waiting out its delay
+struct impair_segment
+{
+    mytcp_timer_t timer;
+    struct impair_flow *flow;
+    enum impair_direction dir;
+    int impaired;                               // IMPAIRED_* bits
+    uint64_t arrived;                           // in ns
+    mytcp_t original;                           // the header as it arrived, for the log
+    size_t size;                                // of the header and payload
+    char data[];
+};
+
+// what became of the segments travelling one way
+struct impair_stats
+{
+    uint64_t segments;
+    uint64_t relayed;                           // duplicates included
+    uint64_t dropped;
+    uint64_t duplicated;
+    uint64_t reordered;
+    uint64_t corrupted;
+    uint64_t discarded;                         // still held when their flow ended, or refused by the socket
+    mytcp_histogram_t held;                     // time from arrival to being relayed, in ns
+};
+
+struct impair_proxy
+{
+    const mytcp_impair_config_t *config;
+    int epfd;
+    int listen_fd;
+    mytcp_wheel_t held;                         // segments, by when they are due
+    mytcp_wheel_t idle;                         // UDP flows, by when they are forgotten
+    mytcp_table_t table;                        // UDP flows by client address
+    struct impair_flow *active;
+    struct impair_flow *released;
+    uint32_t flows;                             // ever opened, so the next flow's id
+    uint64_t rng;
+    uint64_t begin;
+    struct impair_stats stats[NUM_DIRECTIONS];
+};
+
+static volatile sig_atomic_t relaying = 1;
+
+static void stop_relaying(int sig)
+{
+    (void) sig;
+    relaying = 0;
+}
+
+/**
+ * Read the monotonic clock.
+ *
+ * @return The current time in nanoseconds
+ */
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+/**
+ * Draw the next number from the proxy's xorshift generator.
+ *
+ * @param p The proxy
+ * @return A pseudo-random number
+ */
+static uint64_t impair_random(struct impair_proxy *p)
+{
+    uint64_t x = p->rng;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return p->rng = x;
+}
+
+/**
+ * Draw a number uniformly from [0, 1).
+ *
+ * @param p The proxy
+ * @return The number
+ */
+static double impair_uniform(struct impair_proxy *p)
+{
+    return (double) (impair_random(p) >> 11) / (double) (1ull << 53);
+}
+
+/**
+ * Decide whether an impairment hits a segment.
+ *
+ * @param p The proxy
+ * @param percent How often it does
+ * @return True iff it does this time
+ */
+static bool impair_chance(struct impair_proxy *p, double percent)
+{
+    return percent > 0 && impair_uniform(p) * 100 < percent;
+}
+
+/**
+ * Log what became of a segment, as a CSV row: when it arrived and left the proxy (in microseconds since the proxy
+ * started) and how long it was held, which flow and direction it travelled, its header as it arrived, and the
+ * event: dropped, discarded, or relayed along with whatever impaired it.
+ *
+ * @param p The proxy
+ * @param seg The segment's header
+ * @param flow The flow's id
+ * @param dir The direction
+ * @param arrived When the segment arrived, in ns
+ * @param left When it left (or was dropped), in ns
+ * @param event What became of it
+ */
+static void impair_log(const struct impair_proxy *p, const mytcp_t *seg, uint32_t flow, enum impair_direction dir,
+                       uint64_t arrived, uint64_t left, const char *event)
+{
+    FILE *log = p->config->log;
+    if (log == NULL) return;
+
+    char flags[NUM_FLAGS * 4] = "";
+    for (uint8_t i = 0; i < NUM_FLAGS; i++)
+    {
+        if (!mytcp_check_flag(seg, i)) continue;
+        if (flags[0] != '\0') strcat(flags, "|");
+        strcat(flags, FLAG_NAMES[i]);
+    }
+
+    fprintf(log, "%llu,%llu,%llu,%u,%s,%s,%u,%u,%u,%s\n", (unsigned long long) ((arrived - p->begin) / 1000),
+            (unsigned long long) ((left - p->begin) / 1000), (unsigned long long) ((left - arrived) / 1000), flow,
+            dir == TO_SERVER ? "to_server" : "to_client", flags, seg->sequence, seg->acknowledgment, seg->urgent,
+            event);
+}
+
+/**
+ * Describe the impairments a relayed segment went through, for the log.
+ *
+ * @param impaired The IMPAIRED_* bits
+ * @param buf Where to write the description
+ * @param len The size of buf
+ * @return buf
+ */
+static const char *impair_event(int impaired, char *buf, size_t len)
+{
+    static const char *NAMES[] = { "duplicate", "reordered", "corrupted" };
+
+    snprintf(buf, len, "relayed");
+    for (int i = 0; i < 3; i++)
+        if (impaired & (1 << i)) snprintf(buf + strlen(buf), len - strlen(buf), "+%s", NAMES[i]);
+    return buf;
+}
+
+/* FLOWS */
+
+/**
+ * Start tracking a flow for a client.
+ *
+ * @param p The proxy
+ * @param client The client's address
+ * @return The flow, or NULL if it could not be allocated
+ */
+static struct impair_flow *impair_flow_new(struct impair_proxy *p, const struct sockaddr_in *client)
+{
+    struct impair_flow *flow = calloc(1, sizeof(*flow));
+    if (flow == NULL)
+    {
+        write_errno(errno, "calloc");
+        return NULL;
+    }
+
+    flow->id = p->flows++;
+    flow->client = *client;
+    for (int d = 0; d < NUM_DIRECTIONS; d++)
+    {
+        flow->fds[d] = -1;
+        flow->ends[d].flow = flow;
+        flow->ends[d].dir = (enum impair_direction) d;
+    }
+    mytcp_timer_init(&flow->idle);
+
+    flow->next = p->active;
+    if (p->active != NULL) p->active->prev = flow;
+    p->active = flow;
+    return flow;
+}
+
+/**
+ * Watch one of a flow's sockets for segments to read.
+ *
+ * @param p The proxy
+ * @param flow The flow
+ * @param dir The direction of the segments read from the socket
+ * @return 0 on success, -1 on failure (errno is set)
+ */
+static int impair_flow_watch(struct impair_proxy *p, struct impair_flow *flow, enum impair_direction dir)
+{
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = &flow->ends[dir] };
+    return epoll_ctl(p->epfd, EPOLL_CTL_ADD, flow->fds[dir], &ev);
+}
+
+/**
+ * Stop relaying a flow: close its sockets and forget it. Segments it still has held are discarded as they come due,
+ * and the flow is freed once the last of them is gone (see impair_bury()).
+ *
+ * @param p The proxy
+ * @param flow The flow
+ */
+static void impair_flow_release(struct impair_proxy *p, struct impair_flow *flow)
+{
+    if (flow->released) return;
+    flow->released = true;
+
+    for (int d = 0; d < NUM_DIRECTIONS; d++)
+    {
+        if (flow->fds[d] != -1) close(flow->fds[d]);
+        mytcp_reader_free(&flow->readers[d]);
+    }
+    if (p->config->udp)
+    {
+        mytcp_table_remove(&p->table, &flow->tuple);
+        mytcp_wheel_cancel(&p->idle, &flow->idle);
+    }
+
+    // move from the active list to the released list
+    if (flow->prev != NULL)
+        flow->prev->next = flow->next;
+    else
+        p->active = flow->next;
+    if (flow->next != NULL) flow->next->prev = flow->prev;
+    flow->prev = NULL;
+    flow->next = p->released;
+    if (p->released != NULL) p->released->prev = flow;
+    p->released = flow;
+}
+
+/**
+ * Free the released flows that hold no more segments. Called between batches of events, so no event still refers
+ * to them.
+ *
+ * @param p The proxy
+ */
+static void impair_bury(struct impair_proxy *p)
+{
+    struct impair_flow *flow = p->released;
+    while (flow != NULL)
+    {
+        struct impair_flow *next = flow->next;
+        if (flow->held[TO_SERVER] == 0 && flow->held[TO_CLIENT] == 0)
+        {
+            if (flow->prev != NULL)
+                flow->prev->next = next;
+            else
+                p->released = next;
+            if (next != NULL) next->prev = flow->prev;
+            free(flow);
+        }
+        flow = next;
+    }
+}
+
+/**
+ * A TCP direction may have nothing left to relay: once its stream ended and no segment is held, pass the end on to
+ * the other side, and release the flow when both directions are done.
+ *
+ * @param p The proxy
+ * @param flow The flow
+ * @param dir The direction
+ */
+static void impair_flow_drained(struct impair_proxy *p, struct impair_flow *flow, enum impair_direction dir)
+{
+    if (p->config->udp || flow->released || !flow->eof[dir] || flow->held[dir] != 0) return;
+
+    shutdown(flow->fds[1 - dir], SHUT_WR);
+    if (flow->eof[1 - dir] && flow->held[1 - dir] == 0) impair_flow_release(p, flow);
+}
+
+/* RELAYING */
+
+/**
+ * Send a segment on to its destination. Over TCP the sockets are blocking for writes, so a segment always goes out
+ * whole; a slow reader stalls the proxy rather than have it buffer without bound.
+ *
+ * @param p The proxy
+ * @param seg The segment
+ * @return 0 on success, -1 if the socket refused it (errno is set)
+ */
+static int impair_send(struct impair_proxy *p, const struct impair_segment *seg)
+{
+    const struct impair_flow *flow = seg->flow;
+
+    if (p->config->udp && seg->dir == TO_CLIENT)
+    {
+        ssize_t sent = sendto(p->listen_fd, seg->data, seg->size, 0, (const struct sockaddr *) &flow->client,
+                              sizeof(flow->client));
+        return sent == (ssize_t) seg->size ? 0 : -1;
+    }
+
+    size_t done = 0;
+    while (done < seg->size)
+    {
+        ssize_t sent = send(flow->fds[1 - seg->dir], seg->data + done, seg->size - done, MSG_NOSIGNAL);
+        if (sent == -1 && errno == EINTR) continue;
+        if (sent <= 0) return -1;
+        done += (size_t) sent;
+    }
+    return 0;
+}
+
+/**
+ * Relay a segment whose delay is over, unless its flow ended meanwhile, and free it.
+ *
+ * @param p The proxy
+ * @param seg The segment
+ */
+static void impair_relay(struct impair_proxy *p, struct impair_segment *seg)
+{
+    struct impair_flow *flow = seg->flow;
+    struct impair_stats *stats = &p->stats[seg->dir];
+    uint64_t now = now_ns();
+    char event[TITLE_LEN];
+
+    flow->held[seg->dir]--;
+    if (flow->released || impair_send(p, seg) != 0)
+    {
+        stats->discarded++;
+        impair_log(p, &seg->original, flow->id, seg->dir, seg->arrived, now, "discarded");
+
+        // a TCP peer that went away ends the flow; a UDP one may come back
+        if (!p->config->udp) impair_flow_release(p, flow);
+    }
+    else
+    {
+        stats->relayed++;
+        mytcp_hist_record(&stats->held, now - seg->arrived);
+        impair_log(p, &seg->original, flow->id, seg->dir, seg->arrived, now,
+                   impair_event(seg->impaired, event, sizeof(event)));
+        impair_flow_drained(p, flow, seg->dir);
+    }
+    free(seg);
+}
+
+/**
+ * A held segment is due.
+ *
+ * @param timer The segment's timer
+ * @param arg The proxy
+ */
+static void impair_due(mytcp_timer_t *timer, void *arg)
+{
+    impair_relay(arg, TIMER_OWNER(timer, struct impair_segment, timer));
+}
+
+/**
+ * Hold a segment that arrived, impaired as configured: it may be dropped, duplicated, corrupted, and it is delayed
+ * by the configured delay and jitter, plus the reordering gap if it is to be overtaken.
+ *
+ * @param p The proxy
+ * @param flow The flow it arrived on
+ * @param dir The direction it is travelling
+ * @param data The segment: its header, followed by its payload
+ * @param size The size of the header and payload
+ * @param now When it arrived, in ns
+ */
+static void impair_input(struct impair_proxy *p, struct impair_flow *flow, enum impair_direction dir, const char *data,
+                         size_t size, uint64_t now)
+{
+    const mytcp_impair_config_t *config = p->config;
+    struct impair_stats *stats = &p->stats[dir];
+    stats->segments++;
+
+    if (impair_chance(p, config->loss))
+    {
+        stats->dropped++;
+        impair_log(p, (const mytcp_t *) data, flow->id, dir, now, now, "dropped");
+        return;
+    }
+
+    int copies = 1;
+    if (impair_chance(p, config->duplicate))
+    {
+        copies = 2;
+        stats->duplicated++;
+    }
+
+    for (int i = 0; i < copies; i++)
+    {
+        struct impair_segment *seg = malloc(sizeof(*seg) + size);
+        if (seg == NULL)
+        {
+            write_errno(errno, "malloc");
+            stats->discarded++;
+            continue;
+        }
+
+        mytcp_timer_init(&seg->timer);
+        seg->flow = flow;
+        seg->dir = dir;
+        seg->impaired = i > 0 ? IMPAIRED_DUPLICATE : 0;
+        seg->arrived = now;
+        seg->size = size;
+        memcpy(&seg->original, data, sizeof(seg->original));
+        memcpy(seg->data, data, size);
+
+        if (impair_chance(p, config->corrupt))
+        {
+            uint64_t r = impair_random(p);
+            size_t byte = r % CORRUPTIBLE_BYTES;
+            if (byte >= offsetof(mytcp_t, urgent)) byte += sizeof(uint16_t);
+            seg->data[byte] ^= (char) (1 << (r >> 32) % 8);
+
+            // nor is the offset, which frames it too: a bit flipped there is flipped in the reserved bits instead
+            mytcp_t *header = (mytcp_t *) seg->data;
+            uint16_t moved = (uint16_t) ((header->flags ^ seg->original.flags) & MASK_OFFSET);
+            header->flags ^= (uint16_t) (moved | moved >> 6);
+            seg->impaired |= IMPAIRED_CORRUPTED;
+            stats->corrupted++;
+        }
+
+        double delay = config->delay_ms + config->jitter_ms * (2 * impair_uniform(p) - 1);
+        if (impair_chance(p, config->reorder))
+        {
+            delay += config->reorder_ms;
+            seg->impaired |= IMPAIRED_REORDERED;
+            stats->reordered++;
+        }
+
+        // segments due at the same tick leave in the order they arrived; the wheel has run the current tick
+        // already, so a segment due now goes right away rather than a tick late
+        flow->held[dir]++;
+        if (delay < 0.5)
+            impair_relay(p, seg);
+        else
+            mytcp_wheel_arm(&p->held, &seg->timer, now / NS_PER_MS + (uint64_t) (delay + 0.5));
+    }
+}
+
+/**
+ * A UDP client went quiet: forget it.
+ *
+ * @param timer The flow's idle timer
+ * @param arg The proxy
+ */
+static void impair_idle(mytcp_timer_t *timer, void *arg)
+{
+    impair_flow_release(arg, TIMER_OWNER(timer, struct impair_flow, idle));
+}
+
+/* TCP */
+
+/**
+ * Accept every pending client, and connect to the server for each.
+ *
+ * @param p The proxy
+ */
+static void impair_accept(struct impair_proxy *p)
+{
+    for (;;)
+    {
+        struct sockaddr_in client;
+        socklen_t len = sizeof(client);
+        int client_fd = accept(p->listen_fd, (struct sockaddr *) &client, &len);
+        if (client_fd == -1)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) write_errno(errno, "accept");
+            return;
+        }
+
+        int server_fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (server_fd == -1 || connect(server_fd, (const struct sockaddr *) &p->config->target,
+                                       sizeof(p->config->target)) != 0)
+        {
+            write_errno(errno, "connect to server");
+            if (server_fd != -1) close(server_fd);
+            close(client_fd);
+            continue;
+        }
+
+        // segments are timed one by one, so the kernel must not hold them back to coalesce them
+        int32_t yes = 1;
+        setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+        setsockopt(server_fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+
+        struct impair_flow *flow = impair_flow_new(p, &client);
+        if (flow == NULL)
+        {
+            close(server_fd);
+            close(client_fd);
+            continue;
+        }
+        flow->fds[TO_SERVER] = client_fd;
+        flow->fds[TO_CLIENT] = server_fd;
+
+        for (int d = 0; d < NUM_DIRECTIONS; d++)
+        {
+            if (mytcp_reader_init(&flow->readers[d], flow->fds[d], READER_DEFAULT_CAPACITY) != 0
+                || impair_flow_watch(p, flow, (enum impair_direction) d) != 0)
+            {
+                write_errno(errno, "flow setup");
+                impair_flow_release(p, flow);
+                break;
+            }
+        }
+    }
+}
+
+/**
+ * Read what arrived on one of a TCP flow's streams, and take every whole segment in it.
+ *
+ * @param p The proxy
+ * @param flow The flow
+ * @param dir The direction of the stream
+ * @param now The current time, in ns
+ */
+static void impair_stream(struct impair_proxy *p, struct impair_flow *flow, enum impair_direction dir, uint64_t now)
+{
+    ssize_t got = mytcp_reader_fill(&flow->readers[dir]);
+
+    // the reader moves past the header, its options and its payload
+    size_t length, head = flow->readers[dir].head;
+    const mytcp_t *seg;
+    while ((seg = mytcp_reader_next_segment(&flow->readers[dir], &length)) != NULL)
+    {
+        impair_input(p, flow, dir, (const char *) seg, flow->readers[dir].head - head, now);
+        head = flow->readers[dir].head;
+    }
+
+    // the stream ended, or was reset (as the load generator does to skip TIME_WAIT): stop watching it, and pass the
+    // end on once everything held is relayed
+    if (got <= 0)
+    {
+        flow->eof[dir] = true;
+        epoll_ctl(p->epfd, EPOLL_CTL_DEL, flow->fds[dir], NULL);
+        impair_flow_drained(p, flow, dir);
+    }
+}
+
+/* UDP */
+
+/**
+ * Start a flow for a new UDP client, with its own socket connected to the server so the server tells clients apart.
+ *
+ * @param p The proxy
+ * @param client The client's address
+ * @param tuple The client's key in the flow table
+ * @return The flow, or NULL on failure
+ */
+static struct impair_flow *impair_udp_flow(struct impair_proxy *p, const struct sockaddr_in *client,
+                                           const mytcp_tuple_t *tuple)
+{
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (fd == -1 || connect(fd, (const struct sockaddr *) &p->config->target, sizeof(p->config->target)) != 0)
+    {
+        write_errno(errno, "connect to server");
+        if (fd != -1) close(fd);
+        return NULL;
+    }
+
+    struct impair_flow *flow = impair_flow_new(p, client);
+    if (flow == NULL)
+    {
+        close(fd);
+        return NULL;
+    }
+    flow->fds[TO_CLIENT] = fd;
+    flow->tuple = *tuple;
+
+    int err = mytcp_table_insert(&p->table, tuple, flow);
+    if (err != 0 || impair_flow_watch(p, flow, TO_CLIENT) != 0)
+    {
+        write_errno(err != 0 ? err : errno, "flow setup");
+        impair_flow_release(p, flow);
+        return NULL;
+    }
+    return flow;
+}
+
+/**
+ * Receive every datagram waiting on a UDP socket: from clients on the listening socket, or from the server on a
+ * flow's socket.
+ *
+ * @param p The proxy
+ * @param flow The flow whose socket is readable, or NULL for the listening socket
+ * @param now The current time, in ns
+ */
+static void impair_datagrams(struct impair_proxy *p, struct impair_flow *flow, uint64_t now)
+{
+    static char buf[MYTCP_MAX_HEADER + MYTCP_MAX_PAYLOAD];
+    int fd = flow != NULL ? flow->fds[TO_CLIENT] : p->listen_fd;
+
+    for (;;)
+    {
+        struct sockaddr_in from;
+        socklen_t len = sizeof(from);
+        ssize_t got = recvfrom(fd, buf, sizeof(buf), 0, (struct sockaddr *) &from, &len);
+        if (got == -1) return;
+
+        // each datagram is one segment: the header, then its payload
+        if ((size_t) got < sizeof(mytcp_t)) continue;
+
+        struct impair_flow *f = flow;
+        if (f == NULL)
+        {
+            mytcp_tuple_t tuple = {
+                    .src_addr = from.sin_addr.s_addr,
+                    .dest_addr = p->config->listen.sin_addr.s_addr,
+                    .srcport = from.sin_port,
+                    .destport = p->config->listen.sin_port
+            };
+            f = mytcp_table_find(&p->table, &tuple);
+            if (f == NULL && (f = impair_udp_flow(p, &from, &tuple)) == NULL) continue;
+        }
+
+        mytcp_wheel_arm(&p->idle, &f->idle, now / NS_PER_MS + IMPAIR_IDLE_MS);
+        impair_input(p, f, flow != NULL ? TO_CLIENT : TO_SERVER, buf, (size_t) got, now);
+    }
+}
+
+/* DRIVER */
+
+/**
+ * Print what became of the segments each way, and how long the relayed ones were held.
+ *
+ * @param p The proxy
+ */
+static void impair_report(const struct impair_proxy *p)
+{
+    const struct impair_stats *s = p->stats;
+
+    printf("\n%u flows\n%-12s %14s %14s\n", p->flows, "segments", DIRECTION_NAMES[TO_SERVER],
+           DIRECTION_NAMES[TO_CLIENT]);
+    printf("%-12s %14llu %14llu\n", "arrived", (unsigned long long) s[0].segments, (unsigned long long) s[1].segments);
+    printf("%-12s %14llu %14llu\n", "relayed", (unsigned long long) s[0].relayed, (unsigned long long) s[1].relayed);
+    printf("%-12s %14llu %14llu\n", "dropped", (unsigned long long) s[0].dropped, (unsigned long long) s[1].dropped);
+    printf("%-12s %14llu %14llu\n", "duplicated", (unsigned long long) s[0].duplicated,
+           (unsigned long long) s[1].duplicated);
+    printf("%-12s %14llu %14llu\n", "reordered", (unsigned long long) s[0].reordered,
+           (unsigned long long) s[1].reordered);
+    printf("%-12s %14llu %14llu\n", "corrupted", (unsigned long long) s[0].corrupted,
+           (unsigned long long) s[1].corrupted);
+    printf("%-12s %14llu %14llu\n", "discarded", (unsigned long long) s[0].discarded,
+           (unsigned long long) s[1].discarded);
+
+    printf("\ntime held:\n");
+    for (int d = 0; d < NUM_DIRECTIONS; d++) mytcp_hist_print(stdout, DIRECTION_NAMES[d], &s[d].held);
+}
+
+/**
+ * Open the socket clients connect to.
+ *
+ * @param config The proxy's configuration
+ * @return The socket, or -1 after printing an error
+ */
+static int impair_listen(const mytcp_impair_config_t *config)
+{
+    int fd = socket(AF_INET, (config->udp ? SOCK_DGRAM : SOCK_STREAM) | SOCK_NONBLOCK, 0);
+    if (fd == -1)
+    {
+        write_errno(errno, "socket");
+        return -1;
+    }
+
+    int32_t yes = 1;
+    const char *failed = NULL;
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes)) == -1)
+        failed = "setsockopt";
+    else if (bind(fd, (const struct sockaddr *) &config->listen, sizeof(config->listen)) != 0)
+        failed = "bind";
+    else if (!config->udp && listen(fd, SOMAXCONN) != 0)
+        failed = "listen";
+
+    if (failed != NULL)
+    {
+        write_errno(errno, failed);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * Run the proxy: relay segments between any number of clients and the server, each one held in a timer wheel for
+ * its delay, until SIGINT or SIGTERM. Segments still held then are discarded, and a summary is printed.
+ *
+ * @param config What to relay, and how to impair it
+ * @return 0 on success, else a non-zero error code
+ */
+int mytcp_impair_run(const mytcp_impair_config_t *config)
+{
+    struct impair_proxy *p = calloc(1, sizeof(*p));
+    if (p == NULL) return abort_with_errno(errno, "calloc");
+    p->config = config;
+
+    struct sigaction sa;
+    bzero(&sa, sizeof(sa));
+    sa.sa_handler = stop_relaying;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    p->listen_fd = impair_listen(config);
+    if (p->listen_fd == -1)
+    {
+        free(p);
+        return 1;
+    }
+    p->epfd = epoll_create1(0);
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+    if (p->epfd == -1 || epoll_ctl(p->epfd, EPOLL_CTL_ADD, p->listen_fd, &ev) != 0)
+        return abort_with_errno(errno, "epoll");
+    int err = config->udp ? mytcp_table_init(&p->table, IMPAIR_FLOW_TABLE_SIZE) : 0;
+    if (err != 0) return abort_with_errno(err, "flow table");
+
+    uint32_t seed = config->seeded ? config->seed : (uint32_t) now_ns() | 1;
+    p->rng = ((uint64_t) seed << 32 | seed) ^ 0x9E3779B97F4A7C15ull;
+    p->begin = now_ns();
+    mytcp_wheel_init(&p->held, p->begin / NS_PER_MS);
+    mytcp_wheel_init(&p->idle, p->begin / NS_PER_MS);
+
+    char target[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &config->target.sin_addr, target, sizeof(target));
+    printf("relaying %s from port %d to %s:%d: delay %.1f ms +/- %.1f ms, loss %.1f%%, duplication %.1f%%, "
+           "reordering %.1f%% (by %.1f ms), corruption %.1f%% (seed %u); press ^C to stop\n",
+           config->udp ? "UDP" : "TCP", ntohs(config->listen.sin_port), target, ntohs(config->target.sin_port),
+           config->delay_ms, config->jitter_ms, config->loss, config->duplicate, config->reorder, config->reorder_ms,
+           config->corrupt, seed);
+    if (config->log != NULL)
+        fprintf(config->log, "arrived_us,left_us,held_us,flow,direction,flags,sequence,acknowledgment,length,event\n");
+
+    int result = 0;
+    struct epoll_event events[IMPAIR_MAX_EVENTS];
+    while (relaying)
+    {
+        uint64_t now = now_ns();
+        int timeout = mytcp_wheel_timeout(&p->held, now / NS_PER_MS, -1);
+        timeout = mytcp_wheel_timeout(&p->idle, now / NS_PER_MS, timeout);
+
+        int n = epoll_wait(p->epfd, events, IMPAIR_MAX_EVENTS, timeout);
+        if (n == -1 && errno != EINTR)
+        {
+            result = abort_with_errno(errno, "epoll_wait");
+            break;
+        }
+
+        now = now_ns();
+        for (int i = 0; i < n; i++)
+        {
+            struct impair_end *end = events[i].data.ptr;
+            if (end == NULL && config->udp)
+                impair_datagrams(p, NULL, now);
+            else if (end == NULL)
+                impair_accept(p);
+            else if (end->flow->released)
+                continue;
+            else if (config->udp)
+                impair_datagrams(p, end->flow, now);
+            else
+                impair_stream(p, end->flow, end->dir, now);
+        }
+
+        mytcp_wheel_advance(&p->held, now / NS_PER_MS, impair_due, p);
+        mytcp_wheel_advance(&p->idle, now / NS_PER_MS, impair_idle, p);
+        impair_bury(p);
+    }
+
+    // end every flow, and discard what they still hold
+    while (p->active != NULL) impair_flow_release(p, p->active);
+    uint64_t longest = (uint64_t) (config->delay_ms + config->jitter_ms + config->reorder_ms) + 1;
+    mytcp_wheel_advance(&p->held, now_ns() / NS_PER_MS + longest, impair_due, p);
+    impair_bury(p);
+
+    impair_report(p);
+
+    if (config->udp) mytcp_table_free(&p->table);
+    close(p->epfd);
+    close(p->listen_fd);
+    free(p);
+    return result;
+}
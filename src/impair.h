@@ -0,0 +1,38 @@
+#ifndef CSCE3530_LAB3_IMPAIR_H
+#define CSCE3530_LAB3_IMPAIR_H
+
+#include <inttypes.h>
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+// defaults for the proxy's options: the port clients connect to (the server's is SERVER_PORT), and how long a
+// reordered segment is held back
+#define IMPAIR_DEFAULT_PORT 27016
+#define IMPAIR_DEFAULT_REORDER_MS 10.0
+
+// a UDP client the proxy has heard nothing from for this long is forgotten
+#define IMPAIR_IDLE_MS 10000
+
+// what the proxy does to the segments it relays; percentages apply to each segment independently, each way
+typedef struct mytcp_impair_config
+{
+    struct sockaddr_in listen;  // where clients connect to
+    struct sockaddr_in target;  // the server segments are relayed to
+    bool udp;                   // segments are UDP datagrams rather than a TCP stream
+    double delay_ms;            // added to every segment
+    double jitter_ms;           // the delay varies uniformly by up to this much either way
+    double loss;                // percentage of segments dropped
+    double duplicate;           // percentage of segments relayed twice
+    double reorder;             // percentage of segments held back reorder_ms longer, so later ones overtake them
+    double reorder_ms;
+    double corrupt;             // percentage of segments with one header bit flipped, so their checksum fails
+    uint32_t seed;              // of the random choices, so a run can be repeated
+    bool seeded;                // seed was given; otherwise one is picked
+    FILE *log;                  // CSV log of every segment and what became of it, or NULL
+} mytcp_impair_config_t;
+
+// relay segments between clients and a server, impairing them, until SIGINT or SIGTERM; then print a summary
+int mytcp_impair_run(const mytcp_impair_config_t *);
+
+#endif //CSCE3530_LAB3_IMPAIR_H
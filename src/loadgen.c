@@ -0,0 +1,1110 @@
+#define _GNU_SOURCE     // pthread_tryjoin_np
+
+#include "loadgen.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "histogram.h"
+
+
+// maximum number of epoll events handled per wakeup by a worker
+#define LOAD_MAX_EVENTS 256
+
+// longest a worker sleeps before checking whether to stop
+#define LOAD_TICK_MS 10
+
+// most segments a persistent socket reads at once
+#define LOAD_STREAM_BATCH 64
+
+// how long the SYN flood thread sleeps between bursts
+#define LOAD_FLOOD_TICK_NS 1000000ull
+
+#define NS_PER_SEC 1000000000ull
+#define NS_PER_MS 1000000ull
+
+// handshake phases timed by the load generator
+enum load_phase
+{
+    PHASE_CONNECT,          // connect() until the socket is writable (TCP only; once per persistent socket)
+    PHASE_OPEN_GRANTED,     // connection request written until connection granted received
+    PHASE_OPEN,             // connect() until the whole open handshake is done
+    PHASE_CLOSE_ACK,        // close request written until close acknowledgment received
+    PHASE_CLOSE_PEER,       // close request written until the server's close request received
+    PHASE_CLOSE,            // connect() until the whole close handshake is done
+    NUM_LOAD_PHASES
+};
+
+static const char *LOAD_PHASE_NAMES[NUM_LOAD_PHASES] = {
+        "connect", "open: request->granted", "open: total",
+        "close: request->ack", "close: request->fin", "close: total"
+};
+
+static const char *LOAD_PHASE_LABELS[NUM_LOAD_PHASES] = {
+        "connect", "open_granted", "open", "close_ack", "close_fin", "close"
+};
+
+// reasons a handshake fails
+enum load_failure
+{
+    FAILURE_CONNECT,
+    FAILURE_IO,
+    FAILURE_PROTOCOL,
+    FAILURE_TIMEOUT,
+    NUM_LOAD_FAILURES
+};
+
+static const char *LOAD_FAILURE_NAMES[NUM_LOAD_FAILURES] = {
+        "connect failed", "reset or closed by server", "protocol violation", "timed out"
+};
+
+static const char *LOAD_FAILURE_LABELS[NUM_LOAD_FAILURES] = { "connect", "reset", "protocol", "timeout" };
+
+// a persistent TCP socket carrying the handshakes of many slots, each from its own port; fd is -1 until it is
+// connected, and again once it breaks
+struct load_stream
+{
+    int fd;
+
+    // received bytes not yet handled: whole segments, then the start of a partial one
+    char in[LOAD_STREAM_BATCH * sizeof(mytcp_t)];
+    size_t in_len;
+
+    // segments of all its handshakes not yet accepted by the kernel, in the order they were queued
+    mytcp_t *out;
+    size_t out_len;
+    size_t out_cap;
+    size_t out_sent;        // in bytes
+};
+
+// one handshake in flight; a slot is free while fd is -1
+struct load_conn
+{
+    int fd;                 // its own socket, or its stream's
+    struct load_stream *stream;     // the persistent socket it is multiplexed over, or NULL
+    bool open;              // open handshake, else close handshake
+    bool connected;
+    mytcp_conn_t conn;
+
+    // partially received incoming segment
+    mytcp_t in;
+    size_t in_len;
+
+    // segments not yet accepted by the kernel
+    mytcp_t out[2];
+    size_t out_len;
+    size_t out_sent;
+
+    uint64_t started;       // when connect() was called (CLOCK_MONOTONIC, ns)
+    uint64_t requested;     // when our first segment was written
+
+    mytcp_timer_t deadline; // fails the handshake once the timeout runs out
+    mytcp_timer_t rto;      // UDP: retransmits our latest segments if the server does not answer them in time
+};
+
+// one worker thread; only it writes what it counts, which the metrics exporter may read meanwhile (see METRIC_INC())
+struct load_worker
+{
+    const mytcp_load_config_t *config;
+    pthread_t thread;
+    int epfd;
+    uint32_t rng;
+
+    // handshake slots, and a stack of the free ones
+    struct load_conn *slots;
+    int *free_slots;
+    int nslots;
+    int nfree;
+
+    // persistent sockets the handshakes are multiplexed over (slot s uses streams[s % nstreams]), or NULL
+    struct load_stream *streams;
+    int nstreams;
+
+    double rate;            // this worker's share of the target rate
+    uint64_t quota;         // this worker's share of the handshake count, 0 for no limit
+
+    uint64_t started;
+    uint64_t completed[2];  // indexed by open
+    uint64_t failures[NUM_LOAD_FAILURES];
+    uint64_t retransmitted;
+    uint64_t rejected[NUM_CONN_ERRORS];     // segments from the server we rejected, by reason
+    mytcp_histogram_t phases[NUM_LOAD_PHASES];
+
+    mytcp_wheel_t wheel;    // the handshakes' timers, in milliseconds
+};
+
+// the SYN flood thread; it runs until every worker is done
+struct load_flood
+{
+    const mytcp_load_config_t *config;
+    pthread_t thread;
+    uint64_t sent;
+};
+
+// what the metrics exporter and SIGUSR1 report on
+struct load_export
+{
+    const struct load_worker *workers;
+    int nworkers;
+    const struct load_flood *flood;
+};
+
+static volatile sig_atomic_t loading = 1;
+static bool flooding;
+
+static void stop_loading(int sig)
+{
+    (void) sig;
+    loading = 0;
+}
+
+/**
+ * Read the monotonic clock.
+ *
+ * @return The current time in nanoseconds
+ */
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * NS_PER_SEC + (uint64_t) ts.tv_nsec;
+}
+
+/**
+ * Draw the next number from a worker's xorshift generator.
+ *
+ * @param state The generator state (never zero)
+ * @return A pseudo-random number
+ */
+static uint32_t load_random(uint32_t *state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+/**
+ * Close a handshake's socket (unless it is a persistent one), cancel its timers and return its slot to the free stack.
+ *
+ * @param w The worker owning the handshake
+ * @param c The handshake
+ */
+static void load_release(struct load_worker *w, struct load_conn *c)
+{
+    mytcp_wheel_cancel(&w->wheel, &c->deadline);
+    mytcp_wheel_cancel(&w->wheel, &c->rto);
+    if (c->stream == NULL)
+    {
+        epoll_ctl(w->epfd, EPOLL_CTL_DEL, c->fd, NULL);
+        close(c->fd);
+    }
+    c->fd = -1;
+    w->free_slots[w->nfree++] = (int) (c - w->slots);
+}
+
+/**
+ * Record a failed handshake and release it.
+ *
+ * @param w The worker owning the handshake
+ * @param c The handshake
+ * @param failure Why it failed
+ */
+static void load_fail(struct load_worker *w, struct load_conn *c, enum load_failure failure)
+{
+    METRIC_INC(w->failures[failure]);
+    load_release(w, c);
+}
+
+/**
+ * Move a multiplexed handshake's output to the end of its stream's queue, which is written once per wakeup for all
+ * of the stream's handshakes (see load_flush_streams()).
+ *
+ * @param s The handshake's stream
+ * @param c The handshake
+ * @return 0 on success, -1 if out of memory
+ */
+static int load_queue(struct load_stream *s, struct load_conn *c)
+{
+    if (s->out_len + c->out_len > s->out_cap)
+    {
+        size_t cap = s->out_cap == 0 ? LOAD_STREAM_BATCH : 2 * s->out_cap;
+        mytcp_t *out = realloc(s->out, cap * sizeof(*out));
+        if (out == NULL) return -1;
+        s->out = out;
+        s->out_cap = cap;
+    }
+
+    memcpy(&s->out[s->out_len], c->out, c->out_len * sizeof(mytcp_t));
+    s->out_len += c->out_len;
+    c->out_len = 0;
+    return 0;
+}
+
+/**
+ * Write as much queued output as the socket accepts without blocking. Segments are written one at a time so each
+ * is exactly one datagram over UDP; a multiplexed handshake's are queued on its stream instead.
+ *
+ * @param c The handshake whose output we are flushing
+ * @return 0 if all output was written, queued or the socket is full, -1 on a write error
+ */
+static int load_flush(struct load_conn *c)
+{
+    if (c->stream != NULL) return load_queue(c->stream, c);
+
+    size_t total = c->out_len * sizeof(mytcp_t);
+
+    while (c->out_sent < total)
+    {
+        size_t remaining = sizeof(mytcp_t) - c->out_sent % sizeof(mytcp_t);
+        ssize_t written = send(c->fd, (char *) c->out + c->out_sent, remaining, MSG_NOSIGNAL);
+        if (written == -1)
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+        c->out_sent += (size_t) written;
+    }
+
+    c->out_len = 0;
+    c->out_sent = 0;
+    return 0;
+}
+
+/**
+ * Keep the retransmission timer of a UDP handshake in step with its connection: armed while the server owes us an
+ * answer, cancelled otherwise. Over TCP nothing is lost, and only the deadline applies.
+ *
+ * @param w The worker owning the handshake
+ * @param c The handshake
+ * @param now The current time
+ */
+static void load_arm_rto(struct load_worker *w, struct load_conn *c, uint64_t now)
+{
+    if (w->config->udp && !mytcp_conn_done(&c->conn) && c->conn.nsent > 0)
+        mytcp_wheel_arm(&w->wheel, &c->rto, now / NS_PER_MS + mytcp_conn_rto(&c->conn));
+    else
+        mytcp_wheel_cancel(&w->wheel, &c->rto);
+}
+
+/**
+ * Write the segment that starts a connected handshake: a connection request or a close request.
+ *
+ * @param w The worker owning the handshake
+ * @param c The connected handshake
+ * @param now The current time
+ * @return 0 on success, -1 on a write error
+ */
+static int load_request(struct load_worker *w, struct load_conn *c, uint64_t now)
+{
+    if (c->open)
+        mytcp_conn_open(&c->conn, &c->out[0]);
+    else
+        mytcp_conn_close(&c->conn, &c->out[0]);
+
+    c->out_len = 1;
+    c->requested = now;
+    load_arm_rto(w, c, now);
+    return load_flush(c);
+}
+
+/**
+ * Connect a persistent socket to the server. This blocks, but a stream is only connected once per run (and again
+ * only if it breaks), which is the cost multiplexing takes off every handshake.
+ *
+ * @param w The worker owning the stream
+ * @param s The stream, not connected
+ * @return 0 on success, -1 on failure
+ */
+static int load_stream_connect(struct load_worker *w, struct load_stream *s)
+{
+    uint64_t begin = now_ns();
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == -1) return -1;
+
+    // every write carries segments that are waiting to be answered, so never hold one back for a fuller one
+    int one = 1;
+    struct epoll_event ev = { .events = EPOLLIN | EPOLLOUT | EPOLLET | EPOLLRDHUP, .data.ptr = s };
+    if (connect(fd, (const struct sockaddr *) &w->config->target, sizeof(w->config->target)) != 0
+        || setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) != 0
+        || fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK) != 0
+        || epoll_ctl(w->epfd, EPOLL_CTL_ADD, fd, &ev) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    s->fd = fd;
+    mytcp_hist_record(&w->phases[PHASE_CONNECT], now_ns() - begin);
+    return 0;
+}
+
+/**
+ * Start one multiplexed handshake: connect its stream if it is not connected yet, and queue the first segment.
+ *
+ * @param w The worker starting the handshake
+ * @param c The handshake, initialized
+ * @param now The current time
+ */
+static void load_start_multiplexed(struct load_worker *w, struct load_conn *c, uint64_t now)
+{
+    if (c->stream->fd == -1 && load_stream_connect(w, c->stream) != 0)
+    {
+        METRIC_INC(w->failures[FAILURE_CONNECT]);
+        c->fd = -1;
+        w->free_slots[w->nfree++] = (int) (c - w->slots);
+        return;
+    }
+
+    c->fd = c->stream->fd;
+    c->connected = true;
+    mytcp_wheel_arm(&w->wheel, &c->deadline, now / NS_PER_MS + (uint64_t) w->config->timeout_ms);
+    if (load_request(w, c, now) != 0) load_fail(w, c, FAILURE_IO);
+}
+
+/**
+ * Start one handshake in a free slot: create a non-blocking socket, connect it and, if the connection is already
+ * established (always the case for UDP), write the first segment. A handshake multiplexed over a persistent socket
+ * uses the slot's own port instead (see load_start_multiplexed()).
+ *
+ * @param w The worker starting the handshake
+ * @param now The current time
+ */
+static void load_start(struct load_worker *w, uint64_t now)
+{
+    const mytcp_load_config_t *config = w->config;
+    int slot = w->free_slots[--w->nfree];
+    struct load_conn *c = &w->slots[slot];
+
+    METRIC_INC(w->started);
+    bzero(c, sizeof(*c));
+    c->open = (int) (load_random(&w->rng) % 100) < config->open_percent;
+    c->started = now;
+    mytcp_timer_init(&c->deadline);
+    mytcp_timer_init(&c->rto);
+    if (w->streams != NULL)
+    {
+        c->stream = &w->streams[slot % w->nstreams];
+        mytcp_conn_init(&c->conn, (uint16_t) (slot + 1), SERVER_PORT, c->open ? STATE_CLOSED : STATE_ESTABLISHED);
+        load_start_multiplexed(w, c, now);
+        return;
+    }
+    mytcp_conn_init(&c->conn, CLIENT_PORT, SERVER_PORT, c->open ? STATE_CLOSED : STATE_ESTABLISHED);
+
+    c->fd = socket(AF_INET, (config->udp ? SOCK_DGRAM : SOCK_STREAM) | SOCK_NONBLOCK, 0);
+    if (c->fd == -1)
+    {
+        METRIC_INC(w->failures[FAILURE_CONNECT]);
+        w->free_slots[w->nfree++] = (int) (c - w->slots);
+        return;
+    }
+
+    // reset instead of lingering in TIME_WAIT, or a fast run exhausts the ephemeral ports within seconds; likewise a
+    // UDP handshake is released as soon as it is done, without lingering to answer a retransmission from the server
+    struct linger linger = { .l_onoff = 1, .l_linger = 0 };
+    if (!config->udp) setsockopt(c->fd, SOL_SOCKET, SO_LINGER, &linger, sizeof(linger));
+
+    mytcp_wheel_arm(&w->wheel, &c->deadline, now / NS_PER_MS + (uint64_t) config->timeout_ms);
+
+    struct epoll_event ev = { .events = EPOLLIN | EPOLLOUT | EPOLLET | EPOLLRDHUP, .data.ptr = c };
+    if (epoll_ctl(w->epfd, EPOLL_CTL_ADD, c->fd, &ev) == -1)
+    {
+        load_fail(w, c, FAILURE_CONNECT);
+        return;
+    }
+
+    if (connect(c->fd, (const struct sockaddr *) &config->target, sizeof(config->target)) == 0)
+    {
+        c->connected = true;
+        if (!config->udp) mytcp_hist_record(&w->phases[PHASE_CONNECT], now_ns() - now);
+        if (load_request(w, c, now_ns()) != 0) load_fail(w, c, FAILURE_IO);
+    }
+    else if (errno != EINPROGRESS)
+        load_fail(w, c, FAILURE_CONNECT);
+}
+
+/**
+ * Complete a connect() that was in progress and write the first segment.
+ *
+ * @param w The worker owning the handshake
+ * @param c The handshake whose socket became writable
+ * @param now The current time
+ * @return 0 if the handshake is still in progress, -1 if it failed and was released
+ */
+static int load_connected(struct load_worker *w, struct load_conn *c, uint64_t now)
+{
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len) == -1 || err != 0)
+    {
+        load_fail(w, c, FAILURE_CONNECT);
+        return -1;
+    }
+
+    c->connected = true;
+    mytcp_hist_record(&w->phases[PHASE_CONNECT], now - c->started);
+
+    if (load_request(w, c, now) != 0)
+    {
+        load_fail(w, c, FAILURE_IO);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Process one complete segment received for a handshake, timing the server's response against our request, and
+ * write (or queue) our answer. Over UDP a rejected segment is only counted and dropped: it may have been damaged or
+ * delayed on the way, and the retransmission timeout still recovers the handshake.
+ *
+ * @param w The worker owning the handshake
+ * @param c The handshake, with the segment in c->in
+ * @param now The current time
+ * @return 0 if the handshake is still in progress or done, -1 if it failed and was released
+ */
+static int load_input(struct load_worker *w, struct load_conn *c, uint64_t now)
+{
+    // a duplicate from the server means our answer was lost: send it again, unless it is still being written
+    int nout;
+    mytcp_conn_error_t err = mytcp_conn_input(&c->conn, &c->in, &c->out[c->out_len], &nout);
+    if (err != CONN_OK) METRIC_INC(w->rejected[err]);
+    if (err == CONN_ERR_DUPLICATE)
+    {
+        if (c->out_len == 0)
+        {
+            c->out_len = (size_t) mytcp_conn_retransmit(&c->conn, c->out);
+            METRIC_ADD(w->retransmitted, c->out_len);
+        }
+        nout = 0;
+    }
+    else if (err != CONN_OK && w->config->udp)
+        return 0;
+    else if (err != CONN_OK)
+    {
+        load_fail(w, c, FAILURE_PROTOCOL);
+        return -1;
+    }
+    else
+        load_arm_rto(w, c, now);
+    c->out_len += nout;
+
+    switch (mytcp_conn_kind(&c->conn, &c->in))
+    {
+        case SEGMENT_CONN_GRANTED:
+            mytcp_hist_record(&w->phases[PHASE_OPEN_GRANTED], now - c->requested);
+            break;
+        case SEGMENT_CLOSE_ACK:
+            mytcp_hist_record(&w->phases[PHASE_CLOSE_ACK], now - c->requested);
+            break;
+        case SEGMENT_CLOSE_REQUEST:
+            mytcp_hist_record(&w->phases[PHASE_CLOSE_PEER], now - c->requested);
+            break;
+        default:
+            break;
+    }
+
+    if (load_flush(c) != 0)
+    {
+        load_fail(w, c, FAILURE_IO);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Read and process every complete segment currently available on a handshake.
+ *
+ * @param w The worker owning the handshake
+ * @param c The readable handshake
+ * @param now The current time
+ * @return 0 if the handshake is still in progress or done, -1 if it failed and was released
+ */
+static int load_readable(struct load_worker *w, struct load_conn *c, uint64_t now)
+{
+    // the server may close as soon as it has our last segment, so stop reading once we are done
+    while (!mytcp_conn_done(&c->conn))
+    {
+        ssize_t got = recv(c->fd, (char *) &c->in + c->in_len, sizeof(mytcp_t) - c->in_len, 0);
+
+        if (got == 0 || (got == -1 && errno != EAGAIN && errno != EWOULDBLOCK))
+        {
+            load_fail(w, c, FAILURE_IO);
+            return -1;
+        }
+        if (got == -1) return 0;
+
+        // a datagram carries exactly one segment
+        if (w->config->udp && got != sizeof(mytcp_t)) continue;
+
+        c->in_len += (size_t) got;
+        if (c->in_len < sizeof(mytcp_t)) continue;
+        c->in_len = 0;
+
+        if (load_input(w, c, now) != 0) return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Record a handshake as completed and release it, once it is done and its last segment written (or queued).
+ *
+ * @param w The worker owning the handshake
+ * @param c The handshake
+ * @param now The current time
+ */
+static void load_finish(struct load_worker *w, struct load_conn *c, uint64_t now)
+{
+    if (!mytcp_conn_done(&c->conn) || c->out_len != 0) return;
+
+    mytcp_hist_record(&w->phases[c->open ? PHASE_OPEN : PHASE_CLOSE], now - c->started);
+    METRIC_INC(w->completed[c->open]);
+    load_release(w, c);
+}
+
+/**
+ * Handle one epoll event on a handshake, and release the handshake once it is done and its last segment written.
+ *
+ * @param w The worker owning the handshake
+ * @param c The handshake
+ * @param events The epoll events reported
+ * @param now The current time
+ */
+static void load_event(struct load_worker *w, struct load_conn *c, uint32_t events, uint64_t now)
+{
+    if (!c->connected)
+    {
+        if (!(events & (EPOLLOUT | EPOLLERR | EPOLLHUP))) return;
+        if (load_connected(w, c, now) != 0) return;
+    }
+    else if (events & EPOLLOUT && load_flush(c) != 0)
+    {
+        load_fail(w, c, FAILURE_IO);
+        return;
+    }
+
+    if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR) && load_readable(w, c, now) != 0) return;
+
+    load_finish(w, c, now);
+}
+
+/**
+ * A persistent socket broke: fail every handshake multiplexed over it and close it. The next handshake started on
+ * it connects it again.
+ *
+ * @param w The worker owning the stream
+ * @param s The stream
+ */
+static void load_stream_fail(struct load_worker *w, struct load_stream *s)
+{
+    for (int i = 0; i < w->nslots; i++)
+        if (w->slots[i].fd != -1 && w->slots[i].stream == s) load_fail(w, &w->slots[i], FAILURE_IO);
+
+    epoll_ctl(w->epfd, EPOLL_CTL_DEL, s->fd, NULL);
+    close(s->fd);
+    s->fd = -1;
+    s->in_len = 0;
+    s->out_len = 0;
+    s->out_sent = 0;
+}
+
+/**
+ * Write as much of a persistent socket's queue as it accepts without blocking.
+ *
+ * @param s The stream
+ * @return 0 if the whole queue was written or the socket is full, -1 on a write error
+ */
+static int load_stream_flush(struct load_stream *s)
+{
+    size_t total = s->out_len * sizeof(mytcp_t);
+
+    while (s->out_sent < total)
+    {
+        ssize_t written = send(s->fd, (char *) s->out + s->out_sent, total - s->out_sent, MSG_NOSIGNAL);
+        if (written == -1)
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+        s->out_sent += (size_t) written;
+    }
+
+    s->out_len = 0;
+    s->out_sent = 0;
+    return 0;
+}
+
+/**
+ * Write every persistent socket's queue, so what a whole wakeup's handshakes queued goes out in one write per socket.
+ *
+ * @param w The worker
+ */
+static void load_flush_streams(struct load_worker *w)
+{
+    for (int i = 0; i < w->nstreams; i++)
+    {
+        struct load_stream *s = &w->streams[i];
+        if (s->fd != -1 && s->out_len != 0 && load_stream_flush(s) != 0) load_stream_fail(w, s);
+    }
+}
+
+/**
+ * Read every complete segment available on a persistent socket and hand each to its handshake. The server answers
+ * from the handshake's own port pair, so a segment's destination port is the port of the slot it is for.
+ *
+ * @param w The worker owning the stream
+ * @param s The readable stream
+ * @param now The current time
+ */
+static void load_stream_readable(struct load_worker *w, struct load_stream *s, uint64_t now)
+{
+    for (;;)
+    {
+        ssize_t got = recv(s->fd, s->in + s->in_len, sizeof(s->in) - s->in_len, 0);
+
+        if (got == 0 || (got == -1 && errno != EAGAIN && errno != EWOULDBLOCK))
+        {
+            load_stream_fail(w, s);
+            return;
+        }
+        if (got == -1) return;
+
+        s->in_len += (size_t) got;
+        size_t whole = s->in_len / sizeof(mytcp_t) * sizeof(mytcp_t);
+        for (size_t off = 0; off < whole; off += sizeof(mytcp_t))
+        {
+            // anything else is late for a handshake that has already failed (or done) in its slot
+            const mytcp_t *seg = (const mytcp_t *) (s->in + off);
+            int slot = seg->destport - 1;
+            struct load_conn *c = slot >= 0 && slot < w->nslots ? &w->slots[slot] : NULL;
+            if (c == NULL || c->fd == -1 || c->stream != s || mytcp_conn_done(&c->conn))
+            {
+                METRIC_INC(w->rejected[CONN_ERR_STATE]);
+                continue;
+            }
+
+            memcpy(&c->in, seg, sizeof(mytcp_t));
+            if (load_input(w, c, now) == 0) load_finish(w, c, now);
+        }
+
+        s->in_len -= whole;
+        memmove(s->in, s->in + whole, s->in_len);
+    }
+}
+
+/**
+ * A UDP handshake's retransmission timer expired: the server has not answered our latest segments, so send them
+ * again and back off. A handshake out of retries fails, even if its deadline is further out.
+ *
+ * @param w The worker owning the handshake
+ * @param c The handshake
+ */
+static void load_retransmit(struct load_worker *w, struct load_conn *c)
+{
+    mytcp_t out[2];
+    int n = mytcp_conn_timeout(&c->conn, out);
+    if (n == -1)
+    {
+        load_fail(w, c, FAILURE_TIMEOUT);
+        return;
+    }
+
+    // segments still queued go out anyway once the socket has room
+    if (c->out_len == 0)
+    {
+        for (int i = 0; i < n; i++) c->out[i] = out[i];
+        c->out_len = (size_t) n;
+        METRIC_ADD(w->retransmitted, (uint64_t) n);
+        if (load_flush(c) != 0)
+        {
+            load_fail(w, c, FAILURE_IO);
+            return;
+        }
+    }
+    load_arm_rto(w, c, now_ns());
+}
+
+/**
+ * Timer callback: a handshake past its deadline fails, and one whose retransmission timer expired retransmits.
+ *
+ * @param timer The expired timer, one of a handshake's
+ * @param arg The worker
+ */
+static void load_timer(mytcp_timer_t *timer, void *arg)
+{
+    struct load_worker *w = arg;
+
+    // both timers live in the handshake's slot
+    struct load_conn *c = &w->slots[((char *) timer - (char *) w->slots) / (ptrdiff_t) sizeof(*c)];
+    if (timer == &c->deadline)
+        load_fail(w, c, FAILURE_TIMEOUT);
+    else
+        load_retransmit(w, c);
+}
+
+/**
+ * Worker thread: keep up to nslots handshakes in flight on one epoll instance, starting new ones as fast as the
+ * rate allows until the duration or count runs out (or SIGINT), then let the ones in flight finish or time out.
+ * Handshakes multiplexed over persistent sockets have their segments written once per wakeup, for all at once.
+ *
+ * @param arg The worker
+ * @return NULL
+ */
+static void *load_worker_main(void *arg)
+{
+    struct load_worker *w = arg;
+    struct epoll_event events[LOAD_MAX_EVENTS];
+
+    uint64_t begin = now_ns();
+    uint64_t end = begin + (uint64_t) (w->config->duration * NS_PER_SEC);
+
+    for (;;)
+    {
+        uint64_t now = now_ns();
+        bool starting = loading && now < end && (w->quota == 0 || w->started < w->quota);
+        if (!starting && w->nfree == w->nslots) break;
+
+        // start as many handshakes as free slots and the rate allow
+        int wait_ms = LOAD_TICK_MS;
+        while (starting && w->nfree > 0 && (w->quota == 0 || w->started < w->quota))
+        {
+            if (w->rate > 0)
+            {
+                uint64_t due = begin + (uint64_t) ((double) w->started / w->rate * NS_PER_SEC);
+                if (due > now)
+                {
+                    uint64_t until = (due - now + NS_PER_MS - 1) / NS_PER_MS;
+                    if (until < (uint64_t) wait_ms) wait_ms = (int) until;
+                    break;
+                }
+            }
+            load_start(w, now);
+        }
+        load_flush_streams(w);
+
+        // and sleep no longer than until the next timer
+        wait_ms = mytcp_wheel_timeout(&w->wheel, now / NS_PER_MS, wait_ms);
+        int n = epoll_wait(w->epfd, events, LOAD_MAX_EVENTS, wait_ms);
+        if (n == -1 && errno != EINTR)
+        {
+            write_errno(errno, "epoll_wait");
+            break;
+        }
+
+        now = now_ns();
+        for (int i = 0; i < n; i++)
+        {
+            // persistent sockets only have their queues written once every event is handled, below
+            if (w->streams == NULL)
+                load_event(w, events[i].data.ptr, events[i].events, now);
+            else if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+                load_stream_readable(w, events[i].data.ptr, now);
+        }
+        mytcp_wheel_advance(&w->wheel, now / NS_PER_MS, load_timer, w);
+        load_flush_streams(w);
+    }
+
+    // anything still in flight after an epoll failure counts as timed out
+    for (int i = 0; i < w->nslots; i++)
+        if (w->slots[i].fd != -1) load_fail(w, &w->slots[i], FAILURE_TIMEOUT);
+
+    // the last handshakes' final segments may still be queued: write them out before the persistent sockets close
+    for (int i = 0; i < w->nstreams; i++)
+    {
+        struct load_stream *s = &w->streams[i];
+        if (s->fd == -1) continue;
+        if (s->out_len != 0 && fcntl(s->fd, F_SETFL, fcntl(s->fd, F_GETFL, 0) & ~O_NONBLOCK) == 0)
+            load_stream_flush(s);
+        close(s->fd);
+        s->fd = -1;
+    }
+
+    return NULL;
+}
+
+/**
+ * SYN flood thread: send connection requests at the configured rate, each from a fresh socket (and so a fresh
+ * ephemeral port) that is closed right away, so every request looks like a new client that never completes its
+ * handshake. This is the load a server keeping half-open handshakes in memory cannot absorb.
+ *
+ * @param arg The flood
+ * @return NULL
+ */
+static void *load_flood_main(void *arg)
+{
+    struct load_flood *f = arg;
+    const mytcp_load_config_t *config = f->config;
+    uint64_t begin = now_ns();
+
+    while (__atomic_load_n(&flooding, __ATOMIC_RELAXED))
+    {
+        // send everything due by now, then sleep a tick
+        uint64_t now = now_ns();
+        while (begin + (uint64_t) ((double) f->sent / config->flood * NS_PER_SEC) <= now)
+        {
+            int fd = socket(AF_INET, SOCK_DGRAM, 0);
+            if (fd == -1)
+            {
+                write_errno(errno, "flood socket");
+                return NULL;
+            }
+
+            mytcp_t syn;
+            mytcp_conn_t conn;
+            mytcp_conn_init(&conn, CLIENT_PORT, SERVER_PORT, STATE_CLOSED);
+            mytcp_conn_open(&conn, &syn);
+            sendto(fd, &syn, sizeof(syn), 0, (const struct sockaddr *) &config->target, sizeof(config->target));
+            close(fd);
+            METRIC_INC(f->sent);
+        }
+
+        struct timespec tick = { .tv_sec = 0, .tv_nsec = LOAD_FLOOD_TICK_NS };
+        nanosleep(&tick, NULL);
+    }
+
+    return NULL;
+}
+
+/**
+ * Write the load generator's metrics, summed over the running workers, in Prometheus text format.
+ *
+ * @param f The file to write to
+ * @param arg The workers (struct load_export)
+ */
+static void load_metrics(FILE *f, void *arg)
+{
+    const struct load_export *export = arg;
+
+    mytcp_histogram_t *phases = malloc(NUM_LOAD_PHASES * sizeof(*phases));
+    if (phases == NULL) return;
+    uint64_t started = 0, completed[2] = { 0 }, failures[NUM_LOAD_FAILURES] = { 0 }, retransmitted = 0;
+    uint64_t rejected[NUM_CONN_ERRORS] = { 0 };
+
+    for (int p = 0; p < NUM_LOAD_PHASES; p++) mytcp_hist_init(&phases[p]);
+    for (int i = 0; i < export->nworkers; i++)
+    {
+        const struct load_worker *w = &export->workers[i];
+        started += METRIC_READ(w->started);
+        completed[0] += METRIC_READ(w->completed[0]);
+        completed[1] += METRIC_READ(w->completed[1]);
+        for (int r = 0; r < NUM_LOAD_FAILURES; r++) failures[r] += METRIC_READ(w->failures[r]);
+        retransmitted += METRIC_READ(w->retransmitted);
+        for (int e = 0; e < NUM_CONN_ERRORS; e++) rejected[e] += METRIC_READ(w->rejected[e]);
+        for (int p = 0; p < NUM_LOAD_PHASES; p++) mytcp_hist_merge(&phases[p], &w->phases[p]);
+    }
+
+    mytcp_metrics_family(f, "mytcp_client_handshakes_started_total", "counter", "Handshakes started");
+    mytcp_metrics_value(f, "mytcp_client_handshakes_started_total", NULL, NULL, started);
+    mytcp_metrics_family(f, "mytcp_client_handshakes_completed_total", "counter", "Handshakes completed");
+    mytcp_metrics_value(f, "mytcp_client_handshakes_completed_total", "handshake", "open", completed[1]);
+    mytcp_metrics_value(f, "mytcp_client_handshakes_completed_total", "handshake", "close", completed[0]);
+    mytcp_metrics_family(f, "mytcp_client_handshakes_failed_total", "counter", "Handshakes failed, by reason");
+    for (int r = 0; r < NUM_LOAD_FAILURES; r++)
+        mytcp_metrics_value(f, "mytcp_client_handshakes_failed_total", "reason", LOAD_FAILURE_LABELS[r], failures[r]);
+    mytcp_metrics_family(f, "mytcp_client_segments_retransmitted_total", "counter", "Segments sent again (UDP)");
+    mytcp_metrics_value(f, "mytcp_client_segments_retransmitted_total", NULL, NULL, retransmitted);
+    mytcp_metrics_family(f, "mytcp_client_segments_rejected_total", "counter", "Segments from the server rejected, "
+                         "by reason");
+    for (int e = CONN_OK + 1; e < NUM_CONN_ERRORS; e++)
+        mytcp_metrics_value(f, "mytcp_client_segments_rejected_total", "reason", CONN_ERROR_LABELS[e], rejected[e]);
+    if (export->flood->config->flood > 0)
+    {
+        mytcp_metrics_family(f, "mytcp_client_flood_requests_total", "counter", "Never-completed connection "
+                             "requests sent");
+        mytcp_metrics_value(f, "mytcp_client_flood_requests_total", NULL, NULL, METRIC_READ(export->flood->sent));
+    }
+
+    mytcp_metrics_family(f, "mytcp_client_phase_seconds", "histogram", "Time taken by each handshake phase");
+    for (int p = 0; p < NUM_LOAD_PHASES; p++)
+        mytcp_metrics_histogram(f, "mytcp_client_phase_seconds", "phase", LOAD_PHASE_LABELS[p], &phases[p]);
+    free(phases);
+}
+
+/**
+ * Print the merged results of all workers.
+ *
+ * @param workers The finished workers
+ * @param nworkers The number of workers
+ * @param elapsed The run's wall-clock duration in seconds
+ */
+static void load_report(const struct load_worker *workers, int nworkers, double elapsed)
+{
+    static mytcp_histogram_t phases[NUM_LOAD_PHASES];
+    uint64_t started = 0, completed[2] = { 0 }, failures[NUM_LOAD_FAILURES] = { 0 }, failed = 0, retransmitted = 0;
+
+    for (int p = 0; p < NUM_LOAD_PHASES; p++) mytcp_hist_init(&phases[p]);
+
+    for (int i = 0; i < nworkers; i++)
+    {
+        started += workers[i].started;
+        completed[0] += workers[i].completed[0];
+        completed[1] += workers[i].completed[1];
+        for (int f = 0; f < NUM_LOAD_FAILURES; f++) failures[f] += workers[i].failures[f];
+        retransmitted += workers[i].retransmitted;
+        for (int p = 0; p < NUM_LOAD_PHASES; p++) mytcp_hist_merge(&phases[p], &workers[i].phases[p]);
+    }
+    for (int f = 0; f < NUM_LOAD_FAILURES; f++) failed += failures[f];
+
+    uint64_t done = completed[0] + completed[1];
+    printf("\n%llu handshakes started, %llu completed (%llu open, %llu close), %llu failed in %.3f s\n",
+           (unsigned long long) started, (unsigned long long) done, (unsigned long long) completed[1],
+           (unsigned long long) completed[0], (unsigned long long) failed, elapsed);
+    printf("throughput: %.1f handshakes/s\n", elapsed > 0 ? done / elapsed : 0.0);
+
+    for (int f = 0; f < NUM_LOAD_FAILURES; f++)
+        if (failures[f] != 0) printf("    %-28s %llu\n", LOAD_FAILURE_NAMES[f], (unsigned long long) failures[f]);
+    if (retransmitted != 0) printf("%llu segments retransmitted\n", (unsigned long long) retransmitted);
+
+    printf("\nlatency per phase:\n");
+    for (int p = 0; p < NUM_LOAD_PHASES; p++) mytcp_hist_print(stdout, LOAD_PHASE_NAMES[p], &phases[p]);
+}
+
+/**
+ * Run the load generator: spread the concurrent handshakes, rate and count over worker threads, wait for them to
+ * finish, and print throughput, failures by reason, and latency percentiles for each handshake phase.
+ * SIGINT stops starting new handshakes early. Meanwhile, SIGUSR1 prints the metrics so far in Prometheus text
+ * format, and the exporter serves them if a port is configured.
+ *
+ * @param config What to run
+ * @return 0 on success, else a non-zero error code
+ */
+int mytcp_load_run(const mytcp_load_config_t *config)
+{
+    int nworkers = config->threads;
+    if (nworkers > config->connections) nworkers = config->connections;
+
+    struct load_worker *workers = calloc((size_t) nworkers, sizeof(*workers));
+    if (workers == NULL) return abort_with_errno(errno, "calloc");
+
+    struct sigaction sa;
+    bzero(&sa, sizeof(sa));
+    sa.sa_handler = stop_loading;
+    sigaction(SIGINT, &sa, NULL);
+
+    // SIGUSR1 is only taken by sigtimedwait() below; threads inherit the mask
+    sigset_t dump_signals;
+    sigemptyset(&dump_signals);
+    sigaddset(&dump_signals, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &dump_signals, NULL);
+
+    uint32_t seed = (uint32_t) now_ns() | 1;
+    for (int i = 0; i < nworkers; i++)
+    {
+        struct load_worker *w = &workers[i];
+        w->config = config;
+        w->rng = seed * (uint32_t) (2 * i + 1) | 1;
+
+        // share connections, rate and count as evenly as possible
+        w->nslots = config->connections / nworkers + (i < config->connections % nworkers);
+        w->rate = config->rate / nworkers;
+        if (config->count != 0)
+            w->quota = config->count / (uint64_t) nworkers + ((uint64_t) i < config->count % (uint64_t) nworkers);
+
+        w->slots = calloc((size_t) w->nslots, sizeof(*w->slots));
+        w->free_slots = calloc((size_t) w->nslots, sizeof(*w->free_slots));
+        w->epfd = epoll_create1(0);
+        if (w->slots == NULL || w->free_slots == NULL || w->epfd == -1)
+            return abort_with_errno(errno, "worker setup");
+
+        // streams are connected by the first handshake started on each
+        if (config->persistent > 0)
+        {
+            w->nstreams = config->persistent < w->nslots ? config->persistent : w->nslots;
+            w->streams = calloc((size_t) w->nstreams, sizeof(*w->streams));
+            if (w->streams == NULL) return abort_with_errno(errno, "worker setup");
+            for (int s = 0; s < w->nstreams; s++) w->streams[s].fd = -1;
+        }
+
+        for (int s = 0; s < w->nslots; s++)
+        {
+            w->slots[s].fd = -1;
+            w->free_slots[w->nfree++] = w->nslots - 1 - s;
+        }
+        for (int p = 0; p < NUM_LOAD_PHASES; p++) mytcp_hist_init(&w->phases[p]);
+        mytcp_wheel_init(&w->wheel, now_ns() / NS_PER_MS);
+    }
+
+    printf("running %s handshakes (%d%% open) against %s:%d: %d threads, %d concurrent, ",
+           config->udp ? "UDP" : "TCP", config->open_percent, inet_ntoa(config->target.sin_addr),
+           ntohs(config->target.sin_port), nworkers, config->connections);
+    if (config->rate > 0)
+        printf("%.0f/s", config->rate);
+    else
+        printf("unthrottled");
+    printf(" for %.1f s", config->duration);
+    if (config->count != 0) printf(" or %llu handshakes", (unsigned long long) config->count);
+    if (config->flood > 0) printf(", under a SYN flood of %.0f/s", config->flood);
+    if (config->persistent > 0)
+        printf(", multiplexed over %d persistent socket%s per thread", config->persistent,
+               config->persistent == 1 ? "" : "s");
+    printf("; press ^C to stop early\n");
+
+    struct load_flood flood = { .config = config };
+    if (config->flood > 0)
+    {
+        flooding = true;
+        int err = pthread_create(&flood.thread, NULL, load_flood_main, &flood);
+        if (err != 0) return abort_with_errno(err, "pthread_create");
+    }
+
+    uint64_t begin = now_ns();
+    for (int i = 0; i < nworkers; i++)
+    {
+        int err = pthread_create(&workers[i].thread, NULL, load_worker_main, &workers[i]);
+        if (err != 0) return abort_with_errno(err, "pthread_create");
+    }
+
+    struct load_export export = { .workers = workers, .nworkers = nworkers, .flood = &flood };
+    mytcp_exporter_t exporter;
+    bool exporting = false;
+    if (config->metrics_port != 0)
+    {
+        int err = mytcp_exporter_start(&exporter, config->metrics_port, load_metrics, &export);
+        if (err != 0)
+            write_errno(err, "metrics exporter");
+        else
+            exporting = true;
+    }
+
+    // wait for the workers, printing the metrics whenever SIGUSR1 arrives
+    struct timespec tick = { .tv_sec = 0, .tv_nsec = LOAD_TICK_MS * (long) NS_PER_MS };
+    for (int i = 0; i < nworkers; i++)
+        while (pthread_tryjoin_np(workers[i].thread, NULL) == EBUSY)
+            if (sigtimedwait(&dump_signals, NULL, &tick) == SIGUSR1)
+            {
+                load_metrics(stdout, &export);
+                fflush(stdout);
+            }
+    double elapsed = (double) (now_ns() - begin) / NS_PER_SEC;
+
+    if (config->flood > 0)
+    {
+        __atomic_store_n(&flooding, false, __ATOMIC_RELAXED);
+        pthread_join(flood.thread, NULL);
+    }
+
+    if (exporting) mytcp_exporter_stop(&exporter);
+    load_report(workers, nworkers, elapsed);
+    if (config->flood > 0)
+        printf("\nSYN flood: %llu connection requests sent (%.1f/s)\n", (unsigned long long) flood.sent,
+               elapsed > 0 ? flood.sent / elapsed : 0.0);
+
+    for (int i = 0; i < nworkers; i++)
+    {
+        close(workers[i].epfd);
+        free(workers[i].slots);
+        free(workers[i].free_slots);
+        for (int s = 0; s < workers[i].nstreams; s++) free(workers[i].streams[s].out);
+        free(workers[i].streams);
+    }
+    free(workers);
+    return 0;
+}
@@ -0,0 +1,39 @@
+#ifndef CSCE3530_LAB3_LOADGEN_H
+#define CSCE3530_LAB3_LOADGEN_H
+
+#include <inttypes.h>
+#include <netinet/in.h>
+#include <stdbool.h>
+
+// defaults for the load generator's options
+#define LOAD_DEFAULT_THREADS 1
+#define LOAD_DEFAULT_CONNECTIONS 64
+#define LOAD_DEFAULT_DURATION 10.0
+#define LOAD_DEFAULT_TIMEOUT_MS 2000
+
+// handshakes multiplexed over persistent sockets are told apart by their port, slot + 1, so a thread runs at most this
+// many at once
+#define LOAD_MAX_MUX_SLOTS 65535
+
+// what the load generator runs against a server
+typedef struct mytcp_load_config
+{
+    struct sockaddr_in target;
+    bool udp;                   // carry segments as UDP datagrams
+    int threads;                // worker threads, each with its own epoll loop
+    int connections;            // concurrent handshakes in flight, across all threads
+    double rate;                // handshakes started per second, across all threads; 0 for as fast as possible
+    int open_percent;           // share of open handshakes (the rest are close handshakes)
+    double duration;            // seconds to keep starting handshakes
+    uint64_t count;             // stop after starting this many handshakes; 0 for no limit
+    int timeout_ms;             // a handshake not done after this long fails
+    double flood;               // connection requests per second that are never completed (UDP only); 0 for none
+    uint16_t metrics_port;      // local port to serve live metrics on; 0 for none
+    int persistent;             // TCP sockets each thread keeps open and multiplexes its handshakes over; 0 for a
+                                // fresh socket per handshake
+} mytcp_load_config_t;
+
+// run the load and print throughput and per-phase latency percentiles to stdout
+int mytcp_load_run(const mytcp_load_config_t *);
+
+#endif //CSCE3530_LAB3_LOADGEN_H
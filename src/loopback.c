@@ -0,0 +1,380 @@
+#include "loopback.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "common.h"
+#include "spsc.h"
+
+
+// segments taken off a ring at once
+#define LOOPBACK_BATCH 256
+
+// one end of the link: segments arrive on rx and leave on tx
+struct loop_side
+{
+    mytcp_spsc_t *rx;
+    mytcp_spsc_t *tx;
+    mytcp_t in[LOOPBACK_BATCH];
+    mytcp_t out[2 * LOOPBACK_BATCH];    // an incoming segment produces at most two responses
+    size_t nout;
+    uint64_t sent;
+    uint64_t errors[NUM_CONN_ERRORS];
+    bool overflow;
+};
+
+// the client: one connection per concurrent handshake, using port slot + 1
+struct loop_client
+{
+    struct loop_side side;
+    const mytcp_loopback_config_t *config;
+    mytcp_conn_t *conns;
+    bool *open;                 // whether each slot runs an open handshake, else a close handshake
+    int active;                 // slots with a handshake in progress
+    uint32_t rng;
+    uint64_t started;
+    uint64_t completed[2];      // indexed by open
+    uint64_t failed;
+};
+
+// the server: one connection per client port, created by the port's first segment
+struct loop_server
+{
+    struct loop_side side;
+    mytcp_conn_t *conns;
+    bool *active;
+    uint64_t completed;
+    uint64_t failed;
+    bool client_done;           // set by the client's thread once it has sent its last segment
+    pthread_t thread;
+};
+
+static uint64_t loop_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+/**
+ * Hand every queued response to the peer with one push. The rings are sized for every connection's worst case, so
+ * a push that does not fit means a bug; it is recorded and the run stops.
+ *
+ * @param side The sending side
+ */
+static void loop_flush(struct loop_side *side)
+{
+    if (side->nout == 0) return;
+    if (mytcp_spsc_push(side->tx, side->out, side->nout) != side->nout) side->overflow = true;
+    side->sent += side->nout;
+    side->nout = 0;
+}
+
+/**
+ * Start the next handshake in a client slot, or retire the slot once every handshake has been started.
+ *
+ * @param c The client
+ * @param slot The slot
+ */
+static void loop_client_start(struct loop_client *c, int slot)
+{
+    if (c->started == c->config->count)
+    {
+        c->active--;
+        return;
+    }
+
+    uint32_t x = c->rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    c->rng = x;
+
+    bool open = (int) (x % 100) < c->config->open_percent;
+    mytcp_conn_t *conn = &c->conns[slot];
+    mytcp_conn_init(conn, (uint16_t) (slot + 1), SERVER_PORT, open ? STATE_CLOSED : STATE_ESTABLISHED);
+    if (open)
+        mytcp_conn_open(conn, &c->side.out[c->side.nout++]);
+    else
+        mytcp_conn_close(conn, &c->side.out[c->side.nout++]);
+
+    c->open[slot] = open;
+    c->started++;
+}
+
+/**
+ * Feed a segment to a connection the way run_handshake() does: input, then the response, then our own close request
+ * if the peer's close left the connection in CLOSE_WAIT.
+ *
+ * @param side The side owning the connection
+ * @param conn The connection
+ * @param seg The incoming segment
+ * @return CONN_OK if the segment was accepted, else the reason it was rejected
+ */
+static mytcp_conn_error_t loop_input(struct loop_side *side, mytcp_conn_t *conn, const mytcp_t *seg)
+{
+    int produced;
+    mytcp_conn_error_t err = mytcp_conn_input(conn, seg, &side->out[side->nout], &produced);
+    if (err != CONN_OK)
+    {
+        side->errors[err]++;
+        return err;
+    }
+
+    side->nout += (size_t) produced;
+    if (conn->state == STATE_CLOSE_WAIT) mytcp_conn_close(conn, &side->out[side->nout++]);
+    return CONN_OK;
+}
+
+/**
+ * Whether a reset from the server answers the segment a client connection sent last: a reset meant for the slot's
+ * previous handshake must not fail the current one.
+ *
+ * @param conn The client connection
+ * @param seg The reset
+ * @return True if the server rejected this connection's latest segment
+ */
+static bool loop_client_reset(const mytcp_conn_t *conn, const mytcp_t *seg)
+{
+    for (int i = 0; i < conn->nsent; i++)
+        if (conn->sent[i].sequence == seg->acknowledgment) return true;
+    return false;
+}
+
+/**
+ * Handle one batch of segments on the client side: advance each handshake, and start a new one in every slot whose
+ * handshake finished or failed. A reset from the server means the server rejected the slot's handshake.
+ *
+ * @param c The client
+ * @return The number of segments handled
+ */
+static size_t loop_client_step(struct loop_client *c)
+{
+    size_t n = mytcp_spsc_pop(c->side.rx, c->side.in, LOOPBACK_BATCH);
+
+    for (size_t i = 0; i < n; i++)
+    {
+        const mytcp_t *seg = &c->side.in[i];
+        int slot = seg->destport - 1;
+        if (slot < 0 || slot >= c->config->connections)
+        {
+            c->side.errors[CONN_ERR_STATE]++;
+            continue;
+        }
+
+        mytcp_conn_t *conn = &c->conns[slot];
+        if (mytcp_check_flag(seg, FLAG_RST))
+        {
+            if (!loop_client_reset(conn, seg)) continue;
+            c->failed++;
+        }
+        else if (loop_input(&c->side, conn, seg) != CONN_OK)
+            c->failed++;
+        else if (mytcp_conn_done(conn))
+            c->completed[c->open[slot]]++;
+        else
+            continue;
+
+        loop_client_start(c, slot);
+    }
+
+    loop_flush(&c->side);
+    return n;
+}
+
+/**
+ * Handle one batch of segments on the server side. A client port's first segment creates its connection, in
+ * whichever state the segment calls for; the connection is dropped once its handshake is done or fails. A failure
+ * is answered with a reset, so the client fails the handshake too instead of waiting for an answer forever.
+ *
+ * @param s The server
+ * @return The number of segments handled
+ */
+static size_t loop_server_step(struct loop_server *s)
+{
+    size_t n = mytcp_spsc_pop(s->side.rx, s->side.in, LOOPBACK_BATCH);
+
+    for (size_t i = 0; i < n; i++)
+    {
+        const mytcp_t *seg = &s->side.in[i];
+        uint16_t port = seg->srcport;
+        mytcp_conn_t *conn = &s->conns[port];
+
+        if (!s->active[port])
+        {
+            mytcp_conn_accept(conn, SERVER_PORT, port, seg);
+            s->active[port] = true;
+        }
+
+        if (loop_input(&s->side, conn, seg) != CONN_OK)
+        {
+            s->failed++;
+            s->active[port] = false;
+            // the reset acknowledges the rejected segment, which tells the client which handshake failed
+            mytcp_t *reset = &s->side.out[s->side.nout++];
+            *reset = mytcp_create_segment(SERVER_PORT, port);
+            mytcp_set_acknowledgment(reset, seg->sequence);
+            mytcp_set_flag(reset, FLAG_RST);
+        }
+        else if (mytcp_conn_done(conn))
+        {
+            s->completed++;
+            s->active[port] = false;
+        }
+    }
+
+    loop_flush(&s->side);
+    return n;
+}
+
+/**
+ * Server thread (two-thread runs): serve until the client is done and every segment it sent has been handled.
+ *
+ * @param arg The server
+ * @return NULL
+ */
+static void *loop_server_main(void *arg)
+{
+    struct loop_server *s = arg;
+
+    for (;;)
+    {
+        // read the flag before draining, so segments sent just before it was set are not missed
+        bool done = __atomic_load_n(&s->client_done, __ATOMIC_ACQUIRE);
+        if (loop_server_step(s) == 0)
+        {
+            if (done || s->side.overflow) break;
+            sched_yield();
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Print the results and check that both sides agree.
+ *
+ * @param c The client
+ * @param s The server
+ * @param elapsed The run's duration in seconds
+ * @return 0 iff every handshake completed on both sides
+ */
+static int loop_report(const struct loop_client *c, const struct loop_server *s, double elapsed)
+{
+    uint64_t done = c->completed[0] + c->completed[1];
+    uint64_t segments = c->side.sent + s->side.sent;
+
+    printf("\n%llu handshakes completed (%llu open, %llu close), %llu failed in %.3f s\n",
+           (unsigned long long) done, (unsigned long long) c->completed[1], (unsigned long long) c->completed[0],
+           (unsigned long long) c->failed, elapsed);
+    printf("throughput: %.0f handshakes/s, %.0f segments/s\n", elapsed > 0 ? done / elapsed : 0.0,
+           elapsed > 0 ? segments / elapsed : 0.0);
+    printf("server: %llu handshakes completed, %llu failed\n", (unsigned long long) s->completed,
+           (unsigned long long) s->failed);
+
+    for (int e = CONN_OK + 1; e < NUM_CONN_ERRORS; e++)
+    {
+        if (c->side.errors[e] != 0)
+            printf("    client: %-30s %llu\n", CONN_ERROR_NAMES[e], (unsigned long long) c->side.errors[e]);
+        if (s->side.errors[e] != 0)
+            printf("    server: %-30s %llu\n", CONN_ERROR_NAMES[e], (unsigned long long) s->side.errors[e]);
+    }
+
+    if (c->side.overflow || s->side.overflow) printf("error: a ring overflowed\n");
+
+    bool ok = !c->side.overflow && !s->side.overflow && c->failed == 0 && s->failed == 0 && done == c->config->count
+              && s->completed == done;
+    printf("%s\n", ok ? "all handshakes completed on both sides" : "MISMATCH: see above");
+    return ok ? 0 : 1;
+}
+
+/**
+ * Run handshakes between an in-process client and server that exchange segments over a pair of lock-free SPSC
+ * rings instead of sockets. Both sides drive the unchanged connection state machine (mytcp_conn_*), so this measures
+ * the handshake logic alone and checks it end to end: every handshake must complete on both sides.
+ * With one thread the sides take turns; with two, the server runs on its own thread.
+ *
+ * @param config What to run
+ * @return 0 iff every handshake completed on both sides, else a non-zero error code
+ */
+int mytcp_loopback_run(const mytcp_loopback_config_t *config)
+{
+    static mytcp_spsc_t to_server, to_client;
+    static struct loop_client client;
+    static struct loop_server server;
+
+    // every connection has at most two segments in flight each way
+    size_t capacity = 2 * (size_t) config->connections + 2 * LOOPBACK_BATCH;
+    int err = mytcp_spsc_init(&to_server, capacity);
+    if (err == 0) err = mytcp_spsc_init(&to_client, capacity);
+    if (err != 0) return abort_with_errno(err, "mytcp_spsc_init");
+
+    bzero(&client, sizeof(client));
+    bzero(&server, sizeof(server));
+    client.side.rx = &to_client;
+    client.side.tx = &to_server;
+    server.side.rx = &to_server;
+    server.side.tx = &to_client;
+
+    client.config = config;
+    client.rng = (uint32_t) loop_now_ns() | 1;
+    client.conns = calloc((size_t) config->connections, sizeof(*client.conns));
+    client.open = calloc((size_t) config->connections, sizeof(*client.open));
+    server.conns = calloc(LOOPBACK_MAX_CONNECTIONS + 1, sizeof(*server.conns));
+    server.active = calloc(LOOPBACK_MAX_CONNECTIONS + 1, sizeof(*server.active));
+    if (client.conns == NULL || client.open == NULL || server.conns == NULL || server.active == NULL)
+        return abort_with_errno(errno, "calloc");
+
+    printf("running %llu handshakes (%d%% open) in-process: %d concurrent, %d thread%s\n",
+           (unsigned long long) config->count, config->open_percent, config->connections, config->threads,
+           config->threads == 1 ? "" : "s");
+
+    uint64_t begin = loop_now_ns();
+
+    // start a handshake in every slot; each slot starts its next one as soon as the previous is over
+    client.active = config->connections;
+    for (int slot = 0; slot < config->connections; slot++)
+    {
+        loop_client_start(&client, slot);
+        if (client.side.nout == LOOPBACK_BATCH) loop_flush(&client.side);
+    }
+    loop_flush(&client.side);
+
+    if (config->threads > 1)
+    {
+        err = pthread_create(&server.thread, NULL, loop_server_main, &server);
+        if (err != 0) return abort_with_errno(err, "pthread_create");
+
+        while (client.active > 0 && !client.side.overflow)
+            if (loop_client_step(&client) == 0) sched_yield();
+
+        __atomic_store_n(&server.client_done, true, __ATOMIC_RELEASE);
+        pthread_join(server.thread, NULL);
+    }
+    else
+    {
+        while (client.active > 0 && !client.side.overflow && !server.side.overflow)
+        {
+            loop_server_step(&server);
+            loop_client_step(&client);
+        }
+
+        // the client's last segments (the final acknowledgments) still need the server
+        while (loop_server_step(&server) > 0);
+    }
+
+    int result = loop_report(&client, &server, (double) (loop_now_ns() - begin) / 1e9);
+
+    free(client.conns);
+    free(client.open);
+    free(server.conns);
+    free(server.active);
+    mytcp_spsc_free(&to_server);
+    mytcp_spsc_free(&to_client);
+    return result;
+}
@@ -0,0 +1,25 @@
+#ifndef CSCE3530_LAB3_LOOPBACK_H
+#define CSCE3530_LAB3_LOOPBACK_H
+
+#include <inttypes.h>
+
+// defaults for the loopback run's options
+#define LOOPBACK_DEFAULT_THREADS 1
+#define LOOPBACK_DEFAULT_CONNECTIONS 1024
+#define LOOPBACK_DEFAULT_COUNT 1000000
+#define LOOPBACK_MAX_CONNECTIONS 65535     // each concurrent handshake has its own client port
+
+// what to run between an in-process client and server
+typedef struct mytcp_loopback_config
+{
+    int threads;                // 1: client and server take turns on one thread, 2: each gets its own thread
+    int connections;            // concurrent handshakes
+    int open_percent;           // share of open handshakes (the rest are close handshakes)
+    uint64_t count;             // handshakes to run
+} mytcp_loopback_config_t;
+
+// run handshakes between a client and a server linked by two SPSC rings, then print throughput and any failures;
+// returns 0 iff every handshake completed on both sides
+int mytcp_loopback_run(const mytcp_loopback_config_t *);
+
+#endif //CSCE3530_LAB3_LOOPBACK_H
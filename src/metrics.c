@@ -0,0 +1,382 @@
+#include "metrics.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+
+// room for a metric name with a prefix and a suffix
+#define METRICS_NAME_LEN 128
+
+// scrapers waiting to be answered; they come one at a time
+#define METRICS_BACKLOG 16
+
+const char *STEP_NAMES[NUM_STEPS] = {
+        "syn_to_synack", "synack_to_ack", "fin_to_ack", "ack_to_fin", "fin_to_last_ack"
+};
+
+const char *CONN_ERROR_LABELS[NUM_CONN_ERRORS] = {
+        "ok", "checksum", "flags", "sequence", "ack", "state", "duplicate"
+};
+
+// upper bounds of the exported buckets, in nanoseconds
+static const uint64_t BUCKET_BOUNDS[METRICS_BUCKETS] = {
+        1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000,
+        1000000, 2500000, 5000000, 10000000, 25000000, 50000000, 100000000, 250000000, 500000000,
+        1000000000, 5000000000
+};
+
+/**
+ * Read the monotonic clock.
+ *
+ * @return The current time in nanoseconds
+ */
+uint64_t mytcp_metrics_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+/**
+ * Initialize empty metrics.
+ *
+ * @param m The metrics
+ */
+void mytcp_metrics_init(mytcp_metrics_t *m)
+{
+    bzero(m, sizeof(*m));
+    for (int s = 0; s < NUM_STEPS; s++) mytcp_hist_init(&m->steps[s]);
+}
+
+/**
+ * Add one thread's metrics to a total. The source may be counting on its thread meanwhile.
+ *
+ * @param dst The metrics to add to
+ * @param src The metrics to add
+ */
+void mytcp_metrics_merge(mytcp_metrics_t *dst, const mytcp_metrics_t *src)
+{
+    for (int s = 0; s < NUM_STEPS; s++) mytcp_hist_merge(&dst->steps[s], &src->steps[s]);
+    for (int e = 0; e < NUM_CONN_ERRORS; e++) dst->rejected[e] += METRIC_READ(src->rejected[e]);
+}
+
+/**
+ * Time the step a connection event ends, from the connection's previous event, and make this event the previous one.
+ *
+ * @param m The metrics
+ * @param stamp When the connection's previous event happened, 0 if there was none
+ * @param step The step ended by this event
+ * @param now When this event happened
+ */
+static void metrics_step(mytcp_metrics_t *m, uint64_t *stamp, mytcp_step_t step, uint64_t now)
+{
+    if (*stamp != 0 && now >= *stamp) mytcp_hist_record(&m->steps[step], now - *stamp);
+    *stamp = now;
+}
+
+/**
+ * A connection accepted an incoming segment: a request starts a handshake, an acknowledgment ends a step.
+ *
+ * @param m The metrics
+ * @param stamp When the connection's previous event happened, 0 if there was none
+ * @param kind The segment's kind
+ * @param now When the segment was received
+ */
+void mytcp_metrics_received(mytcp_metrics_t *m, uint64_t *stamp, mytcp_segment_kind_t kind, uint64_t now)
+{
+    switch (kind)
+    {
+        case SEGMENT_CONN_REQUEST:
+        case SEGMENT_CLOSE_REQUEST:
+            *stamp = now;
+            break;
+        case SEGMENT_CONN_ACK:
+            metrics_step(m, stamp, STEP_ESTABLISH, now);
+            break;
+        case SEGMENT_CLOSE_ACK:
+            metrics_step(m, stamp, STEP_CLOSED, now);
+            break;
+        default:
+            break;
+    }
+}
+
+/**
+ * A connection's outgoing segment was handed to the kernel. Retransmissions are not reported, so a step that needed
+ * one is timed from the original transmission.
+ *
+ * @param m The metrics
+ * @param stamp When the connection's previous event happened, 0 if there was none
+ * @param kind The segment's kind
+ * @param now When the segment was sent
+ */
+void mytcp_metrics_sent(mytcp_metrics_t *m, uint64_t *stamp, mytcp_segment_kind_t kind, uint64_t now)
+{
+    switch (kind)
+    {
+        case SEGMENT_CONN_GRANTED:
+            metrics_step(m, stamp, STEP_GRANT, now);
+            break;
+        case SEGMENT_CLOSE_ACK:
+            metrics_step(m, stamp, STEP_CLOSE_ACK, now);
+            break;
+        case SEGMENT_CLOSE_REQUEST:
+            metrics_step(m, stamp, STEP_CLOSE, now);
+            break;
+        default:
+            break;
+    }
+}
+
+/**
+ * Count an incoming segment rejected by a connection.
+ *
+ * @param m The metrics
+ * @param err Why it was rejected
+ */
+void mytcp_metrics_rejected(mytcp_metrics_t *m, mytcp_conn_error_t err)
+{
+    METRIC_INC(m->rejected[err]);
+}
+
+/**
+ * Write the header of a metric family.
+ *
+ * @param f The file to write to
+ * @param name The family's name
+ * @param type counter, gauge or histogram
+ * @param help What the family measures
+ */
+void mytcp_metrics_family(FILE *f, const char *name, const char *type, const char *help)
+{
+    fprintf(f, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+/**
+ * Write one sample of a counter or gauge.
+ *
+ * @param f The file to write to
+ * @param name The family's name
+ * @param label The sample's label, or NULL for none
+ * @param label_value The label's value
+ * @param value The sample's value
+ */
+void mytcp_metrics_value(FILE *f, const char *name, const char *label, const char *label_value, uint64_t value)
+{
+    if (label != NULL)
+        fprintf(f, "%s{%s=\"%s\"} %llu\n", name, label, label_value, (unsigned long long) value);
+    else
+        fprintf(f, "%s %llu\n", name, (unsigned long long) value);
+}
+
+/**
+ * Write a latency histogram recorded in nanoseconds as a histogram in seconds, with the cumulative buckets of
+ * BUCKET_BOUNDS.
+ *
+ * @param f The file to write to
+ * @param name The family's name
+ * @param label The histogram's label, or NULL for none
+ * @param label_value The label's value
+ * @param h The histogram
+ */
+void mytcp_metrics_histogram(FILE *f, const char *name, const char *label, const char *label_value,
+                             const mytcp_histogram_t *h)
+{
+    // the label as it leads the bucket labels, and as the only one of the sum and count
+    char labels[METRICS_NAME_LEN] = "", braced[METRICS_NAME_LEN] = "";
+    if (label != NULL)
+    {
+        snprintf(labels, sizeof(labels), "%s=\"%s\",", label, label_value);
+        snprintf(braced, sizeof(braced), "{%s=\"%s\"}", label, label_value);
+    }
+
+    for (int b = 0; b < METRICS_BUCKETS; b++)
+        fprintf(f, "%s_bucket{%sle=\"%g\"} %llu\n", name, labels, BUCKET_BOUNDS[b] / 1e9,
+                (unsigned long long) mytcp_hist_count_upto(h, BUCKET_BOUNDS[b]));
+    fprintf(f, "%s_bucket{%sle=\"+Inf\"} %llu\n", name, labels, (unsigned long long) h->total);
+    fprintf(f, "%s_sum%s %.9f\n", name, braced, h->sum / 1e9);
+    fprintf(f, "%s_count%s %llu\n", name, braced, (unsigned long long) h->total);
+}
+
+/**
+ * Write handshake metrics: the time taken by each step, and the segments rejected by reason.
+ *
+ * @param f The file to write to
+ * @param prefix Prefix of the families' names
+ * @param m The metrics, typically merged from every thread's
+ */
+void mytcp_metrics_write(FILE *f, const char *prefix, const mytcp_metrics_t *m)
+{
+    char name[METRICS_NAME_LEN];
+
+    snprintf(name, sizeof(name), "%s_step_seconds", prefix);
+    mytcp_metrics_family(f, name, "histogram", "Time from one handshake event to the next");
+    for (int s = 0; s < NUM_STEPS; s++) mytcp_metrics_histogram(f, name, "step", STEP_NAMES[s], &m->steps[s]);
+
+    snprintf(name, sizeof(name), "%s_segments_rejected_total", prefix);
+    mytcp_metrics_family(f, name, "counter", "Incoming segments rejected, by reason");
+    for (int e = CONN_OK + 1; e < NUM_CONN_ERRORS; e++)
+        mytcp_metrics_value(f, name, "reason", CONN_ERROR_LABELS[e], m->rejected[e]);
+}
+
+/**
+ * Write a whole buffer to a socket.
+ *
+ * @param fd The socket
+ * @param buf The bytes
+ * @param len The number of bytes
+ * @return 0 on success, -1 on error (including a timeout)
+ */
+static int exporter_send(int fd, const char *buf, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t written = send(fd, buf, len, MSG_NOSIGNAL);
+        if (written == -1)
+        {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        buf += written;
+        len -= (size_t) written;
+    }
+    return 0;
+}
+
+/**
+ * Answer one scrape: read the request up to the end of its headers (whatever it asks for, the answer is the
+ * metrics), then write the metrics and hang up.
+ *
+ * @param e The exporter
+ * @param fd The scraper's socket
+ */
+static void exporter_answer(mytcp_exporter_t *e, int fd)
+{
+    struct timeval timeout = { .tv_sec = METRICS_IO_TIMEOUT_MS / 1000, .tv_usec = METRICS_IO_TIMEOUT_MS % 1000 * 1000 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    char request[METRICS_REQUEST_MAX + 1];
+    size_t got = 0;
+    while (got < METRICS_REQUEST_MAX)
+    {
+        ssize_t n = recv(fd, request + got, METRICS_REQUEST_MAX - got, 0);
+        if (n <= 0) break;
+        got += (size_t) n;
+        request[got] = '\0';
+        if (strstr(request, "\r\n\r\n") != NULL || strstr(request, "\n\n") != NULL) break;
+    }
+
+    char *body = NULL;
+    size_t body_len = 0;
+    FILE *f = open_memstream(&body, &body_len);
+    if (f == NULL) return;
+    e->write(f, e->arg);
+    fclose(f);
+
+    char header[256];
+    int header_len = snprintf(header, sizeof(header),
+                              "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                              "Content-Length: %zu\r\nConnection: close\r\n\r\n", body_len);
+    if (exporter_send(fd, header, (size_t) header_len) == 0) exporter_send(fd, body, body_len);
+    free(body);
+}
+
+/**
+ * Exporter thread: answer scrapes one at a time until the exporter is stopped. Scrapes are rare, so answering them
+ * from one blocking thread is plenty, and it keeps them away from the threads being measured.
+ *
+ * @param arg The exporter
+ * @return NULL
+ */
+static void *exporter_main(void *arg)
+{
+    mytcp_exporter_t *e = arg;
+    struct pollfd fds[2] = { { .fd = e->sockfd, .events = POLLIN }, { .fd = e->stopfd, .events = POLLIN } };
+
+    for (;;)
+    {
+        if (poll(fds, 2, -1) == -1)
+        {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (fds[1].revents != 0) break;
+
+        int fd = accept(e->sockfd, NULL, NULL);
+        if (fd == -1) continue;
+        exporter_answer(e, fd);
+        close(fd);
+    }
+
+    return NULL;
+}
+
+/**
+ * Start serving metrics over HTTP, in Prometheus text format, on a port of the loopback interface only.
+ *
+ * @param e The exporter to start
+ * @param port The port to listen on
+ * @param writer Writes the metrics of one scrape; called on the exporter's thread
+ * @param arg Passed to the writer
+ * @return 0 on success, else an errno value
+ */
+int mytcp_exporter_start(mytcp_exporter_t *e, uint16_t port, mytcp_metrics_writer_t writer, void *arg)
+{
+    e->write = writer;
+    e->arg = arg;
+
+    struct sockaddr_in addr;
+    bzero(&addr, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+
+    e->sockfd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (e->sockfd == -1) return errno;
+
+    int enable = 1;
+    setsockopt(e->sockfd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+    if (bind(e->sockfd, (struct sockaddr *) &addr, sizeof(addr)) == -1 || listen(e->sockfd, METRICS_BACKLOG) == -1)
+    {
+        int err = errno;
+        close(e->sockfd);
+        return err;
+    }
+
+    e->stopfd = eventfd(0, EFD_NONBLOCK);
+    if (e->stopfd == -1)
+    {
+        int err = errno;
+        close(e->sockfd);
+        return err;
+    }
+
+    int err = pthread_create(&e->thread, NULL, exporter_main, e);
+    if (err != 0)
+    {
+        close(e->stopfd);
+        close(e->sockfd);
+    }
+    return err;
+}
+
+/**
+ * Stop serving metrics, once the scrape being answered (if any) is done.
+ *
+ * @param e The running exporter
+ */
+void mytcp_exporter_stop(mytcp_exporter_t *e)
+{
+    uint64_t one = 1;
+    if (write(e->stopfd, &one, sizeof(one)) == sizeof(one)) pthread_join(e->thread, NULL);
+    close(e->stopfd);
+    close(e->sockfd);
+}
@@ -0,0 +1,80 @@
+#ifndef CSCE3530_LAB3_METRICS_H
+#define CSCE3530_LAB3_METRICS_H
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include "connection.h"
+#include "histogram.h"
+
+// bucket bounds of exported latency histograms, in nanoseconds, from 1 us to 5 s
+#define METRICS_BUCKETS 20
+
+// most bytes of a scrape request read before answering it, and how long a scraper may take to send or read
+#define METRICS_REQUEST_MAX 4096
+#define METRICS_IO_TIMEOUT_MS 1000
+
+// count into a counter only the calling thread writes, but that other threads may read at any time; relaxed atomics
+// compile to plain loads and stores, so counting costs nothing more than before
+#define METRIC_ADD(counter, n) __atomic_store_n(&(counter), (counter) + (n), __ATOMIC_RELAXED)
+#define METRIC_INC(counter) METRIC_ADD(counter, 1)
+#define METRIC_READ(counter) __atomic_load_n(&(counter), __ATOMIC_RELAXED)
+
+// handshake steps the server times, each from the connection's previous event
+typedef enum mytcp_step
+{
+    STEP_GRANT,             // connection request received until connection granted sent
+    STEP_ESTABLISH,         // connection granted sent until its acknowledgment received
+    STEP_CLOSE_ACK,         // close request received until acknowledged
+    STEP_CLOSE,             // close acknowledgment sent until our own close request sent
+    STEP_CLOSED,            // our close request sent until acknowledged
+    NUM_STEPS
+} mytcp_step_t;
+
+// one thread's handshake metrics; only that thread writes them, any thread may merge them
+typedef struct mytcp_metrics
+{
+    mytcp_histogram_t steps[NUM_STEPS];
+    uint64_t rejected[NUM_CONN_ERRORS];     // incoming segments rejected, by reason
+} mytcp_metrics_t;
+
+// writes one scrape: the exporter's caller decides what is in it
+typedef void (*mytcp_metrics_writer_t)(FILE *, void *);
+
+// serves scrapes over HTTP from a thread of its own, until stopped
+typedef struct mytcp_exporter
+{
+    int sockfd;
+    int stopfd;                 // eventfd, readable once the exporter is stopping
+    mytcp_metrics_writer_t write;
+    void *arg;
+    pthread_t thread;
+} mytcp_exporter_t;
+
+// names as arrays to make exporting easier later
+extern const char *STEP_NAMES[NUM_STEPS];
+extern const char *CONN_ERROR_LABELS[NUM_CONN_ERRORS];
+
+// monotonic clock, in nanoseconds
+uint64_t mytcp_metrics_now(void);
+
+// setup, and merging threads' metrics for an export
+void mytcp_metrics_init(mytcp_metrics_t *);
+void mytcp_metrics_merge(mytcp_metrics_t *, const mytcp_metrics_t *);
+
+// events of a connection, whose previous event is kept in its stamp (0 before the first)
+void mytcp_metrics_received(mytcp_metrics_t *, uint64_t *, mytcp_segment_kind_t, uint64_t);
+void mytcp_metrics_sent(mytcp_metrics_t *, uint64_t *, mytcp_segment_kind_t, uint64_t);
+void mytcp_metrics_rejected(mytcp_metrics_t *, mytcp_conn_error_t);
+
+// Prometheus text format: a family's header, then its samples (optionally with one label)
+void mytcp_metrics_family(FILE *, const char *, const char *, const char *);
+void mytcp_metrics_value(FILE *, const char *, const char *, const char *, uint64_t);
+void mytcp_metrics_histogram(FILE *, const char *, const char *, const char *, const mytcp_histogram_t *);
+void mytcp_metrics_write(FILE *, const char *, const mytcp_metrics_t *);
+
+// serve scrapes on a local port until stopped
+int mytcp_exporter_start(mytcp_exporter_t *, uint16_t, mytcp_metrics_writer_t, void *);
+void mytcp_exporter_stop(mytcp_exporter_t *);
+
+#endif //CSCE3530_LAB3_METRICS_H
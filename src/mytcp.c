@@ -1,31 +1,128 @@
 #include "mytcp.h"
 
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/random.h>
 #include <time.h>
+#include <unistd.h>
 
 
 // flag names as array to make printing easier later
 char *FLAG_NAMES[6] = { "FIN", "SYN", "RST", "PSH", "ACK", "URG" };
 
 
+// per-thread xoshiro128** state for sequence numbers; all zero until the thread's first call seeds it
+static __thread uint32_t isn_state[4];
+
+/**
+ * SplitMix64 step, used to spread a seed over the generator state.
+ *
+ * @param x The mixer state, advanced in place
+ * @return The next 64 well-mixed bits
+ */
+static uint64_t isn_splitmix64(uint64_t *x)
+{
+    uint64_t z = (*x += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+/**
+ * Seed the calling thread's generator from the kernel's random pool, so processes started in the same second (and
+ * threads within one process) get unrelated sequences. If that pool is unavailable, the clock, process ID and the
+ * address of the thread's state are mixed instead.
+ */
+static void isn_seed(void)
+{
+    uint64_t seed;
+    if (getrandom(&seed, sizeof(seed), GRND_NONBLOCK) != sizeof(seed))
+    {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        seed = (uint64_t) now.tv_sec * 1000000000ull + (uint64_t) now.tv_nsec;
+        seed ^= (uint64_t) getpid() << 32 ^ (uint64_t) (uintptr_t) isn_state;
+    }
+
+    uint64_t a = isn_splitmix64(&seed), b = isn_splitmix64(&seed);
+    isn_state[0] = (uint32_t) a;
+    isn_state[1] = (uint32_t) (a >> 32);
+    isn_state[2] = (uint32_t) b;
+    isn_state[3] = (uint32_t) (b >> 32) | 1;    // never all zero
+}
+
+static inline uint32_t isn_rotl(uint32_t x, int k)
+{
+    return (x << k) | (x >> (32 - k));
+}
+
 /**
  * Generate a random initial sequence number, leaving room for adding 1.
+ * Each thread draws from its own xoshiro128** generator, so threads never contend (unlike rand(), which takes a lock
+ * in glibc) and the call is a handful of register operations.
  *
  * @return A pseudo-randomly generated 32-bit integer between 0 and 4.2E9
  */
 uint32_t mytcp_generate_sequence()
 {
-    return ((uint32_t) rand()) % 0xFFFFFFF0;
+    uint32_t *s = isn_state;
+    if ((s[0] | s[1] | s[2] | s[3]) == 0) isn_seed();
+
+    uint32_t result = isn_rotl(s[1] * 5, 7) * 9;
+    uint32_t t = s[1] << 9;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = isn_rotl(s[3], 11);
+
+    return result % 0xFFFFFFF0;
+}
+
+/**
+ * Apply RFC 1624 (eqn. 3) to a segment's checksum after one of its 16-bit words changed: HC' = ~(~HC + ~m + m').
+ * Keeps a valid checksum valid without summing the whole segment again.
+ *
+ * @param seg The segment whose checksum we are updating
+ * @param old_word The word's previous value
+ * @param new_word The word's new value
+ */
+static void mytcp_update_checksum(mytcp_t *seg, uint16_t old_word, uint16_t new_word)
+{
+    uint32_t sum = (uint16_t) ~seg->checksum + (uint16_t) ~old_word + (uint32_t) new_word;
+
+    // fold twice; the first fold can carry once more
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    sum = (sum & 0xFFFF) + (sum >> 16);
+
+    seg->checksum = (uint16_t) ~sum;
+}
+
+/**
+ * Incrementally update a segment's checksum after one of its 32-bit fields changed. The field covers two 16-bit
+ * words of the checksum, one per half.
+ *
+ * @param seg The segment whose checksum we are updating
+ * @param old_value The field's previous value
+ * @param new_value The field's new value
+ */
+static void mytcp_update_checksum32(mytcp_t *seg, uint32_t old_value, uint32_t new_value)
+{
+    mytcp_update_checksum(seg, (uint16_t) old_value, (uint16_t) new_value);
+    mytcp_update_checksum(seg, (uint16_t) (old_value >> 16), (uint16_t) (new_value >> 16));
 }
 
 /**
  * Create a TCP header segment, given a source and destination port.
- * Automatically fills the sequence number.
+ * Automatically fills the sequence number and a valid checksum, so the segment can be modified with the setters
+ * below without recalculating the checksum from scratch.
  *
  * @param srcport Source port
  * @param destport Destination port
- * @return A segment with srcport, destport, sequence, and header length set properly and everything else set to zero
+ * @return A segment with srcport, destport, sequence, header length and checksum set properly and everything else
+ *         set to zero
  */
 mytcp_t mytcp_create_segment(uint16_t srcport, uint16_t destport)
 {
@@ -42,11 +139,96 @@ mytcp_t mytcp_create_segment(uint16_t srcport, uint16_t destport)
     // set offset properly in the flags; it will not change
     result.flags = (sizeof(mytcp_t) / 4) << 12;
 
+    mytcp_set_checksum(&result);
     return result;
 }
 
 /**
- * Set a segment's flag. Can only set a single flag per call to mytcp_set_flag().
+ * Set a segment's sequence number, keeping its checksum valid.
+ *
+ * @param segment The segment we are modifying
+ * @param sequence The new sequence number
+ */
+void mytcp_set_sequence(mytcp_t *segment, uint32_t sequence)
+{
+    mytcp_update_checksum32(segment, segment->sequence, sequence);
+    segment->sequence = sequence;
+}
+
+/**
+ * Set a segment's acknowledgment number, keeping its checksum valid.
+ *
+ * @param segment The segment we are modifying
+ * @param acknowledgment The new acknowledgment number
+ */
+void mytcp_set_acknowledgment(mytcp_t *segment, uint32_t acknowledgment)
+{
+    mytcp_update_checksum32(segment, segment->acknowledgment, acknowledgment);
+    segment->acknowledgment = acknowledgment;
+}
+
+/**
+ * Set the window a segment advertises, keeping its checksum valid.
+ *
+ * @param segment The segment we are modifying
+ * @param window The number of payload bytes the sender of the segment is willing to receive
+ */
+void mytcp_set_window(mytcp_t *segment, uint16_t window)
+{
+    mytcp_update_checksum(segment, segment->receive, window);
+    segment->receive = window;
+}
+
+/**
+ * Set the length of the payload following a segment's header, keeping its checksum valid. The checksum only covers
+ * the header, so the payload itself can be written without touching it.
+ *
+ * @param segment The segment we are modifying
+ * @param length The payload length in bytes, at most MYTCP_MAX_PAYLOAD
+ */
+void mytcp_set_payload_length(mytcp_t *segment, uint16_t length)
+{
+    mytcp_update_checksum(segment, segment->urgent, length);
+    segment->urgent = length;
+}
+
+/**
+ * The length of a segment's header, options included, as its offset field gives it. A segment received from the
+ * network may carry any offset, so check it (mytcp_validate() does) before relying on it.
+ *
+ * @param segment The segment
+ * @return The header length in bytes
+ */
+size_t mytcp_header_length(const mytcp_t *segment)
+{
+    return (size_t) ((segment->flags & MASK_OFFSET) >> 12) * 4;
+}
+
+/**
+ * Replace a segment's options, setting the offset to cover them and keeping the checksum valid. The options start
+ * at the options field and continue past the fixed header, so the segment must have room for them (a mytcp_header_t
+ * always does). They are padded to a whole 32-bit word, and never take less than the options field.
+ *
+ * @param segment The segment whose options we are replacing
+ * @param options The encoded options (see options.h)
+ * @param length Their length in bytes, at most MYTCP_MAX_OPTIONS
+ */
+void mytcp_set_options(mytcp_t *segment, const uint8_t *options, size_t length)
+{
+    size_t padded = length < sizeof(segment->options) ? sizeof(segment->options) : (length + 3) / 4 * 4;
+    size_t header = offsetof(mytcp_t, options) + padded;
+
+    // zero bytes after the options are end-of-option-list padding
+    uint8_t *area = (uint8_t *) segment + offsetof(mytcp_t, options);
+    memcpy(area, options, length);
+    bzero(area + length, padded - length);
+
+    segment->flags = (uint16_t) ((segment->flags & ~MASK_OFFSET) | (header / 4) << 12);
+    segment->checksum = mytcp_calculate_header_checksum(segment, header);
+}
+
+/**
+ * Set a segment's flag, keeping its checksum valid. Can only set a single flag per call to mytcp_set_flag().
  * Flags are defined as macros in mytcp.h.
  *
  * @param segment The segment whose flags we are modifying
@@ -54,18 +236,22 @@ mytcp_t mytcp_create_segment(uint16_t srcport, uint16_t destport)
  */
 void mytcp_set_flag(mytcp_t *segment, uint8_t offset)
 {
-    segment->flags |= 1 << offset;
+    uint16_t flags = (uint16_t) (segment->flags | (1 << offset));
+    mytcp_update_checksum(segment, segment->flags, flags);
+    segment->flags = flags;
 }
 
 /**
- * Clear a segment's flag. Can only clear a single flag per call to mytcp_clear_flag().
+ * Clear a segment's flag, keeping its checksum valid. Can only clear a single flag per call to mytcp_clear_flag().
  *
  * @param segment The segment whose flags we are modifying
  * @param offset The (single!) flag to clear, e.g. FLAG_SYN
  */
 void mytcp_clear_flag(mytcp_t *segment, uint8_t offset)
 {
-    segment->flags &= 0 << offset;
+    uint16_t flags = (uint16_t) (segment->flags & ~(1 << offset));
+    mytcp_update_checksum(segment, segment->flags, flags);
+    segment->flags = flags;
 }
 
 /**
@@ -75,31 +261,32 @@ void mytcp_clear_flag(mytcp_t *segment, uint8_t offset)
  * @param offset The (single!) flag to check, e.g. FLAG_FIN
  * @return True iff the flag is set, else false
  */
-bool mytcp_check_flag(const mytcp_t segment, uint8_t offset)
+bool mytcp_check_flag(const mytcp_t *segment, uint8_t offset)
 {
-    return (segment.flags & (1 << offset)) > 0;
+    return (segment->flags & (1 << offset)) > 0;
 }
 
 /**
  * Calculate the checksum of a mytcp_t segment as if its prior checksum value was zero.
- * Creates a copy with a zero checksum, whose checksum we calculate.
+ * The checksum field is summed along with everything else and then taken back out, so no copy is needed.
  *
  * Checksum calculation algorithm was provided with the assignment requirements.
  *
  * @param segment The segment whose checksum we are calculating
  * @return The checksum of the segment, truncated to fit into a 16-bit integer
  */
-uint16_t mytcp_calculate_checksum(mytcp_t segment)
+uint16_t mytcp_calculate_checksum(const mytcp_t *segment)
 {
     // initialize calculation values
     uint16_t checksum_arr[12];
     uint32_t i, checksum, sum = 0;
 
     // copy 24 bytes to the checksum array
-    memcpy(checksum_arr, &segment, 24);
+    memcpy(checksum_arr, segment, 24);
 
-    // compute the sum
+    // compute the sum, leaving out the checksum field
     for (i = 0; i < 12; i++) sum += checksum_arr[i];
+    sum -= segment->checksum;
 
     // fold once
     checksum = sum >> 16;
@@ -114,6 +301,31 @@ uint16_t mytcp_calculate_checksum(mytcp_t segment)
     return (uint16_t) (0xFFFF ^ checksum);
 }
 
+/**
+ * Calculate the checksum of a segment's whole header, options included, as if its prior checksum value was zero.
+ * Over the fixed header alone, this is mytcp_calculate_checksum(); option words past it are added to that sum.
+ *
+ * @param segment The segment whose checksum we are calculating
+ * @param length The header length in bytes, a multiple of 4 and at least sizeof(mytcp_t)
+ * @return The checksum of the header, truncated to fit into a 16-bit integer
+ */
+uint16_t mytcp_calculate_header_checksum(const mytcp_t *segment, size_t length)
+{
+    uint32_t sum = (uint16_t) ~mytcp_calculate_checksum(segment);
+    for (size_t i = sizeof(mytcp_t); i < length; i += sizeof(uint16_t))
+    {
+        uint16_t word;
+        memcpy(&word, (const char *) segment + i, sizeof(word));
+        sum += word;
+    }
+
+    // fold twice; the first fold can carry once more
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    sum = (sum & 0xFFFF) + (sum >> 16);
+
+    return (uint16_t) ~sum;
+}
+
 /**
  * Calculate and populate the checksum value for a segment.
  *
@@ -121,41 +333,107 @@ uint16_t mytcp_calculate_checksum(mytcp_t segment)
  */
 void mytcp_set_checksum(mytcp_t *seg)
 {
-    seg->checksum = 0;
-    seg->checksum = mytcp_calculate_checksum(*seg);
+    seg->checksum = mytcp_calculate_checksum(seg);
 }
 
 /**
  * Calculate a segment's checksum and verify against the prior checksum given.
- * Does not modify the segment in any way; creates a copy with a zero-checksum.
+ * Does not modify or copy the segment.
  *
  * @param seg The segment whose checksum we are verifying
  * @return True iff the segment's checksum is correct, else false
  */
-bool mytcp_verify_checksum(const mytcp_t seg)
+bool mytcp_verify_checksum(const mytcp_t *seg)
 {
-    uint16_t given = seg.checksum;
+    return (bool) (mytcp_calculate_checksum(seg) == seg->checksum);
+}
 
-    // create a copy and set its checksum to zero
-    mytcp_t test;
-    bzero(&test, sizeof(mytcp_t));
-    memcpy(&test, &seg, sizeof(seg));
-    test.checksum = 0;
+/**
+ * Compile an expectation from the flags a segment must and must not carry. The header length is always checked,
+ * and must be the fixed header's until mytcp_expect_options() allows options past it; the sequence and
+ * acknowledgment numbers are not checked until mytcp_expect_sequence() and mytcp_expect_ack() set them.
+ *
+ * @param expect The expectation to initialize
+ * @param required Flags that must be set, as a bit mask, e.g. 1 << FLAG_ACK
+ * @param forbidden Flags that must be clear, as a bit mask
+ */
+void mytcp_expect_init(mytcp_expect_t *expect, uint16_t required, uint16_t forbidden)
+{
+    bzero(expect, sizeof(*expect));
+    expect->flags_mask = (uint16_t) (required | forbidden);
+    expect->flags = required;
+    expect->header_max = sizeof(mytcp_t);
+}
 
-    // calculate expected checksum
-    uint16_t expected = mytcp_calculate_checksum(test);
-    return (bool) (expected == given);
+/**
+ * Make an expectation check the sequence number.
+ *
+ * @param expect The expectation
+ * @param sequence The sequence number the segment must carry
+ */
+void mytcp_expect_sequence(mytcp_expect_t *expect, uint32_t sequence)
+{
+    expect->sequence_mask = UINT32_MAX;
+    expect->sequence = sequence;
 }
 
 /**
- * Print a segment to file, as well as stdout.
- * Complies with assignment requirements.
+ * Make an expectation check the acknowledgment number.
  *
- * @param f The file to print the segment to
- * @param seg The segment to print to file and stdout
+ * @param expect The expectation
+ * @param acknowledgment The acknowledgment number the segment must carry
+ */
+void mytcp_expect_ack(mytcp_expect_t *expect, uint32_t acknowledgment)
+{
+    expect->ack_mask = UINT32_MAX;
+    expect->acknowledgment = acknowledgment;
+}
+
+/**
+ * Make an expectation accept options past the fixed header. The caller's buffer must then hold the whole header,
+ * as mytcp_reader_next_segment() guarantees, since it is checksummed.
+ *
+ * @param expect The expectation
+ */
+void mytcp_expect_options(mytcp_expect_t *expect)
+{
+    expect->header_max = MYTCP_MAX_HEADER;
+}
+
+/**
+ * Validate a segment against an expectation: checksum, flags, header length, sequence and acknowledgment numbers
+ * are all checked in one pass, without branching on the outcome of any of them, and every failure is reported.
+ * Equivalent to mytcp_verify_checksum(), then one mytcp_check_flag() per flag, then comparing the numbers.
+ *
+ * @param seg The segment to validate
+ * @param expect What the segment must look like
+ * @return 0 if the segment is valid, else the INVALID_* bits of every check it failed
+ */
+uint32_t mytcp_validate(const mytcp_t *seg, const mytcp_expect_t *expect)
+{
+    // an offset below the fixed header wraps around, so one compare checks both bounds
+    size_t length = mytcp_header_length(seg);
+    bool fits = length - sizeof(mytcp_t) <= (size_t) (expect->header_max - sizeof(mytcp_t));
+    uint16_t checksum = mytcp_calculate_header_checksum(seg, fits ? length : sizeof(mytcp_t));
+
+    return (uint32_t) (checksum != seg->checksum) * INVALID_CHECKSUM
+           | (uint32_t) (((seg->flags ^ expect->flags) & expect->flags_mask) != 0) * INVALID_FLAGS
+           | (uint32_t) !fits * INVALID_OFFSET
+           | (uint32_t) (((seg->sequence ^ expect->sequence) & expect->sequence_mask) != 0) * INVALID_SEQUENCE
+           | (uint32_t) (((seg->acknowledgment ^ expect->acknowledgment) & expect->ack_mask) != 0) * INVALID_ACK;
+}
+
+/**
+ * Format a segment the way mytcp_print_segment() prints it, into a caller-provided buffer.
+ * Does not allocate, so it is safe to call from a logging thread at high rates.
+ *
+ * @param buf The buffer to format into
+ * @param len The size of buf; MAX_TCP_CHAR_SIZE is always enough
+ * @param seg The segment to format
  * @param title The title to give this segment, e.g. "incoming connection request"
+ * @return The number of characters written (excluding the terminating NUL), truncated to fit
  */
-void mytcp_print_segment(FILE *f, const mytcp_t seg, const char *title)
+size_t mytcp_format_segment(char *buf, size_t len, const mytcp_t *seg, const char *title)
 {
     // title and separator
     char sep[strlen(title) + 1];
@@ -168,30 +446,24 @@ void mytcp_print_segment(FILE *f, const mytcp_t seg, const char *title)
     for (uint8_t i = FLAG_FIN; i < NUM_FLAGS; i++)
         flags[FLAG_URG - i] = (char) (mytcp_check_flag(seg, i) ? '1' : '0');
 
-    // names of flags
-    size_t max_flag_names_len = (FLAG_URG * 4) + 1;
-    char flag_names[max_flag_names_len];
-    bzero(flag_names, max_flag_names_len);
+    // names of flags, each preceded by a space
+    char flag_names[(NUM_FLAGS * 4) + 1];
+    size_t names_len = 0;
+    flag_names[0] = '\0';
     for (uint8_t i = 0; i < NUM_FLAGS; i++)
     {
         if (mytcp_check_flag(seg, i))
-        {
-            // copy this flag name into flag names
-            char *flag_name = FLAG_NAMES[i];
-            snprintf(flag_names, max_flag_names_len, "%s %s", flag_names, flag_name);
-        }
+            names_len += (size_t) snprintf(flag_names + names_len, sizeof(flag_names) - names_len, " %s",
+                                           FLAG_NAMES[i]);
     }
 
     // extract reserved from 16-bit that also holds flags and offset
-    uint8_t reserved = (uint8_t) ((seg.flags & MASK_RESERVED) >> 6);
+    uint8_t reserved = (uint8_t) ((seg->flags & MASK_RESERVED) >> 6);
 
     // extract offset from 16-bit that also holds flags and reserved
-    char offset = (char) ((seg.flags & MASK_OFFSET) >> 12);
+    char offset = (char) ((seg->flags & MASK_OFFSET) >> 12);
 
-    // hold in a string so we don't have to format twice
-    char *str = (char *) malloc(MAX_TCP_CHAR_SIZE);
-    bzero(str, MAX_TCP_CHAR_SIZE);
-    snprintf(str, MAX_TCP_CHAR_SIZE,
+    int written = snprintf(buf, len,
              "%s\n%s\n"
              "srcport:         %d\n"
              "destport:        %d\n"
@@ -205,11 +477,29 @@ void mytcp_print_segment(FILE *f, const mytcp_t seg, const char *title)
              "urgent:          0x%04X\n"
              "options:         0x%08X\n",
              title, sep,
-             seg.srcport, seg.destport, seg.sequence, seg.acknowledgment,
+             seg->srcport, seg->destport, seg->sequence, seg->acknowledgment,
              offset, reserved, flags, flag_names,
-             seg.receive, seg.checksum, seg.urgent, seg.options
+             seg->receive, seg->checksum, seg->urgent, seg->options
     );
 
+    if (written < 0) return 0;
+    return (size_t) written < len ? (size_t) written : len - 1;
+}
+
+/**
+ * Print a segment to file, as well as stdout.
+ * Complies with assignment requirements.
+ *
+ * @param f The file to print the segment to
+ * @param seg The segment to print to file and stdout
+ * @param title The title to give this segment, e.g. "incoming connection request"
+ */
+void mytcp_print_segment(FILE *f, const mytcp_t *seg, const char *title)
+{
+    // hold in a string so we don't have to format twice
+    char str[MAX_TCP_CHAR_SIZE];
+    mytcp_format_segment(str, sizeof(str), seg, title);
+
     // print to file, then print to stdout
     fprintf(f, "%s\n", str);
     fprintf(stdout, "%s\n", str);
@@ -14,6 +14,20 @@
 
 #define MAX_TCP_CHAR_SIZE 2048
 
+// reasons a segment fails mytcp_validate(), as bits of its result
+#define INVALID_CHECKSUM (1u << 0)
+#define INVALID_FLAGS    (1u << 1)
+#define INVALID_OFFSET   (1u << 2)
+#define INVALID_SEQUENCE (1u << 3)
+#define INVALID_ACK      (1u << 4)
+
+// largest payload a segment may carry after its header (see urgent below)
+#define MYTCP_MAX_PAYLOAD 16384
+
+// longest header: the offset counts 32-bit words in 4 bits, so at most 40 bytes of options follow the 20 fixed bytes
+#define MYTCP_MAX_HEADER 60
+#define MYTCP_MAX_OPTIONS (MYTCP_MAX_HEADER - 20)
+
 #include <inttypes.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -26,17 +40,37 @@ struct mytcp
     uint32_t sequence;
     uint32_t acknowledgment;
     uint16_t flags;     // <---  also contains offset and reserved
-    uint16_t receive;
+    uint16_t receive;   // <---  window: payload bytes the sender is willing to receive
     uint16_t checksum;
-    uint16_t urgent;
-    uint32_t options;
+    uint16_t urgent;    // <---  URG is never set, so this holds the payload length (there is no IP header for it)
+    uint32_t options;   // <---  first 4 bytes of the options; longer options continue past the struct (see offset)
 } __attribute__((packed));
 
 // typedef above struct as mytcp_t
 typedef struct mytcp mytcp_t;
 
+// a header with room for the longest options, for segments built or read with options past the fixed header
+typedef struct mytcp_header
+{
+    mytcp_t seg;
+    uint8_t more_options[MYTCP_MAX_HEADER - sizeof(mytcp_t)];
+} __attribute__((packed)) mytcp_header_t;
+
+// what an incoming segment must look like: built for each segment from the handshake step's flag masks and the
+// connection's current numbers, so validating it is a few masked compares
+typedef struct mytcp_expect
+{
+    uint16_t flags_mask;        // flags that are checked: the required and the forbidden ones
+    uint16_t flags;             // their expected values
+    uint32_t sequence_mask;     // all ones to check the sequence number, zero to accept any
+    uint32_t sequence;
+    uint32_t ack_mask;          // likewise for the acknowledgment number
+    uint32_t acknowledgment;
+    uint16_t header_max;        // longest header accepted, in bytes; the fixed header unless options may follow it
+} mytcp_expect_t;
+
 // flag names as arrays to make printing easier later
-char *FLAG_NAMES[6];
+extern char *FLAG_NAMES[6];
 
 // generate random sequence number
 uint32_t mytcp_generate_sequence();
@@ -44,17 +78,43 @@ uint32_t mytcp_generate_sequence();
 // tcp segment creation
 mytcp_t mytcp_create_segment(uint16_t, uint16_t);
 
-// set/clear header flags
+// set sequence/acknowledgment numbers (checksum is updated incrementally)
+void mytcp_set_sequence(mytcp_t *, uint32_t);
+void mytcp_set_acknowledgment(mytcp_t *, uint32_t);
+
+// set the advertised window / the payload length (checksum is updated incrementally)
+void mytcp_set_window(mytcp_t *, uint16_t);
+void mytcp_set_payload_length(mytcp_t *, uint16_t);
+
+// header length in bytes from the offset field, and replacing the options (checksum is updated incrementally)
+size_t mytcp_header_length(const mytcp_t *);
+void mytcp_set_options(mytcp_t *, const uint8_t *, size_t);
+
+// set/clear header flags (checksum is updated incrementally)
 void mytcp_set_flag(mytcp_t *, uint8_t);
 void mytcp_clear_flag(mytcp_t *, uint8_t);
-bool mytcp_check_flag(const mytcp_t, uint8_t);
+bool mytcp_check_flag(const mytcp_t *, uint8_t);
 
 // calculate checksum
-uint16_t mytcp_calculate_checksum(mytcp_t);
+uint16_t mytcp_calculate_checksum(const mytcp_t *);
+uint16_t mytcp_calculate_header_checksum(const mytcp_t *, size_t);
 void mytcp_set_checksum(mytcp_t *);
-bool mytcp_verify_checksum(const mytcp_t);
+bool mytcp_verify_checksum(const mytcp_t *);
+
+// calculate/verify checksums of many contiguous segments at once (SIMD where available, see checksum.c)
+void mytcp_calculate_checksum_batch(const mytcp_t *, size_t, uint16_t *);
+size_t mytcp_verify_checksum_batch(const mytcp_t *, size_t, bool *);
+const char *mytcp_checksum_impl(void);
+
+// validate a segment against an expectation in one pass
+void mytcp_expect_init(mytcp_expect_t *, uint16_t, uint16_t);
+void mytcp_expect_sequence(mytcp_expect_t *, uint32_t);
+void mytcp_expect_ack(mytcp_expect_t *, uint32_t);
+void mytcp_expect_options(mytcp_expect_t *);
+uint32_t mytcp_validate(const mytcp_t *, const mytcp_expect_t *);
 
-// print segment
-void mytcp_print_segment(FILE *, const mytcp_t, const char *);
+// format/print segment
+size_t mytcp_format_segment(char *, size_t, const mytcp_t *, const char *);
+void mytcp_print_segment(FILE *, const mytcp_t *, const char *);
 
 #endif //CSCE3530_LAB3_MYTCP_H
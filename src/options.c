@@ -0,0 +1,212 @@
+#include "options.h"
+
+#include <string.h>
+
+
+// multi-byte option values are big-endian on the wire, whatever the host
+static inline void options_put16(uint8_t *p, uint16_t v)
+{
+    p[0] = (uint8_t) (v >> 8);
+    p[1] = (uint8_t) v;
+}
+
+static inline void options_put32(uint8_t *p, uint32_t v)
+{
+    options_put16(p, (uint16_t) (v >> 16));
+    options_put16(p + 2, (uint16_t) v);
+}
+
+static inline uint16_t options_get16(const uint8_t *p)
+{
+    return (uint16_t) (p[0] << 8 | p[1]);
+}
+
+static inline uint32_t options_get32(const uint8_t *p)
+{
+    return (uint32_t) options_get16(p) << 16 | options_get16(p + 2);
+}
+
+/**
+ * Encode options into the caller's buffer, laid out the way common stacks do: each option is padded with NOPs so
+ * that timestamps and SACK blocks start on a 32-bit boundary, and the whole length is a multiple of 4.
+ *
+ * @param options The options to encode; those not in options->present are left out
+ * @param buf Where to encode them
+ * @param len The size of buf
+ * @return The encoded length in bytes (0 if there are none), or -1 if they do not fit into buf or into a header
+ */
+int mytcp_options_encode(const mytcp_options_t *options, uint8_t *buf, size_t len)
+{
+    uint8_t present = options->present;
+    size_t nsack = present & OPTION_SACK ? options->nsack : 0;
+    if ((present & OPTION_SACK) && (nsack == 0 || nsack > OPTIONS_MAX_SACK)) return -1;
+
+    size_t need = (present & OPTION_MSS ? 4 : 0) + (present & OPTION_TIMESTAMPS ? 12 : 0)
+                  + ((present & OPTION_SACK_PERMITTED) && !(present & OPTION_TIMESTAMPS) ? 4 : 0)
+                  + (present & OPTION_WINDOW_SCALE ? 4 : 0) + (nsack > 0 ? 4 + 8 * nsack : 0);
+    if (need > len || need > MYTCP_MAX_OPTIONS) return -1;
+
+    uint8_t *p = buf;
+    if (present & OPTION_MSS)
+    {
+        p[0] = OPTION_KIND_MSS;
+        p[1] = 4;
+        options_put16(p + 2, options->mss);
+        p += 4;
+    }
+
+    // SACK permitted takes the two bytes that would otherwise pad the timestamps
+    if (present & (OPTION_SACK_PERMITTED | OPTION_TIMESTAMPS))
+    {
+        bool permitted = present & OPTION_SACK_PERMITTED;
+        p[0] = permitted ? OPTION_KIND_SACK_PERMITTED : OPTION_KIND_NOP;
+        p[1] = permitted ? 2 : OPTION_KIND_NOP;
+        p += 2;
+    }
+    if (present & OPTION_TIMESTAMPS)
+    {
+        p[0] = OPTION_KIND_TIMESTAMPS;
+        p[1] = 10;
+        options_put32(p + 2, options->ts_val);
+        options_put32(p + 6, options->ts_ecr);
+        p += 10;
+    }
+    else if (present & OPTION_SACK_PERMITTED)
+    {
+        p[0] = p[1] = OPTION_KIND_NOP;
+        p += 2;
+    }
+
+    if (present & OPTION_WINDOW_SCALE)
+    {
+        p[0] = OPTION_KIND_NOP;
+        p[1] = OPTION_KIND_WINDOW_SCALE;
+        p[2] = 3;
+        p[3] = options->window_scale;
+        p += 4;
+    }
+
+    if (nsack > 0)
+    {
+        p[0] = p[1] = OPTION_KIND_NOP;
+        p[2] = OPTION_KIND_SACK;
+        p[3] = (uint8_t) (2 + 8 * nsack);
+        p += 4;
+        for (size_t i = 0; i < nsack; i++, p += 8)
+        {
+            options_put32(p, options->sack[i].left);
+            options_put32(p + 4, options->sack[i].right);
+        }
+    }
+
+    return (int) (p - buf);
+}
+
+/**
+ * Decode options from the caller's buffer. Options of unknown kinds are skipped, as their length says; a window
+ * scale over the maximum is taken as the maximum (RFC 7323).
+ *
+ * @param buf The encoded options
+ * @param len Their length in bytes
+ * @param options Where to decode them
+ * @return 0 on success, or -1 if they are malformed (an option runs past the end, or a known one has the wrong
+ *         length)
+ */
+int mytcp_options_decode(const uint8_t *buf, size_t len, mytcp_options_t *options)
+{
+    options->present = 0;
+    options->nsack = 0;
+
+    size_t i = 0;
+    while (i < len && buf[i] != OPTION_KIND_EOL)
+    {
+        if (buf[i] == OPTION_KIND_NOP)
+        {
+            i++;
+            continue;
+        }
+
+        if (len - i < 2 || buf[i + 1] < 2 || buf[i + 1] > len - i) return -1;
+        const uint8_t *p = buf + i;
+        uint8_t kind = p[0], size = p[1];
+        i += size;
+
+        switch (kind)
+        {
+            case OPTION_KIND_MSS:
+                if (size != 4) return -1;
+                options->mss = options_get16(p + 2);
+                options->present |= OPTION_MSS;
+                break;
+
+            case OPTION_KIND_WINDOW_SCALE:
+                if (size != 3) return -1;
+                options->window_scale = p[2] < OPTIONS_MAX_WINDOW_SCALE ? p[2] : OPTIONS_MAX_WINDOW_SCALE;
+                options->present |= OPTION_WINDOW_SCALE;
+                break;
+
+            case OPTION_KIND_SACK_PERMITTED:
+                if (size != 2) return -1;
+                options->present |= OPTION_SACK_PERMITTED;
+                break;
+
+            case OPTION_KIND_SACK:
+                if (size < 10 || (size - 2) % 8 != 0 || (size - 2) / 8 > OPTIONS_MAX_SACK) return -1;
+                options->nsack = (uint8_t) ((size - 2) / 8);
+                for (size_t b = 0; b < options->nsack; b++)
+                {
+                    options->sack[b].left = options_get32(p + 2 + 8 * b);
+                    options->sack[b].right = options_get32(p + 6 + 8 * b);
+                }
+                options->present |= OPTION_SACK;
+                break;
+
+            case OPTION_KIND_TIMESTAMPS:
+                if (size != 10) return -1;
+                options->ts_val = options_get32(p + 2);
+                options->ts_ecr = options_get32(p + 6);
+                options->present |= OPTION_TIMESTAMPS;
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Encode options straight into a segment, after its fixed fields, and update its offset and checksum. Nothing is
+ * allocated: the segment must have room for the options, as a mytcp_header_t always does.
+ *
+ * @param seg The segment
+ * @param options The options; any the segment already carried are replaced
+ * @return 0 on success, or -1 if the options do not fit into a header
+ */
+int mytcp_options_write(mytcp_t *seg, const mytcp_options_t *options)
+{
+    uint8_t buf[MYTCP_MAX_OPTIONS];
+    int len = mytcp_options_encode(options, buf, sizeof(buf));
+    if (len < 0) return -1;
+
+    mytcp_set_options(seg, buf, (size_t) len);
+    return 0;
+}
+
+/**
+ * Decode a segment's options in place. The whole header, as long as its offset says, must be in the buffer: validate
+ * the segment first with an expectation that accepts options (see mytcp_expect_options()).
+ *
+ * @param seg The segment
+ * @param options Where to decode its options
+ * @return 0 on success, or -1 if the offset or the options are malformed
+ */
+int mytcp_options_read(const mytcp_t *seg, mytcp_options_t *options)
+{
+    size_t length = mytcp_header_length(seg);
+    if (length < sizeof(mytcp_t) || length > MYTCP_MAX_HEADER) return -1;
+
+    return mytcp_options_decode((const uint8_t *) seg + offsetof(mytcp_t, options),
+                                length - offsetof(mytcp_t, options), options);
+}
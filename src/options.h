@@ -0,0 +1,58 @@
+#ifndef CSCE3530_LAB3_OPTIONS_H
+#define CSCE3530_LAB3_OPTIONS_H
+
+#include <inttypes.h>
+#include <stddef.h>
+#include "mytcp.h"
+
+// option kinds on the wire (RFC 9293, 7323, 2018)
+#define OPTION_KIND_EOL 0
+#define OPTION_KIND_NOP 1
+#define OPTION_KIND_MSS 2
+#define OPTION_KIND_WINDOW_SCALE 3
+#define OPTION_KIND_SACK_PERMITTED 4
+#define OPTION_KIND_SACK 5
+#define OPTION_KIND_TIMESTAMPS 8
+
+// which options are present, as bits of mytcp_options_t.present
+#define OPTION_MSS            (1u << 0)
+#define OPTION_WINDOW_SCALE   (1u << 1)
+#define OPTION_SACK_PERMITTED (1u << 2)
+#define OPTION_SACK           (1u << 3)
+#define OPTION_TIMESTAMPS     (1u << 4)
+
+// most SACK blocks in one segment: four fill the option space, and only three fit alongside timestamps
+#define OPTIONS_MAX_SACK 4
+#define OPTIONS_MAX_SACK_TIMESTAMPS 3
+
+// largest window scale shift: windows up to 1 GiB (RFC 7323)
+#define OPTIONS_MAX_WINDOW_SCALE 14
+
+// a range of sequence numbers the receiver holds beyond a gap: left edge, and the number just past the right edge
+typedef struct mytcp_sack_block
+{
+    uint32_t left;
+    uint32_t right;
+} mytcp_sack_block_t;
+
+// a segment's options, decoded; only those whose bit is in present are meaningful
+typedef struct mytcp_options
+{
+    uint8_t present;
+    uint8_t window_scale;       // shift count of the sender's advertised window, once both sides offered one
+    uint16_t mss;               // largest payload the sender of the option is willing to receive
+    uint8_t nsack;
+    mytcp_sack_block_t sack[OPTIONS_MAX_SACK];
+    uint32_t ts_val;            // sender's clock when it sent the segment
+    uint32_t ts_ecr;            // ts_val of the segment being echoed
+} mytcp_options_t;
+
+// encode into/decode from the caller's buffer
+int mytcp_options_encode(const mytcp_options_t *, uint8_t *, size_t);
+int mytcp_options_decode(const uint8_t *, size_t, mytcp_options_t *);
+
+// write/read the options of a segment, in place after its fixed fields
+int mytcp_options_write(mytcp_t *, const mytcp_options_t *);
+int mytcp_options_read(const mytcp_t *, mytcp_options_t *);
+
+#endif //CSCE3530_LAB3_OPTIONS_H
@@ -0,0 +1,172 @@
+#define _GNU_SOURCE     // memfd_create
+
+#include "reader.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+
+/**
+ * Set up a reader over a socket. The ring is one shared memory object mapped twice, back-to-back, so that the bytes
+ * of a segment straddling the end of the ring are also contiguous in the second mapping. A datagram socket is read
+ * one datagram at a time (see mytcp_reader_fill()).
+ *
+ * @param reader The reader to initialize
+ * @param fd The socket (or any readable file descriptor) to read from
+ * @param capacity The ring size in bytes, rounded up to a whole number of pages
+ * @return 0 on success, -1 on failure (errno is set)
+ */
+int mytcp_reader_init(mytcp_reader_t *reader, int fd, size_t capacity)
+{
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    capacity = (capacity + page - 1) / page * page;
+
+    bzero(reader, sizeof(*reader));
+    reader->fd = fd;
+    reader->capacity = capacity;
+
+    // anything that is not a socket reads like a stream
+    int type;
+    socklen_t type_len = sizeof(type);
+    reader->datagrams = getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &type_len) == 0 && type == SOCK_DGRAM;
+
+    int memfd = memfd_create("mytcp_reader", MFD_CLOEXEC);
+    if (memfd == -1) return -1;
+
+    if (ftruncate(memfd, (off_t) capacity) == -1)
+    {
+        close(memfd);
+        return -1;
+    }
+
+    // reserve room for both mappings, then map the object into each half
+    char *base = mmap(NULL, 2 * capacity, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED
+        || mmap(base, capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, memfd, 0) == MAP_FAILED
+        || mmap(base + capacity, capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, memfd, 0) == MAP_FAILED)
+    {
+        int err = errno;
+        if (base != MAP_FAILED) munmap(base, 2 * capacity);
+        close(memfd);
+        errno = err;
+        return -1;
+    }
+
+    // the mappings keep the object alive
+    close(memfd);
+
+    reader->ring = base;
+    return 0;
+}
+
+/**
+ * Release a reader's ring. Does not close the file descriptor.
+ *
+ * @param reader The reader to release
+ */
+void mytcp_reader_free(mytcp_reader_t *reader)
+{
+    if (reader->ring != NULL) munmap(reader->ring, 2 * reader->capacity);
+    reader->ring = NULL;
+}
+
+/**
+ * Read as much as fits into the ring's free space with a single read(). A short read is fine: partial segments stay
+ * buffered until the rest arrives. Views returned by mytcp_reader_next() before this call may be overwritten.
+ * On a datagram socket, whatever is left of the previous datagram is dropped first: it cannot complete a segment,
+ * so the ring only ever holds the latest datagram.
+ *
+ * @param reader The reader to fill
+ * @return The number of bytes read, 0 on end of file, or -1 on error (errno is set; EAGAIN for a non-blocking socket
+ *         with nothing to read, EBADMSG once a stream carried a malformed segment)
+ */
+ssize_t mytcp_reader_fill(mytcp_reader_t *reader)
+{
+    if (reader->malformed)
+    {
+        errno = EBADMSG;
+        return -1;
+    }
+    if (reader->datagrams) reader->head = reader->tail;
+
+    size_t used = reader->tail - reader->head;
+    size_t offset = reader->tail % reader->capacity;
+
+    if (used == reader->capacity)
+    {
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    // the mirror makes the free space contiguous even when it wraps
+    ssize_t got = read(reader->fd, reader->ring + offset, reader->capacity - used);
+    if (got > 0) reader->tail += (size_t) got;
+    return got;
+}
+
+/**
+ * Take the next whole segment out of the ring, without copying it.
+ *
+ * @param reader The reader
+ * @return A view of the segment, valid until the next call to mytcp_reader_fill(), or NULL if no whole segment is
+ *         buffered
+ */
+const mytcp_t *mytcp_reader_next(mytcp_reader_t *reader)
+{
+    if (reader->tail - reader->head < sizeof(mytcp_t)) return NULL;
+
+    const mytcp_t *seg = (const mytcp_t *) (reader->ring + reader->head % reader->capacity);
+    reader->head += sizeof(mytcp_t);
+    return seg;
+}
+
+/**
+ * Take the next whole segment out of the ring, options and payload included, without copying it. The header and
+ * payload lengths are read from the header (see mytcp_t), and the payload follows the options directly. An offset
+ * shorter than the fixed header is taken as the fixed header, so the segment can still be rejected as malformed.
+ * A payload longer than MYTCP_MAX_PAYLOAD is never waited for: a datagram claiming one, or whose length does not
+ * match its header and payload, is dropped; a stream claiming one cannot be read any further (see
+ * mytcp_reader_fill()).
+ *
+ * @param reader The reader
+ * @param length Set to the payload length
+ * @return A view of the segment, valid until the next call to mytcp_reader_fill(), or NULL if no whole segment is
+ *         buffered
+ */
+const mytcp_t *mytcp_reader_next_segment(mytcp_reader_t *reader, size_t *length)
+{
+    size_t buffered = reader->tail - reader->head;
+    if (buffered < sizeof(mytcp_t)) return NULL;
+
+    const mytcp_t *seg = (const mytcp_t *) (reader->ring + reader->head % reader->capacity);
+    size_t header = mytcp_header_length(seg);
+    if (header < sizeof(mytcp_t)) header = sizeof(mytcp_t);
+
+    if (seg->urgent > MYTCP_MAX_PAYLOAD || (reader->datagrams && buffered != header + seg->urgent))
+    {
+        if (reader->datagrams)
+            reader->head = reader->tail;
+        else
+            reader->malformed = true;
+        return NULL;
+    }
+    if (buffered < header + seg->urgent) return NULL;
+
+    *length = seg->urgent;
+    reader->head += header + seg->urgent;
+    return seg;
+}
+
+/**
+ * Number of bytes read in but not yet taken out as segments.
+ *
+ * @param reader The reader
+ * @return The number of buffered bytes
+ */
+size_t mytcp_reader_buffered(const mytcp_reader_t *reader)
+{
+    return reader->tail - reader->head;
+}
@@ -0,0 +1,33 @@
+#ifndef CSCE3530_LAB3_READER_H
+#define CSCE3530_LAB3_READER_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include "mytcp.h"
+
+// default ring capacity; rounded up to a whole number of pages
+#define READER_DEFAULT_CAPACITY (64 * 1024)
+
+// buffered segment reader over a socket: large reads into a ring, whole segments out as zero-copy views
+typedef struct mytcp_reader
+{
+    int fd;
+    char *ring;         // capacity bytes, mapped twice back-to-back so no view ever wraps
+    size_t capacity;
+    size_t head;        // total bytes consumed
+    size_t tail;        // total bytes read in
+    bool datagrams;     // each read() takes one datagram, which carries one segment
+    bool malformed;     // a stream carried a segment too long to be one, so nothing after it can be told apart
+} mytcp_reader_t;
+
+// set up/tear down
+int mytcp_reader_init(mytcp_reader_t *, int, size_t);
+void mytcp_reader_free(mytcp_reader_t *);
+
+// fill the ring with one read(), then take whole segments out of it (headers only, or with their payload)
+ssize_t mytcp_reader_fill(mytcp_reader_t *);
+const mytcp_t *mytcp_reader_next(mytcp_reader_t *);
+const mytcp_t *mytcp_reader_next_segment(mytcp_reader_t *, size_t *);
+size_t mytcp_reader_buffered(const mytcp_reader_t *);
+
+#endif //CSCE3530_LAB3_READER_H
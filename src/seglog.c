@@ -0,0 +1,247 @@
+#include "seglog.h"
+#include "capture.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+// bytes of formatted output the writer collects before writing them out
+#define LOG_WRITE_BUFFER (64 * 1024)
+
+// room for "incoming"/"outgoing" plus a segment kind name
+#define LOG_TITLE_LEN 64
+
+// how long the writer sleeps when the queue is empty
+#define LOG_IDLE_NS 1000000L
+
+// what the handshake path hands over: the raw segment, enough to rebuild its title, and where/when it was seen
+struct log_entry
+{
+    mytcp_t seg;
+    uint8_t kind;
+    bool incoming;
+    uint32_t local_addr;
+    uint32_t peer_addr;
+    struct timespec ts;
+};
+
+// one queue slot; seq tells producers and the consumer whose turn it is (bounded MPMC queue after D. Vyukov)
+struct log_cell
+{
+    size_t seq;
+    struct log_entry entry;
+};
+
+// the logger; a single instance per process
+static struct
+{
+    struct log_cell *cells;
+    size_t mask;
+    size_t tail __attribute__((aligned(64)));     // next slot producers claim
+    size_t head __attribute__((aligned(64)));     // next slot the writer reads; touched by the writer only
+    size_t dropped;
+    bool running;
+    bool echo;
+    mytcp_log_format_t format;
+    FILE *outfile;
+    pthread_t writer;
+} logger;
+
+/**
+ * Take the next entry off the queue. Only the writer thread calls this.
+ *
+ * @param entry Receives the entry
+ * @return True if an entry was taken, false if the queue is empty
+ */
+static bool log_dequeue(struct log_entry *entry)
+{
+    struct log_cell *cell = &logger.cells[logger.head & logger.mask];
+    size_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+
+    if ((intptr_t) (seq - (logger.head + 1)) < 0) return false;
+
+    *entry = cell->entry;
+    __atomic_store_n(&cell->seq, logger.head + logger.mask + 1, __ATOMIC_RELEASE);
+    logger.head++;
+    return true;
+}
+
+/**
+ * Write out everything collected so far.
+ *
+ * @param buf The formatted output
+ * @param len The number of bytes in buf
+ */
+static void log_write(const char *buf, size_t len)
+{
+    if (len == 0) return;
+    fwrite(buf, 1, len, logger.outfile);
+    if (logger.echo) fwrite(buf, 1, len, stdout);
+}
+
+/**
+ * Writer thread: formats queued segments in the same layout as mytcp_print_segment(), or as pcap records, and writes
+ * them in large chunks. Sleeps briefly whenever the queue is empty; exits once stopped and drained.
+ *
+ * @param arg Unused
+ * @return NULL
+ */
+static void *log_writer(void *arg)
+{
+    (void) arg;
+
+    static char out[LOG_WRITE_BUFFER];
+    size_t len = 0;
+    struct log_entry entry;
+    char title[LOG_TITLE_LEN];
+
+    if (logger.format == LOG_FORMAT_PCAP) len = mytcp_capture_file_header(out);
+
+    for (;;)
+    {
+        if (!log_dequeue(&entry))
+        {
+            log_write(out, len);
+            len = 0;
+            fflush(logger.outfile);
+
+            // read the flag once: stopping between two reads would fall through here without an entry
+            bool running = __atomic_load_n(&logger.running, __ATOMIC_ACQUIRE);
+            if (running)
+            {
+                struct timespec idle = { 0, LOG_IDLE_NS };
+                nanosleep(&idle, NULL);
+                continue;
+            }
+
+            // stopped: whatever was queued before the stop is visible now, so drain it and finish
+            if (!log_dequeue(&entry)) break;
+        }
+
+        // make sure the next segment fits
+        if (LOG_WRITE_BUFFER - len < MAX_TCP_CHAR_SIZE + 1)
+        {
+            log_write(out, len);
+            len = 0;
+        }
+
+        if (logger.format == LOG_FORMAT_PCAP)
+        {
+            len += mytcp_capture_record(out + len, &entry.seg, entry.kind, entry.incoming, entry.local_addr,
+                                        entry.peer_addr, &entry.ts);
+            continue;
+        }
+
+        snprintf(title, sizeof(title), "%s %s", entry.incoming ? "incoming" : "outgoing",
+                 SEGMENT_KIND_NAMES[entry.kind]);
+        len += mytcp_format_segment(out + len, MAX_TCP_CHAR_SIZE, &entry.seg, title);
+        out[len++] = '\n';
+    }
+
+    return NULL;
+}
+
+/**
+ * Start the background writer. The queue is allocated here, once; nothing is allocated afterwards.
+ *
+ * @param outfile The file segments are written to
+ * @param format Text or pcap
+ * @param echo True to also write segments to stdout (text only)
+ * @param capacity The number of segments the queue holds; rounded up to a power of two
+ * @return 0 on success, else an errno value
+ */
+int mytcp_log_start(FILE *outfile, mytcp_log_format_t format, bool echo, size_t capacity)
+{
+    size_t size = 1;
+    while (size < capacity) size <<= 1;
+
+    logger.cells = calloc(size, sizeof(*logger.cells));
+    if (logger.cells == NULL) return errno;
+
+    for (size_t i = 0; i < size; i++) logger.cells[i].seq = i;
+    logger.mask = size - 1;
+    logger.head = logger.tail = logger.dropped = 0;
+    logger.outfile = outfile;
+    logger.format = format;
+    logger.echo = echo && format == LOG_FORMAT_TEXT;
+    logger.running = true;
+
+    int err = pthread_create(&logger.writer, NULL, log_writer, NULL);
+    if (err != 0)
+    {
+        free(logger.cells);
+        logger.cells = NULL;
+        logger.running = false;
+    }
+    return err;
+}
+
+/**
+ * Stop the background writer after it has written everything already queued.
+ */
+void mytcp_log_stop(void)
+{
+    if (logger.cells == NULL) return;
+
+    __atomic_store_n(&logger.running, false, __ATOMIC_RELEASE);
+    pthread_join(logger.writer, NULL);
+
+    if (logger.dropped > 0)
+        fprintf(stderr, "segment log: dropped %zu segments (queue full)\n", logger.dropped);
+
+    free(logger.cells);
+    logger.cells = NULL;
+}
+
+/**
+ * Queue a segment for the writer. Safe to call from any number of threads; copies 24 bytes, a couple of ids and a
+ * timestamp, never blocks and never allocates. If the writer has fallen a whole queue behind, the segment is dropped.
+ *
+ * @param seg The segment to log
+ * @param kind The segment's kind, which makes up its title
+ * @param incoming True if the segment was received, false if it was sent
+ * @param local_addr Our IPv4 address the segment was received on or sent from (network byte order), for pcap captures
+ * @param peer_addr The peer's IPv4 address (network byte order)
+ * @return True if the segment was queued, false if it was dropped (or the logger is not running)
+ */
+bool mytcp_log_segment(const mytcp_t *seg, mytcp_segment_kind_t kind, bool incoming, uint32_t local_addr,
+                       uint32_t peer_addr)
+{
+    if (logger.cells == NULL) return false;
+
+    struct log_cell *cell;
+    size_t pos = __atomic_load_n(&logger.tail, __ATOMIC_RELAXED);
+
+    for (;;)
+    {
+        cell = &logger.cells[pos & logger.mask];
+        size_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+        intptr_t diff = (intptr_t) (seq - pos);
+
+        if (diff == 0)
+        {
+            if (__atomic_compare_exchange_n(&logger.tail, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        }
+        else if (diff < 0)
+        {
+            __atomic_fetch_add(&logger.dropped, 1, __ATOMIC_RELAXED);
+            return false;
+        }
+        else
+            pos = __atomic_load_n(&logger.tail, __ATOMIC_RELAXED);
+    }
+
+    cell->entry.seg = *seg;
+    cell->entry.kind = (uint8_t) kind;
+    cell->entry.incoming = incoming;
+    cell->entry.local_addr = local_addr;
+    cell->entry.peer_addr = peer_addr;
+    clock_gettime(CLOCK_REALTIME, &cell->entry.ts);
+    __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+    return true;
+}
@@ -0,0 +1,28 @@
+#ifndef CSCE3530_LAB3_SEGLOG_H
+#define CSCE3530_LAB3_SEGLOG_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include "connection.h"
+#include "mytcp.h"
+
+// default number of queued segments; must be a power of two
+#define LOG_DEFAULT_CAPACITY 65536
+
+// how the writer stores segments
+typedef enum mytcp_log_format
+{
+    LOG_FORMAT_TEXT,        // same layout as mytcp_print_segment()
+    LOG_FORMAT_PCAP         // binary pcap capture, see capture.h
+} mytcp_log_format_t;
+
+// start/stop the background writer; stopping drains everything already queued
+int mytcp_log_start(FILE *, mytcp_log_format_t, bool, size_t);
+void mytcp_log_stop(void);
+
+// queue a segment for logging; never blocks or allocates, returns false if the segment had to be dropped
+bool mytcp_log_segment(const mytcp_t *, mytcp_segment_kind_t, bool, uint32_t, uint32_t);
+
+#endif //CSCE3530_LAB3_SEGLOG_H
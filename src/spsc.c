@@ -0,0 +1,83 @@
+#include "spsc.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/**
+ * Create an empty ring.
+ *
+ * @param q The ring to initialize
+ * @param capacity The number of segments it holds; rounded up to a power of two
+ * @return 0 on success, else an errno value
+ */
+int mytcp_spsc_init(mytcp_spsc_t *q, size_t capacity)
+{
+    bzero(q, sizeof(*q));
+
+    // at least 8 slots, so the allocation is a whole number of cache lines
+    size_t size = 8;
+    while (size < capacity) size *= 2;
+
+    void *slots;
+    if (posix_memalign(&slots, 64, size * sizeof(mytcp_t)) != 0) return ENOMEM;
+    q->slots = slots;
+    q->mask = size - 1;
+    return 0;
+}
+
+/**
+ * Free a ring. Segments still in it are discarded.
+ *
+ * @param q The ring
+ */
+void mytcp_spsc_free(mytcp_spsc_t *q)
+{
+    free(q->slots);
+    q->slots = NULL;
+}
+
+/**
+ * Append segments to the ring. Only the producer thread calls this. The consumer's position is re-read only when the
+ * cached copy says the ring is full, so a push usually touches no cache line the consumer writes to; the whole batch
+ * is published with one release store.
+ *
+ * @param q The ring
+ * @param segs The segments
+ * @param n The number of segments
+ * @return The number of segments appended, fewer than n if the ring filled up
+ */
+size_t mytcp_spsc_push(mytcp_spsc_t *q, const mytcp_t *segs, size_t n)
+{
+    size_t capacity = q->mask + 1;
+    if (q->tail - q->head_cache + n > capacity) q->head_cache = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+
+    size_t room = capacity - (q->tail - q->head_cache);
+    if (n > room) n = room;
+
+    for (size_t i = 0; i < n; i++) q->slots[(q->tail + i) & q->mask] = segs[i];
+    __atomic_store_n(&q->tail, q->tail + n, __ATOMIC_RELEASE);
+    return n;
+}
+
+/**
+ * Take segments off the ring, oldest first. Only the consumer thread calls this.
+ *
+ * @param q The ring
+ * @param segs Receives the segments
+ * @param max The most segments to take
+ * @return The number of segments taken, 0 if the ring is empty
+ */
+size_t mytcp_spsc_pop(mytcp_spsc_t *q, mytcp_t *segs, size_t max)
+{
+    if (q->tail_cache - q->head < max) q->tail_cache = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+
+    size_t n = q->tail_cache - q->head;
+    if (n > max) n = max;
+    if (n == 0) return 0;
+
+    for (size_t i = 0; i < n; i++) segs[i] = q->slots[(q->head + i) & q->mask];
+    __atomic_store_n(&q->head, q->head + n, __ATOMIC_RELEASE);
+    return n;
+}
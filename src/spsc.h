@@ -0,0 +1,28 @@
+#ifndef CSCE3530_LAB3_SPSC_H
+#define CSCE3530_LAB3_SPSC_H
+
+#include <stddef.h>
+#include "mytcp.h"
+
+// bounded lock-free ring of segments for exactly one producer thread and one consumer thread
+typedef struct mytcp_spsc
+{
+    mytcp_t *slots;
+    size_t mask;                                    // capacity - 1; capacity is a power of two
+
+    size_t tail __attribute__((aligned(64)));       // next slot to fill; written by the producer only
+    size_t head_cache;                              // producer's last view of head
+
+    size_t head __attribute__((aligned(64)));       // next slot to drain; written by the consumer only
+    size_t tail_cache;                              // consumer's last view of tail
+} __attribute__((aligned(64))) mytcp_spsc_t;
+
+// setup and teardown; init returns 0 or an errno value
+int mytcp_spsc_init(mytcp_spsc_t *, size_t);
+void mytcp_spsc_free(mytcp_spsc_t *);
+
+// push/pop up to n segments at once; both return how many were moved
+size_t mytcp_spsc_push(mytcp_spsc_t *, const mytcp_t *, size_t);
+size_t mytcp_spsc_pop(mytcp_spsc_t *, mytcp_t *, size_t);
+
+#endif //CSCE3530_LAB3_SPSC_H
@@ -0,0 +1,129 @@
+#include "syncookie.h"
+
+#include <pthread.h>
+#include <sys/random.h>
+#include <time.h>
+#include "mytcp.h"
+
+#define COOKIE_HASH_MASK ((1u << COOKIE_SLOT_SHIFT) - 1)
+
+// process-wide SipHash key, drawn once from the kernel's random pool
+static uint64_t cookie_key[2];
+static pthread_once_t cookie_key_once = PTHREAD_ONCE_INIT;
+
+static void cookie_init_key(void)
+{
+    if (getrandom(cookie_key, sizeof(cookie_key), 0) != sizeof(cookie_key))
+    {
+        // no random pool: fall back to the sequence number generator, which seeds itself from the clock
+        for (int i = 0; i < 2; i++)
+            cookie_key[i] = (uint64_t) mytcp_generate_sequence() << 32 | mytcp_generate_sequence();
+    }
+}
+
+static inline uint64_t rotl64(uint64_t x, int k)
+{
+    return (x << k) | (x >> (64 - k));
+}
+
+#define SIP_ROUND(v0, v1, v2, v3)                                                   \
+    do {                                                                            \
+        v0 += v1; v1 = rotl64(v1, 13); v1 ^= v0; v0 = rotl64(v0, 32);               \
+        v2 += v3; v3 = rotl64(v3, 16); v3 ^= v2;                                    \
+        v0 += v3; v3 = rotl64(v3, 21); v3 ^= v0;                                    \
+        v2 += v1; v1 = rotl64(v1, 17); v1 ^= v2; v2 = rotl64(v2, 32);               \
+    } while (0)
+
+/**
+ * SipHash-2-4 of three 64-bit words under the process key: a keyed hash that cannot be inverted or steered without
+ * the key, which is what RFC 4987 asks of a SYN cookie function.
+ *
+ * @param m0 The first message word
+ * @param m1 The second message word
+ * @param m2 The third message word
+ * @return The 64-bit hash
+ */
+static uint64_t cookie_siphash(uint64_t m0, uint64_t m1, uint64_t m2)
+{
+    uint64_t v0 = cookie_key[0] ^ 0x736F6D6570736575ull;
+    uint64_t v1 = cookie_key[1] ^ 0x646F72616E646F6Dull;
+    uint64_t v2 = cookie_key[0] ^ 0x6C7967656E657261ull;
+    uint64_t v3 = cookie_key[1] ^ 0x7465646279746573ull;
+    uint64_t words[4] = { m0, m1, m2, (uint64_t) 24 << 56 };    // last block: message length, no tail bytes
+
+    for (int i = 0; i < 4; i++)
+    {
+        v3 ^= words[i];
+        SIP_ROUND(v0, v1, v2, v3);
+        SIP_ROUND(v0, v1, v2, v3);
+        v0 ^= words[i];
+    }
+
+    v2 ^= 0xFF;
+    for (int i = 0; i < 4; i++) SIP_ROUND(v0, v1, v2, v3);
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+/**
+ * The current time slot.
+ *
+ * @return Seconds on the monotonic clock, divided into 2^COOKIE_SLOT_BITS-second slots
+ */
+static uint32_t cookie_slot(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint32_t) (now.tv_sec >> COOKIE_SLOT_BITS);
+}
+
+/**
+ * The hash part of a cookie: keyed over the 4-tuple, the peer's initial sequence number and the time slot.
+ *
+ * @param tuple The connection's 4-tuple
+ * @param peer_isn The peer's initial sequence number
+ * @param slot The time slot
+ * @return The low COOKIE_SLOT_SHIFT bits of the hash
+ */
+static uint32_t cookie_hash(const mytcp_tuple_t *tuple, uint32_t peer_isn, uint32_t slot)
+{
+    pthread_once(&cookie_key_once, cookie_init_key);
+
+    uint64_t m0 = (uint64_t) tuple->src_addr << 32 | tuple->dest_addr;
+    uint64_t m1 = ((uint64_t) tuple->srcport << 16 | tuple->destport) << 32 | peer_isn;
+
+    // the slot gets a word of its own: folded into the tuple's, a port could be traded for a slot
+    return (uint32_t) cookie_siphash(m0, m1, slot) & COOKIE_HASH_MASK;
+}
+
+/**
+ * Make a SYN cookie. Sent as our initial sequence number, it lets the server answer a connection request without
+ * remembering anything: the peer's acknowledgment echoes it back (plus one), and mytcp_cookie_check() recomputes it.
+ * Layout: the time slot's low 8 bits, then 24 bits of keyed hash.
+ *
+ * @param tuple The connection's 4-tuple
+ * @param peer_isn The peer's initial sequence number, from its connection request
+ * @return The cookie
+ */
+uint32_t mytcp_cookie_make(const mytcp_tuple_t *tuple, uint32_t peer_isn)
+{
+    uint32_t slot = cookie_slot();
+    return (slot & 0xFF) << COOKIE_SLOT_SHIFT | cookie_hash(tuple, peer_isn, slot);
+}
+
+/**
+ * Check a SYN cookie returned by a peer: it must have been made for the same 4-tuple and peer initial sequence
+ * number, during the current time slot or the one before.
+ *
+ * @param tuple The connection's 4-tuple
+ * @param peer_isn The peer's initial sequence number (its acknowledgment's sequence number - 1)
+ * @param cookie The cookie (its acknowledgment number - 1)
+ * @return True iff the cookie is genuine and fresh
+ */
+bool mytcp_cookie_check(const mytcp_tuple_t *tuple, uint32_t peer_isn, uint32_t cookie)
+{
+    uint32_t now = cookie_slot();
+    uint32_t age = (now - (cookie >> COOKIE_SLOT_SHIFT)) & 0xFF;
+    if (age > 1) return false;
+
+    return (cookie & COOKIE_HASH_MASK) == cookie_hash(tuple, peer_isn, now - age);
+}
@@ -0,0 +1,18 @@
+#ifndef CSCE3530_LAB3_SYNCOOKIE_H
+#define CSCE3530_LAB3_SYNCOOKIE_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include "conntable.h"
+
+// a cookie is valid during the time slot it was made in and the next one
+#define COOKIE_SLOT_BITS 6          // 64-second slots
+#define COOKIE_SLOT_SHIFT 24        // the slot counter lives in the cookie's top 8 bits
+
+// make a SYN cookie: our initial sequence number for a connection, given its 4-tuple and the peer's initial sequence
+uint32_t mytcp_cookie_make(const mytcp_tuple_t *, uint32_t);
+
+// check that a cookie was made for this 4-tuple and peer initial sequence, and is still fresh
+bool mytcp_cookie_check(const mytcp_tuple_t *, uint32_t, uint32_t);
+
+#endif //CSCE3530_LAB3_SYNCOOKIE_H
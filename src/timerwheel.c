@@ -0,0 +1,226 @@
+#include "timerwheel.h"
+
+#include <string.h>
+#include <time.h>
+
+
+#define SLOT_MASK ((uint64_t) WHEEL_SLOTS - 1)
+
+// ticks covered by the whole wheel; a timer further out is parked at the far end of the last level
+#define WHEEL_SPAN (1ull << (WHEEL_LEVELS * WHEEL_SLOT_BITS))
+
+static void wheel_unlink(mytcp_wheel_t *w, mytcp_timer_t *t)
+{
+    t->prev->next = t->next;
+    t->next->prev = t->prev;
+    t->next = NULL;
+    t->prev = NULL;
+
+    int level = t->slot / WHEEL_SLOTS, index = t->slot % WHEEL_SLOTS;
+    mytcp_timer_t *head = &w->slots[level][index];
+    if (head->next == head) w->occupied[level] &= ~(1ull << index);
+}
+
+/**
+ * Put an armed timer into the slot its expiry falls in. Level k holds timers due within 64^(k+1) ticks, in the slot
+ * given by bits 6k to 6k+5 of the expiry; mytcp_wheel_advance() cascades them down a level as their time comes.
+ *
+ * @param w The wheel
+ * @param t The timer, with expires set
+ */
+static void wheel_place(mytcp_wheel_t *w, mytcp_timer_t *t)
+{
+    uint64_t expires = t->expires < w->now ? w->now : t->expires;
+    uint64_t delta = expires - w->now;
+    if (delta >= WHEEL_SPAN) expires = w->now + WHEEL_SPAN - 1;
+
+    int level = 0;
+    while (level < WHEEL_LEVELS - 1 && delta >> (WHEEL_SLOT_BITS * (level + 1)) != 0) level++;
+    int index = (int) ((expires >> (WHEEL_SLOT_BITS * level)) & SLOT_MASK);
+
+    // append, so timers due at the same tick fire in the order they were armed
+    mytcp_timer_t *head = &w->slots[level][index];
+    t->next = head;
+    t->prev = head->prev;
+    head->prev->next = t;
+    head->prev = t;
+    t->slot = (uint16_t) (level * WHEEL_SLOTS + index);
+    w->occupied[level] |= 1ull << index;
+}
+
+/**
+ * Create an empty wheel.
+ *
+ * @param w The wheel to initialize
+ * @param now The current tick (see mytcp_wheel_clock())
+ */
+void mytcp_wheel_init(mytcp_wheel_t *w, uint64_t now)
+{
+    bzero(w, sizeof(*w));
+    w->now = now;
+
+    for (int level = 0; level < WHEEL_LEVELS; level++)
+        for (int index = 0; index < WHEEL_SLOTS; index++)
+            w->slots[level][index].next = w->slots[level][index].prev = &w->slots[level][index];
+}
+
+/**
+ * Initialize a timer as unarmed.
+ *
+ * @param t The timer
+ */
+void mytcp_timer_init(mytcp_timer_t *t)
+{
+    bzero(t, sizeof(*t));
+}
+
+/**
+ * Arm a timer, cancelling it first if it is already armed. O(1).
+ *
+ * @param w The wheel
+ * @param t The timer
+ * @param expires The tick to fire at; a tick that has already been run fires at the next mytcp_wheel_advance()
+ */
+void mytcp_wheel_arm(mytcp_wheel_t *w, mytcp_timer_t *t, uint64_t expires)
+{
+    if (t->next != NULL)
+        wheel_unlink(w, t);
+    else
+        w->armed++;
+
+    t->expires = expires;
+    wheel_place(w, t);
+}
+
+/**
+ * Cancel a timer. O(1); does nothing if the timer is not armed.
+ *
+ * @param w The wheel
+ * @param t The timer
+ */
+void mytcp_wheel_cancel(mytcp_wheel_t *w, mytcp_timer_t *t)
+{
+    if (t->next == NULL) return;
+    wheel_unlink(w, t);
+    w->armed--;
+}
+
+/**
+ * Whether a timer is armed.
+ *
+ * @param t The timer
+ * @return True iff the timer is armed and has not fired yet
+ */
+bool mytcp_timer_armed(const mytcp_timer_t *t)
+{
+    return t->next != NULL;
+}
+
+/**
+ * Move every timer in one slot of a higher level down to the level their expiry now falls in.
+ *
+ * @param w The wheel
+ * @param level The level
+ * @param index The slot
+ */
+static void wheel_cascade(mytcp_wheel_t *w, int level, int index)
+{
+    mytcp_timer_t *head = &w->slots[level][index];
+    while (head->next != head)
+    {
+        mytcp_timer_t *t = head->next;
+        wheel_unlink(w, t);
+        wheel_place(w, t);
+    }
+}
+
+/**
+ * Run the wheel up to and including a tick: call fn with every timer that expires by then, in expiry order.
+ * A lap of the first level at a time, only its non-empty slots are visited, and each higher level is cascaded one
+ * slot down whenever the level below wraps, so a call costs O(timers fired + ticks / 64).
+ * The callback may arm or cancel any timer, including the one it was called with.
+ *
+ * @param w The wheel
+ * @param now The current tick
+ * @param fn Called with each expired timer
+ * @param arg Passed to fn
+ * @return The number of timers fired
+ */
+size_t mytcp_wheel_advance(mytcp_wheel_t *w, uint64_t now, mytcp_timer_fn fn, void *arg)
+{
+    size_t fired = 0;
+
+    while (w->now <= now)
+    {
+        int index = (int) (w->now & SLOT_MASK);
+
+        // the first level wrapped: bring the next slot of each level down, as far up as the levels wrap too
+        if (index == 0)
+        {
+            for (int level = 1; level < WHEEL_LEVELS; level++)
+            {
+                int up = (int) ((w->now >> (WHEEL_SLOT_BITS * level)) & SLOT_MASK);
+                wheel_cascade(w, level, up);
+                if (up != 0) break;
+            }
+        }
+
+        mytcp_timer_t *head = &w->slots[0][index];
+        while (head->next != head)
+        {
+            mytcp_timer_t *t = head->next;
+            wheel_unlink(w, t);
+            w->armed--;
+            fired++;
+            fn(t, arg);
+        }
+
+        // skip to the next non-empty slot of this lap, or to the start of the next lap
+        uint64_t ahead = index == WHEEL_SLOTS - 1 ? 0 : w->occupied[0] >> (index + 1);
+        uint64_t step = ahead != 0 ? (uint64_t) __builtin_ctzll(ahead) + 1 : (uint64_t) (WHEEL_SLOTS - index);
+        if (w->now + step > now + 1) step = now + 1 - w->now;
+        w->now += step;
+    }
+
+    return fired;
+}
+
+/**
+ * How long a caller may sleep before the wheel next has work: until the next non-empty slot of the first level, or
+ * the end of its lap, when higher levels may cascade down.
+ *
+ * @param w The wheel
+ * @param now The current tick
+ * @param max The longest to report, or -1 for no limit
+ * @return Ticks to sleep, between 0 and max (or -1 if max is -1 and no timer is armed)
+ */
+int mytcp_wheel_timeout(const mytcp_wheel_t *w, uint64_t now, int max)
+{
+    if (w->armed == 0) return max;
+
+    // at the start of a lap the higher levels have yet to cascade, so the first level alone does not tell
+    int index = (int) (w->now & SLOT_MASK);
+    uint64_t ahead = w->occupied[0] >> index;
+    uint64_t higher = 0;
+    for (int level = 1; level < WHEEL_LEVELS; level++) higher |= w->occupied[level];
+
+    uint64_t next = w->now;
+    if (index != 0 || higher == 0)
+        next += ahead != 0 ? (uint64_t) __builtin_ctzll(ahead) : (uint64_t) (WHEEL_SLOTS - index);
+
+    if (next <= now) return 0;
+    if (max != -1 && next - now >= (uint64_t) max) return max;
+    return next - now < INT32_MAX ? (int) (next - now) : INT32_MAX;
+}
+
+/**
+ * Read the monotonic clock at the wheel's resolution.
+ *
+ * @return The current time in milliseconds
+ */
+uint64_t mytcp_wheel_clock(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000 + (uint64_t) ts.tv_nsec / 1000000;
+}
@@ -0,0 +1,55 @@
+#ifndef CSCE3530_LAB3_TIMERWHEEL_H
+#define CSCE3530_LAB3_TIMERWHEEL_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// wheel geometry: WHEEL_LEVELS levels of 2^WHEEL_SLOT_BITS slots; at 1 ms per tick the wheel spans 2^24 ms (4.6 hours),
+// and timers further out are parked in the last level until they come into range
+#define WHEEL_LEVELS 4
+#define WHEEL_SLOT_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_SLOT_BITS)
+
+// a timer, embedded in whatever it times (see mytcp_wheel_advance()); unarmed while next is NULL
+typedef struct mytcp_timer
+{
+    struct mytcp_timer *next;
+    struct mytcp_timer *prev;
+    uint64_t expires;           // tick the timer fires at
+    uint16_t slot;              // level * WHEEL_SLOTS + slot index, while armed
+} mytcp_timer_t;
+
+// hierarchical timing wheel: each slot is a doubly-linked list, so arming and cancelling are O(1) whatever the
+// number of timers, and a bitmap per level lets time skip over empty slots
+typedef struct mytcp_wheel
+{
+    uint64_t now;                                       // next tick to run
+    size_t armed;
+    uint64_t occupied[WHEEL_LEVELS];                    // bit i set iff slot i of the level is non-empty
+    mytcp_timer_t slots[WHEEL_LEVELS][WHEEL_SLOTS];     // list heads
+} mytcp_wheel_t;
+
+// called with each expired timer, which is no longer armed and may be armed again
+typedef void (*mytcp_timer_fn)(mytcp_timer_t *, void *);
+
+// the structure a timer is embedded in, from within a mytcp_timer_fn
+#define TIMER_OWNER(timer, type, member) ((type *) ((char *) (timer) - offsetof(type, member)))
+
+// setup; the wheel starts at the given tick
+void mytcp_wheel_init(mytcp_wheel_t *, uint64_t);
+void mytcp_timer_init(mytcp_timer_t *);
+
+// arm (or re-arm) a timer to fire at a tick, cancel it, and check whether it is armed
+void mytcp_wheel_arm(mytcp_wheel_t *, mytcp_timer_t *, uint64_t);
+void mytcp_wheel_cancel(mytcp_wheel_t *, mytcp_timer_t *);
+bool mytcp_timer_armed(const mytcp_timer_t *);
+
+// run every timer due up to and including a tick, and tell how many ticks a caller may sleep before the next one
+size_t mytcp_wheel_advance(mytcp_wheel_t *, uint64_t, mytcp_timer_fn, void *);
+int mytcp_wheel_timeout(const mytcp_wheel_t *, uint64_t, int);
+
+// the monotonic clock in milliseconds, the tick every caller uses
+uint64_t mytcp_wheel_clock(void);
+
+#endif //CSCE3530_LAB3_TIMERWHEEL_H
@@ -0,0 +1,1081 @@
+#include "transfer.h"
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "common.h"
+
+
+// bytes of segments queued before they are written to a stream socket with one write()
+#define TRANSFER_OUT_CAPACITY (256 * 1024)
+
+#define BIT(flag) ((uint16_t) (1 << (flag)))
+
+// payload carried by every data segment; its content does not matter, only its length
+static const char PAYLOAD[MYTCP_MAX_PAYLOAD];
+
+/* SENDER */
+
+/**
+ * Set up the sending half of a transfer on an established connection. The first payload byte takes the connection's
+ * next sequence number.
+ *
+ * @param s The sender to initialize
+ * @param conn The connection, which must be established
+ * @param total The number of payload bytes to send
+ * @param mss The largest payload per segment, at most MYTCP_MAX_PAYLOAD
+ * @param window The most unacknowledged bytes to allow, whatever the peer advertises
+ * @param cc The congestion control algorithm, or NULL for none
+ */
+void mytcp_sender_init(mytcp_sender_t *s, mytcp_conn_t *conn, uint64_t total, uint16_t mss, uint32_t window,
+                       const mytcp_cc_ops_t *cc)
+{
+    bzero(s, sizeof(*s));
+    s->conn = conn;
+    s->base = conn->snd_nxt;
+    s->total = total;
+    s->mss = mss;
+    s->window = window;
+    if (cc != NULL) mytcp_cc_init(&s->cc, cc, mss);
+}
+
+/**
+ * Use the options both sides agreed on in the handshake. The window the peer advertised in its SYN was not scaled,
+ * so it is converted (rounding down) until the peer's first acknowledgment brings a scaled one.
+ *
+ * @param s The sender
+ * @param agreed The options both sides offered, with the peer's window scale shift
+ */
+void mytcp_sender_set_options(mytcp_sender_t *s, const mytcp_options_t *agreed)
+{
+    s->wscale = agreed->present & OPTION_WINDOW_SCALE ? agreed->window_scale : 0;
+    s->sack = agreed->present & OPTION_SACK_PERMITTED;
+    s->timestamps = agreed->present & OPTION_TIMESTAMPS;
+    s->conn->snd_wnd = (uint16_t) (s->conn->snd_wnd >> s->wscale);
+}
+
+/**
+ * The most unacknowledged bytes the sender may have: the smallest of its own window, the peer's and, with
+ * congestion control, the congestion window.
+ *
+ * @param s The sender
+ * @return The limit in bytes
+ */
+static uint64_t sender_limit(const mytcp_sender_t *s)
+{
+    uint64_t peer = (uint64_t) s->conn->snd_wnd << s->wscale;
+    uint64_t limit = s->window < peer ? s->window : peer;
+    return s->cc.ops != NULL && s->cc.cwnd < limit ? s->cc.cwnd : limit;
+}
+
+/**
+ * Move past any bytes the peer reported it holds (SACK), since they need not be sent again. Only the gaps below the
+ * highest byte it holds are taken as lost: once they are sent again, whatever was sent past it is still in flight,
+ * so the sender goes on from the most it ever sent instead of going back over it.
+ *
+ * @param s The sender
+ * @return Where the next range the peer holds begins, or UINT64_MAX if it holds nothing further
+ */
+static uint64_t sender_skip_sacked(mytcp_sender_t *s)
+{
+    // ranges are disjoint, but need not be in order, so look again after every move
+    bool moved = true;
+    while (moved)
+    {
+        moved = false;
+        for (uint8_t i = 0; i < s->nsacked; i++)
+            if (s->sent >= s->sacked[i][0] && s->sent < s->sacked[i][1])
+            {
+                s->sent = s->sacked[i][1];
+                moved = true;
+            }
+    }
+
+    uint64_t next = UINT64_MAX, held = 0;
+    for (uint8_t i = 0; i < s->nsacked; i++)
+    {
+        if (s->sacked[i][0] > s->sent && s->sacked[i][0] < next) next = s->sacked[i][0];
+        if (s->sacked[i][1] > held) held = s->sacked[i][1];
+    }
+    if (s->sent >= held) s->sent = s->highest;
+    s->conn->snd_nxt = s->base + (uint32_t) s->sent;
+    return next;
+}
+
+/**
+ * Bytes in flight: sent but not acknowledged, leaving out those the peer reported it holds (SACK), which have left
+ * the network.
+ *
+ * @param s The sender
+ * @return The number of bytes
+ */
+static uint64_t sender_in_flight(const mytcp_sender_t *s)
+{
+    uint64_t in_flight = s->sent - s->acked;
+    for (uint8_t i = 0; i < s->nsacked; i++)
+        if (s->sacked[i][0] < s->sent)
+            in_flight -= (s->sacked[i][1] < s->sent ? s->sacked[i][1] : s->sent) - s->sacked[i][0];
+    return in_flight;
+}
+
+/**
+ * Take the SACK blocks of an acknowledgment as the ranges the peer now holds past the gap, as byte counts from the
+ * start of the transfer. Blocks that are already acknowledged, or that cover bytes never sent, are ignored.
+ *
+ * @param s The sender
+ * @param options The acknowledgment's options
+ */
+static void sender_take_sacks(mytcp_sender_t *s, const mytcp_options_t *options)
+{
+    uint32_t una = s->base + (uint32_t) s->acked;
+    s->nsacked = 0;
+    for (uint8_t i = 0; (options->present & OPTION_SACK) && i < options->nsack; i++)
+    {
+        // sequence numbers wrap, but the distance from snd_una never exceeds the window
+        uint64_t left = s->acked + (uint32_t) (options->sack[i].left - una);
+        uint64_t right = s->acked + (uint32_t) (options->sack[i].right - una);
+        if (left >= right || right > s->highest) continue;
+
+        s->sacked[s->nsacked][0] = left;
+        s->sacked[s->nsacked][1] = right;
+        s->nsacked++;
+    }
+}
+
+/**
+ * Go back to the oldest unacknowledged byte, to send everything from there again (go-back-N). The segment being
+ * timed will be sent again, so its acknowledgment would not tell which copy it answers (Karn's algorithm).
+ *
+ * @param s The sender
+ */
+static void sender_go_back(mytcp_sender_t *s)
+{
+    s->sent = s->acked;
+    s->conn->snd_nxt = s->base + (uint32_t) s->sent;
+    s->timed = 0;
+}
+
+/**
+ * Produce the next data segment, if the window allows one. Segments are full-sized unless the data runs out (or,
+ * after going back, a range the peer holds begins); a window smaller than the MSS is only filled once nothing is in
+ * flight, so the sender never trickles out small segments while it waits for the window to open.
+ *
+ * @param s The sender
+ * @param out Where to write the segment's header, with its options; its payload (of the returned length) must follow
+ *            it on the wire
+ * @param now The current time, in ns
+ * @return The payload length, or 0 if nothing may be sent until an acknowledgment or a timeout
+ */
+size_t mytcp_sender_next(mytcp_sender_t *s, mytcp_header_t *out, uint64_t now)
+{
+    uint64_t sacked = s->nsacked > 0 ? sender_skip_sacked(s) : UINT64_MAX;
+    uint64_t in_flight = sender_in_flight(s);
+    uint64_t limit = sender_limit(s);
+    uint64_t left = (sacked < s->total ? sacked : s->total) - s->sent;
+    if (left == 0 || in_flight >= limit) return 0;
+
+    uint64_t length = left < s->mss ? left : s->mss;
+    if (in_flight + length > limit)
+    {
+        if (in_flight > 0) return 0;
+        length = limit;
+    }
+
+    out->seg = s->conn->header;
+    mytcp_set_sequence(&out->seg, s->base + (uint32_t) s->sent);
+    mytcp_set_acknowledgment(&out->seg, s->conn->rcv_nxt);
+    mytcp_set_flag(&out->seg, FLAG_ACK);
+    mytcp_set_payload_length(&out->seg, (uint16_t) length);
+    if (s->timestamps)
+    {
+        mytcp_options_t options = { .present = OPTION_TIMESTAMPS, .ts_val = (uint32_t) (now / 1000),
+                                    .ts_ecr = s->ts_recent };
+        mytcp_options_write(&out->seg, &options);
+    }
+
+    if (s->sent < s->highest)
+    {
+        s->retransmitted += s->highest - s->sent < length ? s->highest - s->sent : length;
+        if (s->sent + length > s->resent) s->resent = s->sent + length;
+    }
+
+    // time one segment of new data per round trip, unless every acknowledgment echoes a timestamp
+    if (!s->timestamps && s->timed == 0 && s->sent >= s->highest)
+    {
+        s->timed = s->sent + length;
+        s->timed_at = now;
+    }
+
+    s->sent += length;
+    if (s->sent > s->highest) s->highest = s->sent;
+    s->segments++;
+    s->conn->snd_nxt = s->base + (uint32_t) s->sent;
+    return (size_t) length;
+}
+
+/**
+ * Take a cumulative acknowledgment from the peer. It may acknowledge anything up to the most ever sent, and it
+ * updates the peer's window; one that acknowledges nothing new is counted as a duplicate, and one from before the
+ * oldest unacknowledged byte (overtaken by a later one, or delayed) is ignored. With congestion control,
+ * new data grows the congestion window, and enough duplicates while data is in flight mean a segment was lost: the
+ * sender goes back to it right away instead of waiting for the retransmission timeout (fast retransmit). With SACK,
+ * the acknowledgment also says which bytes past the gap the peer holds, and with timestamps it is an RTT sample.
+ *
+ * @param s The sender
+ * @param in The acknowledgment; its whole header, options included
+ * @param now The current time, in ns
+ * @return CONN_OK if the acknowledgment was accepted, else the reason it was rejected
+ */
+mytcp_conn_error_t mytcp_sender_input(mytcp_sender_t *s, const mytcp_t *in, uint64_t now)
+{
+    mytcp_expect_t expect;
+    mytcp_expect_init(&expect, BIT(FLAG_ACK), BIT(FLAG_SYN) | BIT(FLAG_FIN));
+    mytcp_expect_sequence(&expect, s->conn->rcv_nxt);
+    mytcp_expect_options(&expect);
+    uint32_t invalid = mytcp_validate(in, &expect);
+
+    if (invalid & INVALID_CHECKSUM) return CONN_ERR_CHECKSUM;
+    if (invalid & (INVALID_FLAGS | INVALID_OFFSET)) return CONN_ERR_FLAGS;
+    if (invalid & INVALID_SEQUENCE) return CONN_ERR_SEQUENCE;
+
+    // sequence numbers wrap, but the distance from snd_una never exceeds the window
+    uint32_t advance = in->acknowledgment - (s->base + (uint32_t) s->acked);
+    if ((int32_t) advance < 0) return CONN_OK;
+    if (advance > s->highest - s->acked) return CONN_ERR_ACK;
+
+    mytcp_options_t options = { .present = 0 };
+    if ((s->sack || s->timestamps) && mytcp_options_read(in, &options) != 0) return CONN_ERR_FLAGS;
+    if (options.present & OPTION_TIMESTAMPS) s->ts_recent = options.ts_val;
+
+    s->conn->snd_wnd = in->receive;
+    if (advance == 0)
+    {
+        if (s->sack) sender_take_sacks(s, &options);
+        s->duplicate_acks++;
+        if (s->cc.ops != NULL && s->highest > s->acked && mytcp_cc_duplicate(&s->cc, s->highest, now))
+        {
+            s->fast_retransmits++;
+            sender_go_back(s);
+        }
+        return CONN_OK;
+    }
+
+    bool limited = s->highest - s->acked + s->mss > s->cc.cwnd;
+    s->acked += advance;
+    if (s->sent < s->acked)
+    {
+        s->sent = s->acked;
+        s->conn->snd_nxt = s->base + (uint32_t) s->sent;
+    }
+    if (s->sack) sender_take_sacks(s, &options);
+
+    if (s->timed != 0 && s->acked >= s->timed)
+    {
+        if (s->cc.ops != NULL) mytcp_cc_rtt(&s->cc, now - s->timed_at);
+        s->timed = 0;
+    }
+
+    // the echo tells which copy of a segment was acknowledged, so retransmissions are sampled too
+    if ((options.present & OPTION_TIMESTAMPS) && options.ts_ecr != 0 && s->cc.ops != NULL)
+        mytcp_cc_rtt(&s->cc, (uint64_t) ((uint32_t) (now / 1000) - options.ts_ecr) * 1000);
+    if (s->cc.ops != NULL) mytcp_cc_ack(&s->cc, advance, s->acked, limited, now);
+
+    // still recovering: the acknowledgment stops at the next gap, which was lost as well (RFC 6582) unless it was
+    // already sent again
+    if (s->sack && s->cc.ops != NULL && s->cc.recovering && s->acked >= s->resent) sender_go_back(s);
+    return CONN_OK;
+}
+
+/**
+ * Nothing was acknowledged for a retransmission timeout: go back to the oldest unacknowledged byte and send
+ * everything from there again (go-back-N). What the peer reported holding is forgotten too, since it may have
+ * dropped it since. With congestion control, the window starts again from one segment.
+ *
+ * @param s The sender
+ * @param now The current time, in ns
+ */
+void mytcp_sender_timeout(mytcp_sender_t *s, uint64_t now)
+{
+    s->timeouts++;
+    s->nsacked = 0;
+    sender_go_back(s);
+    if (s->cc.ops != NULL) mytcp_cc_timeout(&s->cc, now);
+}
+
+/**
+ * Whether every payload byte has been acknowledged.
+ *
+ * @param s The sender
+ * @return True iff the transfer is complete
+ */
+bool mytcp_sender_done(const mytcp_sender_t *s)
+{
+    return s->acked == s->total;
+}
+
+/* RECEIVER */
+
+/**
+ * Set up the receiving half of a transfer on a connection.
+ *
+ * @param r The receiver to initialize
+ * @param conn The connection
+ */
+void mytcp_receiver_init(mytcp_receiver_t *r, mytcp_conn_t *conn)
+{
+    bzero(r, sizeof(*r));
+    r->conn = conn;
+}
+
+/**
+ * Use the options both sides agreed on in the handshake.
+ *
+ * @param r The receiver
+ * @param agreed The options both sides offered
+ */
+void mytcp_receiver_set_options(mytcp_receiver_t *r, const mytcp_options_t *agreed)
+{
+    r->sack = agreed->present & OPTION_SACK_PERMITTED;
+    r->timestamps = agreed->present & OPTION_TIMESTAMPS;
+}
+
+/**
+ * Hold the range of a segment that arrived past the gap, merged with any range it touches, and make it the first
+ * to report. If there is no room left, the range reported longest ago is dropped: the sender will send it again.
+ *
+ * @param r The receiver
+ * @param left The segment's sequence number
+ * @param right The sequence number just past its payload
+ */
+static void receiver_hold(mytcp_receiver_t *r, uint32_t left, uint32_t right)
+{
+    // held ranges are all ahead of rcv_nxt, so distances from it compare without wrapping
+    uint32_t base = r->conn->rcv_nxt;
+    for (uint8_t i = 0; i < r->nsack;)
+    {
+        mytcp_sack_block_t *b = &r->held[i];
+        if (b->left - base > right - base || left - base > b->right - base)
+        {
+            i++;
+            continue;
+        }
+
+        if (b->left - base < left - base) left = b->left;
+        if (b->right - base > right - base) right = b->right;
+        memmove(b, b + 1, (size_t) (--r->nsack - i) * sizeof(*b));
+    }
+
+    // everything held is reported, and only three blocks fit alongside timestamps
+    uint8_t room = r->timestamps ? OPTIONS_MAX_SACK_TIMESTAMPS : OPTIONS_MAX_SACK;
+    if (r->nsack == room) r->nsack--;
+    memmove(&r->held[1], &r->held[0], r->nsack * sizeof(r->held[0]));
+    r->held[0] = (mytcp_sack_block_t) { .left = left, .right = right };
+    r->nsack++;
+}
+
+/**
+ * Take a data segment from the peer. The payload that comes next in sequence is accepted, along with any held past
+ * the gap it fills. Anything else (a retransmission of data we already have, or data past a gap) is dropped, or with
+ * SACK, data past a gap is held. Either way an acknowledgment becomes due, so the sender learns what we have.
+ *
+ * @param r The receiver
+ * @param in The segment; its whole header, options included
+ * @param length The length of its payload
+ * @return CONN_OK if the segment was valid (even if it was dropped), else the reason it was rejected
+ */
+mytcp_conn_error_t mytcp_receiver_input(mytcp_receiver_t *r, const mytcp_t *in, size_t length)
+{
+    mytcp_expect_t expect;
+    mytcp_expect_init(&expect, BIT(FLAG_ACK), BIT(FLAG_SYN) | BIT(FLAG_FIN));
+    mytcp_expect_sequence(&expect, r->conn->rcv_nxt);
+    mytcp_expect_ack(&expect, r->conn->snd_nxt);
+    mytcp_expect_options(&expect);
+    uint32_t invalid = mytcp_validate(in, &expect);
+
+    if (invalid & INVALID_CHECKSUM) return CONN_ERR_CHECKSUM;
+    if (invalid & (INVALID_FLAGS | INVALID_OFFSET)) return CONN_ERR_FLAGS;
+    if (invalid & INVALID_ACK) return CONN_ERR_ACK;
+
+    mytcp_options_t options = { .present = 0 };
+    if (r->timestamps && mytcp_options_read(in, &options) != 0) return CONN_ERR_FLAGS;
+
+    r->conn->snd_wnd = in->receive;
+    r->ack_pending = true;
+
+    // a segment out of order is valid, but only acknowledged (and held, with SACK, if it is past the gap)
+    if (invalid & INVALID_SEQUENCE)
+    {
+        r->out_of_order++;
+        if (r->sack && length > 0 && in->sequence - r->conn->rcv_nxt < UINT32_MAX / 2)
+            receiver_hold(r, in->sequence, in->sequence + (uint32_t) length);
+        return CONN_OK;
+    }
+
+    // echo the first segment since our last acknowledgment, so the sender's sample covers the whole delay (RFC 7323)
+    if ((options.present & OPTION_TIMESTAMPS) && (r->conn->rcv_nxt == r->last_ack || r->ts_recent == 0))
+        r->ts_recent = options.ts_val;
+
+    uint32_t before = r->conn->rcv_nxt;
+    r->conn->rcv_nxt += (uint32_t) length;
+    r->segments++;
+
+    // the gap may be filled: what was held past it is now next in sequence
+    for (uint8_t i = 0; i < r->nsack;)
+    {
+        mytcp_sack_block_t *b = &r->held[i];
+        if ((int32_t) (b->left - r->conn->rcv_nxt) > 0)
+        {
+            i++;
+            continue;
+        }
+
+        if ((int32_t) (b->right - r->conn->rcv_nxt) > 0) r->conn->rcv_nxt = b->right;
+        memmove(b, b + 1, (size_t) (--r->nsack - i) * sizeof(*b));
+        i = 0;
+    }
+
+    r->received += r->conn->rcv_nxt - before;
+    return CONN_OK;
+}
+
+/**
+ * Produce a cumulative acknowledgment of everything received so far, if any data arrived since the last one. Called
+ * once per batch of segments rather than per segment, it acknowledges the whole batch at once. With SACK it also
+ * reports the ranges held past the gap, and with timestamps it echoes the sender's.
+ *
+ * @param r The receiver
+ * @param out Where to write the acknowledgment, with its options
+ * @param now The current time, in ns
+ * @return True iff an acknowledgment was written
+ */
+bool mytcp_receiver_ack(mytcp_receiver_t *r, mytcp_header_t *out, uint64_t now)
+{
+    if (!r->ack_pending) return false;
+
+    out->seg = r->conn->header;
+    mytcp_set_sequence(&out->seg, r->conn->snd_nxt);
+    mytcp_set_acknowledgment(&out->seg, r->conn->rcv_nxt);
+    mytcp_set_flag(&out->seg, FLAG_ACK);
+
+    mytcp_options_t options = { .present = 0 };
+    if (r->timestamps)
+    {
+        options.present |= OPTION_TIMESTAMPS;
+        options.ts_val = (uint32_t) (now / 1000);
+        options.ts_ecr = r->ts_recent;
+    }
+    if (r->nsack > 0)
+    {
+        options.present |= OPTION_SACK;
+        options.nsack = r->nsack;
+        memcpy(options.sack, r->held, r->nsack * sizeof(r->held[0]));
+    }
+    if (options.present != 0) mytcp_options_write(&out->seg, &options);
+
+    r->last_ack = r->conn->rcv_nxt;
+    r->ack_pending = false;
+    return true;
+}
+
+/* DRIVERS */
+
+// one side of a transfer over a blocking socket
+struct transfer_link
+{
+    int fd;
+    FILE *outfile;
+    bool udp;                   // datagrams carry one segment each, so segments are not coalesced into one write()
+    mytcp_reader_t reader;      // shared by the handshakes and the transfer, so no segment read ahead is lost
+    char *out;                  // segments queued for the next write()
+    size_t nout;
+    mytcp_options_t offer;      // options our SYN carries
+    mytcp_options_t peer;       // options the peer's SYN carried
+};
+
+static uint64_t transfer_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+/**
+ * Write every queued segment.
+ *
+ * @param link The link
+ * @return 0 on success, else a non-zero error code
+ */
+static int link_flush(struct transfer_link *link)
+{
+    if (link->nout == 0) return 0;
+
+    ssize_t rw_result = write(link->fd, link->out, link->nout);
+    if (rw_result != (ssize_t) link->nout || errno != 0) return handle_bad_rw_result(rw_result, "send segments");
+
+    link->nout = 0;
+    return 0;
+}
+
+/**
+ * Queue a segment and its payload for the next write. Over UDP each segment is written right away, as its own
+ * datagram.
+ *
+ * @param link The link
+ * @param seg The segment's header, with its options
+ * @param length The length of its payload
+ * @return 0 on success, else a non-zero error code
+ */
+static int link_queue(struct transfer_link *link, const mytcp_t *seg, size_t length)
+{
+    int result;
+    size_t header = mytcp_header_length(seg);
+    if (link->nout + header + length > TRANSFER_OUT_CAPACITY && (result = link_flush(link)) != 0) return result;
+
+    memcpy(link->out + link->nout, seg, header);
+    memcpy(link->out + link->nout + header, PAYLOAD, length);
+    link->nout += header + length;
+
+    return link->udp ? link_flush(link) : 0;
+}
+
+/**
+ * Whether a segment the transfer rejected is dropped rather than ending it: over UDP, one that was damaged on the way
+ * (it fails the checksum or the flag checks) is dropped as the network would have, and retransmission recovers it.
+ *
+ * @param link The link
+ * @param err Why the segment was rejected
+ * @return True if the segment is dropped
+ */
+static bool link_drops(const struct transfer_link *link, mytcp_conn_error_t err)
+{
+    return link->udp && (err == CONN_ERR_CHECKSUM || err == CONN_ERR_FLAGS);
+}
+
+/**
+ * Read more into the link's reader, waiting at most timeout_ms for something to arrive.
+ *
+ * @param link The link
+ * @param timeout_ms The longest to wait in milliseconds, or -1 to wait indefinitely
+ * @return 0 on success, -1 on a timeout, else a non-zero error code
+ */
+static int link_fill(struct transfer_link *link, int timeout_ms)
+{
+    if (timeout_ms >= 0)
+    {
+        struct pollfd pfd = { .fd = link->fd, .events = POLLIN };
+        int ready = poll(&pfd, 1, timeout_ms);
+        if (ready == -1) return abort_with_errno(errno, "poll");
+        if (ready == 0) return -1;
+    }
+
+    ssize_t rw_result = mytcp_reader_fill(&link->reader);
+    if (rw_result <= 0 || errno != 0)
+        return handle_bad_rw_result(rw_result < 0 ? rw_result : (ssize_t) mytcp_reader_buffered(&link->reader),
+                                    "receive segment");
+    return 0;
+}
+
+/**
+ * The smallest window scale shift that lets a window be advertised in the 16-bit window field.
+ *
+ * @param window The window in bytes, at most TRANSFER_MAX_WINDOW
+ * @return The shift count
+ */
+static uint8_t transfer_window_scale(uint32_t window)
+{
+    uint8_t shift = 0;
+    while (shift < OPTIONS_MAX_WINDOW_SCALE && window >> shift > UINT16_MAX) shift++;
+    return shift;
+}
+
+/**
+ * Send a handshake segment produced by the connection, and print it. A SYN carries our options: all of them on a
+ * connection request, and on a connection granted only those the peer's request offered as well (and the MSS).
+ *
+ * @param link The link
+ * @param conn The connection that produced the segment
+ * @param seg The segment
+ * @return 0 on success, else a non-zero error code
+ */
+static int link_send_handshake(struct transfer_link *link, const mytcp_conn_t *conn, const mytcp_t *seg)
+{
+    char title[TITLE_LEN];
+    snprintf(title, TITLE_LEN, "outgoing %s", SEGMENT_KIND_NAMES[mytcp_conn_kind(conn, seg)]);
+
+    mytcp_header_t out = { .seg = *seg };
+    if (mytcp_check_flag(seg, FLAG_SYN))
+    {
+        mytcp_options_t options = link->offer;
+        options.ts_val = (uint32_t) (transfer_now_ns() / 1000);
+        if (mytcp_check_flag(seg, FLAG_ACK))
+        {
+            options.present &= (uint8_t) (link->peer.present | OPTION_MSS);
+            options.ts_ecr = link->peer.ts_val;
+        }
+        mytcp_options_write(&out.seg, &options);
+    }
+
+    int result = link_queue(link, &out.seg, 0);
+    if (result == 0) result = link_flush(link);
+    if (result == 0) mytcp_print_segment(link->outfile, &out.seg, title);
+    return result;
+}
+
+/**
+ * Send again the handshake segments the connection last sent.
+ *
+ * @param link The link
+ * @param conn The connection that produced the segments
+ * @param segs The segments (see mytcp_conn_retransmit())
+ * @param n The number of segments
+ * @return 0 on success, else a non-zero error code
+ */
+static int transfer_resend(struct transfer_link *link, const mytcp_conn_t *conn, const mytcp_t *segs, int n)
+{
+    int result = 0;
+    for (int i = 0; i < n && result == 0; i++) result = link_send_handshake(link, conn, &segs[i]);
+    return result;
+}
+
+/**
+ * Feed a handshake segment to the connection, print it, and send whatever the connection responds with, followed by
+ * our own close request if the peer's close left the connection in CLOSE_WAIT. A duplicate of the peer's last
+ * handshake segment gets our answer again.
+ *
+ * @param link The link
+ * @param conn The connection
+ * @param seg The incoming segment
+ * @return 0 on success, else a non-zero error code
+ */
+static int transfer_handshake_input(struct transfer_link *link, mytcp_conn_t *conn, const mytcp_t *seg)
+{
+    mytcp_t response, retransmit[2];
+    char title[TITLE_LEN];
+    int result = 0, nout;
+
+    const char *expecting = SEGMENT_KIND_NAMES[mytcp_conn_expecting(conn)];
+    mytcp_conn_error_t err = mytcp_conn_input(conn, seg, &response, &nout);
+    if (err == CONN_ERR_DUPLICATE)
+        return transfer_resend(link, conn, retransmit, mytcp_conn_retransmit(conn, retransmit));
+    if (err != CONN_OK)
+    {
+        snprintf(title, TITLE_LEN, "incoming %s: %s", expecting, CONN_ERROR_NAMES[err]);
+        return abort_with_message(title);
+    }
+
+    snprintf(title, TITLE_LEN, "incoming %s", SEGMENT_KIND_NAMES[mytcp_conn_kind(conn, seg)]);
+    mytcp_print_segment(link->outfile, seg, title);
+
+    // the peer's SYN says which options it supports; malformed ones count as none
+    if (mytcp_check_flag(seg, FLAG_SYN) && mytcp_options_read(seg, &link->peer) != 0) link->peer.present = 0;
+
+    if (nout > 0) result = link_send_handshake(link, conn, &response);
+    if (result == 0 && conn->state == STATE_CLOSE_WAIT)
+    {
+        mytcp_conn_close(conn, &response);
+        result = link_send_handshake(link, conn, &response);
+    }
+    return result;
+}
+
+/**
+ * Run a handshake until the connection is done. While opening, a data segment may stand in for the lost connection
+ * acknowledgment, so its payload goes on to the receiver. While closing, leftovers of the transfer are skipped:
+ * retransmitted data, and acknowledgments of data sent before our close request.
+ * Our handshake segments are resent after each retransmission timeout over UDP, and a connection that closed by
+ * sending the last acknowledgment lingers for CONN_TIME_WAIT_MS to answer the peer if that acknowledgment was lost.
+ *
+ * @param link The link
+ * @param conn The connection
+ * @param receiver The receiver to hand payload to, or NULL on the sending side
+ * @return 0 on success, else a non-zero error code
+ */
+static int transfer_handshake(struct transfer_link *link, mytcp_conn_t *conn, mytcp_receiver_t *receiver)
+{
+    int result = 0;
+    while (result == 0 && !mytcp_conn_done(conn))
+    {
+        size_t length;
+        const mytcp_t *seg = mytcp_reader_next_segment(&link->reader, &length);
+        if (seg == NULL)
+        {
+            // if we sent nothing, the peer speaks first (or retransmits), so only then is there no timeout
+            result = link_fill(link, conn->nsent > 0 ? (int) mytcp_conn_rto(conn) : -1);
+            if (result == -1)
+            {
+                mytcp_t retransmit[2];
+                int n = mytcp_conn_timeout(conn, retransmit);
+                if (n == -1) return abort_with_message("timed out");
+                result = link->udp ? transfer_resend(link, conn, retransmit, n) : 0;
+            }
+            continue;
+        }
+
+        if (conn->closing && !mytcp_check_flag(seg, FLAG_FIN) && (length > 0 || seg->acknowledgment != conn->snd_nxt))
+            continue;
+
+        result = transfer_handshake_input(link, conn, seg);
+        if (result == 0 && length > 0 && receiver != NULL) mytcp_receiver_input(receiver, seg, length);
+    }
+
+    bool linger = link->udp && conn->closing && mytcp_conn_lingers(conn);
+    uint64_t until = mytcp_wheel_clock() + CONN_TIME_WAIT_MS, now;
+    while (result == 0 && linger && (now = mytcp_wheel_clock()) < until)
+    {
+        size_t length;
+        const mytcp_t *seg = mytcp_reader_next_segment(&link->reader, &length);
+        if (seg == NULL)
+        {
+            result = link_fill(link, (int) (until - now));
+            if (result == -1) break;
+            continue;
+        }
+
+        // feed a copy, so nothing but a duplicate can move the connection on
+        mytcp_conn_t probe = *conn;
+        mytcp_t response[2];
+        int nout;
+        if (mytcp_conn_input(&probe, seg, response, &nout) == CONN_ERR_DUPLICATE)
+            result = transfer_resend(link, conn, response, mytcp_conn_retransmit(conn, response));
+    }
+    return result == -1 ? 0 : result;
+}
+
+/**
+ * Set up a link over a connected socket, and the connection it carries: its SYN offers every option we support, with
+ * the window scale our window needs, and it advertises the window, unscaled (as SYNs always are) until the options
+ * are agreed on. Nagle's algorithm is turned off on a stream socket.
+ *
+ * @param link The link to initialize
+ * @param fd The socket
+ * @param outfile The file to print handshake segments to (as well as stdout)
+ * @param udp True if the socket carries datagrams
+ * @param conn The connection, initialized
+ * @param window The receive window to advertise
+ * @return 0 on success, else a non-zero error code
+ */
+static int link_init(struct transfer_link *link, int fd, FILE *outfile, bool udp, mytcp_conn_t *conn,
+                     uint32_t window)
+{
+    bzero(link, sizeof(*link));
+    link->fd = fd;
+    link->outfile = outfile;
+    link->udp = udp;
+
+    // each write is a whole window's worth of segments, so the kernel must not hold one back for the peer's ACK
+    int one = 1;
+    if (!udp && setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) != 0)
+        return abort_with_errno(errno, "setsockopt");
+
+    link->offer.present = OPTION_MSS | OPTION_WINDOW_SCALE | OPTION_SACK_PERMITTED | OPTION_TIMESTAMPS;
+    link->offer.mss = MYTCP_MAX_PAYLOAD;
+    link->offer.window_scale = transfer_window_scale(window);
+    conn->options = true;
+    mytcp_conn_set_window(conn, (uint16_t) (window < UINT16_MAX ? window : UINT16_MAX));
+
+    if (mytcp_reader_init(&link->reader, fd, READER_DEFAULT_CAPACITY) != 0) return abort_with_errno(errno, "reader");
+    link->out = malloc(TRANSFER_OUT_CAPACITY);
+    if (link->out == NULL) return abort_with_errno(errno, "malloc");
+    return 0;
+}
+
+static void link_free(struct transfer_link *link)
+{
+    mytcp_reader_free(&link->reader);
+    free(link->out);
+}
+
+/**
+ * Once the connection is open, take the options both sides offered: from now on the window we advertise is scaled if
+ * the peer agreed to window scaling, and the peer's own shift applies to the windows it advertises.
+ *
+ * @param link The link
+ * @param conn The connection
+ * @param window The receive window we advertise
+ * @param agreed Set to the options both sides offered, with the peer's MSS and window scale shift
+ */
+static void link_agree(struct transfer_link *link, mytcp_conn_t *conn, uint32_t window, mytcp_options_t *agreed)
+{
+    *agreed = link->peer;
+    agreed->present &= link->offer.present;
+
+    uint8_t shift = agreed->present & OPTION_WINDOW_SCALE ? link->offer.window_scale : 0;
+    window >>= shift;
+    mytcp_conn_set_window(conn, (uint16_t) (window < UINT16_MAX ? window : UINT16_MAX));
+
+    printf("options: MSS %u, window scale %s (ours %u, peer's %u), SACK %s, timestamps %s\n\n",
+           agreed->present & OPTION_MSS ? agreed->mss : 0, agreed->present & OPTION_WINDOW_SCALE ? "on" : "off",
+           shift, agreed->present & OPTION_WINDOW_SCALE ? agreed->window_scale : 0,
+           agreed->present & OPTION_SACK_PERMITTED ? "on" : "off", agreed->present & OPTION_TIMESTAMPS ? "on" : "off");
+}
+
+// trace of a sender's windows over time, one CSV row per TRANSFER_TRACE_INTERVAL_NS at most, and one per loss
+struct transfer_trace
+{
+    FILE *file;                 // NULL when not tracing
+    uint64_t begin;             // when the transfer started, in ns
+    uint64_t last;              // when the last periodic row was written
+    uint64_t losses;            // losses and timeouts already traced
+    uint64_t timeouts;
+};
+
+/**
+ * Write a row of the trace if one is due: an event if the sender saw a loss or a timeout since the last row, or a
+ * periodic sample.
+ *
+ * @param trace The trace
+ * @param s The sender
+ * @param now The current time, in ns
+ */
+static void trace_sample(struct transfer_trace *trace, const mytcp_sender_t *s, uint64_t now)
+{
+    if (trace->file == NULL) return;
+
+    const char *event = "ack";
+    if (s->timeouts != trace->timeouts)
+        event = "timeout";
+    else if (s->cc.losses != trace->losses)
+        event = "loss";
+    else if (now - trace->last < TRANSFER_TRACE_INTERVAL_NS)
+        return;
+
+    if (strcmp(event, "ack") == 0) trace->last = now;
+    trace->losses = s->cc.losses;
+    trace->timeouts = s->timeouts;
+
+    // without congestion control, the window is our own
+    uint32_t cwnd = s->cc.ops != NULL ? s->cc.cwnd : s->window, ssthresh = s->cc.ops != NULL ? s->cc.ssthresh : 0;
+    fprintf(trace->file, "%llu,%llu,%u,%u,%u,%llu,%llu,%s\n", (unsigned long long) ((now - trace->begin) / 1000),
+            (unsigned long long) s->acked, cwnd, ssthresh, (uint32_t) s->conn->snd_wnd << s->wscale,
+            (unsigned long long) (s->sent - s->acked), (unsigned long long) (s->cc.srtt / 1000), event);
+}
+
+/**
+ * Move the payload: keep the window full, take acknowledgments as they arrive, and go back to the oldest
+ * unacknowledged byte after a retransmission timeout.
+ *
+ * @param link The link
+ * @param s The sender
+ * @param trace The trace to sample the windows to
+ * @return 0 once every byte is acknowledged, else a non-zero error code
+ */
+static int transfer_send_data(struct transfer_link *link, mytcp_sender_t *s, struct transfer_trace *trace)
+{
+    char title[TITLE_LEN];
+    int result = 0, idle = 0;
+
+    while (result == 0 && !mytcp_sender_done(s))
+    {
+        // take every buffered acknowledgment before sending, so the window is filled in one write
+        size_t length;
+        const mytcp_t *seg = mytcp_reader_next_segment(&link->reader, &length);
+        if (seg != NULL)
+        {
+            // a retransmitted connection granted: the data we keep sending acknowledges it
+            if (mytcp_check_flag(seg, FLAG_SYN)) continue;
+
+            uint64_t acked = s->acked, now = transfer_now_ns();
+            mytcp_conn_error_t err = mytcp_sender_input(s, seg, now);
+            if (link_drops(link, err)) continue;
+            if (err != CONN_OK)
+            {
+                snprintf(title, TITLE_LEN, "incoming acknowledgment: %s", CONN_ERROR_NAMES[err]);
+                result = abort_with_message(title);
+            }
+            if (s->acked != acked) idle = 0;
+            trace_sample(trace, s, now);
+            continue;
+        }
+
+        mytcp_header_t out;
+        uint64_t now = transfer_now_ns();
+        while ((length = mytcp_sender_next(s, &out, now)) > 0 && (result = link_queue(link, &out.seg, length)) == 0);
+        if (result == 0) result = link_flush(link);
+        if (result != 0) break;
+
+        result = link_fill(link, TRANSFER_RTO_MS);
+        if (result == -1)
+        {
+            if (++idle == TRANSFER_MAX_TIMEOUTS) return abort_with_message("error: the peer stopped acknowledging");
+            now = transfer_now_ns();
+            mytcp_sender_timeout(s, now);
+            trace_sample(trace, s, now);
+            result = 0;
+        }
+    }
+
+    return result;
+}
+
+/**
+ * Open a connection, send bytes of payload over it, close it, and report goodput: payload bytes acknowledged per
+ * second, from the first data segment to the last acknowledgment.
+ *
+ * @param fd The connected socket
+ * @param outfile The file to print handshake segments to (as well as stdout)
+ * @param udp True if the socket carries datagrams
+ * @param config What to send, and how
+ * @return 0 on success, else a non-zero error code
+ */
+int mytcp_transfer_send(int fd, FILE *outfile, bool udp, const mytcp_transfer_config_t *config)
+{
+    errno = 0;
+
+    mytcp_t first;
+    mytcp_conn_t conn;
+    mytcp_conn_init(&conn, CLIENT_PORT, SERVER_PORT, STATE_CLOSED);
+
+    struct transfer_link link;
+    int result = link_init(&link, fd, outfile, udp, &conn, config->window);
+    if (result != 0) return result;
+
+    mytcp_conn_open(&conn, &first);
+    result = link_send_handshake(&link, &conn, &first);
+    if (result == 0) result = transfer_handshake(&link, &conn, NULL);
+    if (result != 0)
+    {
+        link_free(&link);
+        return result;
+    }
+
+    // the peer may ask for smaller segments than ours
+    uint16_t mss = config->mss;
+    if ((link.peer.present & OPTION_MSS) && link.peer.mss > 0 && link.peer.mss < mss) mss = link.peer.mss;
+
+    printf("\nconnected; sending %llu bytes (window %u, peer window %u, MSS %u, congestion control %s)\n",
+           (unsigned long long) config->bytes, config->window, conn.snd_wnd, mss,
+           config->cc != NULL ? config->cc->name : "none");
+    mytcp_options_t agreed;
+    link_agree(&link, &conn, config->window, &agreed);
+
+    struct transfer_trace trace;
+    bzero(&trace, sizeof(trace));
+    if (config->trace != NULL)
+    {
+        trace.file = fopen(config->trace, "w");
+        if (trace.file == NULL)
+        {
+            link_free(&link);
+            return abort_with_errno(errno, "fopen");
+        }
+        fprintf(trace.file, "time_us,acked,cwnd,ssthresh,peer_window,in_flight,srtt_us,event\n");
+    }
+
+    mytcp_sender_t s;
+    mytcp_sender_init(&s, &conn, config->bytes, mss, config->window, config->cc);
+    mytcp_sender_set_options(&s, &agreed);
+    uint64_t begin = transfer_now_ns();
+    trace.begin = begin;
+    trace_sample(&trace, &s, begin);
+    result = transfer_send_data(&link, &s, &trace);
+    double elapsed = (double) (transfer_now_ns() - begin) / 1e9;
+    if (trace.file != NULL) fclose(trace.file);
+
+    if (result == 0)
+    {
+        mytcp_conn_close(&conn, &first);
+        result = link_send_handshake(&link, &conn, &first);
+    }
+    if (result == 0) result = transfer_handshake(&link, &conn, NULL);
+    link_free(&link);
+    if (result != 0) return result;
+
+    printf("\nsent %llu bytes in %.3f s: goodput %.1f Mbit/s\n", (unsigned long long) s.acked, elapsed,
+           elapsed > 0 ? (double) s.acked * 8 / elapsed / 1e6 : 0.0);
+    printf("%llu data segments, %llu bytes retransmitted after %llu timeouts, %llu duplicate acknowledgments\n",
+           (unsigned long long) s.segments, (unsigned long long) s.retransmitted, (unsigned long long) s.timeouts,
+           (unsigned long long) s.duplicate_acks);
+    if (s.cc.ops != NULL)
+        printf("%s: %llu losses (fast retransmits), %llu timeouts, final window %u, smoothed RTT %.1f us\n",
+               s.cc.ops->name, (unsigned long long) s.cc.losses, (unsigned long long) s.cc.timeouts, s.cc.cwnd,
+               (double) s.cc.srtt / 1e3);
+    printf("all good. we have disconnected.\n");
+    return 0;
+}
+
+/**
+ * Accept a connection, receive payload until the peer closes, finish the close, and report goodput: payload bytes
+ * received per second, from the connection being established to the peer's close request. One acknowledgment is
+ * sent per batch of segments taken from a single read().
+ *
+ * @param fd The connected socket
+ * @param outfile The file to print handshake segments to (as well as stdout)
+ * @param udp True if the socket carries datagrams
+ * @param window The receive window to advertise
+ * @return 0 on success, else a non-zero error code
+ */
+int mytcp_transfer_receive(int fd, FILE *outfile, bool udp, uint32_t window)
+{
+    errno = 0;
+
+    mytcp_conn_t conn;
+    mytcp_receiver_t r;
+    mytcp_conn_init(&conn, SERVER_PORT, CLIENT_PORT, STATE_LISTEN);
+    mytcp_receiver_init(&r, &conn);
+
+    struct transfer_link link;
+    int result = link_init(&link, fd, outfile, udp, &conn, window);
+    if (result != 0) return result;
+
+    result = transfer_handshake(&link, &conn, &r);
+    if (result == 0)
+    {
+        printf("\nconnected; receiving (window %u)\n", window);
+        mytcp_options_t agreed;
+        link_agree(&link, &conn, window, &agreed);
+        mytcp_receiver_set_options(&r, &agreed);
+    }
+
+    uint64_t begin = transfer_now_ns();
+    char title[TITLE_LEN];
+    while (result == 0 && conn.state == STATE_ESTABLISHED)
+    {
+        size_t length;
+        const mytcp_t *seg = mytcp_reader_next_segment(&link.reader, &length);
+        if (seg == NULL)
+        {
+            // the batch is over: acknowledge all of it, then wait for more
+            mytcp_header_t ack;
+            if (mytcp_receiver_ack(&r, &ack, transfer_now_ns()) && ((result = link_queue(&link, &ack.seg, 0)) != 0
+                                                                    || (result = link_flush(&link)) != 0))
+                break;
+            result = link_fill(&link, -1);
+            continue;
+        }
+
+        if (mytcp_check_flag(seg, FLAG_FIN))
+        {
+            result = transfer_handshake_input(&link, &conn, seg);
+            break;
+        }
+
+        // a connection request that was retransmitted before our answer got through
+        if (mytcp_check_flag(seg, FLAG_SYN)) continue;
+
+        mytcp_conn_error_t err = mytcp_receiver_input(&r, seg, length);
+        if (link_drops(&link, err)) continue;
+        if (err != CONN_OK)
+        {
+            snprintf(title, TITLE_LEN, "incoming data: %s", CONN_ERROR_NAMES[err]);
+            result = abort_with_message(title);
+        }
+    }
+    double elapsed = (double) (transfer_now_ns() - begin) / 1e9;
+
+    if (result == 0) result = transfer_handshake(&link, &conn, NULL);
+    link_free(&link);
+    if (result != 0) return result;
+
+    printf("\nreceived %llu bytes in %.3f s: goodput %.1f Mbit/s\n", (unsigned long long) r.received, elapsed,
+           elapsed > 0 ? (double) r.received * 8 / elapsed / 1e6 : 0.0);
+    printf("%llu data segments, %llu out of order (%s)\n", (unsigned long long) r.segments,
+           (unsigned long long) r.out_of_order, r.sack ? "held past the gap, SACK" : "dropped");
+    printf("all good. we have disconnected.\n");
+    return 0;
+}
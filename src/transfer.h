@@ -0,0 +1,104 @@
+#ifndef CSCE3530_LAB3_TRANSFER_H
+#define CSCE3530_LAB3_TRANSFER_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "congestion.h"
+#include "connection.h"
+#include "options.h"
+
+// defaults for the transfer's options
+#define TRANSFER_DEFAULT_BYTES (64 * 1024 * 1024)
+#define TRANSFER_DEFAULT_WINDOW 65535
+#define TRANSFER_DEFAULT_MSS 1400
+
+// largest window either side may use: what a 16-bit window field reaches at the largest window scale shift
+#define TRANSFER_MAX_WINDOW (65535u << OPTIONS_MAX_WINDOW_SCALE)
+
+// the sender goes back to the oldest unacknowledged byte after this long without an acknowledgment, and gives up
+// after this many timeouts in a row
+#define TRANSFER_RTO_MS 200
+#define TRANSFER_MAX_TIMEOUTS 10
+
+// the congestion control algorithm by default, and the most often the windows are traced while nothing happens
+#define TRANSFER_DEFAULT_CC "reno"
+#define TRANSFER_TRACE_INTERVAL_NS 1000000
+
+// what a sender transfers, and how
+typedef struct mytcp_transfer_config
+{
+    uint64_t bytes;             // payload bytes to send
+    uint32_t window;            // most unacknowledged bytes, whatever the peer advertises
+    uint16_t mss;               // largest payload per segment, unless the peer asks for less
+    const mytcp_cc_ops_t *cc;   // congestion control, or NULL to keep the window full regardless of losses
+    const char *trace;          // CSV file to trace the windows to over time, or NULL
+} mytcp_transfer_config_t;
+
+// sending half of a bulk transfer on an established connection: payload bytes are numbered from base, pipelined up
+// to the smallest of our window, the peer's and the congestion window, and acknowledged cumulatively (and, with SACK,
+// selectively: bytes the peer holds past a gap are not sent again)
+typedef struct mytcp_sender
+{
+    mytcp_conn_t *conn;
+    uint32_t base;              // sequence number of the first payload byte
+    uint64_t total;             // payload bytes to send
+    uint64_t acked;             // bytes the peer acknowledged (snd_una - base)
+    uint64_t sent;              // bytes sent (snd_nxt - base); goes back to acked on a timeout
+    uint64_t highest;           // most bytes ever sent, so acknowledgments of data sent before a timeout still count
+    uint16_t mss;               // largest payload per segment
+    uint32_t window;            // our own limit on unacknowledged bytes; the peer's advertised window also applies
+    uint64_t segments;
+    uint64_t retransmitted;     // bytes sent more than once
+    uint64_t resent;            // the end of the furthest bytes sent more than once
+    uint64_t duplicate_acks;
+    uint64_t timeouts;
+    uint64_t fast_retransmits;  // go-backs after CC_DUPACK_THRESHOLD duplicate acknowledgments
+    mytcp_cc_t cc;              // congestion state; cc.ops is NULL without congestion control
+    uint64_t timed;             // bytes sent up to the end of the segment being timed for an RTT sample, 0 if none
+    uint64_t timed_at;          // when it was sent, in ns
+    uint8_t wscale;             // shift of the peer's advertised window, 0 without window scaling
+    bool sack;                  // the peer reports what it holds past a gap
+    bool timestamps;            // segments carry timestamps, so every acknowledgment of new data is an RTT sample
+    uint32_t ts_recent;         // the peer's latest timestamp, echoed back
+    uint8_t nsacked;
+    uint64_t sacked[OPTIONS_MAX_SACK][2];   // bytes the peer holds past a gap, from its latest acknowledgment
+} mytcp_sender_t;
+
+// receiving half: only the next payload in sequence is accepted, everything is acknowledged cumulatively; with
+// SACK, payload past a gap is held (only its range: the content does not matter) and reported as well
+typedef struct mytcp_receiver
+{
+    mytcp_conn_t *conn;
+    uint64_t received;          // payload bytes accepted
+    uint64_t segments;
+    uint64_t out_of_order;      // segments that were not next in sequence: dropped, or held with SACK
+    bool ack_pending;           // something arrived since the last acknowledgment
+    bool sack;
+    bool timestamps;
+    uint32_t ts_recent;         // timestamp of the first segment since the last acknowledgment, echoed back
+    uint32_t last_ack;          // rcv_nxt as last acknowledged
+    uint8_t nsack;
+    mytcp_sack_block_t held[OPTIONS_MAX_SACK];  // ranges held past the gap, the one that last grew first
+} mytcp_receiver_t;
+
+// sender: set up on an established connection, produce the next data segment, take an acknowledgment, time out;
+// times are in ns
+void mytcp_sender_init(mytcp_sender_t *, mytcp_conn_t *, uint64_t, uint16_t, uint32_t, const mytcp_cc_ops_t *);
+void mytcp_sender_set_options(mytcp_sender_t *, const mytcp_options_t *);
+size_t mytcp_sender_next(mytcp_sender_t *, mytcp_header_t *, uint64_t);
+mytcp_conn_error_t mytcp_sender_input(mytcp_sender_t *, const mytcp_t *, uint64_t);
+void mytcp_sender_timeout(mytcp_sender_t *, uint64_t);
+bool mytcp_sender_done(const mytcp_sender_t *);
+
+// receiver: set up on a connection, take a data segment, produce a cumulative acknowledgment if one is due
+void mytcp_receiver_init(mytcp_receiver_t *, mytcp_conn_t *);
+void mytcp_receiver_set_options(mytcp_receiver_t *, const mytcp_options_t *);
+mytcp_conn_error_t mytcp_receiver_input(mytcp_receiver_t *, const mytcp_t *, size_t);
+bool mytcp_receiver_ack(mytcp_receiver_t *, mytcp_header_t *, uint64_t);
+
+// open a connection over a blocking socket, transfer bytes in one or the other direction, close it and report goodput
+int mytcp_transfer_send(int, FILE *, bool, const mytcp_transfer_config_t *);
+int mytcp_transfer_receive(int, FILE *, bool, uint32_t);
+
+#endif //CSCE3530_LAB3_TRANSFER_H
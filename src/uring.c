@@ -0,0 +1,270 @@
+#include "uring.h"
+
+#ifdef MYTCP_HAVE_URING
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+
+/**
+ * Map a freshly set up ring's queues and record where their fields live.
+ *
+ * @param ring The ring, with fd set
+ * @param p The parameters io_uring_setup() filled in
+ * @return 0 on success, else an errno value (whatever was mapped is left for mytcp_uring_free())
+ */
+static int uring_map(mytcp_uring_t *ring, const struct io_uring_params *p)
+{
+    // with IORING_FEAT_SINGLE_MMAP both queues live in one mapping
+    ring->sq_size = p->sq_off.array + p->sq_entries * sizeof(unsigned);
+    ring->cq_size = p->cq_off.cqes + p->cq_entries * sizeof(struct io_uring_cqe);
+    if (p->features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (ring->cq_size > ring->sq_size) ring->sq_size = ring->cq_size;
+        ring->cq_size = ring->sq_size;
+    }
+
+    int prot = PROT_READ | PROT_WRITE, flags = MAP_SHARED | MAP_POPULATE;
+    void *sq = mmap(NULL, ring->sq_size, prot, flags, ring->fd, IORING_OFF_SQ_RING);
+    if (sq == MAP_FAILED) return errno;
+    ring->sq_ptr = sq;
+
+    void *cq = sq;
+    if (!(p->features & IORING_FEAT_SINGLE_MMAP))
+    {
+        cq = mmap(NULL, ring->cq_size, prot, flags, ring->fd, IORING_OFF_CQ_RING);
+        if (cq == MAP_FAILED) return errno;
+    }
+    ring->cq_ptr = cq;
+
+    void *sqes = mmap(NULL, p->sq_entries * sizeof(struct io_uring_sqe), prot, flags, ring->fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) return errno;
+    ring->sqes = sqes;
+    ring->sq_entries = p->sq_entries;
+
+    ring->sq_head = (unsigned *) ((char *) sq + p->sq_off.head);
+    ring->sq_tail = (unsigned *) ((char *) sq + p->sq_off.tail);
+    ring->sq_mask = *(unsigned *) ((char *) sq + p->sq_off.ring_mask);
+    ring->sqe_tail = *ring->sq_tail;
+    ring->cq_head = (unsigned *) ((char *) cq + p->cq_off.head);
+    ring->cq_tail = (unsigned *) ((char *) cq + p->cq_off.tail);
+    ring->cq_mask = *(unsigned *) ((char *) cq + p->cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *) ((char *) cq + p->cq_off.cqes);
+
+    // SQE slot i is always submitted through array slot i
+    unsigned *array = (unsigned *) ((char *) sq + p->sq_off.array);
+    for (unsigned i = 0; i < p->sq_entries; i++) array[i] = i;
+
+    return 0;
+}
+
+/**
+ * Set up a ring and map its queues. Single-issuer mode is requested when the kernel supports it, since each ring is
+ * only ever used by the thread that created it.
+ *
+ * @param ring The ring to initialize
+ * @param entries The submission queue size (rounded up to a power of two by the kernel)
+ * @return 0 on success, else an errno value
+ */
+int mytcp_uring_init(mytcp_uring_t *ring, unsigned entries)
+{
+    struct io_uring_params p;
+    bzero(ring, sizeof(*ring));
+    bzero(&p, sizeof(p));
+
+    p.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_COOP_TASKRUN;
+    ring->fd = (int) syscall(__NR_io_uring_setup, entries, &p);
+    if (ring->fd == -1 && errno == EINVAL)
+    {
+        bzero(&p, sizeof(p));
+        ring->fd = (int) syscall(__NR_io_uring_setup, entries, &p);
+    }
+    if (ring->fd == -1) return errno;
+
+    int err = uring_map(ring, &p);
+    if (err != 0) mytcp_uring_free(ring);
+    return err;
+}
+
+/**
+ * Unmap a ring's queues and close it, which cancels every request still in flight.
+ *
+ * @param ring The ring
+ */
+void mytcp_uring_free(mytcp_uring_t *ring)
+{
+    if (ring->sqes != NULL) munmap(ring->sqes, ring->sq_entries * sizeof(struct io_uring_sqe));
+    if (ring->cq_ptr != NULL && ring->cq_ptr != ring->sq_ptr) munmap(ring->cq_ptr, ring->cq_size);
+    if (ring->sq_ptr != NULL) munmap(ring->sq_ptr, ring->sq_size);
+    close(ring->fd);
+    bzero(ring, sizeof(*ring));
+    ring->fd = -1;
+}
+
+/**
+ * Publish queued SQEs to the kernel and wait for completions, in one system call.
+ *
+ * @param ring The ring
+ * @param wait_nr The number of completions to wait for (0 to only submit)
+ * @return The number of SQEs submitted, or -1 on failure (errno is set)
+ */
+int mytcp_uring_submit_and_wait(mytcp_uring_t *ring, unsigned wait_nr)
+{
+    unsigned submit = ring->sqe_tail - *ring->sq_tail;
+    __atomic_store_n(ring->sq_tail, ring->sqe_tail, __ATOMIC_RELEASE);
+
+    if (submit == 0 && wait_nr == 0) return 0;
+    return (int) syscall(__NR_io_uring_enter, ring->fd, submit, wait_nr, wait_nr ? IORING_ENTER_GETEVENTS : 0,
+                         NULL, 0);
+}
+
+/**
+ * Get the next free SQE, zeroed. If the submission queue is full, everything queued is submitted first.
+ *
+ * @param ring The ring
+ * @return The SQE, or NULL if the queue is still full (the kernel has not consumed any entry)
+ */
+struct io_uring_sqe *mytcp_uring_get_sqe(mytcp_uring_t *ring)
+{
+    if (ring->sqe_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries)
+    {
+        mytcp_uring_submit_and_wait(ring, 0);
+        if (ring->sqe_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries) return NULL;
+    }
+
+    struct io_uring_sqe *sqe = &ring->sqes[ring->sqe_tail++ & ring->sq_mask];
+    bzero(sqe, sizeof(*sqe));
+    return sqe;
+}
+
+/**
+ * Look at a completion without consuming it.
+ *
+ * @param ring The ring
+ * @param seen How many completions have already been looked at since the last mytcp_uring_advance()
+ * @return The next completion, or NULL if there is none
+ */
+struct io_uring_cqe *mytcp_uring_peek(mytcp_uring_t *ring, unsigned seen)
+{
+    unsigned head = *ring->cq_head + seen;
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) return NULL;
+    return &ring->cqes[head & ring->cq_mask];
+}
+
+/**
+ * Hand completions back to the kernel once they have been handled.
+ *
+ * @param ring The ring
+ * @param n The number of completions handled
+ */
+void mytcp_uring_advance(mytcp_uring_t *ring, unsigned n)
+{
+    __atomic_store_n(ring->cq_head, *ring->cq_head + n, __ATOMIC_RELEASE);
+}
+
+/**
+ * Allocate a group of receive buffers and register them with a ring as a provided buffer ring, all of them
+ * initially available to the kernel.
+ *
+ * @param ring The ring
+ * @param bufs The buffer group to initialize
+ * @param group The buffer group ID, used as sqe->buf_group
+ * @param entries The number of buffers; a power of two no greater than 32768
+ * @param size The size of each buffer
+ * @return 0 on success, else an errno value
+ */
+int mytcp_uring_bufs_init(mytcp_uring_t *ring, mytcp_uring_bufs_t *bufs, uint16_t group, unsigned entries,
+                          size_t size)
+{
+    bzero(bufs, sizeof(*bufs));
+    bufs->entries = entries;
+    bufs->buf_size = size;
+    bufs->group = group;
+    bufs->ring_size = entries * sizeof(struct io_uring_buf);
+
+    // the ring must be page aligned; the buffers themselves are plain memory
+    bufs->ring = mmap(NULL, bufs->ring_size + entries * size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                      -1, 0);
+    if (bufs->ring == MAP_FAILED)
+    {
+        bufs->ring = NULL;
+        return errno;
+    }
+    bufs->data = (char *) bufs->ring + bufs->ring_size;
+
+    struct io_uring_buf_reg reg;
+    bzero(&reg, sizeof(reg));
+    reg.ring_addr = (uint64_t) (uintptr_t) bufs->ring;
+    reg.ring_entries = entries;
+    reg.bgid = group;
+    if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0)
+    {
+        int err = errno;
+        munmap(bufs->ring, bufs->ring_size + entries * size);
+        bufs->ring = NULL;
+        return err;
+    }
+
+    for (unsigned i = 0; i < entries; i++) mytcp_uring_bufs_recycle(bufs, (uint16_t) i);
+    mytcp_uring_bufs_publish(bufs);
+    return 0;
+}
+
+/**
+ * Unregister and free a buffer group.
+ *
+ * @param ring The ring the group is registered with
+ * @param bufs The buffer group
+ */
+void mytcp_uring_bufs_free(mytcp_uring_t *ring, mytcp_uring_bufs_t *bufs)
+{
+    if (bufs->ring == NULL) return;
+
+    struct io_uring_buf_reg reg;
+    bzero(&reg, sizeof(reg));
+    reg.bgid = bufs->group;
+    syscall(__NR_io_uring_register, ring->fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+    munmap(bufs->ring, bufs->ring_size + bufs->entries * bufs->buf_size);
+    bufs->ring = NULL;
+}
+
+/**
+ * The memory of a buffer the kernel picked for a completion (its ID is cqe->flags >> IORING_CQE_BUFFER_SHIFT).
+ *
+ * @param bufs The buffer group
+ * @param bid The buffer ID
+ * @return The buffer
+ */
+char *mytcp_uring_buf(const mytcp_uring_bufs_t *bufs, uint16_t bid)
+{
+    return bufs->data + (size_t) bid * bufs->buf_size;
+}
+
+/**
+ * Queue a consumed buffer to be handed back to the kernel by the next mytcp_uring_bufs_publish().
+ *
+ * @param bufs The buffer group
+ * @param bid The buffer ID
+ */
+void mytcp_uring_bufs_recycle(mytcp_uring_bufs_t *bufs, uint16_t bid)
+{
+    struct io_uring_buf *buf = &bufs->ring->bufs[bufs->tail++ & (bufs->entries - 1)];
+    buf->addr = (uint64_t) (uintptr_t) mytcp_uring_buf(bufs, bid);
+    buf->len = (uint32_t) bufs->buf_size;
+    buf->bid = bid;
+}
+
+/**
+ * Make every recycled buffer available to the kernel again.
+ *
+ * @param bufs The buffer group
+ */
+void mytcp_uring_bufs_publish(mytcp_uring_bufs_t *bufs)
+{
+    __atomic_store_n(&bufs->ring->tail, bufs->tail, __ATOMIC_RELEASE);
+}
+
+#endif //MYTCP_HAVE_URING
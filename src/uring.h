@@ -0,0 +1,75 @@
+#ifndef CSCE3530_LAB3_URING_H
+#define CSCE3530_LAB3_URING_H
+
+#include <inttypes.h>
+#include <stddef.h>
+
+// io_uring is used through raw system calls, so only the kernel header is needed (multishot recv: Linux 6.0+)
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#endif
+
+#ifdef IORING_RECV_MULTISHOT
+#define MYTCP_HAVE_URING 1
+
+// a submission/completion queue pair mapped from the kernel
+typedef struct mytcp_uring
+{
+    int fd;
+
+    // submission queue: the kernel consumes from head, we produce at tail
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned sqe_tail;          // our tail, published to the kernel on submit
+    struct io_uring_sqe *sqes;
+
+    // completion queue: the kernel produces at tail, we consume from head
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *sq_ptr;
+    void *cq_ptr;
+    size_t sq_size;
+    size_t cq_size;
+} mytcp_uring_t;
+
+// a ring of equally sized receive buffers the kernel picks from (IOSQE_BUFFER_SELECT)
+typedef struct mytcp_uring_bufs
+{
+    struct io_uring_buf_ring *ring;
+    char *data;
+    size_t ring_size;
+    size_t buf_size;
+    unsigned entries;           // power of two
+    uint16_t tail;              // our tail, published with mytcp_uring_bufs_publish()
+    uint16_t group;
+} mytcp_uring_bufs_t;
+
+// ring setup and teardown; init returns 0 or an errno value
+int mytcp_uring_init(mytcp_uring_t *, unsigned);
+void mytcp_uring_free(mytcp_uring_t *);
+
+// submissions: get a zeroed SQE (submitting queued ones if the queue is full), then submit and wait
+struct io_uring_sqe *mytcp_uring_get_sqe(mytcp_uring_t *);
+int mytcp_uring_submit_and_wait(mytcp_uring_t *, unsigned);
+
+// completions: peek the next one, then mark everything peeked as seen
+struct io_uring_cqe *mytcp_uring_peek(mytcp_uring_t *, unsigned);
+void mytcp_uring_advance(mytcp_uring_t *, unsigned);
+
+// provided buffers; init returns 0 or an errno value
+int mytcp_uring_bufs_init(mytcp_uring_t *, mytcp_uring_bufs_t *, uint16_t, unsigned, size_t);
+void mytcp_uring_bufs_free(mytcp_uring_t *, mytcp_uring_bufs_t *);
+char *mytcp_uring_buf(const mytcp_uring_bufs_t *, uint16_t);
+void mytcp_uring_bufs_recycle(mytcp_uring_bufs_t *, uint16_t);
+void mytcp_uring_bufs_publish(mytcp_uring_bufs_t *);
+
+#endif //IORING_RECV_MULTISHOT
+
+#endif //CSCE3530_LAB3_URING_H
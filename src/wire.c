@@ -0,0 +1,227 @@
+#include "wire.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MYTCP_HAVE_X86 1
+#endif
+
+
+// number of headers each kernel converts per iteration: two fill three 128-bit vectors, four fill three 256-bit ones
+#define SSSE3_BATCH 2
+#define AVX2_BATCH 4
+
+typedef void (*swap_fn)(const char *, size_t, char *);
+
+/**
+ * Swap the byte order of every multi-byte field of a fixed header; the options field holds bytes, so it is copied
+ * as it is. Swapping is its own inverse, so this both encodes and decodes. The header is read whole before it is
+ * written, so in and out may be the same.
+ *
+ * @param in The header to convert
+ * @param out Where to write it
+ */
+static void wire_swap(const mytcp_wire_t *in, mytcp_wire_t *out)
+{
+    mytcp_wire_t w = *in;
+    out->srcport = WIRE16(w.srcport);
+    out->destport = WIRE16(w.destport);
+    out->sequence = WIRE32(w.sequence);
+    out->acknowledgment = WIRE32(w.acknowledgment);
+    out->flags = WIRE16(w.flags);
+    out->receive = WIRE16(w.receive);
+    out->checksum = WIRE16(w.checksum);
+    out->urgent = WIRE16(w.urgent);
+    out->options = w.options;
+}
+
+/**
+ * Scalar fallback: swap n contiguous headers one at a time.
+ *
+ * @param in The headers to convert
+ * @param n The number of headers
+ * @param out Where to write them
+ */
+static void wire_swap_scalar(const char *in, size_t n, char *out)
+{
+    for (size_t k = 0; k < n; k++)
+        wire_swap((const mytcp_wire_t *) (in + k * sizeof(mytcp_t)), (mytcp_wire_t *) (out + k * sizeof(mytcp_t)));
+}
+
+#if defined(MYTCP_HAVE_X86) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+
+/**
+ * SSSE3 kernel: swaps n headers (n a multiple of SSSE3_BATCH) with one PSHUFB per 16 bytes. Two headers span three
+ * vectors, and no field crosses from one vector into the next, so each vector has a shuffle of its own: the one
+ * starting a header, the one holding its end and the start of the next, and the one ending that.
+ */
+__attribute__((target("ssse3")))
+static void wire_swap_ssse3(const char *in, size_t n, char *out)
+{
+    const __m128i shuffles[3] = {
+            _mm_setr_epi8(1, 0, 3, 2, 7, 6, 5, 4, 11, 10, 9, 8, 13, 12, 15, 14),
+            _mm_setr_epi8(1, 0, 3, 2, 4, 5, 6, 7, 9, 8, 11, 10, 15, 14, 13, 12),
+            _mm_setr_epi8(3, 2, 1, 0, 5, 4, 7, 6, 9, 8, 11, 10, 12, 13, 14, 15)
+    };
+    size_t vectors = n * sizeof(mytcp_t) / sizeof(__m128i);
+
+    for (size_t i = 0; i < vectors; i += 3)
+        for (size_t j = 0; j < 3; j++)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i *) (in + (i + j) * sizeof(__m128i)));
+            _mm_storeu_si128((__m128i *) (out + (i + j) * sizeof(__m128i)), _mm_shuffle_epi8(v, shuffles[j]));
+        }
+}
+
+/**
+ * AVX2 kernel: same as wire_swap_ssse3(), 32 bytes at a time (n a multiple of AVX2_BATCH). VPSHUFB shuffles each
+ * 128-bit half on its own, so the three shuffles of two headers pair up across the three vectors of four headers.
+ */
+__attribute__((target("avx2")))
+static void wire_swap_avx2(const char *in, size_t n, char *out)
+{
+    const __m256i shuffles[3] = {
+            _mm256_setr_epi8(1, 0, 3, 2, 7, 6, 5, 4, 11, 10, 9, 8, 13, 12, 15, 14,
+                             1, 0, 3, 2, 4, 5, 6, 7, 9, 8, 11, 10, 15, 14, 13, 12),
+            _mm256_setr_epi8(3, 2, 1, 0, 5, 4, 7, 6, 9, 8, 11, 10, 12, 13, 14, 15,
+                             1, 0, 3, 2, 7, 6, 5, 4, 11, 10, 9, 8, 13, 12, 15, 14),
+            _mm256_setr_epi8(1, 0, 3, 2, 4, 5, 6, 7, 9, 8, 11, 10, 15, 14, 13, 12,
+                             3, 2, 1, 0, 5, 4, 7, 6, 9, 8, 11, 10, 12, 13, 14, 15)
+    };
+    size_t vectors = n * sizeof(mytcp_t) / sizeof(__m256i);
+
+    for (size_t i = 0; i < vectors; i += 3)
+        for (size_t j = 0; j < 3; j++)
+        {
+            __m256i v = _mm256_loadu_si256((const __m256i *) (in + (i + j) * sizeof(__m256i)));
+            _mm256_storeu_si256((__m256i *) (out + (i + j) * sizeof(__m256i)), _mm256_shuffle_epi8(v, shuffles[j]));
+        }
+}
+
+#define MYTCP_HAVE_SWAP_KERNELS 1
+#endif
+
+// selected kernel and how many headers it converts at once; resolved at load time
+static swap_fn swap_kernel = NULL;
+static size_t swap_batch = 1;
+static const char *impl_name = "scalar";
+
+/**
+ * Pick the widest byte swap kernel the running CPU supports. Runs before main(), so no locking is needed.
+ */
+__attribute__((constructor))
+static void resolve_wire_impl(void)
+{
+#ifdef MYTCP_HAVE_SWAP_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        swap_batch = AVX2_BATCH;
+        impl_name = "avx2";
+        swap_kernel = wire_swap_avx2;
+        return;
+    }
+    if (__builtin_cpu_supports("ssse3"))
+    {
+        swap_batch = SSSE3_BATCH;
+        impl_name = "ssse3";
+        swap_kernel = wire_swap_ssse3;
+        return;
+    }
+#endif
+}
+
+/**
+ * Swap n contiguous headers, using the SIMD kernel for whole batches and the scalar loop for the remainder.
+ *
+ * @param in The headers to convert
+ * @param n The number of headers
+ * @param out Where to write them; may be in itself
+ */
+static void wire_swap_batch(const char *in, size_t n, char *out)
+{
+    size_t done = 0;
+    if (swap_kernel != NULL)
+    {
+        done = n / swap_batch * swap_batch;
+        swap_kernel(in, done, out);
+    }
+
+    wire_swap_scalar(in + done * sizeof(mytcp_t), n - done, out + done * sizeof(mytcp_t));
+}
+
+/**
+ * Encode a segment's header into network byte order, as a real TCP stack would send it. The options past the fixed
+ * header are bytes already, so they are copied as they are; the checksum is carried like any other field, so it
+ * still checks out once the header is decoded again.
+ *
+ * @param seg The segment, in host byte order; its whole header, as long as its offset says (at least the fixed part)
+ * @param out Where to encode it, with room for the whole header; may be the segment itself, to convert it in place
+ * @return The length of the encoded header in bytes
+ */
+size_t mytcp_wire_encode(const mytcp_t *seg, mytcp_wire_t *out)
+{
+    size_t length = mytcp_header_length(seg);
+    if (length < sizeof(mytcp_t)) length = sizeof(mytcp_t);
+
+    wire_swap((const mytcp_wire_t *) seg, out);
+    if (length > sizeof(mytcp_t) && (const void *) seg != (void *) out)
+        memcpy((uint8_t *) out + sizeof(mytcp_t), (const uint8_t *) seg + sizeof(mytcp_t), length - sizeof(mytcp_t));
+    return length;
+}
+
+/**
+ * Decode a header in network byte order, as a real TCP stack sent it, into a segment in host byte order.
+ *
+ * @param wire The header; all of it, as long as its offset says (at least the fixed part)
+ * @param out Where to decode it, with room for the whole header; may be the header itself, to convert it in place
+ * @return The length of the decoded header in bytes
+ */
+size_t mytcp_wire_decode(const mytcp_wire_t *wire, mytcp_t *out)
+{
+    size_t length = mytcp_wire_header_length(wire);
+    if (length < sizeof(mytcp_t)) length = sizeof(mytcp_t);
+
+    wire_swap(wire, (mytcp_wire_t *) out);
+    if (length > sizeof(mytcp_t) && (const void *) wire != (void *) out)
+        memcpy((uint8_t *) out + sizeof(mytcp_t), (const uint8_t *) wire + sizeof(mytcp_t), length - sizeof(mytcp_t));
+    return length;
+}
+
+/**
+ * Encode n contiguous fixed-size headers (as the handshakes send them, and as the batch checksums take them) into
+ * network byte order. Equivalent to calling mytcp_wire_encode() on each, but converts them with the widest SIMD
+ * kernel the CPU supports; only the fixed part of each header is converted, whatever its offset says.
+ *
+ * @param segs The segments, in host byte order
+ * @param n The number of segments
+ * @param out Where to encode them; may be segs, to convert them in place
+ */
+void mytcp_wire_encode_batch(const mytcp_t *segs, size_t n, mytcp_wire_t *out)
+{
+    wire_swap_batch((const char *) segs, n, (char *) out);
+}
+
+/**
+ * Decode n contiguous fixed-size headers from network byte order. Equivalent to calling mytcp_wire_decode() on each
+ * (only the fixed part of each header is converted), with the same kernels as mytcp_wire_encode_batch().
+ *
+ * @param wire The headers, in network byte order
+ * @param n The number of headers
+ * @param out Where to decode them; may be wire, to convert them in place
+ */
+void mytcp_wire_decode_batch(const mytcp_wire_t *wire, size_t n, mytcp_t *out)
+{
+    wire_swap_batch((const char *) wire, n, (char *) out);
+}
+
+/**
+ * Name of the byte swap kernel selected for this CPU ("avx2", "ssse3" or "scalar").
+ *
+ * @return The kernel's name
+ */
+const char *mytcp_wire_impl(void)
+{
+    return impl_name;
+}
@@ -0,0 +1,75 @@
+#ifndef CSCE3530_LAB3_WIRE_H
+#define CSCE3530_LAB3_WIRE_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "mytcp.h"
+
+// multi-byte fields in network byte order: a byte swap on little-endian hosts, nothing on big-endian ones
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define WIRE16(x) __builtin_bswap16(x)
+#define WIRE32(x) __builtin_bswap32(x)
+#else
+#define WIRE16(x) ((uint16_t) (x))
+#define WIRE32(x) ((uint32_t) (x))
+#endif
+
+// a segment header as a real TCP stack lays it out: the fields of mytcp_t, in network byte order; the options are
+// bytes, which already are (see mytcp.h), so they are the same either way. It may overlay any buffer (may_alias),
+// so a pointer into one is a view of the header there
+struct mytcp_wire
+{
+    uint16_t srcport;
+    uint16_t destport;
+    uint32_t sequence;
+    uint32_t acknowledgment;
+    uint16_t flags;
+    uint16_t receive;
+    uint16_t checksum;
+    uint16_t urgent;
+    uint32_t options;
+} __attribute__((packed, may_alias));
+
+// typedef above struct as mytcp_wire_t
+typedef struct mytcp_wire mytcp_wire_t;
+
+// views: read a field of a header in network byte order where it lies (a receive buffer, a capture), without a copy
+static inline uint16_t mytcp_wire_srcport(const mytcp_wire_t *w) { return WIRE16(w->srcport); }
+static inline uint16_t mytcp_wire_destport(const mytcp_wire_t *w) { return WIRE16(w->destport); }
+static inline uint32_t mytcp_wire_sequence(const mytcp_wire_t *w) { return WIRE32(w->sequence); }
+static inline uint32_t mytcp_wire_acknowledgment(const mytcp_wire_t *w) { return WIRE32(w->acknowledgment); }
+static inline uint16_t mytcp_wire_flags(const mytcp_wire_t *w) { return WIRE16(w->flags); }
+static inline uint16_t mytcp_wire_window(const mytcp_wire_t *w) { return WIRE16(w->receive); }
+static inline uint16_t mytcp_wire_checksum(const mytcp_wire_t *w) { return WIRE16(w->checksum); }
+static inline uint16_t mytcp_wire_payload_length(const mytcp_wire_t *w) { return WIRE16(w->urgent); }
+static inline size_t mytcp_wire_header_length(const mytcp_wire_t *w)
+{
+    return (size_t) ((mytcp_wire_flags(w) & MASK_OFFSET) >> 12) * 4;
+}
+static inline bool mytcp_wire_check_flag(const mytcp_wire_t *w, uint8_t flag)
+{
+    return (mytcp_wire_flags(w) >> flag) & 1;
+}
+static inline const uint8_t *mytcp_wire_options(const mytcp_wire_t *w) { return (const uint8_t *) &w->options; }
+
+// and write one the same way; these do not keep the checksum valid, so set it last (or encode a whole segment)
+static inline void mytcp_wire_set_srcport(mytcp_wire_t *w, uint16_t v) { w->srcport = WIRE16(v); }
+static inline void mytcp_wire_set_destport(mytcp_wire_t *w, uint16_t v) { w->destport = WIRE16(v); }
+static inline void mytcp_wire_set_sequence(mytcp_wire_t *w, uint32_t v) { w->sequence = WIRE32(v); }
+static inline void mytcp_wire_set_acknowledgment(mytcp_wire_t *w, uint32_t v) { w->acknowledgment = WIRE32(v); }
+static inline void mytcp_wire_set_flags(mytcp_wire_t *w, uint16_t v) { w->flags = WIRE16(v); }
+static inline void mytcp_wire_set_window(mytcp_wire_t *w, uint16_t v) { w->receive = WIRE16(v); }
+static inline void mytcp_wire_set_checksum(mytcp_wire_t *w, uint16_t v) { w->checksum = WIRE16(v); }
+static inline void mytcp_wire_set_payload_length(mytcp_wire_t *w, uint16_t v) { w->urgent = WIRE16(v); }
+
+// convert a whole header, options included, between host and network byte order (in place if both are the same)
+size_t mytcp_wire_encode(const mytcp_t *, mytcp_wire_t *);
+size_t mytcp_wire_decode(const mytcp_wire_t *, mytcp_t *);
+
+// convert many contiguous fixed-size headers at once (SIMD where available, like the batch checksums)
+void mytcp_wire_encode_batch(const mytcp_t *, size_t, mytcp_wire_t *);
+void mytcp_wire_decode_batch(const mytcp_wire_t *, size_t, mytcp_t *);
+const char *mytcp_wire_impl(void);
+
+#endif //CSCE3530_LAB3_WIRE_H